@@ -51,6 +51,14 @@ LOCAL_SRC_FILES := \
     twrp.cpp \
     fixContexts.cpp \
     twrpTar.cpp \
+    twrpRestorePipeline.cpp \
+    twrpAes.cpp \
+    twrpTelemetry.cpp \
+    twrpTaskGraph.cpp \
+    twrpBackupManifest.cpp \
+    twrpProbeCache.cpp \
+    twrpWipe.cpp \
+    twrpFormat.cpp \
     exclude.cpp \
     find_file.cpp \
     infomanager.cpp \
@@ -333,9 +341,7 @@ endif
 ifneq ($(TW_CUSTOM_CPU_TEMP_PATH),)
 	LOCAL_CFLAGS += -DTW_CUSTOM_CPU_TEMP_PATH=$(TW_CUSTOM_CPU_TEMP_PATH)
 endif
-ifneq ($(TW_EXCLUDE_ENCRYPTED_BACKUPS), true)
-    LOCAL_SHARED_LIBRARIES += libopenaes
-else
+ifeq ($(TW_EXCLUDE_ENCRYPTED_BACKUPS), true)
     LOCAL_CFLAGS += -DTW_EXCLUDE_ENCRYPTED_BACKUPS
 endif
 ifeq ($(TARGET_RECOVERY_QCOM_RTC_FIX),)
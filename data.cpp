@@ -22,6 +22,7 @@
 #include <sstream>
 #include <fstream>
 #include <cctype>
+#include <string.h>
 #include <cutils/properties.h>
 #include <unistd.h>
 
@@ -50,6 +51,44 @@ extern "C"
 
 #define FILE_VERSION 0x00010010 // Do not set to 0
 
+#define VARIABLE_CHUNK_SIZE 256
+#define VARIABLE_CHUNKS 64
+
+// Variable kinds, decided once when the name is interned
+enum {
+	VAR_STORED = 0,
+	VAR_PROPERTY,
+	VAR_HOT,
+	VAR_MAGIC_TIME,
+	VAR_MAGIC_CPU_TEMP,
+	VAR_MAGIC_BATTERY
+};
+
+// Type of the value held in a hot variable
+enum {
+	HOT_UNSET = 0,
+	HOT_INT,
+	HOT_FLOAT,
+	HOT_STORED, // last set as a string, which lives in mData
+};
+
+// How often magic and property values are sampled, in seconds
+static const int sample_interval[] = {
+	0, // stored
+	1, // property
+	0, // hot
+	1, // tw_time
+	5, // tw_cpu_temp
+	60, // tw_battery
+};
+
+static const char* hot_variables[] = {
+	"ui_progress",
+	"ui_progress_portion",
+	"ui_progress_frames",
+	NULL
+};
+
 using namespace std;
 
 string                                  DataManager::mBackingFile;
@@ -57,6 +96,10 @@ int                                     DataManager::mInitialized = 0;
 InfoManager                             DataManager::mPersist;  // Data that that is not constant and will be saved to the settings file
 InfoManager                             DataManager::mData;     // Data that is not constant and will not be saved to settings file
 InfoManager                             DataManager::mConst;    // Data that is constant and will not be saved to settings file
+map<string, int>                        DataManager::mVariableIds;
+DataManager::Variable**                 DataManager::mVariables[VARIABLE_CHUNKS];
+volatile int                            DataManager::mVariableCount = 0;
+volatile uint32_t                       DataManager::mGeneration = 0;
 
 extern bool datamedia;
 
@@ -65,6 +108,7 @@ pthread_mutex_t DataManager::m_valuesLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
 #else
 pthread_mutex_t DataManager::m_valuesLock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 #endif
+pthread_mutex_t DataManager::m_idLock = PTHREAD_MUTEX_INITIALIZER;
 
 // Device ID functions
 void DataManager::sanitize_device_id(char* device_id) {
@@ -222,6 +266,8 @@ int DataManager::ResetDefaults()
 	mPersist.Clear();
 	mData.Clear();
 	mConst.Clear();
+	ClearHotValues();
+	__sync_fetch_and_add(&mGeneration, 1);
 	pthread_mutex_unlock(&m_valuesLock);
 
 	SetDefaultValues();
@@ -244,6 +290,7 @@ int DataManager::LoadValues(const string& filename)
 	// Read in the file, if possible
 	pthread_mutex_lock(&m_valuesLock);
 	mPersist.LoadValues();
+	__sync_fetch_and_add(&mGeneration, 1);
 
 #ifndef TW_NO_SCREEN_TIMEOUT
 	blankTimer.setTime(mPersist.GetIntValue("tw_screen_timeout_secs"));
@@ -284,6 +331,7 @@ int DataManager::LoadPersistValues(void)
 	// Read in the file, if possible
 	pthread_mutex_lock(&m_valuesLock);
 	mPersist.LoadValues();
+	__sync_fetch_and_add(&mGeneration, 1);
 
 #ifndef TW_NO_SCREEN_TIMEOUT
 	blankTimer.setTime(mPersist.GetIntValue("tw_screen_timeout_secs"));
@@ -336,43 +384,228 @@ int DataManager::SaveValues()
 	return 0;
 }
 
-int DataManager::GetValue(const string& varName, string& value)
+// The GUI passes names with the '%' around them
+static string Strip_Variable_Name(const string& varName)
 {
-	string localStr = varName;
-	int ret = 0;
+	if (varName.length() > 2 && varName[0] == '%' && varName[varName.length()-1] == '%')
+		return varName.substr(1, varName.length() - 2);
+	return varName;
+}
 
-	if (!mInitialized)
-		SetDefaultValues();
+static int Variable_Kind(const string& name)
+{
+	if (name == "tw_time")
+		return VAR_MAGIC_TIME;
+	if (name == "tw_cpu_temp")
+		return VAR_MAGIC_CPU_TEMP;
+	if (name == "tw_battery")
+		return VAR_MAGIC_BATTERY;
+	for (int i = 0; hot_variables[i]; i++) {
+		if (name == hot_variables[i])
+			return VAR_HOT;
+	}
+	if (name.length() > 9 && name.substr(0, 9) == "property.")
+		return VAR_PROPERTY;
+	return VAR_STORED;
+}
 
-	// Strip off leading and trailing '%' if provided
-	if (localStr.length() > 2 && localStr[0] == '%' && localStr[localStr.length()-1] == '%')
-	{
-		localStr.erase(0, 1);
-		localStr.erase(localStr.length() - 1, 1);
+int DataManager::GetVariableId(const string& varName)
+{
+	return LookupVariableId(varName, true);
+}
+
+int DataManager::FindVariableId(const string& varName)
+{
+	return LookupVariableId(varName, false);
+}
+
+int DataManager::LookupVariableId(const string& varName, bool intern)
+{
+	string localStr = Strip_Variable_Name(varName);
+	if (localStr.empty())
+		return -1;
+
+	pthread_mutex_lock(&m_idLock);
+	map<string, int>::iterator pos = mVariableIds.find(localStr);
+	if (pos != mVariableIds.end()) {
+		pthread_mutex_unlock(&m_idLock);
+		return pos->second;
 	}
 
-	// Handle magic values
-	if (GetMagicValue(localStr, value) == 0)
-		return 0;
+	int id = mVariableCount;
+	if (!intern || id >= VARIABLE_CHUNK_SIZE * VARIABLE_CHUNKS) {
+		pthread_mutex_unlock(&m_idLock);
+		if (intern)
+			LOGINFO("Too many variables, '%s' is looked up by name\n", localStr.c_str());
+		return -1;
+	}
 
-	// Handle property
-	if (localStr.length() > 9 && localStr.substr(0, 9) == "property.") {
+	Variable* var = new Variable;
+	var->name = localStr;
+	var->kind = Variable_Kind(localStr);
+	var->hot = 0;
+	var->version = 0;
+	var->sample_ret = -1;
+	var->next_sample.tv_sec = 0;
+	var->next_sample.tv_nsec = 0;
+
+	// Readers index the chunks without the lock, so publish the entry before the count
+	Variable**& chunk = mVariables[id / VARIABLE_CHUNK_SIZE];
+	if (!chunk)
+		chunk = new Variable*[VARIABLE_CHUNK_SIZE];
+	chunk[id % VARIABLE_CHUNK_SIZE] = var;
+	__sync_synchronize();
+	mVariableCount = id + 1;
+	mVariableIds.insert(make_pair(localStr, id));
+	pthread_mutex_unlock(&m_idLock);
+	return id;
+}
+
+DataManager::Variable* DataManager::GetVariable(int varId)
+{
+	if (varId < 0 || varId >= mVariableCount)
+		return NULL;
+	return mVariables[varId / VARIABLE_CHUNK_SIZE][varId % VARIABLE_CHUNK_SIZE];
+}
+
+string DataManager::GetVariableName(int varId)
+{
+	Variable* var = GetVariable(varId);
+	return var ? var->name : "";
+}
+
+int DataManager::GetValue(const string& varName, string& value)
+{
+	int varId = FindVariableId(varName);
+	if (varId >= 0)
+		return GetValue(varId, value);
+
+	// Only setting a value or binding a theme to it interns a name, lookups of names that
+	// were never set must not use up IDs
+	if (!mInitialized)
+		SetDefaultValues();
+
+	string localStr = Strip_Variable_Name(varName);
+	int kind = Variable_Kind(localStr);
+	if (kind == VAR_PROPERTY) {
 		char property_value[PROPERTY_VALUE_MAX];
 		property_get(localStr.substr(9).c_str(), property_value, "");
 		value = property_value;
 		return 0;
 	}
+	if (kind == VAR_MAGIC_TIME || kind == VAR_MAGIC_CPU_TEMP || kind == VAR_MAGIC_BATTERY) {
+		if (GetMagicValue(kind, value) == 0)
+			return 0;
+	}
+	return GetStoredValue(localStr, value);
+}
+
+int DataManager::GetValue(int varId, string& value)
+{
+	if (!mInitialized)
+		SetDefaultValues();
+
+	Variable* var = GetVariable(varId);
+	if (!var)
+		return -1;
+
+	switch (var->kind) {
+		case VAR_PROPERTY:
+		{
+			char property_value[PROPERTY_VALUE_MAX];
+			property_get(var->name.substr(9).c_str(), property_value, "");
+			value = property_value;
+			return 0;
+		}
+		case VAR_HOT:
+		{
+			uint64_t hot = __atomic_load_n(&var->hot, __ATOMIC_ACQUIRE);
+			uint32_t bits = (uint32_t) hot;
+			ostringstream valStr;
+			if ((hot >> 32) == HOT_INT) {
+				valStr << (int) bits;
+				value = valStr.str();
+				return 0;
+			} else if ((hot >> 32) == HOT_FLOAT) {
+				float f;
+				memcpy(&f, &bits, sizeof(f));
+				valStr << f;
+				value = valStr.str();
+				return 0;
+			}
+			break;
+		}
+		case VAR_MAGIC_TIME:
+		case VAR_MAGIC_CPU_TEMP:
+		case VAR_MAGIC_BATTERY:
+			if (SampleValue(var, value) == 0)
+				return 0;
+			break;
+	}
+	return GetStoredValue(var->name, value);
+}
+
+uint32_t DataManager::GetVariableVersion(int varId)
+{
+	Variable* var = GetVariable(varId);
+	if (!var)
+		return mGeneration;
+
+	if (sample_interval[var->kind]) {
+		string value;
+		SampleValue(var, value);
+	}
+	return var->version + mGeneration;
+}
+
+// Magic values read sysfs and properties can change behind our back, so both are sampled
+// at most every sample_interval seconds and the version is bumped when the value differs.
+int DataManager::SampleValue(Variable* var, string& value)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	pthread_mutex_lock(&m_valuesLock);
+	if (now.tv_sec > var->next_sample.tv_sec ||
+		(now.tv_sec == var->next_sample.tv_sec && now.tv_nsec >= var->next_sample.tv_nsec)) {
+		string sample;
+		int ret;
+		if (var->kind == VAR_PROPERTY) {
+			char property_value[PROPERTY_VALUE_MAX];
+			property_get(var->name.substr(9).c_str(), property_value, "");
+			sample = property_value;
+			ret = 0;
+		} else {
+			ret = GetMagicValue(var->kind, sample);
+		}
+		if (ret != var->sample_ret || sample != var->sample) {
+			var->sample = sample;
+			var->sample_ret = ret;
+			__sync_fetch_and_add(&var->version, 1);
+		}
+		var->next_sample = now;
+		var->next_sample.tv_sec += sample_interval[var->kind];
+	}
+	value = var->sample;
+	int ret = var->sample_ret;
+	pthread_mutex_unlock(&m_valuesLock);
+	return ret;
+}
+
+int DataManager::GetStoredValue(const string& varName, string& value)
+{
+	int ret = 0;
 
 	pthread_mutex_lock(&m_valuesLock);
-	ret = mConst.GetValue(localStr, value);
+	ret = mConst.GetValue(varName, value);
 	if (ret == 0)
 		goto exit;
 
-	ret = mPersist.GetValue(localStr, value);
+	ret = mPersist.GetValue(varName, value);
 	if (ret == 0)
 		goto exit;
 
-	ret = mData.GetValue(localStr, value);
+	ret = mData.GetValue(varName, value);
 exit:
 	pthread_mutex_unlock(&m_valuesLock);
 	return ret;
@@ -400,6 +633,47 @@ int DataManager::GetValue(const string& varName, float& value)
 	return 0;
 }
 
+int DataManager::GetValue(int varId, int& value)
+{
+	Variable* var = GetVariable(varId);
+	if (var && var->kind == VAR_HOT) {
+		uint64_t hot = __atomic_load_n(&var->hot, __ATOMIC_ACQUIRE);
+		if ((hot >> 32) == HOT_INT) {
+			value = (int) (uint32_t) hot;
+			return 0;
+		}
+	}
+
+	string data;
+
+	if (GetValue(varId, data) != 0)
+		return -1;
+
+	value = atoi(data.c_str());
+	return 0;
+}
+
+int DataManager::GetValue(int varId, float& value)
+{
+	Variable* var = GetVariable(varId);
+	if (var && var->kind == VAR_HOT) {
+		uint64_t hot = __atomic_load_n(&var->hot, __ATOMIC_ACQUIRE);
+		if ((hot >> 32) == HOT_FLOAT) {
+			uint32_t bits = (uint32_t) hot;
+			memcpy(&value, &bits, sizeof(value));
+			return 0;
+		}
+	}
+
+	string data;
+
+	if (GetValue(varId, data) != 0)
+		return -1;
+
+	value = atof(data.c_str());
+	return 0;
+}
+
 int DataManager::GetValue(const string& varName, unsigned long long& value)
 {
 	string data;
@@ -465,6 +739,14 @@ int DataManager::SetValue(const string& varName, const string& value, const int
 		}
 	}
 
+	Variable* var = GetVariable(GetVariableId(varName));
+	if (var) {
+		// A string set on a hot variable overrides its last number
+		if (var->kind == VAR_HOT)
+			__atomic_store_n(&var->hot, (uint64_t) HOT_STORED << 32, __ATOMIC_RELEASE);
+		__sync_fetch_and_add(&var->version, 1);
+	}
+
 	pthread_mutex_unlock(&m_valuesLock);
 
 #ifndef TW_NO_SCREEN_TIMEOUT
@@ -483,6 +765,10 @@ int DataManager::SetValue(const string& varName, const int value, const int pers
 {
 	ostringstream valStr;
 	valStr << value;
+	if (SetHotValue(varName, ((uint64_t) HOT_INT << 32) | (uint32_t) value, persist)) {
+		gui_notifyVarChange(varName.c_str(), valStr.str().c_str());
+		return 0;
+	}
 	return SetValue(varName, valStr.str(), persist);
 }
 
@@ -490,9 +776,44 @@ int DataManager::SetValue(const string& varName, const float value, const int pe
 {
 	ostringstream valStr;
 	valStr << value;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	if (SetHotValue(varName, ((uint64_t) HOT_FLOAT << 32) | bits, persist)) {
+		gui_notifyVarChange(varName.c_str(), valStr.str().c_str());
+		return 0;
+	}
 	return SetValue(varName, valStr.str(), persist);;
 }
 
+// Stores an int or float for a hot variable without taking m_valuesLock. Returns false
+// if varName isn't hot, in which case the caller stores the value as a string.
+bool DataManager::SetHotValue(const string& varName, uint64_t hot, const int persist)
+{
+	if (persist)
+		return false;
+
+	Variable* var = GetVariable(GetVariableId(varName));
+	if (!var || var->kind != VAR_HOT)
+		return false;
+
+	if (!mInitialized)
+		SetDefaultValues();
+	if (__atomic_exchange_n(&var->hot, hot, __ATOMIC_ACQ_REL) != hot)
+		__sync_fetch_and_add(&var->version, 1);
+	return true;
+}
+
+void DataManager::ClearHotValues(void)
+{
+	pthread_mutex_lock(&m_idLock);
+	for (int i = 0; i < mVariableCount; i++) {
+		Variable* var = GetVariable(i);
+		if (var->kind == VAR_HOT)
+			__atomic_store_n(&var->hot, (uint64_t) HOT_UNSET, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&m_idLock);
+}
+
 int DataManager::SetValue(const string& varName, const unsigned long long& value, const int persist /* = 0 */)
 {
 	ostringstream valStr;
@@ -901,10 +1222,10 @@ void DataManager::SetDefaultValues()
 }
 
 // Magic Values
-int DataManager::GetMagicValue(const string& varName, string& value)
+int DataManager::GetMagicValue(int kind, string& value)
 {
 	// Handle special dynamic cases
-	if (varName == "tw_time")
+	if (kind == VAR_MAGIC_TIME)
 	{
 		char tmp[32];
 
@@ -931,7 +1252,7 @@ int DataManager::GetMagicValue(const string& varName, string& value)
 		value = tmp;
 		return 0;
 	}
-	else if (varName == "tw_cpu_temp")
+	else if (kind == VAR_MAGIC_CPU_TEMP)
 	{
 		int tw_no_cpu_temp;
 		GetValue("tw_no_cpu_temp", tw_no_cpu_temp);
@@ -965,7 +1286,7 @@ int DataManager::GetMagicValue(const string& varName, string& value)
 		value = TWFunc::to_string(convert_temp);
 		return 0;
 	}
-	else if (varName == "tw_battery")
+	else if (kind == VAR_MAGIC_BATTERY)
 	{
 		char tmp[16];
 		static char charging = ' ';
@@ -20,7 +20,10 @@
 #define _DATAMANAGER_HPP_HEADER
 
 #include <string>
+#include <map>
 #include <pthread.h>
+#include <stdint.h>
+#include <time.h>
 #include "infomanager.hpp"
 
 #define PERSIST_SETTINGS_FILE  "/persist/.twrps"
@@ -41,6 +44,19 @@ public:
 	static int GetValue(const string& varName, float& value);
 	static int GetValue(const string& varName, unsigned long long& value);
 
+	// Variable IDs - a name is interned once (e.g. when a theme is loaded or a value is set)
+	// and the ID is stable until reboot. Lookups by ID skip the '%' stripping and the magic
+	// name checks. Once the table is full, names that are not in it are used by name.
+	static int GetVariableId(const string& varName); // Interns the name, -1 if it can't be
+	static int FindVariableId(const string& varName); // -1 for names that were never interned
+	static string GetVariableName(int varId);
+	static int GetValue(int varId, string& value);
+	static int GetValue(int varId, int& value);
+	static int GetValue(int varId, float& value);
+	// Changes whenever the value may have changed. Magic and property values are sampled
+	// here on a timer, so polling the version is cheap.
+	static uint32_t GetVariableVersion(int varId);
+
 	// Helper functions
 	static string GetStrValue(const string& varName);
 	static int GetIntValue(const string& varName);
@@ -73,16 +89,41 @@ protected:
 
 	static map<string, string> mConstValues;
 
+	// An interned variable. Progress values that change constantly during backups and
+	// restores are "hot": their int or float value is kept in one atomic word and read
+	// without taking m_valuesLock.
+	struct Variable {
+		string name;
+		int kind;
+		volatile uint64_t hot;                   // HOT_* type in the upper half, the value in the lower
+		volatile uint32_t version;               // bumped by every set
+		string sample;                           // last magic or property value, with its GetValue result
+		int sample_ret;
+		struct timespec next_sample;
+	};
+
+	static map<string, int> mVariableIds;
+	static Variable** mVariables[];              // chunks of VARIABLE_CHUNK_SIZE entries
+	static volatile int mVariableCount;
+	static volatile uint32_t mGeneration;        // bumped when values are loaded or reset in bulk
+
 protected:
 	static int SaveValues();
 
-	static int GetMagicValue(const string& varName, string& value);
+	static Variable* GetVariable(int varId);
+	static int LookupVariableId(const string& varName, bool intern);
+	static int GetStoredValue(const string& varName, string& value);
+	static bool SetHotValue(const string& varName, uint64_t hot, const int persist);
+	static void ClearHotValues(void);
+	static int GetMagicValue(int kind, string& value);
+	static int SampleValue(Variable* var, string& value);
 
 private:
 	static void sanitize_device_id(char* device_id);
 	static void get_device_id(void);
 
 	static pthread_mutex_t m_valuesLock;
+	static pthread_mutex_t m_idLock;
 };
 
 #endif // _DATAMANAGER_HPP_HEADER
@@ -47,6 +47,12 @@ bool Evaluate(State* state, const std::unique_ptr<Expr>& expr, std::string* resu
         return false;
     }
 
+    // Literals are by far the most common leaves; skip boxing them into a Value.
+    if (expr->fn == Literal) {
+        *result = expr->name.c_str();
+        return true;
+    }
+
     std::unique_ptr<Value> v(expr->fn(expr->name.c_str(), state, expr->argv));
     if (!v) {
         return false;
@@ -343,6 +349,114 @@ void RegisterBuiltins() {
 }
 
 
+// -----------------------------------------------------------------
+//   compile-time folding
+// -----------------------------------------------------------------
+
+static bool IsLiteral(const std::unique_ptr<Expr>& expr) {
+    return expr->fn == Literal;
+}
+
+static bool AllLiterals(const std::vector<std::unique_ptr<Expr>>& argv) {
+    for (const auto& arg : argv) {
+        if (!IsLiteral(arg)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The replacement keeps the source range of the node it replaces, so that messages built from
+// the script text (e.g. "assert failed: ...") stay the same after folding.
+static void ReplaceWithLiteral(std::unique_ptr<Expr>* expr, const std::string& value) {
+    int start = (*expr)->start;
+    int end = (*expr)->end;
+    expr->reset(new Expr(Literal, value, start, end));
+}
+
+static void ReplaceWithArg(std::unique_ptr<Expr>* expr, size_t index) {
+    std::unique_ptr<Expr> arg = std::move((*expr)->argv[index]);
+    arg->start = (*expr)->start;
+    arg->end = (*expr)->end;
+    *expr = std::move(arg);
+}
+
+void CompileExpr(std::unique_ptr<Expr>* expr) {
+    if (expr == nullptr || !*expr) {
+        return;
+    }
+    for (auto& arg : (*expr)->argv) {
+        CompileExpr(&arg);
+    }
+
+    Function fn = (*expr)->fn;
+    const std::vector<std::unique_ptr<Expr>>& argv = (*expr)->argv;
+
+    if (fn == ConcatFn) {
+        if (!AllLiterals(argv)) {
+            return;
+        }
+        std::string result;
+        for (const auto& arg : argv) {
+            result += arg->name.c_str();
+        }
+        ReplaceWithLiteral(expr, result);
+    } else if (fn == SequenceFn) {
+        if (argv.size() == 2 && IsLiteral(argv[0])) {
+            ReplaceWithArg(expr, 1);
+        }
+    } else if (fn == IfElseFn) {
+        if ((argv.size() != 2 && argv.size() != 3) || !IsLiteral(argv[0])) {
+            return;
+        }
+        if (BooleanString(argv[0]->name.c_str())) {
+            ReplaceWithArg(expr, 1);
+        } else if (argv.size() == 3) {
+            ReplaceWithArg(expr, 2);
+        } else {
+            ReplaceWithLiteral(expr, "");
+        }
+    } else if (fn == LogicalAndFn) {
+        if (argv.size() != 2 || !IsLiteral(argv[0])) {
+            return;
+        }
+        if (BooleanString(argv[0]->name.c_str())) {
+            ReplaceWithArg(expr, 1);
+        } else {
+            ReplaceWithLiteral(expr, "");
+        }
+    } else if (fn == LogicalOrFn) {
+        if (argv.size() != 2 || !IsLiteral(argv[0])) {
+            return;
+        }
+        if (BooleanString(argv[0]->name.c_str())) {
+            ReplaceWithArg(expr, 0);
+        } else {
+            ReplaceWithArg(expr, 1);
+        }
+    } else if (fn == LogicalNotFn) {
+        if (argv.size() != 1 || !IsLiteral(argv[0])) {
+            return;
+        }
+        ReplaceWithLiteral(expr, BooleanString(argv[0]->name.c_str()) ? "" : "t");
+    } else if (fn == EqualityFn || fn == InequalityFn || fn == SubstringFn) {
+        if (argv.size() != 2 || !AllLiterals(argv)) {
+            return;
+        }
+        std::string left = argv[0]->name.c_str();
+        std::string right = argv[1]->name.c_str();
+        bool value;
+        if (fn == EqualityFn) {
+            value = (left == right);
+        } else if (fn == InequalityFn) {
+            value = (left != right);
+        } else {
+            value = (right.find(left) != std::string::npos);
+        }
+        ReplaceWithLiteral(expr, value ? "t" : "");
+    }
+}
+
 // -----------------------------------------------------------------
 //   convenience methods for functions
 // -----------------------------------------------------------------
@@ -158,4 +158,11 @@ Value* StringValue(const std::string& str);
 
 int parse_string(const char* str, std::unique_ptr<Expr>* root, int* error_count);
 
+// Rewrite a parsed tree in place so it evaluates with less work: builtin operators whose
+// arguments are all literals are folded into a single literal, and control-flow builtins with a
+// literal condition are replaced by the branch they would take. Function calls are already
+// bound to their Function at parse time. The result is identical to evaluating the original
+// tree, including error messages.
+void CompileExpr(std::unique_ptr<Expr>* expr);
+
 #endif  // _EXPRESSION_H
@@ -23,6 +23,7 @@ extern "C" {
 #include <sys/stat.h>
 #include <dirent.h>
 #include <errno.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 #include "exclude.hpp"
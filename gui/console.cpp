@@ -19,6 +19,7 @@
 // console.cpp - GUIConsole object
 
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -41,12 +42,34 @@ extern "C" {
 
 #define GUI_CONSOLE_BUFFER_SIZE 512
 
+// The console keeps the most recent lines in a fixed ring that all GUIConsoles read in place.
+// Writers are serialized by console_lock, readers take no lock: a line is valid as long as
+// its sequence number is >= console_tail, so readers copy what they need and check the tail
+// again afterwards, like a seqlock. Every line also goes to stdout, which is the recovery
+// log, so nothing is lost when old lines drop out of the ring.
+#define CONSOLE_MAX_LINES 8192			// must be a power of 2
+#define CONSOLE_TEXT_SIZE (1024 * 1024)
+#define CONSOLE_MAX_LINE_LEN 4096		// longer lines are cut, gui_print lines are at most 512
+#define CONSOLE_MAX_COLORS 32
+
+struct ConsoleLine
+{
+	uint64_t text; // logical offset of the text in console_text, the physical one is modulo CONSOLE_TEXT_SIZE
+	uint32_t len;
+	uint32_t color; // interned color id, 0 is "normal"
+};
+
 static pthread_mutex_t console_lock;
 static size_t last_message_count = 0;
 static std::vector<Message> gMessages;
 
-static std::vector<std::string> gConsole;
-static std::vector<std::string> gConsoleColor;
+static ConsoleLine console_lines[CONSOLE_MAX_LINES];
+static char console_text[CONSOLE_TEXT_SIZE];
+static uint64_t console_head = 0; // sequence number of the next line
+static uint64_t console_tail = 0; // sequence number of the oldest line still in the ring
+static uint64_t console_text_head = 0; // logical offset where the next line's text goes
+static char console_colors[CONSOLE_MAX_COLORS][32] = { "normal" };
+static unsigned console_color_count = 1;
 static FILE* ors_file = NULL;
 
 struct InitMutex
@@ -54,6 +77,83 @@ struct InitMutex
 	InitMutex() { pthread_mutex_init(&console_lock, NULL); }
 } initMutex;
 
+// Must be called with console_lock held. Colors beyond CONSOLE_MAX_COLORS show as normal.
+static unsigned Console_Color_Id(const char* color)
+{
+	for (unsigned i = 0; i < console_color_count; i++) {
+		if (strcmp(console_colors[i], color) == 0)
+			return i;
+	}
+	if (console_color_count == CONSOLE_MAX_COLORS || strlen(color) >= sizeof(console_colors[0]))
+		return 0;
+	strcpy(console_colors[console_color_count], color);
+	return console_color_count++;
+}
+
+// Must be called with console_lock held. Drops the oldest lines as needed to make room.
+static void Console_Append(const char* text, size_t len, unsigned color)
+{
+	if (len > CONSOLE_MAX_LINE_LEN)
+		len = CONSOLE_MAX_LINE_LEN;
+
+	// text never wraps around the end of the buffer, so skip the rest of it if the line doesn't fit
+	uint64_t start = console_text_head;
+	size_t pos = start % CONSOLE_TEXT_SIZE;
+	if (pos + len + 1 > CONSOLE_TEXT_SIZE) {
+		start += CONSOLE_TEXT_SIZE - pos;
+		pos = 0;
+	}
+	uint64_t end = start + len + 1;
+
+	uint64_t head = console_head;
+	uint64_t tail = console_tail;
+	while (tail < head && (head - tail >= CONSOLE_MAX_LINES || console_lines[tail & (CONSOLE_MAX_LINES - 1)].text + CONSOLE_TEXT_SIZE < end))
+		tail++;
+	if (tail != console_tail) {
+		// readers must see the new tail before the slots and text get overwritten
+		__atomic_store_n(&console_tail, tail, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+	}
+
+	memcpy(console_text + pos, text, len);
+	console_text[pos + len] = '\0';
+	ConsoleLine* line = &console_lines[head & (CONSOLE_MAX_LINES - 1)];
+	line->text = start;
+	line->len = len;
+	line->color = color;
+	console_text_head = end;
+	__atomic_store_n(&console_head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Copies up to len bytes of line seq, starting at offset, into buf and terminates it.
+// Returns the number of bytes copied, or -1 if the line has dropped out of the ring.
+static int Console_Copy(uint64_t seq, size_t offset, size_t len, char* buf, unsigned* color)
+{
+	if (seq < __atomic_load_n(&console_tail, __ATOMIC_ACQUIRE))
+		return -1;
+
+	const ConsoleLine* line = &console_lines[seq & (CONSOLE_MAX_LINES - 1)];
+	uint64_t text = line->text;
+	size_t line_len = line->len;
+	unsigned line_color = line->color;
+	if (offset > line_len)
+		offset = line_len;
+	if (len > line_len - offset)
+		len = line_len - offset;
+	size_t pos = text % CONSOLE_TEXT_SIZE + offset;
+	if (pos + len > CONSOLE_TEXT_SIZE || line_color >= CONSOLE_MAX_COLORS)
+		return -1; // torn read of a slot that is being reused
+	memcpy(buf, console_text + pos, len);
+	buf[len] = '\0';
+
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (seq < __atomic_load_n(&console_tail, __ATOMIC_RELAXED))
+		return -1;
+	if (color)
+		*color = line_color;
+	return len;
+}
+
 static void internal_gui_print(const char *color, char *buf)
 {
 	// make sure to flush any outstanding messages first to preserve order of outputs
@@ -73,14 +173,12 @@ static void internal_gui_print(const char *color, char *buf)
 	}
 
 	pthread_mutex_lock(&console_lock);
+	unsigned color_id = Console_Color_Id(color);
 	for (start = next = buf; *next != '\0';)
 	{
 		if (*next == '\n')
 		{
-			*next = '\0';
-			gConsole.push_back(start);
-			gConsoleColor.push_back(color);
-
+			Console_Append(start, next - start, color_id);
 			start = ++next;
 		}
 		else
@@ -88,10 +186,8 @@ static void internal_gui_print(const char *color, char *buf)
 	}
 
 	// The text after last \n (or whole string if there is no \n)
-	if (*start) {
-		gConsole.push_back(start);
-		gConsoleColor.push_back(color);
-	}
+	if (*start)
+		Console_Append(start, next - start, color_id);
 	pthread_mutex_unlock(&console_lock);
 }
 
@@ -182,15 +278,14 @@ void GUIConsole::Translate_Now()
 
 	for (size_t m = last_message_count; m < message_count; m++) {
 		std::string message = gMessages[m];
-		std::string color = "normal";
+		const char* color = "normal";
 		if (gMessages[m].GetKind() == msg::kError)
 			color = "error";
 		else if (gMessages[m].GetKind() == msg::kHighlight)
 			color = "highlight";
 		else if (gMessages[m].GetKind() == msg::kWarning)
 			color = "warning";
-		gConsole.push_back(message);
-		gConsoleColor.push_back(color);
+		Console_Append(message.c_str(), message.size(), Console_Color_Id(color));
 	}
 	last_message_count = message_count;
 	pthread_mutex_unlock(&console_lock);
@@ -200,8 +295,7 @@ void GUIConsole::Clear_For_Retranslation()
 {
 	pthread_mutex_lock(&console_lock);
 	last_message_count = 0;
-	gConsole.clear();
-	gConsoleColor.clear();
+	__atomic_store_n(&console_tail, console_head, __ATOMIC_RELEASE);
 	pthread_mutex_unlock(&console_lock);
 }
 
@@ -209,7 +303,7 @@ GUIConsole::GUIConsole(xml_node<>* node) : GUIScrollList(node)
 {
 	xml_node<>* child;
 
-	mLastCount = 0;
+	mNextLine = 0;
 	scrollToEnd = true;
 	mSlideoutX = mSlideoutY = mSlideoutW = mSlideoutH = 0;
 	mSlideout = 0;
@@ -270,9 +364,7 @@ int GUIConsole::RenderSlideout(void)
 int GUIConsole::RenderConsole(void)
 {
 	Translate_Now();
-	pthread_mutex_lock(&console_lock);
-	AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
-	pthread_mutex_unlock(&console_lock);
+	UpdateRows();
 	GUIScrollList::Render();
 
 	// if last line is fully visible, keep tracking the last line when new lines are added
@@ -318,15 +410,12 @@ int GUIConsole::Update(void)
 			mSlideoutState = visible;
 
 		// Any time we activate the console, we reset the position
-		SetVisibleListLocation(rConsole.size() - 1);
+		SetVisibleListLocation(mRows.size() - 1);
 		mUpdate = 1;
 		scrollToEnd = true;
 	}
 
-	pthread_mutex_lock(&console_lock);
-	bool addedNewText = AddLines(&gConsole, &gConsoleColor, &mLastCount, &rConsole, &rConsoleColor);
-	pthread_mutex_unlock(&console_lock);
-	if (addedNewText) {
+	if (UpdateRows()) {
 		// someone added new text
 		// at least the scrollbar must be updated, even if the new lines are currently not visible
 		mUpdate = 1;
@@ -334,7 +423,7 @@ int GUIConsole::Update(void)
 
 	if (scrollToEnd) {
 		// keep the last line in view
-		SetVisibleListLocation(rConsole.size() - 1);
+		SetVisibleListLocation(mRows.size() - 1);
 	}
 
 	GUIScrollList::Update();
@@ -386,24 +475,22 @@ int GUIConsole::NotifyTouch(TOUCH_STATE state, int x, int y)
 
 size_t GUIConsole::GetItemCount()
 {
-	return rConsole.size();
+	return mRows.size();
 }
 
 void GUIConsole::RenderItem(size_t itemindex, int yPos, bool selected __unused)
 {
+	const ConsoleRow& row = mRows[itemindex];
+	char text[CONSOLE_MAX_LINE_LEN + 1];
+	unsigned color;
+	if (Console_Copy(row.line, row.offset, row.len, text, &color) < 0)
+		return; // the line is gone, the row is dropped on the next update
+
 	// Set the color for the font
-	if (rConsoleColor[itemindex] == "normal") {
-		gr_color(mFontColor.red, mFontColor.green, mFontColor.blue, mFontColor.alpha);
-	} else {
-		COLOR FontColor;
-		std::string color = rConsoleColor[itemindex];
-		ConvertStrToColor(color, &FontColor);
-		FontColor.alpha = 255;
-		gr_color(FontColor.red, FontColor.green, FontColor.blue, FontColor.alpha);
-	}
+	const COLOR& FontColor = GetLineColor(color);
+	gr_color(FontColor.red, FontColor.green, FontColor.blue, FontColor.alpha);
 
 	// render text
-	const char* text = rConsole[itemindex].c_str();
 	gr_textEx_scaleW(mRenderX, yPos, text, mFont->GetResource(), mRenderW, TOP_LEFT, 0);
 }
 
@@ -411,3 +498,74 @@ void GUIConsole::NotifySelect(size_t item_selected __unused)
 {
 	// do nothing - console ignores selections
 }
+
+const COLOR& GUIConsole::GetLineColor(unsigned color)
+{
+	if (color == 0)
+		return mFontColor;
+	if (color >= mColors.size())
+		mColors.resize(color + 1);
+	if (mColors[color].alpha == 0) {
+		// resolved colors are opaque, so alpha 0 means not looked up yet
+		ConvertStrToColor(console_colors[color], &mColors[color]);
+		mColors[color].alpha = 255;
+	}
+	return mColors[color];
+}
+
+bool GUIConsole::UpdateRows()
+{
+	if (!mFont || !mFont->GetResource())
+		return false;
+
+	bool changed = false;
+
+	// forget rows of lines that have dropped out of the ring
+	uint64_t tail = __atomic_load_n(&console_tail, __ATOMIC_ACQUIRE);
+	size_t dropped = 0;
+	while (!mRows.empty() && mRows.front().line < tail) {
+		mRows.pop_front();
+		dropped++;
+	}
+	if (dropped) {
+		// keep the rows that are on screen in place
+		firstDisplayedItem = (size_t)firstDisplayedItem > dropped ? firstDisplayedItem - dropped : 0;
+		changed = true;
+	}
+	if (mNextLine < tail)
+		mNextLine = tail;
+
+	// Due to word wrap, figure out how the new lines split into rows. Note, that multiple consoles on different
+	// GUI pages may be different widths or use different fonts, so the word wrapping may be different in each
+	// console. Rows only hold offsets into the shared line, not copies of the text.
+	uint64_t head = __atomic_load_n(&console_head, __ATOMIC_ACQUIRE);
+	char text[CONSOLE_MAX_LINE_LEN + 1];
+	for (; mNextLine < head; mNextLine++) {
+		int len = Console_Copy(mNextLine, 0, CONSOLE_MAX_LINE_LEN, text, NULL);
+		if (len < 0)
+			continue;
+		changed = true;
+
+		ConsoleRow row;
+		row.line = mNextLine;
+		row.offset = 0;
+		for (;;) {
+			size_t remaining = len - row.offset;
+			size_t wrap_pos = WrapLength(text + row.offset, remaining);
+			if (wrap_pos < remaining) {
+				row.len = wrap_pos;
+				mRows.push_back(row);
+				/* After word wrapping, skip any leading spaces. Note that the word wrapping is not smart enough to know not
+				 * to wrap in the middle of something like ... so some of the ... could appear on the following line. */
+				row.offset += wrap_pos;
+				while (text[row.offset] == ' ')
+					row.offset++;
+			} else {
+				row.len = remaining;
+				mRows.push_back(row);
+				break;
+			}
+		}
+	}
+	return changed;
+}
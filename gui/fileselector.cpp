@@ -17,9 +17,14 @@
 */
 
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <dirent.h>
 #include <algorithm>
+#include <list>
 
 extern "C" {
 #include "../twcommon.h"
@@ -31,9 +36,57 @@ extern "C" {
 #include "../data.hpp"
 #include "../twrp-functions.hpp"
 #include "../adbbu/libtwadbbu.hpp"
+#include "../twrpBackupManifest.hpp"
+
+#define LISTING_BUFFER_SIZE (32 * 1024)	// getdents64 batch, also how many entries are handed to the GUI at once
+#define LISTING_CACHE_SIZE 8
 
 int GUIFileSelector::mSortOrder = 0;
 
+// A folder is read by a thread of its own, which hands the entries to the GUI thread in
+// batches as they come in, so large folders show up while they are still being read. The
+// job is shared by the thread and the file selector and freed by whichever lets go last.
+struct GUIFileSelector::ListingJob
+{
+	std::string folder;
+	std::string extn;
+	int showNavFolders;
+	bool needStat; // the sort order needs sizes or dates, otherwise d_type is enough
+	bool backupIndex; // folder is a backups folder, backups are sized and dated from its index
+	int fd;
+	pthread_mutex_t lock;
+	std::vector<FileData> folders; // read but not picked up by the GUI thread yet
+	std::vector<FileData> files;
+	bool done;
+	int cancel;
+	int refs;
+};
+
+// Listings of recently shown folders, most recent first. A listing is good as long as the
+// folder's mtime is unchanged, which covers files being added, removed or renamed but not
+// changes of their sizes or dates, so listings sorted by those are not cached.
+struct GUIFileSelector::CachedListing
+{
+	std::string folder;
+	std::string extn;
+	int showNavFolders;
+	struct timespec mtime;
+	int sortOrder;
+	std::vector<FileData> folders;
+	std::vector<FileData> files;
+};
+
+std::list<GUIFileSelector::CachedListing> GUIFileSelector::mListingCache;
+
+struct kernel_dirent64
+{
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
 GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 {
 	xml_attribute<>* attr;
@@ -44,6 +97,7 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 	mUpdate = 0;
 	mPathVar = "cwd";
 	updateFileList = false;
+	mListing = NULL;
 
 	// Load filter for filtering files (e.g. *.zip for only zips)
 	child = FindNode(node, "filter");
@@ -133,6 +187,7 @@ GUIFileSelector::GUIFileSelector(xml_node<>* node) : GUIScrollList(node)
 
 GUIFileSelector::~GUIFileSelector()
 {
+	StopListing();
 }
 
 int GUIFileSelector::Update(void)
@@ -142,6 +197,10 @@ int GUIFileSelector::Update(void)
 
 	GUIScrollList::Update();
 
+	// Pick up entries read by the listing thread
+	if (mListing && CollectListing())
+		mUpdate = 1;
+
 	// Update the file list if needed
 	if (updateFileList) {
 		string value;
@@ -161,6 +220,14 @@ int GUIFileSelector::Update(void)
 	return 0;
 }
 
+bool GUIFileSelector::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetNotifyVariables(vars);
+	vars.push_back(mPathVar);
+	vars.push_back(mSortVariable);
+	return true;
+}
+
 int GUIFileSelector::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIScrollList::NotifyVarChange(varName, value);
@@ -188,16 +255,13 @@ int GUIFileSelector::NotifyVarChange(const std::string& varName, const std::stri
 	return 0;
 }
 
-bool GUIFileSelector::fileSort(FileData d1, FileData d2)
+bool GUIFileSelector::fileSort(const FileData& d1, const FileData& d2)
 {
-	if (d1.fileName == ".")
-		return -1;
-	if (d2.fileName == ".")
-		return 0;
+	// ".." always goes first
 	if (d1.fileName == "..")
-		return -1;
+		return d2.fileName != "..";
 	if (d2.fileName == "..")
-		return 0;
+		return false;
 
 	switch (mSortOrder) {
 		case 3: // by size largest first
@@ -226,17 +290,20 @@ bool GUIFileSelector::fileSort(FileData d1, FileData d2)
 
 int GUIFileSelector::GetFileList(const std::string folder)
 {
-	DIR* d;
-	struct dirent* de;
+	int fd;
 	struct stat st;
 
+	StopListing();
+
 	// Clear all data
 	mFolderList.clear();
 	mFileList.clear();
 
-	d = opendir(folder.c_str());
-	if (d == NULL) {
+	fd = open(folder.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) != 0) {
 		LOGINFO("Unable to open '%s'\n", folder.c_str());
+		if (fd >= 0)
+			close(fd);
 		if (folder != "/" && (mShowNavFolders != 0 || mShowFiles != 0)) {
 			size_t found;
 			found = folder.find_last_of('/');
@@ -251,48 +318,199 @@ int GUIFileSelector::GetFileList(const std::string folder)
 		return -1;
 	}
 
-	while ((de = readdir(d)) != NULL) {
-		FileData data;
-
-		data.fileName = de->d_name;
-		if (data.fileName == ".")
-			continue;
-		if (data.fileName == ".." && folder == "/")
-			continue;
-
-		data.fileType = de->d_type;
-
-		std::string path = folder + "/" + data.fileName;
-		stat(path.c_str(), &st);
-		data.protection = st.st_mode;
-		data.userId = st.st_uid;
-		data.groupId = st.st_gid;
-		data.fileSize = st.st_size;
-		data.lastAccess = st.st_atime;
-		data.lastModified = st.st_mtime;
-		data.lastStatChange = st.st_ctime;
-
-		if (data.fileType == DT_UNKNOWN) {
-			data.fileType = TWFunc::Get_D_Type_From_Stat(path);
+	bool needStat = mSortOrder == 2 || mSortOrder == -2 || mSortOrder == 3 || mSortOrder == -3;
+	if (!needStat) {
+		for (std::list<CachedListing>::iterator it = mListingCache.begin(); it != mListingCache.end(); ++it) {
+			if (it->folder == folder && it->extn == mExtn && it->showNavFolders == mShowNavFolders) {
+				if (it->mtime.tv_sec == st.st_mtim.tv_sec && it->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+					close(fd);
+					mFolderList = it->folders;
+					mFileList = it->files;
+					if (it->sortOrder != mSortOrder) {
+						std::sort(mFolderList.begin(), mFolderList.end(), fileSort);
+						std::sort(mFileList.begin(), mFileList.end(), fileSort);
+					}
+					mListingCache.splice(mListingCache.begin(), mListingCache, it);
+					return 0;
+				}
+				mListingCache.erase(it);
+				break;
+			}
 		}
-		if (data.fileType == DT_DIR) {
-			if (mShowNavFolders || (data.fileName != "." && data.fileName != ".."))
-				mFolderList.push_back(data);
-		} else if (data.fileType == DT_REG || data.fileType == DT_LNK || data.fileType == DT_BLK) {
-			if (mExtn.empty() || (data.fileName.length() > mExtn.length() && data.fileName.substr(data.fileName.length() - mExtn.length()) == mExtn)) {
-				if (mExtn == ".ab" && twadbbu::Check_ADB_Backup_File(path))
-					mFolderList.push_back(data);
-				else
-					mFileList.push_back(data);
+	}
+
+	ListingJob* job = new ListingJob;
+	job->folder = folder;
+	job->extn = mExtn;
+	job->showNavFolders = mShowNavFolders;
+	job->needStat = needStat;
+	job->backupIndex = needStat && faccessat(fd, TW_BACKUP_INDEX_FILE, F_OK, 0) == 0;
+	job->fd = fd;
+	pthread_mutex_init(&job->lock, NULL);
+	job->done = false;
+	job->cancel = 0;
+	job->refs = 2;
+	mListing = job;
+	mListingMtime = st.st_mtim;
+
+	pthread_t thread;
+	pthread_attr_t tattr;
+	pthread_attr_init(&tattr);
+	pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create(&thread, &tattr, ListingThread, job) != 0) {
+		LOGINFO("Unable to start a listing thread, reading '%s' directly\n", folder.c_str());
+		ListingThread(job);
+	}
+	pthread_attr_destroy(&tattr);
+	CollectListing();
+	return 0;
+}
+
+void* GUIFileSelector::ListingThread(void* cookie)
+{
+	ListingJob* job = (ListingJob*)cookie;
+	char* buf = (char*)malloc(LISTING_BUFFER_SIZE);
+	std::vector<FileData> folders, files;
+
+	while (buf && !__sync_fetch_and_add(&job->cancel, 0)) {
+		int len = syscall(SYS_getdents64, job->fd, buf, LISTING_BUFFER_SIZE);
+		if (len <= 0)
+			break;
+
+		for (int pos = 0; pos < len;) {
+			struct kernel_dirent64* de = (struct kernel_dirent64*)(buf + pos);
+			pos += de->d_reclen;
+
+			FileData data;
+			data.fileName = de->d_name;
+			if (data.fileName == ".")
+				continue;
+			if (data.fileName == ".." && job->folder == "/")
+				continue;
+
+			data.fileType = de->d_type;
+			data.protection = 0;
+			data.userId = 0;
+			data.groupId = 0;
+			data.fileSize = 0;
+			data.lastAccess = data.lastModified = data.lastStatChange = 0;
+
+			std::string path = job->folder + "/" + data.fileName;
+			if (job->needStat) {
+				struct stat st;
+				if (fstatat(job->fd, de->d_name, &st, 0) == 0) {
+					data.protection = st.st_mode;
+					data.userId = st.st_uid;
+					data.groupId = st.st_gid;
+					data.fileSize = st.st_size;
+					data.lastAccess = st.st_atime;
+					data.lastModified = st.st_mtime;
+					data.lastStatChange = st.st_ctime;
+
+					// the size of a backup folder itself says nothing, the index has what is in it
+					twrpBackupManifest manifest;
+					if (job->backupIndex && S_ISDIR(st.st_mode) && data.fileName != ".." && manifest.Load_Index(path, st)) {
+						data.fileSize = manifest.Total_Size();
+						if (manifest.date)
+							data.lastModified = manifest.date;
+					}
+				}
 			}
+
+			if (data.fileType == DT_UNKNOWN) {
+				data.fileType = TWFunc::Get_D_Type_From_Stat(path);
+			}
+			if (data.fileType == DT_DIR) {
+				if (job->showNavFolders || (data.fileName != "." && data.fileName != ".."))
+					folders.push_back(data);
+			} else if (data.fileType == DT_REG || data.fileType == DT_LNK || data.fileType == DT_BLK) {
+				if (job->extn.empty() || (data.fileName.length() > job->extn.length() && data.fileName.substr(data.fileName.length() - job->extn.length()) == job->extn)) {
+					if (job->extn == ".ab" && twadbbu::Check_ADB_Backup_File(path))
+						folders.push_back(data);
+					else
+						files.push_back(data);
+				}
+			}
+		}
+
+		pthread_mutex_lock(&job->lock);
+		job->folders.insert(job->folders.end(), folders.begin(), folders.end());
+		job->files.insert(job->files.end(), files.begin(), files.end());
+		pthread_mutex_unlock(&job->lock);
+		folders.clear();
+		files.clear();
+	}
+	free(buf);
+	close(job->fd);
+
+	pthread_mutex_lock(&job->lock);
+	job->done = true;
+	pthread_mutex_unlock(&job->lock);
+	ReleaseListing(job);
+	return NULL;
+}
+
+// Sorts a batch of new entries and merges it into the already sorted list
+void GUIFileSelector::MergeSorted(std::vector<FileData>& list, std::vector<FileData>& batch)
+{
+	if (batch.empty())
+		return;
+	std::sort(batch.begin(), batch.end(), fileSort);
+	size_t mid = list.size();
+	list.insert(list.end(), batch.begin(), batch.end());
+	std::inplace_merge(list.begin(), list.begin() + mid, list.end(), fileSort);
+}
+
+bool GUIFileSelector::CollectListing()
+{
+	std::vector<FileData> folders, files;
+	bool done;
+
+	pthread_mutex_lock(&mListing->lock);
+	folders.swap(mListing->folders);
+	files.swap(mListing->files);
+	done = mListing->done;
+	pthread_mutex_unlock(&mListing->lock);
+
+	bool added = !folders.empty() || !files.empty();
+	MergeSorted(mFolderList, folders);
+	MergeSorted(mFileList, files);
+
+	if (done) {
+		if (!mListing->needStat) {
+			CachedListing cached;
+			cached.folder = mListing->folder;
+			cached.extn = mListing->extn;
+			cached.showNavFolders = mListing->showNavFolders;
+			cached.mtime = mListingMtime;
+			cached.sortOrder = mSortOrder;
+			cached.folders = mFolderList;
+			cached.files = mFileList;
+			mListingCache.push_front(cached);
+			if (mListingCache.size() > LISTING_CACHE_SIZE)
+				mListingCache.pop_back();
 		}
+		ReleaseListing(mListing);
+		mListing = NULL;
 	}
-	closedir(d);
+	return added || done;
+}
 
-	std::sort(mFolderList.begin(), mFolderList.end(), fileSort);
-	std::sort(mFileList.begin(), mFileList.end(), fileSort);
+void GUIFileSelector::StopListing()
+{
+	if (!mListing)
+		return;
+	__sync_fetch_and_add(&mListing->cancel, 1);
+	ReleaseListing(mListing);
+	mListing = NULL;
+}
 
-	return 0;
+void GUIFileSelector::ReleaseListing(ListingJob* job)
+{
+	if (__sync_sub_and_fetch(&job->refs, 1) == 0) {
+		pthread_mutex_destroy(&job->lock);
+		delete job;
+	}
 }
 
 void GUIFileSelector::SetPageFocus(int inFocus)
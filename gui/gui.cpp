@@ -676,10 +676,9 @@ int gui_changeOverlay(std::string overlay)
 	return 0;
 }
 
-std::string gui_parse_text(std::string str)
+// Replaces string resources given as {@resource_name} or {@resource_name=default}
+void gui_expand_resources(std::string& str)
 {
-	// This function parses text for DataManager values encompassed by %value% in the XML
-	// and string resources (%@resource_name%)
 	size_t pos = 0, next, end;
 
 	while (1)
@@ -705,7 +704,15 @@ std::string gui_parse_text(std::string str)
 			str.insert(next, PageManager::GetResources()->FindString(lookup, default_string));
 		}
 	}
-	pos = 0;
+}
+
+std::string gui_parse_text(std::string str)
+{
+	// This function parses text for DataManager values encompassed by %value% in the XML
+	// and string resources (%@resource_name%)
+	size_t pos = 0, next, end;
+
+	gui_expand_resources(str);
 	while (1)
 	{
 		next = str.find('%', pos);
@@ -738,6 +745,31 @@ std::string gui_parse_text(std::string str)
 	}
 }
 
+void gui_parse_text_variables(std::string str, std::vector<std::string>& vars)
+{
+	// Collects the names gui_parse_text would look up in the DataManager
+	size_t pos = 0, next, end;
+
+	gui_expand_resources(str);
+	while (1)
+	{
+		next = str.find('%', pos);
+		if (next == std::string::npos)
+			return;
+
+		end = str.find('%', next + 1);
+		if (end == std::string::npos)
+			return;
+
+		std::string var = str.substr(next + 1, (end - next) - 1);
+		if (var.size() > 0 && var[0] == '@')
+			gui_parse_text_variables(PageManager::GetResources()->FindString(var.substr(1)), vars);
+		else if (!var.empty())
+			vars.push_back(var);
+		pos = end + 1;
+	}
+}
+
 std::string gui_lookup(const std::string& resource_name, const std::string& default_value) {
 	return PageManager::GetResources()->FindString(resource_name, default_value);
 }
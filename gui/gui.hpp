@@ -30,6 +30,8 @@ void gui_highlight(const char* text);
 void gui_msg(Message msg);
 
 std::string gui_parse_text(std::string inText);
+void gui_expand_resources(std::string& str);
+void gui_parse_text_variables(std::string inText, std::vector<std::string>& vars);
 std::string gui_lookup(const std::string& resource_name, const std::string& default_value);
 
 #endif //_GUI_HPP_HEADER
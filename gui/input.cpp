@@ -414,6 +414,13 @@ int GUIInput::NotifyTouch(TOUCH_STATE state, int x, int y)
 	return 0;
 }
 
+bool GUIInput::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIObject::GetNotifyVariables(vars);
+	vars.push_back(mVariable);
+	return true;
+}
+
 int GUIInput::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIObject::NotifyVarChange(varName, value);
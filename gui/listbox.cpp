@@ -145,6 +145,18 @@ int GUIListBox::Update(void)
 	return 0;
 }
 
+bool GUIListBox::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetNotifyVariables(vars);
+	vars.push_back(mVariable);
+	for (size_t i = 0; i < mListItems.size(); i++) {
+		AddConditionVariables(mListItems[i].mConditions, vars);
+		if (isCheckList)
+			vars.push_back(mListItems[i].variableName);
+	}
+	return true;
+}
+
 int GUIListBox::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIScrollList::NotifyVarChange(varName, value);
@@ -169,6 +169,24 @@ int GUIObject::NotifyVarChange(const std::string& varName, const std::string& va
 	return 0;
 }
 
+bool GUIObject::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	AddConditionVariables(mConditions, vars);
+	return true;
+}
+
+void GUIObject::AddConditionVariables(const std::vector<Condition>& conditions, std::vector<std::string>& vars)
+{
+	std::vector<Condition>::const_iterator iter;
+	for (iter = conditions.begin(); iter != conditions.end(); ++iter)
+	{
+		if (!iter->mVar1.empty())
+			vars.push_back(iter->mVar1);
+		if (!iter->mVar2.empty())
+			vars.push_back(iter->mVar2);
+	}
+}
+
 bool GUIObject::UpdateConditions(std::vector<Condition>& conditions, const std::string& varName)
 {
 	bool result = true;
@@ -23,6 +23,8 @@
 
 #include "rapidxml.hpp"
 #include <vector>
+#include <deque>
+#include <list>
 #include <string>
 #include <map>
 #include <set>
@@ -129,6 +131,11 @@ public:
 	//  Returns 0 on success, <0 on error
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
 
+	// GetNotifyVariables - Adds the variables NotifyVarChange reacts to, pages only notify
+	//  the object about those (and about page changes, with an empty name)
+	//  Return false if the object needs to see every variable change
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
+
 protected:
 	class Condition
 	{
@@ -151,6 +158,7 @@ protected:
 	static bool isMounted(std::string vol);
 	static bool isConditionTrue(Condition* condition);
 	static bool UpdateConditions(std::vector<Condition>& conditions, const std::string& varName);
+	static void AddConditionVariables(const std::vector<Condition>& conditions, std::vector<std::string>& vars);
 
 	bool mConditionsResult;
 };
@@ -172,6 +180,39 @@ protected:
 	int HasInputFocus;
 };
 
+// TextTemplate - Text split into literal and variable parts once, so it can be
+//  evaluated without rescanning and only needs evaluating when a variable changed
+class TextTemplate
+{
+public:
+	TextTemplate() {}
+
+	// Compile - Parses text the way gui_parse_text does, string resources are resolved now
+	void Compile(const std::string& text);
+
+	// IsStatic - True if the text doesn't reference any variables
+	bool IsStatic() const;
+
+	// Changed - True if a referenced variable changed since the last Evaluate
+	bool Changed() const;
+
+	std::string Evaluate();
+	void GetVariables(std::vector<std::string>& vars) const;
+
+protected:
+	struct Segment
+	{
+		std::string text;                  // literal text if varId is -1 and name is empty
+		int varId;
+		std::string name;                  // variable that could not be interned, text is its last value
+		uint32_t version;                  // variable version at the last Evaluate
+	};
+
+	void CompileSegments(std::string text, int depth);
+
+	std::vector<Segment> mSegments;
+};
+
 // Derived Objects
 // GUIText - Used for static text
 class GUIText : public GUIObject, public RenderObject, public ActionObject
@@ -207,6 +248,7 @@ public:
 
 protected:
 	std::string mText;
+	TextTemplate mTemplate;
 	std::string mLastValue;
 	COLOR mColor;
 	COLOR mHighlightColor;
@@ -465,6 +507,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// SetPos - Update the position of the render object
 	//  Return 0 on success, <0 on error
@@ -557,6 +600,7 @@ protected:
 	int fastScroll; // indicates that the inital touch was inside the fastscroll region - makes for easier fast scrolling as the touches don't have to stay within the fast scroll region and you drag your finger
 	int mUpdate; // indicates that a change took place and we need to re-render
 	bool AddLines(std::vector<std::string>* origText, std::vector<std::string>* origColor, size_t* lastCount, std::vector<std::string>* rText, std::vector<std::string>* rColor);
+	size_t WrapLength(const char* text, size_t len); // number of characters of text that go on the next word wrapped row
 };
 
 class GUIFileSelector : public GUIScrollList
@@ -572,6 +616,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -593,9 +638,17 @@ protected:
 		time_t lastStatChange;	  // Uses time_t format from stat
 	};
 
+	struct ListingJob;
+	struct CachedListing;
+
 protected:
-	virtual int GetFileList(const std::string folder);
-	static bool fileSort(FileData d1, FileData d2);
+	virtual int GetFileList(const std::string folder); // starts reading the folder, the entries come in with Update
+	static bool fileSort(const FileData& d1, const FileData& d2);
+	static void MergeSorted(std::vector<FileData>& list, std::vector<FileData>& batch);
+	static void* ListingThread(void* cookie);
+	static void ReleaseListing(ListingJob* job);
+	bool CollectListing(void); // returns true if the list changed
+	void StopListing(void);
 
 protected:
 	std::vector<FileData> mFolderList;
@@ -612,6 +665,9 @@ protected:
 	ImageResource* mFolderIcon;
 	ImageResource* mFileIcon;
 	bool updateFileList;
+	ListingJob* mListing; // folder being read, NULL once all of its entries are in the lists
+	struct timespec mListingMtime; // mtime of the folder when mListing started
+	static std::list<CachedListing> mListingCache;
 };
 
 class GUIListBox : public GUIScrollList
@@ -627,6 +683,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -669,6 +726,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -705,6 +763,7 @@ public:
 
 	// NotifyVarChange - Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// ScrollList interface
 	virtual size_t GetItemCount();
@@ -758,18 +817,27 @@ protected:
 		request_show
 	};
 
+	// One word wrapped row, pointing into a line of the shared console ring
+	struct ConsoleRow {
+		uint64_t line; // sequence number of the line
+		uint32_t offset; // start of the row in the line
+		uint32_t len;
+	};
+
 	ImageResource* mSlideoutImage;
-	size_t mLastCount; // lines from gConsole that are already split and copied into rConsole
+	uint64_t mNextLine; // first line of the console ring that is not split into rows yet
 	bool scrollToEnd; // true if we want to keep tracking the last line
 	int mSlideoutX, mSlideoutY, mSlideoutW, mSlideoutH;
 	int mSlideout;
 	SlideoutState mSlideoutState;
-	std::vector<std::string> rConsole;
-	std::vector<std::string> rConsoleColor;
+	std::deque<ConsoleRow> mRows;
+	std::vector<COLOR> mColors; // interned console colors resolved for this console, indexed by color id
 
 protected:
 	int RenderSlideout(void);
 	int RenderConsole(void);
+	bool UpdateRows(void); // returns true if rows were added or dropped
+	const COLOR& GetLineColor(unsigned color);
 };
 
 class TerminalEngine;
@@ -850,6 +918,7 @@ public:
 	// NotifyVarChange - Notify of a variable change
 	//  Returns 0 on success, <0 on error
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 protected:
 	ImageResource* mEmptyBar;
@@ -1000,6 +1069,7 @@ public:
 
 	// Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// NotifyTouch - Notify of a touch event
 	//  Return 0 on success, >0 to ignore remainder of touch, and <0 on error
@@ -1099,6 +1169,7 @@ public:
 
 	// Notify of a variable change
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 
 	// SetPageFocus - Notify when a page gains or loses focus
 	virtual void SetPageFocus(int inFocus);
@@ -1180,6 +1251,7 @@ public:
 	virtual int Update(void);
 	virtual int NotifyTouch(TOUCH_STATE state, int x, int y);
 	virtual int NotifyVarChange(const std::string& varName, const std::string& value);
+	virtual bool GetNotifyVariables(std::vector<std::string>& vars);
 	virtual int SetRenderPos(int x, int y, int w = 0, int h = 0);
 
 protected:
@@ -314,6 +314,7 @@ Page::Page(xml_node<>* page, std::vector<xml_node<>*> *templates)
 
 	// This is a recursive routine for template handling
 	ProcessNode(page, templates, 0);
+	LoadSubscriptions();
 }
 
 Page::~Page()
@@ -654,10 +655,68 @@ void Page::SetPageFocus(int inFocus)
 	return;
 }
 
+void Page::LoadSubscriptions(void)
+{
+	std::vector<bool> notifyAll(mObjects.size(), false);
+	std::map<int, std::vector<size_t> > watchers;
+
+	for (size_t i = 0; i < mObjects.size(); i++)
+	{
+		std::vector<std::string> vars;
+		if (!mObjects[i]->GetNotifyVariables(vars))
+		{
+			notifyAll[i] = true;
+			mNotifyAll.push_back(mObjects[i]);
+			continue;
+		}
+		for (std::vector<std::string>::iterator var = vars.begin(); var != vars.end(); ++var)
+		{
+			int id = DataManager::GetVariableId(*var);
+			if (id < 0)
+			{
+				// a name that could not be interned has no subscribers, so the object sees everything
+				if (!notifyAll[i])
+				{
+					notifyAll[i] = true;
+					mNotifyAll.push_back(mObjects[i]);
+				}
+				continue;
+			}
+			std::vector<size_t>& indices = watchers[id];
+			if (indices.empty() || indices.back() != i)
+				indices.push_back(i);
+		}
+	}
+
+	// Merge with the objects that see everything so notifications keep the page order
+	std::map<int, std::vector<size_t> >::iterator watched;
+	for (watched = watchers.begin(); watched != watchers.end(); ++watched)
+	{
+		std::vector<GUIObject*>& subscribers = mSubscribers[watched->first];
+		size_t next = 0;
+		for (size_t i = 0; i < mObjects.size(); i++)
+		{
+			bool watching = next < watched->second.size() && watched->second[next] == i;
+			if (watching)
+				next++;
+			if (watching || notifyAll[i])
+				subscribers.push_back(mObjects[i]);
+		}
+	}
+}
+
 int Page::NotifyVarChange(std::string varName, std::string value)
 {
-	std::vector<GUIObject*>::iterator iter;
-	for (iter = mObjects.begin(); iter != mObjects.end(); ++iter)
+	// An empty name is sent on page changes and has to reach every object
+	const std::vector<GUIObject*>* objects = &mObjects;
+	if (!varName.empty())
+	{
+		std::map<int, std::vector<GUIObject*> >::const_iterator pos = mSubscribers.find(DataManager::FindVariableId(varName));
+		objects = (pos != mSubscribers.end() ? &pos->second : &mNotifyAll);
+	}
+
+	std::vector<GUIObject*>::const_iterator iter;
+	for (iter = objects->begin(); iter != objects->end(); ++iter)
 	{
 		if ((*iter)->NotifyVarChange(varName, value))
 			LOGERR("An action handler errored on NotifyVarChange.\n");
@@ -670,6 +729,7 @@ int Page::NotifyVarChange(std::string varName, std::string value)
 struct LoadingContext
 {
 	ZipWrap* zip; // zip to load theme from, or NULL for the stock theme
+	std::string package; // ui.xml or zip file of the theme, names its resource cache
 	std::set<std::string> filenames; // to detect cyclic includes
 	std::string basepath; // if zip is NULL, base path to load includes from with trailing slash, otherwise empty
 	std::vector<xml_document<>*> xmldocs; // all loaded xml docs
@@ -743,6 +803,8 @@ int PageSet::Load(LoadingContext& ctx, const std::string& filename)
 		int rc = LoadDetails(ctx, root);
 		if (rc != 0)
 			return rc;
+		// scaling is known now, so cached images can be used
+		mResources->OpenCache(ctx.package);
 	}
 
 	LOGINFO("Loading resources...\n");
@@ -799,6 +861,8 @@ int PageSet::Load(LoadingContext& ctx, const std::string& filename)
 		}
 	}
 
+	if (isMain)
+		mResources->SaveCache();
 	return 0;
 }
 
@@ -1345,6 +1409,7 @@ int PageManager::LoadPackage(std::string name, std::string package, std::string
 
 	// init the loading context
 	LoadingContext ctx;
+	ctx.package = package;
 
 	// Open the XML file
 	LOGINFO("Loading package: %s (%s)\n", name.c_str(), package.c_str());
@@ -99,11 +99,17 @@ protected:
 	std::vector<ActionObject*> mActions;
 	std::vector<InputObject*> mInputs;
 
+	// Objects to notify per DataManager variable ID, in page order. Variables nobody
+	// subscribed to only go to mNotifyAll.
+	std::map<int, std::vector<GUIObject*> > mSubscribers;
+	std::vector<GUIObject*> mNotifyAll;
+
 	ActionObject* mTouchStart;
 	COLOR mBackground;
 
 protected:
 	bool ProcessNode(xml_node<>* page, std::vector<xml_node<>*> *templates, int depth);
+	void LoadSubscriptions(void);
 };
 
 struct LoadingContext;
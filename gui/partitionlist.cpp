@@ -129,6 +129,13 @@ int GUIPartitionList::Update(void)
 	return 0;
 }
 
+bool GUIPartitionList::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetNotifyVariables(vars);
+	vars.push_back(mVariable);
+	return true;
+}
+
 int GUIPartitionList::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIScrollList::NotifyVarChange(varName, value);
@@ -411,6 +411,13 @@ int GUIPatternPassword::NotifyTouch(TOUCH_STATE state, int x, int y)
 	return 0;
 }
 
+bool GUIPatternPassword::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIObject::GetNotifyVariables(vars);
+	vars.push_back(mSizeVar);
+	return true;
+}
+
 int GUIPatternPassword::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	if (!isConditionTrue())
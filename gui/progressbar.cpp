@@ -182,6 +182,14 @@ int GUIProgressBar::Update(void)
 	return 2;
 }
 
+bool GUIProgressBar::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIObject::GetNotifyVariables(vars);
+	vars.push_back("ui_progress_portion");
+	vars.push_back("ui_progress_frames");
+	return true;
+}
+
 int GUIProgressBar::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIObject::NotifyVarChange(varName, value);
@@ -29,8 +29,15 @@
 #include <iostream>
 #include <iomanip>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+#include <cutils/properties.h>
 
 #include "../zipwrap.hpp"
+#include "../data.hpp"
+#include "../twrp-functions.hpp"
+#include "../set_metadata.h"
+#include "../variables.h"
 extern "C" {
 #include "../twcommon.h"
 #include "gui.h"
@@ -40,7 +47,42 @@ extern "C" {
 #include "rapidxml.hpp"
 #include "objects.hpp"
 
-#define TMP_RESOURCE_NAME   "/tmp/extract.bin"
+#define TMP_RESOURCE_NAME   "/tmp/extract%d.bin"
+#define RESOURCE_LOAD_THREADS 8
+
+#define RESOURCE_CACHE_MAGIC 0x43525754 // "TWRC"
+#define RESOURCE_CACHE_VERSION 1
+#define RESOURCE_CACHE_ALIGN 64
+
+struct resource_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t count;
+	uint32_t reserved;
+};
+
+struct resource_cache_entry {
+	uint64_t data_offset;
+	int64_t source_size;
+	uint32_t name_offset;
+	uint32_t name_length;
+	uint32_t width;
+	uint32_t height;
+	int32_t format;
+	int32_t retain_aspect;
+};
+
+// FNV-1a, enough to tell themes apart
+static uint64_t ResourceHash(const std::string& data)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	for (size_t i = 0; i < data.size(); i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
 
 Resource::Resource(xml_node<>* node, ZipWrap* pZip __unused)
 {
@@ -59,52 +101,6 @@ int Resource::ExtractResource(ZipWrap* pZip, std::string folderName, std::string
 	return 0;
 }
 
-void Resource::LoadImage(ZipWrap* pZip, std::string file, gr_surface* surface)
-{
-	int rc = 0;
-	if (ExtractResource(pZip, "images", file, ".png", TMP_RESOURCE_NAME) == 0)
-	{
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
-	}
-	else if (ExtractResource(pZip, "images", file, "", TMP_RESOURCE_NAME) == 0)
-	{
-		// JPG includes the .jpg extension in the filename so extension should be blank
-		rc = res_create_surface(TMP_RESOURCE_NAME, surface);
-		unlink(TMP_RESOURCE_NAME);
-	}
-	else if (!pZip)
-	{
-		// File name in xml may have included .png so try without adding .png
-		rc = res_create_surface(file.c_str(), surface);
-	}
-	if (rc != 0)
-		LOGINFO("Failed to load image from %s%s, error %d\n", file.c_str(), pZip ? " (zip)" : "", rc);
-}
-
-void Resource::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
-{
-	if (!source) {
-		*destination = NULL;
-		return;
-	}
-	if (get_scale_w() != 0 && get_scale_h() != 0) {
-		float scale_w = get_scale_w(), scale_h = get_scale_h();
-		if (retain_aspect) {
-			if (scale_w < scale_h)
-				scale_h = scale_w;
-			else
-				scale_w = scale_h;
-		}
-		if (res_scale_surface(source, destination, scale_w, scale_h)) {
-			LOGINFO("Error scaling image, using regular size.\n");
-			*destination = source;
-		}
-	} else {
-		*destination = source;
-	}
-}
-
 FontResource::FontResource(xml_node<>* node, ZipWrap* pZip)
  : Resource(node, pZip)
 {
@@ -193,11 +189,10 @@ FontResource::~FontResource()
 	DeleteFont();
 }
 
-ImageResource::ImageResource(xml_node<>* node, ZipWrap* pZip)
+ImageResource::ImageResource(xml_node<>* node, ZipWrap* pZip, ResourceLoader* loader)
  : Resource(node, pZip)
 {
 	std::string file;
-	gr_surface temp_surface = NULL;
 
 	mSurface = NULL;
 	if (!node) {
@@ -214,8 +209,7 @@ ImageResource::ImageResource(xml_node<>* node, ZipWrap* pZip)
 
 	bool retain_aspect = (node->first_attribute("retainaspect") != NULL);
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
-	LoadImage(pZip, file, &temp_surface);
-	CheckAndScaleImage(temp_surface, &mSurface, retain_aspect);
+	loader->Queue(file, retain_aspect, &mSurface, false);
 }
 
 ImageResource::~ImageResource()
@@ -224,11 +218,11 @@ ImageResource::~ImageResource()
 		res_free_surface(mSurface);
 }
 
-AnimationResource::AnimationResource(xml_node<>* node, ZipWrap* pZip)
+AnimationResource::AnimationResource(xml_node<>* node, ZipWrap* pZip, ResourceLoader* loader)
  : Resource(node, pZip)
 {
 	std::string file;
-	int fileNum = 1;
+	std::vector<std::string> frames;
 
 	if (!node)
 		return;
@@ -242,19 +236,30 @@ AnimationResource::AnimationResource(xml_node<>* node, ZipWrap* pZip)
 
 	bool retain_aspect = (node->first_attribute("retainaspect") != NULL);
 	// the value does not matter, if retainaspect is present, we assume that we want to retain it
-	for (;;)
+	for (int fileNum = 1; ; fileNum++)
 	{
 		std::ostringstream fileName;
 		fileName << file << std::setfill ('0') << std::setw (3) << fileNum;
 
-		gr_surface surface, temp_surface = NULL;
-		LoadImage(pZip, fileName.str(), &temp_surface);
-		CheckAndScaleImage(temp_surface, &surface, retain_aspect);
-		if (surface) {
-			mSurfaces.push_back(surface);
-			fileNum++;
-		} else
-			break; // Done loading animation images
+		if (loader->SourceSize(fileName.str()) < 0)
+			break; // Found all animation images
+		frames.push_back(fileName.str());
+	}
+
+	// the loader keeps pointers into mSurfaces, so it must not grow after queueing
+	mSurfaces.resize(frames.size(), NULL);
+	for (size_t i = 0; i < frames.size(); i++)
+		loader->Queue(frames[i], retain_aspect, &mSurfaces[i], i > 0);
+}
+
+void AnimationResource::DropFailedFrames()
+{
+	for (size_t i = 0; i < mSurfaces.size(); i++) {
+		if (!mSurfaces[i]) {
+			// the loader already dropped the frames after a failed one
+			mSurfaces.resize(i);
+			break;
+		}
 	}
 }
 
@@ -268,6 +273,343 @@ AnimationResource::~AnimationResource()
 	mSurfaces.clear();
 }
 
+ResourceCache::ResourceCache()
+{
+	mKey = 0;
+	mData = NULL;
+	mDirty = false;
+}
+
+ResourceCache::~ResourceCache()
+{
+	for (std::map<std::string, Entry>::iterator it = mCached.begin(); it != mCached.end(); ++it)
+		res_free_surface(it->second.surface);
+	free(mData);
+}
+
+std::string ResourceCache::EntryKey(const std::string& file, int retain_aspect)
+{
+	return file + (retain_aspect ? "|aspect" : "|");
+}
+
+bool ResourceCache::Open(const std::string& filename, uint64_t key)
+{
+	struct stat st;
+
+	mFilename = filename;
+	mKey = key;
+	mDirty = true; // until a matching file is read
+
+	int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return false;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(resource_cache_header)) {
+		close(fd);
+		return false;
+	}
+	size_t size = st.st_size;
+	unsigned char* base = (unsigned char*)malloc(size);
+	size_t done = 0;
+	while (base && done < size) {
+		ssize_t len = read(fd, base + done, size - done);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+		done += len;
+	}
+	close(fd);
+	if (!base || done != size) {
+		LOGINFO("Unable to read resource cache '%s'\n", filename.c_str());
+		free(base);
+		return false;
+	}
+
+	const resource_cache_header* header = (const resource_cache_header*)base;
+	if (header->magic != RESOURCE_CACHE_MAGIC || header->version != RESOURCE_CACHE_VERSION || header->key != key
+			|| header->count > (size - sizeof(*header)) / sizeof(resource_cache_entry)) {
+		LOGINFO("Resource cache '%s' is for a different theme or resolution\n", filename.c_str());
+		free(base);
+		return false;
+	}
+
+	const resource_cache_entry* entries = (const resource_cache_entry*)(header + 1);
+	for (uint32_t i = 0; i < header->count; i++) {
+		const resource_cache_entry& e = entries[i];
+		uint64_t data_size = (uint64_t)e.width * e.height * 4;
+		if ((uint64_t)e.name_offset + e.name_length > size || e.data_offset > size || data_size > size - e.data_offset) {
+			LOGINFO("Resource cache '%s' is damaged\n", filename.c_str());
+			for (std::map<std::string, Entry>::iterator it = mCached.begin(); it != mCached.end(); ++it)
+				res_free_surface(it->second.surface);
+			mCached.clear();
+			free(base);
+			return false;
+		}
+		Entry entry;
+		entry.file.assign((const char*)base + e.name_offset, e.name_length);
+		entry.retain_aspect = e.retain_aspect;
+		entry.source_size = e.source_size;
+		entry.surface = res_wrap_surface(e.width, e.height, e.width, e.format, base + e.data_offset);
+		if (entry.surface)
+			mCached[EntryKey(entry.file, entry.retain_aspect)] = entry;
+	}
+	mData = base;
+	mDirty = false;
+	LOGINFO("Read %u cached images from '%s'\n", header->count, filename.c_str());
+	return true;
+}
+
+gr_surface ResourceCache::Find(const std::string& file, int retain_aspect, long source_size)
+{
+	std::map<std::string, Entry>::const_iterator it = mCached.find(EntryKey(file, retain_aspect));
+	if (it == mCached.end() || it->second.source_size != source_size)
+		return NULL;
+
+	// every user gets a surface of its own, as they are freed one by one
+	int stride, format;
+	unsigned char* data = res_surface_data(it->second.surface, &stride, &format);
+	return res_wrap_surface(gr_get_width(it->second.surface), gr_get_height(it->second.surface), stride, format, data);
+}
+
+void ResourceCache::Add(const std::string& file, int retain_aspect, long source_size, gr_surface surface, bool decoded)
+{
+	Entry entry;
+	entry.file = file;
+	entry.retain_aspect = retain_aspect;
+	entry.source_size = source_size;
+	entry.surface = surface;
+	mUsed.push_back(entry);
+	if (decoded)
+		mDirty = true;
+}
+
+bool ResourceCache::Save()
+{
+	if (!mDirty || mFilename.empty())
+		return true;
+
+	std::vector<resource_cache_entry> entries(mUsed.size());
+	std::string names;
+	uint64_t offset = sizeof(resource_cache_header) + entries.size() * sizeof(resource_cache_entry);
+	for (size_t i = 0; i < mUsed.size(); i++) {
+		entries[i].name_offset = offset + names.size();
+		entries[i].name_length = mUsed[i].file.size();
+		names += mUsed[i].file;
+	}
+	offset += names.size();
+	for (size_t i = 0; i < mUsed.size(); i++) {
+		int stride;
+		offset = (offset + RESOURCE_CACHE_ALIGN - 1) & ~(uint64_t)(RESOURCE_CACHE_ALIGN - 1);
+		res_surface_data(mUsed[i].surface, &stride, &entries[i].format);
+		entries[i].data_offset = offset;
+		entries[i].source_size = mUsed[i].source_size;
+		entries[i].width = gr_get_width(mUsed[i].surface);
+		entries[i].height = gr_get_height(mUsed[i].surface);
+		entries[i].retain_aspect = mUsed[i].retain_aspect;
+		offset += (uint64_t)entries[i].width * entries[i].height * 4;
+	}
+
+	resource_cache_header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = RESOURCE_CACHE_MAGIC;
+	header.version = RESOURCE_CACHE_VERSION;
+	header.key = mKey;
+	header.count = entries.size();
+
+	// write a new file and rename it, so a failed write leaves the old one intact
+	std::string tmp_filename = mFilename + ".tmp";
+	FILE* fp = fopen(tmp_filename.c_str(), "wb");
+	if (!fp) {
+		LOGINFO("Unable to create resource cache '%s'\n", tmp_filename.c_str());
+		return false;
+	}
+	fwrite(&header, sizeof(header), 1, fp);
+	if (!entries.empty())
+		fwrite(&entries[0], sizeof(resource_cache_entry), entries.size(), fp);
+	fwrite(names.data(), 1, names.size(), fp);
+	for (size_t i = 0; i < mUsed.size(); i++) {
+		int stride, format;
+		unsigned char* data = res_surface_data(mUsed[i].surface, &stride, &format);
+		fseek(fp, entries[i].data_offset, SEEK_SET);
+		for (uint32_t y = 0; y < entries[i].height; y++)
+			fwrite(data + (size_t)y * stride * 4, 4, entries[i].width, fp);
+	}
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0)
+		ok = false;
+	if (!ok || rename(tmp_filename.c_str(), mFilename.c_str()) != 0) {
+		LOGINFO("Unable to write resource cache '%s'\n", mFilename.c_str());
+		unlink(tmp_filename.c_str());
+		return false;
+	}
+	tw_set_default_metadata(mFilename.c_str());
+	mDirty = false;
+	LOGINFO("Saved %zu images to resource cache '%s'\n", mUsed.size(), mFilename.c_str());
+	return true;
+}
+
+ResourceLoader::ResourceLoader(ZipWrap* pZip, ResourceCache* cache)
+{
+	mZip = pZip;
+	mCache = cache;
+	mNext = 0;
+	pthread_mutex_init(&mZipLock, NULL);
+}
+
+ResourceLoader::~ResourceLoader()
+{
+	pthread_mutex_destroy(&mZipLock);
+}
+
+long ResourceLoader::SourceSize(const std::string& file)
+{
+	if (mZip) {
+		// same lookup order as LoadImage; JPG includes the .jpg extension in the filename
+		std::string entry = "images/" + file + ".png";
+		if (mZip->EntryExists(entry))
+			return mZip->GetUncompressedSize(entry);
+		entry = "images/" + file;
+		if (mZip->EntryExists(entry))
+			return mZip->GetUncompressedSize(entry);
+		return -1;
+	}
+
+	// same lookup order as res_create_surface
+	struct stat st;
+	std::string path = TWRES "images/" + file + ".png";
+	if (stat(path.c_str(), &st) == 0 || stat(file.c_str(), &st) == 0)
+		return st.st_size;
+	path = TWRES "images/" + file;
+	if (stat(path.c_str(), &st) == 0)
+		return st.st_size;
+	return -1;
+}
+
+void ResourceLoader::Queue(const std::string& file, int retain_aspect, gr_surface* surface, bool follows)
+{
+	Request request;
+	request.file = file;
+	request.retain_aspect = retain_aspect;
+	request.source_size = SourceSize(file);
+	request.surface = surface;
+	request.follows = follows;
+	request.cached = false;
+	request.rc = 0;
+	mRequests.push_back(request);
+}
+
+void ResourceLoader::LoadImage(Request& request, int index)
+{
+	gr_surface temp_surface = NULL;
+	char tmp_name[64];
+	int rc = 0;
+
+	if (mCache) {
+		*request.surface = mCache->Find(request.file, request.retain_aspect, request.source_size);
+		if (*request.surface) {
+			request.cached = true;
+			return;
+		}
+	}
+
+	if (mZip) {
+		snprintf(tmp_name, sizeof(tmp_name), TMP_RESOURCE_NAME, index);
+		pthread_mutex_lock(&mZipLock);
+		// JPG includes the .jpg extension in the filename so extension should be blank
+		bool extracted = Resource::ExtractResource(mZip, "images", request.file, ".png", tmp_name) == 0
+				|| Resource::ExtractResource(mZip, "images", request.file, "", tmp_name) == 0;
+		pthread_mutex_unlock(&mZipLock);
+		if (extracted) {
+			rc = res_create_surface(tmp_name, &temp_surface);
+			unlink(tmp_name);
+		}
+	} else {
+		// File name in xml may have included .png so try without adding .png
+		rc = res_create_surface(request.file.c_str(), &temp_surface);
+	}
+	if (rc != 0)
+		LOGINFO("Failed to load image from %s%s, error %d\n", request.file.c_str(), mZip ? " (zip)" : "", rc);
+	request.rc = rc;
+	CheckAndScaleImage(temp_surface, request.surface, request.retain_aspect);
+}
+
+void ResourceLoader::CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect)
+{
+	if (!source) {
+		*destination = NULL;
+		return;
+	}
+	if (get_scale_w() != 0 && get_scale_h() != 0) {
+		float scale_w = get_scale_w(), scale_h = get_scale_h();
+		if (retain_aspect) {
+			if (scale_w < scale_h)
+				scale_h = scale_w;
+			else
+				scale_w = scale_h;
+		}
+		if (res_scale_surface(source, destination, scale_w, scale_h)) {
+			LOGINFO("Error scaling image, using regular size.\n");
+			*destination = source;
+		}
+	} else {
+		*destination = source;
+	}
+}
+
+void* ResourceLoader::Worker(void* cookie)
+{
+	ResourceLoader* loader = (ResourceLoader*)cookie;
+
+	for (;;) {
+		int index = __sync_fetch_and_add(&loader->mNext, 1);
+		if (index >= (int)loader->mRequests.size())
+			break;
+		loader->LoadImage(loader->mRequests[index], index);
+	}
+	return NULL;
+}
+
+void ResourceLoader::Run()
+{
+	if (mRequests.empty())
+		return;
+
+	int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count > RESOURCE_LOAD_THREADS)
+		thread_count = RESOURCE_LOAD_THREADS;
+	if (thread_count > (int)mRequests.size())
+		thread_count = mRequests.size();
+
+	// the calling thread is one of the workers
+	std::vector<pthread_t> threads;
+	mNext = 0;
+	for (int i = 1; i < thread_count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, Worker, this) == 0)
+			threads.push_back(thread);
+	}
+	Worker(this);
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+
+	int cached = 0;
+	for (size_t i = 0; i < mRequests.size(); i++) {
+		Request& request = mRequests[i];
+		if (request.follows && i > 0 && !*mRequests[i - 1].surface && *request.surface) {
+			res_free_surface(*request.surface);
+			*request.surface = NULL;
+		}
+		if (!*request.surface)
+			continue;
+		if (request.cached)
+			cached++;
+		if (mCache)
+			mCache->Add(request.file, request.retain_aspect, request.source_size, *request.surface, !request.cached);
+	}
+	LOGINFO("Loaded %zu images on %zu threads, %d from cache\n", mRequests.size(), threads.size() + 1, cached);
+	mRequests.clear();
+}
+
 FontResource* ResourceManager::FindFont(const std::string& name) const
 {
 	for (std::vector<FontResource*>::const_iterator it = mFonts.begin(); it != mFonts.end(); ++it)
@@ -335,6 +677,7 @@ void ResourceManager::DumpStrings() const
 
 ResourceManager::ResourceManager()
 {
+	mCache = NULL;
 }
 
 void ResourceManager::AddStringResource(std::string resource_source, std::string resource_name, std::string value)
@@ -345,8 +688,45 @@ void ResourceManager::AddStringResource(std::string resource_source, std::string
 	mStrings[resource_name] = res;
 }
 
+void ResourceManager::OpenCache(const std::string& package)
+{
+	struct stat st;
+	char build_date[PROPERTY_VALUE_MAX];
+
+	// the cache lives on the settings storage, which may not be mounted or decrypted yet
+	std::string cache_dir = DataManager::GetSettingsStoragePath() + "/TWRP";
+	if (mCache || !TWFunc::Path_Exists(cache_dir) || stat(package.c_str(), &st) != 0)
+		return;
+	cache_dir += "/.rescache";
+	if (!TWFunc::Path_Exists(cache_dir) && mkdir(cache_dir.c_str(), 0755) != 0) {
+		LOGINFO("Unable to create '%s'\n", cache_dir.c_str());
+		return;
+	}
+
+	// images of the stock theme change with the recovery build, those of a zip theme with the zip
+	property_get("ro.build.date.utc", build_date, "");
+	std::ostringstream theme;
+	theme << DataManager::GetStrValue(TW_VERSION_VAR) << ' ' << build_date << ' ' << package << ' '
+		<< st.st_size << ' ' << st.st_mtime << ' ' << gr_fb_width() << 'x' << gr_fb_height() << ' '
+		<< get_scale_w() << 'x' << get_scale_h();
+	char filename[32];
+	snprintf(filename, sizeof(filename), "/%016llx.bin", (unsigned long long)ResourceHash(package));
+
+	mCache = new ResourceCache();
+	mCache->Open(cache_dir + filename, ResourceHash(theme.str()));
+}
+
+void ResourceManager::SaveCache()
+{
+	if (mCache)
+		mCache->Save();
+}
+
 void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::string resource_source)
 {
+	ResourceLoader loader(pZip, mCache);
+	std::vector<std::pair<Resource*, xml_node<>*> > pending;
+
 	if (!resList)
 		return;
 
@@ -390,25 +770,13 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::str
 			} else if (mFonts.size() != 0)
 				LOGERR("Unable to locate font name for type fontoverride.\n");
 		}
-		else if (type == "image")
+		else if (type == "image" || type == "animation")
 		{
-			ImageResource* res = new ImageResource(child, pZip);
-			if (res && res->GetResource())
-				mImages.push_back(res);
-			else {
-				error = true;
-				delete res;
-			}
-		}
-		else if (type == "animation")
-		{
-			AnimationResource* res = new AnimationResource(child, pZip);
-			if (res && res->GetResourceCount())
-				mAnimations.push_back(res);
-			else {
-				error = true;
-				delete res;
-			}
+			// images are decoded together once all of them are queued
+			if (type == "image")
+				pending.push_back(std::make_pair(new ImageResource(child, pZip, &loader), child));
+			else
+				pending.push_back(std::make_pair(new AnimationResource(child, pZip, &loader), child));
 		}
 		else if (type == "string")
 		{
@@ -427,21 +795,41 @@ void ResourceManager::LoadResources(xml_node<>* resList, ZipWrap* pZip, std::str
 		}
 
 		if (error)
-		{
-			std::string res_name;
-			if (child->first_attribute("name"))
-				res_name = child->first_attribute("name")->value();
-			if (res_name.empty() && child->first_attribute("filename"))
-				res_name = child->first_attribute("filename")->value();
-
-			if (!res_name.empty()) {
-				LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
-			} else
-				LOGERR("Resource type (%s) failed to load\n", type.c_str());
+			ReportError(type, child);
+	}
+
+	loader.Run();
+	for (size_t i = 0; i < pending.size(); i++) {
+		ImageResource* image = dynamic_cast<ImageResource*>(pending[i].first);
+		AnimationResource* animation = dynamic_cast<AnimationResource*>(pending[i].first);
+		if (animation)
+			animation->DropFailedFrames();
+
+		if (image && image->GetResource())
+			mImages.push_back(image);
+		else if (animation && animation->GetResourceCount())
+			mAnimations.push_back(animation);
+		else {
+			ReportError(image ? "image" : "animation", pending[i].second);
+			delete pending[i].first;
 		}
 	}
 }
 
+void ResourceManager::ReportError(const std::string& type, xml_node<>* child)
+{
+	std::string res_name;
+	if (child->first_attribute("name"))
+		res_name = child->first_attribute("name")->value();
+	if (res_name.empty() && child->first_attribute("filename"))
+		res_name = child->first_attribute("filename")->value();
+
+	if (!res_name.empty()) {
+		LOGERR("Resource (%s)-(%s) failed to load\n", type.c_str(), res_name.c_str());
+	} else
+		LOGERR("Resource type (%s) failed to load\n", type.c_str());
+}
+
 ResourceManager::~ResourceManager()
 {
 	for (std::vector<FontResource*>::iterator it = mFonts.begin(); it != mFonts.end(); ++it)
@@ -452,4 +840,7 @@ ResourceManager::~ResourceManager()
 
 	for (std::vector<AnimationResource*>::iterator it = mAnimations.begin(); it != mAnimations.end(); ++it)
 		delete *it;
+
+	// after the images, their surfaces may point into its memory
+	delete mCache;
 }
@@ -24,6 +24,8 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <pthread.h>
+#include <stdint.h>
 #include "rapidxml.hpp"
 #include "../zipwrap.hpp"
 
@@ -31,9 +33,13 @@ extern "C" {
 #include "../minuitwrp/minui.h"
 }
 
+class ResourceLoader;
+
 // Base Objects
 class Resource
 {
+	friend class ResourceLoader;
+
 public:
 	Resource(xml_node<>* node, ZipWrap* pZip);
 	virtual ~Resource() {}
@@ -46,8 +52,6 @@ private:
 
 protected:
 	static int ExtractResource(ZipWrap* pZip, std::string folderName, std::string fileName, std::string fileExtn, std::string destFile);
-	static void LoadImage(ZipWrap* pZip, std::string file, gr_surface* surface);
-	static void CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect);
 };
 
 class FontResource : public Resource
@@ -76,7 +80,7 @@ private:
 class ImageResource : public Resource
 {
 public:
-	ImageResource(xml_node<>* node, ZipWrap* pZip);
+	ImageResource(xml_node<>* node, ZipWrap* pZip, ResourceLoader* loader);
 	virtual ~ImageResource();
 
 public:
@@ -91,7 +95,7 @@ protected:
 class AnimationResource : public Resource
 {
 public:
-	AnimationResource(xml_node<>* node, ZipWrap* pZip);
+	AnimationResource(xml_node<>* node, ZipWrap* pZip, ResourceLoader* loader);
 	virtual ~AnimationResource();
 
 public:
@@ -100,11 +104,79 @@ public:
 	int GetWidth() { return gr_get_width(GetResource()); }
 	int GetHeight() { return gr_get_height(GetResource()); }
 	int GetResourceCount() { return mSurfaces.size(); }
+	void DropFailedFrames(); // the animation ends before the first frame that did not load
 
 protected:
 	std::vector<gr_surface> mSurfaces;
 };
 
+// Decoded and scaled images of an earlier load of the same theme at the same resolution,
+// stored in the pixel format gr_blit expects. The file is read into memory and closed, it
+// lives on the settings storage and must not keep it from being unmounted. The surfaces point
+// into that memory, so the cache must stay around for as long as they are in use.
+class ResourceCache
+{
+public:
+	ResourceCache();
+	~ResourceCache();
+
+	bool Open(const std::string& filename, uint64_t key); // false if missing or made for another key
+	gr_surface Find(const std::string& file, int retain_aspect, long source_size);
+	void Add(const std::string& file, int retain_aspect, long source_size, gr_surface surface, bool decoded);
+	bool Save(); // rewrites the file if any image had to be decoded
+
+private:
+	struct Entry {
+		std::string file;
+		int retain_aspect;
+		long source_size;
+		gr_surface surface;
+	};
+	static std::string EntryKey(const std::string& file, int retain_aspect);
+
+	std::string mFilename;
+	uint64_t mKey;
+	unsigned char* mData; // contents of the file
+	std::map<std::string, Entry> mCached; // surfaces in mData
+	std::vector<Entry> mUsed; // surfaces of this load, written by Save
+	bool mDirty;
+};
+
+// Decodes and scales the images queued by image and animation resources on a pool of
+// threads, taking them from the cache where possible.
+class ResourceLoader
+{
+public:
+	ResourceLoader(ZipWrap* pZip, ResourceCache* cache);
+	~ResourceLoader();
+
+	long SourceSize(const std::string& file); // -1 if there is no such image
+	// With follows set, the image is dropped if the one queued before it fails, so an
+	// animation still ends at its first bad frame.
+	void Queue(const std::string& file, int retain_aspect, gr_surface* surface, bool follows);
+	void Run();
+
+private:
+	struct Request {
+		std::string file;
+		int retain_aspect;
+		long source_size;
+		gr_surface* surface;
+		bool follows;
+		bool cached;
+		int rc;
+	};
+	static void* Worker(void* cookie);
+	void LoadImage(Request& request, int index);
+	static void CheckAndScaleImage(gr_surface source, gr_surface* destination, int retain_aspect);
+
+	ZipWrap* mZip;
+	ResourceCache* mCache;
+	std::vector<Request> mRequests;
+	pthread_mutex_t mZipLock; // zip extraction is not thread safe
+	volatile int mNext;
+};
+
 class ResourceManager
 {
 public:
@@ -112,6 +184,8 @@ public:
 	virtual ~ResourceManager();
 	void AddStringResource(std::string resource_source, std::string resource_name, std::string value);
 	void LoadResources(xml_node<>* resList, ZipWrap* pZip, std::string resource_source);
+	void OpenCache(const std::string& package); // call once the theme scale is known
+	void SaveCache();
 
 public:
 	FontResource* FindFont(const std::string& name) const;
@@ -122,6 +196,8 @@ public:
 	void DumpStrings() const;
 
 private:
+	static void ReportError(const std::string& type, xml_node<>* child);
+
 	struct string_resource_struct {
 		std::string value;
 		std::string source;
@@ -130,6 +206,7 @@ private:
 	std::vector<ImageResource*> mImages;
 	std::vector<AnimationResource*> mAnimations;
 	std::map<std::string, string_resource_struct> mStrings;
+	ResourceCache* mCache;
 };
 
 #endif  // _RESOURCE_HEADER
@@ -568,6 +568,14 @@ int GUIScrollList::GetDisplayRemainder()
 	return (mRenderH - mHeaderH) % actualItemHeight;
 }
 
+bool GUIScrollList::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIObject::GetNotifyVariables(vars);
+	if (!mHeaderIsStatic)
+		gui_parse_text_variables(mHeaderText, vars);
+	return true;
+}
+
 int GUIScrollList::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIObject::NotifyVarChange(varName, value);
@@ -630,14 +638,8 @@ bool GUIScrollList::AddLines(std::vector<std::string>* origText, std::vector<std
 		if (origColor)
 			curr_color = origColor->at(i);
 		for (;;) {
-			size_t line_char_width = gr_ttf_maxExW(curr_line.c_str(), mFont->GetResource(), mRenderW);
-			if (line_char_width < curr_line.size()) {
-				//string left = curr_line.substr(0, line_char_width);
-				size_t wrap_pos = curr_line.find_last_of(" ,./:-_;", line_char_width - 1);
-				if (wrap_pos == string::npos)
-					wrap_pos = line_char_width;
-				else if (wrap_pos < line_char_width - 1)
-					wrap_pos++;
+			size_t wrap_pos = WrapLength(curr_line.c_str(), curr_line.size());
+			if (wrap_pos < curr_line.size()) {
 				rText->push_back(curr_line.substr(0, wrap_pos));
 				if (origColor)
 					rColor->push_back(curr_color);
@@ -655,3 +657,25 @@ bool GUIScrollList::AddLines(std::vector<std::string>* origText, std::vector<std
 	}
 	return true;
 }
+
+// Shared by AddLines and GUIConsole, so that every list wraps the same way: break after the
+// last separator that fits, or in the middle of the word if there is none.
+size_t GUIScrollList::WrapLength(const char* text, size_t len)
+{
+	size_t line_char_width = gr_ttf_maxExW(text, mFont->GetResource(), mRenderW);
+	if (line_char_width >= len)
+		return len;
+
+	size_t wrap_pos = line_char_width;
+	for (size_t i = line_char_width; i > 0; i--) {
+		if (strchr(" ,./:-_;", text[i - 1])) {
+			wrap_pos = i - 1;
+			if (wrap_pos < line_char_width - 1)
+				wrap_pos++;
+			break;
+		}
+	}
+	if (wrap_pos == 0)
+		wrap_pos = 1; // always make progress, even if not a single character fits
+	return wrap_pos;
+}
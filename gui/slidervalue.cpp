@@ -419,6 +419,15 @@ int GUISliderValue::NotifyTouch(TOUCH_STATE state, int x, int y)
 	return 0;
 }
 
+bool GUISliderValue::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIObject::GetNotifyVariables(vars);
+	vars.push_back(mVariable);
+	if (mLabel)
+		mLabel->GetNotifyVariables(vars);
+	return true;
+}
+
 int GUISliderValue::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIObject::NotifyVarChange(varName, value);
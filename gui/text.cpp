@@ -43,6 +43,116 @@ extern "C" {
 #include "rapidxml.hpp"
 #include "objects.hpp"
 
+void TextTemplate::Compile(const std::string& text)
+{
+	mSegments.clear();
+	CompileSegments(text, 0);
+}
+
+void TextTemplate::CompileSegments(std::string text, int depth)
+{
+	size_t pos = 0, next, end;
+
+	gui_expand_resources(text);
+	while (pos < text.size())
+	{
+		next = text.find('%', pos);
+		end = (next == std::string::npos ? next : text.find('%', next + 1));
+		if (end == std::string::npos)
+			next = end = text.size();
+
+		Segment literal;
+		literal.text = text.substr(pos, next - pos);
+		literal.varId = -1;
+		literal.version = 0;
+		if (next + 1 == end)
+			literal.text += '%';
+		if (!literal.text.empty())
+		{
+			if (!mSegments.empty() && mSegments.back().varId < 0 && mSegments.back().name.empty())
+				mSegments.back().text += literal.text;
+			else
+				mSegments.push_back(literal);
+		}
+
+		if (end > next + 1 && end < text.size())
+		{
+			std::string var = text.substr(next + 1, (end - next) - 1);
+			if (var[0] == '@')
+			{
+				// string resources may in turn reference variables
+				if (depth < 10)
+					CompileSegments(PageManager::GetResources()->FindString(var.substr(1)), depth + 1);
+			}
+			else
+			{
+				Segment variable;
+				variable.varId = DataManager::GetVariableId(var);
+				variable.version = 0;
+				if (variable.varId < 0)
+					variable.name = var;
+				mSegments.push_back(variable);
+			}
+		}
+		pos = end + 1;
+	}
+}
+
+bool TextTemplate::IsStatic() const
+{
+	for (std::vector<Segment>::const_iterator iter = mSegments.begin(); iter != mSegments.end(); ++iter)
+	{
+		if (iter->varId >= 0 || !iter->name.empty())
+			return false;
+	}
+	return true;
+}
+
+bool TextTemplate::Changed() const
+{
+	for (std::vector<Segment>::const_iterator iter = mSegments.begin(); iter != mSegments.end(); ++iter)
+	{
+		if (iter->varId >= 0 && DataManager::GetVariableVersion(iter->varId) != iter->version)
+			return true;
+		if (iter->varId < 0 && !iter->name.empty() && DataManager::GetStrValue(iter->name) != iter->text)
+			return true;
+	}
+	return false;
+}
+
+std::string TextTemplate::Evaluate()
+{
+	std::string result;
+	for (std::vector<Segment>::iterator iter = mSegments.begin(); iter != mSegments.end(); ++iter)
+	{
+		if (iter->varId < 0)
+		{
+			if (!iter->name.empty())
+				iter->text = DataManager::GetStrValue(iter->name);
+			result += iter->text;
+			continue;
+		}
+
+		// Take the version first, a change while reading shows up on the next check
+		iter->version = DataManager::GetVariableVersion(iter->varId);
+		std::string value;
+		if (DataManager::GetValue(iter->varId, value) == 0)
+			result += value;
+	}
+	return result;
+}
+
+void TextTemplate::GetVariables(std::vector<std::string>& vars) const
+{
+	for (std::vector<Segment>::const_iterator iter = mSegments.begin(); iter != mSegments.end(); ++iter)
+	{
+		if (iter->varId >= 0)
+			vars.push_back(DataManager::GetVariableName(iter->varId));
+		else if (!iter->name.empty())
+			vars.push_back(iter->name);
+	}
+}
+
 GUIText::GUIText(xml_node<>* node)
 	: GUIObject(node)
 {
@@ -92,9 +202,9 @@ GUIText::GUIText(xml_node<>* node)
 		}
 	}
 
-	// Simple way to check for static state
-	mLastValue = gui_parse_text(mText);
-	if (mLastValue != mText)   mIsStatic = 0;
+	mTemplate.Compile(mText);
+	mIsStatic = mTemplate.IsStatic();
+	mLastValue = mTemplate.Evaluate();
 
 	mFontHeight = mFont->GetHeight();
 }
@@ -110,7 +220,7 @@ int GUIText::Render(void)
 	else
 		return -1;
 
-	mLastValue = gui_parse_text(mText);
+	mLastValue = mTemplate.Evaluate();
 
 	mVarChanged = 0;
 
@@ -129,20 +239,13 @@ int GUIText::Update(void)
 	if (!isConditionTrue())
 		return 0;
 
-	static int updateCounter = 3;
-
-	// This hack just makes sure we update at least once a minute for things like clock and battery
-	if (updateCounter)  updateCounter--;
-	else
-	{
-		mVarChanged = 1;
-		updateCounter = 3;
-	}
-
-	if (mIsStatic || !mVarChanged)
+	// Clock, battery and the like are sampled by the DataManager, so checking the
+	// versions is enough to catch them too
+	if (mIsStatic || (!mVarChanged && !mTemplate.Changed()))
 		return 0;
 
-	std::string newValue = gui_parse_text(mText);
+	mVarChanged = 0;
+	std::string newValue = mTemplate.Evaluate();
 	if (mLastValue == newValue)
 		return 0;
 	else
@@ -158,7 +261,7 @@ int GUIText::GetCurrentBounds(int& w, int& h)
 		fontResource = mFont->GetResource();
 
 	h = mFontHeight;
-	mLastValue = gui_parse_text(mText);
+	mLastValue = mTemplate.Evaluate();
 	w = gr_ttf_measureEx(mLastValue.c_str(), fontResource);
 	return 0;
 }
@@ -167,7 +270,9 @@ int GUIText::NotifyVarChange(const std::string& varName, const std::string& valu
 {
 	GUIObject::NotifyVarChange(varName, value);
 
-	mVarChanged = 1;
+	// Variables in the text are picked up through their versions in Update
+	if (varName.empty())
+		mVarChanged = 1;
 	return 0;
 }
 
@@ -183,4 +288,7 @@ int GUIText::SetMaxWidth(unsigned width)
 void GUIText::SetText(string newtext)
 {
 	mText = newtext;
+	mTemplate.Compile(mText);
+	mIsStatic = mTemplate.IsStatic();
+	mVarChanged = 1;
 }
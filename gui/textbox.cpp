@@ -97,6 +97,16 @@ void GUITextBox::NotifySelect(size_t item_selected __unused)
 	// do nothing - textbox ignores selections
 }
 
+bool GUITextBox::GetNotifyVariables(std::vector<std::string>& vars)
+{
+	GUIScrollList::GetNotifyVariables(vars);
+	if (!mIsStatic) {
+		for (size_t i = 0; i < mText.size(); i++)
+			gui_parse_text_variables(mText.at(i), vars);
+	}
+	return true;
+}
+
 int GUITextBox::NotifyVarChange(const std::string& varName, const std::string& value)
 {
 	GUIScrollList::NotifyVarChange(varName, value);
@@ -14,4 +14,11 @@ LOCAL_MODULE := libcrecovery
 LOCAL_MODULE_TAGS := eng
 include $(BUILD_SHARED_LIBRARY)
 
+include $(CLEAR_VARS)
+LOCAL_SRC_FILES := system.c popen.c
+LOCAL_MODULE := libcrecovery
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_HOST_OS := linux
+include $(BUILD_HOST_STATIC_LIBRARY)
+
 endif
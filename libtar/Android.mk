@@ -41,3 +41,20 @@ ifeq ($(TW_INCLUDE_CRYPTO_FBE), true)
 endif
 
 include $(BUILD_STATIC_LIBRARY)
+
+# Build host static library, used by the backup benchmark
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := libtar_static
+LOCAL_MODULE_TAGS := optional
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_SRC_FILES := append.c block.c decode.c encode.c extract.c handle.c output.c util.c wrapper.c basename.c strmode.c libtar_hash.c libtar_list.c dirname.c android_utils.c strlcpy.c
+LOCAL_CFLAGS += -D_GNU_SOURCE
+LOCAL_C_INCLUDES += $(LOCAL_PATH) \
+                    external/zlib
+LOCAL_STATIC_LIBRARIES += libz
+
+LOCAL_C_INCLUDES += external/libselinux/include
+LOCAL_STATIC_LIBRARIES += libselinux
+
+include $(BUILD_HOST_STATIC_LIBRARY)
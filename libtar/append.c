@@ -22,7 +22,6 @@
 #include <sys/types.h>
 #include <stdbool.h>
 
-#include <sys/capability.h>
 #include <sys/xattr.h>
 #include <linux/xattr.h>
 
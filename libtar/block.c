@@ -12,6 +12,7 @@
 
 #include <internal.h>
 #include <errno.h>
+#include <stdio.h>
 
 #ifdef STDC_HEADERS
 # include <string.h>
@@ -21,7 +21,6 @@
 #include <errno.h>
 #include <utime.h>
 
-#include <sys/capability.h>
 #include <sys/xattr.h>
 #include <linux/xattr.h>
 
@@ -5,6 +5,7 @@ include $(CLEAR_VARS)
 LOCAL_SRC_FILES := \
     graphics.cpp \
     graphics_fbdev.cpp \
+    graphics_kernels.cpp \
     resources.cpp \
     truetype.cpp \
     graphics_utils.cpp \
@@ -41,6 +42,16 @@ else
   endif
 endif
 
+# The NEON pixel kernels are picked at run time, ARMv7 CPUs may lack NEON
+ifeq ($(TARGET_ARCH), arm)
+  LOCAL_CFLAGS += -DHAS_NEON_KERNELS
+  LOCAL_SRC_FILES += graphics_kernels_neon.cpp.neon
+endif
+ifeq ($(TARGET_ARCH), arm64)
+  LOCAL_CFLAGS += -DHAS_NEON_KERNELS
+  LOCAL_SRC_FILES += graphics_kernels_neon.cpp
+endif
+
 ifeq ($(TW_NEW_ION_HEAP), true)
   LOCAL_CFLAGS += -DNEW_ION_HEAP
 endif
@@ -191,3 +202,23 @@ LOCAL_MODULE_TAGS := eng
 LOCAL_MODULE := libminuitwrp
 
 include $(BUILD_SHARED_LIBRARY)
+
+# Compares the pixel kernels with pixelflinger, not part of the recovery image
+include $(CLEAR_VARS)
+LOCAL_MODULE := minuitwrp_kernels_benchmark
+LOCAL_MODULE_TAGS := optional
+LOCAL_SRC_FILES := \
+    graphics_kernels.cpp \
+    graphics_kernels_benchmark.cpp
+ifeq ($(TARGET_ARCH), arm)
+  LOCAL_CFLAGS += -DHAS_NEON_KERNELS
+  LOCAL_SRC_FILES += graphics_kernels_neon.cpp.neon
+endif
+ifeq ($(TARGET_ARCH), arm64)
+  LOCAL_CFLAGS += -DHAS_NEON_KERNELS
+  LOCAL_SRC_FILES += graphics_kernels_neon.cpp
+endif
+LOCAL_C_INCLUDES += system/core/include
+LOCAL_STATIC_LIBRARIES := libpixelflinger_twrp
+LOCAL_SHARED_LIBRARIES := libc libcutils libutils liblog
+include $(BUILD_EXECUTABLE)
@@ -35,6 +35,7 @@
 #include "../gui/placement.h"
 #include "minui.h"
 #include "graphics.h"
+#include "graphics_kernels.h"
 
 struct GRFont {
     GRSurface* texture;
@@ -58,6 +59,84 @@ static GGLContext *gr_context = 0;
 GGLSurface gr_mem_surface;
 static int gr_is_curr_clr_opaque = 0;
 
+// Rows drawn since the last flip, only those are copied to the scanout buffers
+static gr_rows gr_dirty = { 0, 0 };
+
+// Set by gr_init when gr_draw is in a format the pixel kernels draw into,
+// otherwise everything is drawn by pixelflinger
+static const gr_kernels* gr_kern = NULL;
+// gr_draw has blue in the low byte
+static bool gr_draw_bgra = false;
+// The current color as handed to pixelflinger, red in the low byte
+static uint32_t gr_current_color = 0xffffffff;
+
+static bool gr_clip_enabled = false;
+static int gr_clip_x0, gr_clip_y0, gr_clip_x1, gr_clip_y1;
+
+void gr_rows_add(gr_rows* rows, int y0, int y1)
+{
+    if (y0 >= y1)
+        return;
+    if (rows->y0 >= rows->y1) {
+        rows->y0 = y0;
+        rows->y1 = y1;
+        return;
+    }
+    if (y0 < rows->y0)
+        rows->y0 = y0;
+    if (y1 > rows->y1)
+        rows->y1 = y1;
+}
+
+void gr_mark_rows(int y0, int y1)
+{
+    if (!gr_draw)
+        return;
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 > gr_draw->height)
+        y1 = gr_draw->height;
+    gr_rows_add(&gr_dirty, y0, y1);
+}
+
+void gr_copy_rows(const GRSurface* src, GRSurface* dst, int y0, int y1,
+                  bool swap_rb, bool rotate)
+{
+    if (y0 < 0)
+        y0 = 0;
+    if (y1 > src->height)
+        y1 = src->height;
+    if (y0 >= y1)
+        return;
+
+    if (!swap_rb && !rotate) {
+        memcpy(dst->data + y0 * dst->row_bytes, src->data + y0 * src->row_bytes,
+               (y1 - y0) * src->row_bytes);
+        return;
+    }
+
+    for (int y = y0; y < y1; ++y) {
+        const unsigned char* s = src->data + y * src->row_bytes;
+        unsigned char* d = dst->data + (rotate ? src->height - y - 1 : y) * dst->row_bytes;
+        if (src->pixel_bytes == 4) {
+            const uint32_t* sp = reinterpret_cast<const uint32_t*>(s);
+            uint32_t* dp = reinterpret_cast<uint32_t*>(d);
+            if (rotate)
+                gr_kernels_get()->reverse_32(dp, sp, src->width, swap_rb);
+            else
+                gr_kernels_get()->copy_32(dp, sp, src->width, swap_rb, 0);
+        } else if (rotate) {
+            // 16 bit formats have no byte order to swap
+            const uint16_t* sp = reinterpret_cast<const uint16_t*>(s) + src->width;
+            uint16_t* dp = reinterpret_cast<uint16_t*>(d);
+            for (int x = 0; x < src->width; ++x)
+                *(dp++) = *(--sp);
+        } else {
+            memcpy(d, s, src->width * src->pixel_bytes);
+        }
+    }
+}
+
 int gr_textEx_scaleW(int x, int y, const char *s, void* pFont, int max_width, int placement, int scale)
 {
     GGLContext *gl = gr_context;
@@ -113,6 +192,12 @@ void gr_clip(int x, int y, int w, int h)
     GGLContext *gl = gr_context;
     gl->scissor(gl, x, y, w, h);
     gl->enable(gl, GGL_SCISSOR_TEST);
+
+    gr_clip_enabled = true;
+    gr_clip_x0 = x;
+    gr_clip_y0 = y;
+    gr_clip_x1 = x + w;
+    gr_clip_y1 = y + h;
 }
 
 void gr_noclip()
@@ -120,12 +205,47 @@ void gr_noclip()
     GGLContext *gl = gr_context;
     gl->scissor(gl, 0, 0, gr_fb_width(), gr_fb_height());
     gl->disable(gl, GGL_SCISSOR_TEST);
+
+    gr_clip_enabled = false;
+}
+
+// Limits a rectangle to gr_draw and to the clip rectangle, as pixelflinger's
+// scissor test does. Returns false if nothing of it is left.
+static bool gr_clip_rect(int* x0, int* y0, int* x1, int* y1)
+{
+    int left = 0, top = 0, right = gr_draw->width, bottom = gr_draw->height;
+
+    if (gr_clip_enabled) {
+        if (gr_clip_x0 > left)
+            left = gr_clip_x0;
+        if (gr_clip_y0 > top)
+            top = gr_clip_y0;
+        if (gr_clip_x1 < right)
+            right = gr_clip_x1;
+        if (gr_clip_y1 < bottom)
+            bottom = gr_clip_y1;
+    }
+    if (*x0 < left)
+        *x0 = left;
+    if (*y0 < top)
+        *y0 = top;
+    if (*x1 > right)
+        *x1 = right;
+    if (*y1 > bottom)
+        *y1 = bottom;
+    return *x0 < *x1 && *y0 < *y1;
+}
+
+static inline uint8_t* gr_draw_pixel(int x, int y)
+{
+    return gr_draw->data + y * gr_draw->row_bytes + x * gr_draw->pixel_bytes;
 }
 
 void gr_line(int x0, int y0, int x1, int y1, int width)
 {
     GGLContext *gl = gr_context;
 
+    gr_mark_rows((y0 < y1 ? y0 : y1) - width, (y0 > y1 ? y0 : y1) + width + 1);
     if(gr_is_curr_clr_opaque)
         gl->disable(gl, GGL_BLEND);
 
@@ -184,11 +304,18 @@ void gr_color(unsigned char r, unsigned char g, unsigned char b, unsigned char a
 #endif
     gl->color4xv(gl, color);
 
+#if defined(RECOVERY_ABGR) || defined(RECOVERY_BGRA)
+    gr_current_color = b | (g << 8) | (r << 16) | ((uint32_t)a << 24);
+#else
+    gr_current_color = r | (g << 8) | (b << 16) | ((uint32_t)a << 24);
+#endif
+
     gr_is_curr_clr_opaque = (a == 255);
 }
 
 void gr_clear()
 {
+    gr_mark_rows(0, gr_draw->height);
     if (gr_draw->pixel_bytes == 2) {
         gr_fill(0, 0, gr_fb_width(), gr_fb_height());
         return;
@@ -211,10 +338,41 @@ void gr_clear()
     }
 }
 
+static void gr_fill_kernels(int x0, int y0, int x1, int y1)
+{
+    uint32_t a = gr_current_color >> 24;
+    if (a == 0 || !gr_clip_rect(&x0, &y0, &x1, &y1))
+        return;
+
+    uint32_t px = gr_draw_bgra ? gr_swap_rb(gr_current_color) : gr_current_color;
+    int alpha = a + (a >> 7);
+    int count = x1 - x0;
+    for (int y = y0; y < y1; ++y) {
+        uint8_t* row = gr_draw_pixel(x0, y);
+        if (gr_draw->pixel_bytes == 4) {
+            if (a == 255)
+                gr_kern->fill_32((uint32_t*)row, count, px);
+            else
+                gr_kern->blend_fill_32((uint32_t*)row, count, px, alpha);
+        } else {
+            if (a == 255)
+                gr_kern->fill_16((uint16_t*)row, count, gr_pack_565(px));
+            else
+                gr_kern->blend_fill_16((uint16_t*)row, count, px, alpha);
+        }
+    }
+}
+
 void gr_fill(int x, int y, int w, int h)
 {
     GGLContext *gl = gr_context;
 
+    gr_mark_rows(y, y + h);
+    if (gr_kern) {
+        gr_fill_kernels(x, y, x + w, y + h);
+        return;
+    }
+
     if(gr_is_curr_clr_opaque)
         gl->disable(gl, GGL_BLEND);
 
@@ -224,6 +382,95 @@ void gr_fill(int x, int y, int w, int h)
         gl->enable(gl, GGL_BLEND);
 }
 
+// Returns false for the surface formats and texture coordinates that are left
+// to pixelflinger
+static bool gr_blit_kernels(const GGLSurface* surface, int sx, int sy, int w, int h, int dx, int dy)
+{
+    bool opaque, swap_rb;
+    int src_bytes = 4;
+
+    switch (surface->format) {
+        case GGL_PIXEL_FORMAT_RGBX_8888:
+            opaque = true;
+            swap_rb = gr_draw_bgra;
+            break;
+        case GGL_PIXEL_FORMAT_RGBA_8888:
+            opaque = false;
+            swap_rb = gr_draw_bgra;
+            break;
+        case GGL_PIXEL_FORMAT_BGRA_8888:
+            if (gr_draw->pixel_bytes != 4)
+                return false;
+            opaque = false;
+            swap_rb = !gr_draw_bgra;
+            break;
+        case GGL_PIXEL_FORMAT_RGB_565:
+            if (gr_draw->pixel_bytes != 2)
+                return false;
+            opaque = true;
+            swap_rb = false;
+            src_bytes = 2;
+            break;
+        default:
+            return false;
+    }
+    // pixelflinger repeats the texture past its edges
+    if (sx < 0 || sy < 0 || w < 0 || h < 0 ||
+            sx + w > (int)surface->width || sy + h > (int)surface->height)
+        return false;
+
+    int x0 = dx, y0 = dy, x1 = dx + w, y1 = dy + h;
+    if (!gr_clip_rect(&x0, &y0, &x1, &y1))
+        return true;
+    sx += x0 - dx;
+    sy += y0 - dy;
+
+    int count = x1 - x0;
+    for (int y = y0; y < y1; ++y) {
+        const uint8_t* src = surface->data + ((sy + y - y0) * surface->stride + sx) * src_bytes;
+        uint8_t* dst = gr_draw_pixel(x0, y);
+        if (src_bytes == 2) {
+            memcpy(dst, src, count * 2);
+        } else if (gr_draw->pixel_bytes == 4) {
+            if (opaque)
+                gr_kern->copy_32((uint32_t*)dst, (const uint32_t*)src, count, swap_rb, 0xff000000);
+            else
+                gr_kern->blend_32((uint32_t*)dst, (const uint32_t*)src, count, swap_rb);
+        } else {
+            if (opaque)
+                gr_kern->copy_32_to_16((uint16_t*)dst, (const uint32_t*)src, count);
+            else
+                gr_kern->blend_32_to_16((uint16_t*)dst, (const uint32_t*)src, count);
+        }
+    }
+    return true;
+}
+
+bool gr_draw_mask(const uint8_t* mask, int stride, int x, int y, int w, int h)
+{
+    if (!gr_kern)
+        return false;
+
+    int x0 = x, y0 = y, x1 = x + w, y1 = y + h;
+    if (!gr_clip_rect(&x0, &y0, &x1, &y1))
+        return true;
+
+    // Only the mask's alpha is used, as with pixelflinger's GGL_REPLACE
+    uint32_t px = gr_current_color | 0xff000000;
+    if (gr_draw_bgra)
+        px = gr_swap_rb(px);
+    int count = x1 - x0;
+    for (int row = y0; row < y1; ++row) {
+        const uint8_t* m = mask + (row - y) * stride + (x0 - x);
+        uint8_t* dst = gr_draw_pixel(x0, row);
+        if (gr_draw->pixel_bytes == 4)
+            gr_kern->blend_mask_32((uint32_t*)dst, m, count, px);
+        else
+            gr_kern->blend_mask_16((uint16_t*)dst, m, count, px);
+    }
+    return true;
+}
+
 void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy) {
     if (gr_context == NULL) {
         return;
@@ -232,6 +479,10 @@ void gr_blit(gr_surface source, int sx, int sy, int w, int h, int dx, int dy) {
     GGLContext *gl = gr_context;
     GGLSurface *surface = (GGLSurface*)source;
 
+    gr_mark_rows(dy, dy + h);
+    if (gr_kern && gr_blit_kernels(surface, sx, sy, w, h, dx, dy))
+        return;
+
     if(surface->format == GGL_PIXEL_FORMAT_RGBX_8888)
         gl->disable(gl, GGL_BLEND);
 
@@ -263,7 +514,11 @@ unsigned int gr_get_height(gr_surface surface) {
 }
 
 void gr_flip() {
-    gr_draw = gr_backend->flip(gr_backend);
+    if (gr_backend->flip_rows)
+        gr_draw = gr_backend->flip_rows(gr_backend, gr_dirty.y0, gr_dirty.y1);
+    else
+        gr_draw = gr_backend->flip(gr_backend);
+    gr_dirty.y0 = gr_dirty.y1 = 0;
     // On double buffered back ends, when we flip, we need to tell
     // pixel flinger to draw to the other buffer
     gr_mem_surface.data = (GGLubyte*)gr_draw->data;
@@ -346,6 +601,22 @@ int gr_init(void)
     gl->enable(gl, GGL_BLEND);
     gl->blendFunc(gl, GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA);
 
+    // Fills, blits and text go to the pixel kernels for the formats they
+    // cover, pixelflinger still draws the rest
+    gr_kern = NULL;
+    gr_draw_bgra = false;
+    if (gr_draw->pixel_bytes == 4 && (gr_draw->format == GGL_PIXEL_FORMAT_RGBX_8888 ||
+            gr_draw->format == GGL_PIXEL_FORMAT_RGBA_8888)) {
+        gr_kern = gr_kernels_get();
+    } else if (gr_draw->pixel_bytes == 4 && gr_draw->format == GGL_PIXEL_FORMAT_BGRA_8888) {
+        gr_kern = gr_kernels_get();
+        gr_draw_bgra = true;
+    } else if (gr_draw->pixel_bytes == 2 && gr_draw->format == GGL_PIXEL_FORMAT_RGB_565) {
+        gr_kern = gr_kernels_get();
+    }
+    if (gr_kern)
+        printf("Using %s pixel kernels.\n", gr_kern->name);
+
     gr_flip();
     gr_flip();
 
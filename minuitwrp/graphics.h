@@ -17,6 +17,8 @@
 #ifndef _GRAPHICS_H_
 #define _GRAPHICS_H_
 
+#include <stdint.h>
+
 #include "minui.h"
 
 // TODO: lose the function pointers.
@@ -34,8 +36,32 @@ struct minui_backend {
 
     // Device cleanup when drawing is done.
     void (*exit)(minui_backend*);
+
+    // Optional, used instead of flip() if set: only rows y0 to y1 - 1 of
+    // the drawing surface changed since the last flip.
+    GRSurface* (*flip_rows)(minui_backend*, int y0, int y1);
+};
+
+// A range of rows, y0 to y1 - 1. Empty if y0 >= y1.
+struct gr_rows {
+    int y0;
+    int y1;
 };
 
+// Called by everything that draws into the drawing surface.
+void gr_mark_rows(int y0, int y1);
+
+void gr_rows_add(gr_rows* rows, int y0, int y1);
+
+// Copies rows of the drawing surface into a scanout buffer of the same size,
+// swapping red and blue and/or rotating by 180 degrees on the way.
+void gr_copy_rows(const GRSurface* src, GRSurface* dst, int y0, int y1,
+                  bool swap_rb, bool rotate);
+
+// Draws an A_8 mask in the current color, pixel (0, 0) of the mask at x, y.
+// Returns false if pixelflinger has to draw it.
+bool gr_draw_mask(const uint8_t* mask, int stride, int x, int y, int w, int h);
+
 minui_backend* open_fbdev();
 minui_backend* open_adf();
 minui_backend* open_drm();
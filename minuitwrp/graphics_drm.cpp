@@ -16,6 +16,7 @@
 
 #include <drm_fourcc.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -43,6 +44,10 @@ struct drm_surface {
 static drm_surface *drm_surfaces[2];
 static int current_buffer;
 static GRSurface *draw_buf = NULL;
+// Rows each scanout buffer is missing from draw_buf
+static gr_rows stale_rows[2];
+// A page flip was queued and its completion event has not been seen yet
+static bool flip_pending;
 
 static drmModeCrtc *main_monitor_crtc;
 static drmModeConnector *main_monitor_connector;
@@ -75,7 +80,41 @@ static void drm_enable_crtc(int drm_fd, drmModeCrtc *crtc,
         printf("drmModeSetCrtc failed ret=%d\n", ret);
 }
 
+static void drm_page_flip_handler(int fd __unused, unsigned int frame __unused,
+                                  unsigned int sec __unused, unsigned int usec __unused,
+                                  void *data __unused) {
+    flip_pending = false;
+}
+
+// The buffer that was on screen before the last flip may still be scanned out
+// until that flip completes, so it must not be written to before then.
+static void drm_wait_for_flip() {
+    drmEventContext evctx;
+    struct pollfd pfd;
+
+    memset(&evctx, 0, sizeof(evctx));
+    evctx.version = 2;
+    evctx.page_flip_handler = drm_page_flip_handler;
+    pfd.fd = drm_fd;
+    pfd.events = POLLIN;
+
+    while (flip_pending) {
+        pfd.revents = 0;
+        int ret = poll(&pfd, 1, 100);
+        if (ret <= 0) {
+            if (ret == 0)
+                printf("timed out waiting for drm page flip\n");
+            else
+                perror("poll for drm page flip failed");
+            flip_pending = false;
+            break;
+        }
+        drmHandleEvent(drm_fd, &evctx);
+    }
+}
+
 static void drm_blank(minui_backend* backend __unused, bool blank) {
+    drm_wait_for_flip();
     if (blank)
         drm_disable_crtc(drm_fd, main_monitor_crtc);
     else
@@ -474,29 +513,48 @@ static GRSurface* drm_init(minui_backend* backend __unused) {
     }
 
     current_buffer = 0;
+    flip_pending = false;
+    stale_rows[0].y0 = stale_rows[1].y0 = 0;
+    stale_rows[0].y1 = stale_rows[1].y1 = draw_buf->height;
 
     drm_enable_crtc(drm_fd, main_monitor_crtc, drm_surfaces[1]);
 
     return draw_buf;
 }
 
-static GRSurface* drm_flip(minui_backend* backend __unused) {
+// Queues the flip and returns right away, the next flip waits for it to complete
+// before it writes to the buffer that was on screen. Only the rows drawn since a
+// buffer was last brought up to date are copied to it.
+static GRSurface* drm_flip_rows(minui_backend* backend __unused, int y0, int y1) {
     int ret;
-    memcpy(drm_surfaces[current_buffer]->base.data,
-            draw_buf->data, draw_buf->height * draw_buf->row_bytes);
 
+    gr_rows_add(&stale_rows[0], y0, y1);
+    gr_rows_add(&stale_rows[1], y0, y1);
+
+    drm_wait_for_flip();
+    gr_copy_rows(draw_buf, &drm_surfaces[current_buffer]->base,
+                 stale_rows[current_buffer].y0, stale_rows[current_buffer].y1,
+                 false, false);
+    stale_rows[current_buffer].y0 = stale_rows[current_buffer].y1 = 0;
 
     ret = drmModePageFlip(drm_fd, main_monitor_crtc->crtc_id,
-                          drm_surfaces[current_buffer]->fb_id, 0, NULL);
+                          drm_surfaces[current_buffer]->fb_id,
+                          DRM_MODE_PAGE_FLIP_EVENT, NULL);
     if (ret < 0) {
         printf("drmModePageFlip failed ret=%d\n", ret);
-        return NULL;
+        return draw_buf;
     }
+    flip_pending = true;
     current_buffer = 1 - current_buffer;
     return draw_buf;
 }
 
+static GRSurface* drm_flip(minui_backend* backend) {
+    return drm_flip_rows(backend, 0, draw_buf->height);
+}
+
 static void drm_exit(minui_backend* backend __unused) {
+    drm_wait_for_flip();
     drm_disable_crtc(drm_fd, main_monitor_crtc);
     drm_destroy_surface(drm_surfaces[0]);
     drm_destroy_surface(drm_surfaces[1]);
@@ -511,6 +569,7 @@ static minui_backend drm_backend = {
     .flip = drm_flip,
     .blank = drm_blank,
     .exit = drm_exit,
+    .flip_rows = drm_flip_rows,
 };
 
 minui_backend* open_drm() {
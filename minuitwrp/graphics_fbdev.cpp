@@ -36,6 +36,7 @@
 
 static GRSurface* fbdev_init(minui_backend*);
 static GRSurface* fbdev_flip(minui_backend*);
+static GRSurface* fbdev_flip_rows(minui_backend*, int y0, int y1);
 static void fbdev_blank(minui_backend*, bool);
 static void fbdev_exit(minui_backend*);
 
@@ -43,6 +44,9 @@ static GRSurface gr_framebuffer[2];
 static bool double_buffered;
 static GRSurface* gr_draw = NULL;
 static int displayed_buffer;
+// Rows each framebuffer is missing from the in-memory surface
+static gr_rows stale_rows[2];
+static bool pan_display;
 
 static fb_var_screeninfo vi;
 static int fb_fd = -1;
@@ -53,6 +57,7 @@ static minui_backend my_backend = {
     .flip = fbdev_flip,
     .blank = fbdev_blank,
     .exit = fbdev_exit,
+    .flip_rows = fbdev_flip_rows,
 };
 
 minui_backend* open_fbdev() {
@@ -101,6 +106,15 @@ static void set_displayed_framebuffer(unsigned n)
     vi.yres_virtual = gr_framebuffer[0].height * 2;
     vi.yoffset = n * gr_framebuffer[0].height;
     vi.bits_per_pixel = gr_framebuffer[0].pixel_bytes * 8;
+    if (pan_display) {
+        // The virtual resolution is set up already, so just move the visible area
+        if (ioctl(fb_fd, FBIOPAN_DISPLAY, &vi) == 0) {
+            displayed_buffer = n;
+            return;
+        }
+        perror("pan failed, falling back to FBIOPUT_VSCREENINFO");
+        pan_display = false;
+    }
     if (ioctl(fb_fd, FBIOPUT_VSCREENINFO, &vi) < 0) {
         perror("active fb swap failed");
 #ifdef TW_FBIOPAN
@@ -270,7 +284,14 @@ static GRSurface* fbdev_init(minui_backend* backend) {
     printf("RECOVERY_BGRA\n");
 #endif
     fb_fd = fd;
+    pan_display = false;
     set_displayed_framebuffer(0);
+#ifdef TW_FBIOPAN
+    // The first flip has set up the virtual resolution, later ones only need to pan
+    pan_display = double_buffered;
+#endif
+    stale_rows[0].y0 = stale_rows[1].y0 = 0;
+    stale_rows[0].y1 = stale_rows[1].y1 = gr_draw->height;
 
     printf("framebuffer: %d (%d x %d)\n", fb_fd, gr_draw->width, gr_draw->height);
 
@@ -282,56 +303,34 @@ static GRSurface* fbdev_init(minui_backend* backend) {
     return gr_draw;
 }
 
-static GRSurface* fbdev_flip(minui_backend* backend __unused) {
+static GRSurface* fbdev_flip(minui_backend* backend) {
+    return fbdev_flip_rows(backend, 0, gr_draw->height);
+}
+
+// Only the rows drawn since they were last brought up to date are copied to a framebuffer.
+// The in-memory surface is left alone, red and blue are swapped and the screen is
+// rotated during the copy.
+static GRSurface* fbdev_flip_rows(minui_backend* backend __unused, int y0, int y1) {
 #if defined(RECOVERY_BGRA)
-    // In case of BGRA, do some byte swapping
-    unsigned int idx;
-    unsigned char tmp;
-    unsigned char* ucfb_vaddr = (unsigned char*)gr_draw->data;
-    for (idx = 0 ; idx < (gr_draw->height * gr_draw->row_bytes);
-            idx += 4) {
-        tmp = ucfb_vaddr[idx];
-        ucfb_vaddr[idx    ] = ucfb_vaddr[idx + 2];
-        ucfb_vaddr[idx + 2] = tmp;
-    }
+    const bool swap_rb = gr_draw->pixel_bytes == 4;
+#else
+    const bool swap_rb = false;
 #endif
-#ifndef BOARD_HAS_FLIPPED_SCREEN
-    if (double_buffered) {
-        // Copy from the in-memory surface to the framebuffer.
-        memcpy(gr_framebuffer[1-displayed_buffer].data, gr_draw->data,
-               gr_draw->height * gr_draw->row_bytes);
-        set_displayed_framebuffer(1-displayed_buffer);
-    } else {
-        // Copy from the in-memory surface to the framebuffer.
-        memcpy(gr_framebuffer[0].data, gr_draw->data,
-               gr_draw->height * gr_draw->row_bytes);
-    }
+#ifdef BOARD_HAS_FLIPPED_SCREEN
+    const bool rotate = true;
 #else
-    int gr_active_fb = 0;
-    if (double_buffered)
-        gr_active_fb = 1-displayed_buffer;
-
-    /* flip buffer 180 degrees for devices with physically inverted screens */
-    unsigned int row_pixels = gr_draw->row_bytes / gr_framebuffer[0].pixel_bytes;
-    if (gr_framebuffer[0].pixel_bytes == 4) {
-        for (unsigned int y = 0; y < gr_draw->height; ++y) {
-            uint32_t* dst = reinterpret_cast<uint32_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
-            uint32_t* src = reinterpret_cast<uint32_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
-            for (unsigned int x = 0; x < gr_draw->width; ++x)
-                *(dst++) = *(--src);
-        }
-    } else {
-        for (unsigned int y = 0; y < gr_draw->height; ++y) {
-            uint16_t* dst = reinterpret_cast<uint16_t*>(gr_framebuffer[gr_active_fb].data) + y * row_pixels;
-            uint16_t* src = reinterpret_cast<uint16_t*>(gr_draw->data) + (gr_draw->height - y - 1) * row_pixels + gr_draw->width;
-            for (unsigned int x = 0; x < gr_draw->width; ++x)
-                 *(dst++) = *(--src);
-        }
-    }
+    const bool rotate = false;
+#endif
+    int gr_active_fb = double_buffered ? 1 - displayed_buffer : 0;
+
+    gr_rows_add(&stale_rows[0], y0, y1);
+    gr_rows_add(&stale_rows[1], y0, y1);
+    gr_copy_rows(gr_draw, &gr_framebuffer[gr_active_fb], stale_rows[gr_active_fb].y0,
+                 stale_rows[gr_active_fb].y1, swap_rb, rotate);
+    stale_rows[gr_active_fb].y0 = stale_rows[gr_active_fb].y1 = 0;
 
     if (double_buffered)
-        set_displayed_framebuffer(1-displayed_buffer);
-#endif
+        set_displayed_framebuffer(gr_active_fb);
     return gr_draw;
 }
 
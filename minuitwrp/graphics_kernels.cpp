@@ -0,0 +1,406 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__arm__) && defined(HAS_NEON_KERNELS)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "graphics_kernels.h"
+
+// (s * alpha + d * (256 - alpha)) >> 8 for all four channels, two at a time
+static inline uint32_t blend_px(uint32_t s, uint32_t d, int alpha) {
+    uint32_t inv = 256 - alpha;
+    uint32_t rb = (((s & 0xff00ff) * alpha + (d & 0xff00ff) * inv) >> 8) & 0xff00ff;
+    uint32_t ag = (((s >> 8) & 0xff00ff) * alpha + ((d >> 8) & 0xff00ff) * inv) & 0xff00ff00;
+    return rb | ag;
+}
+
+static inline int alpha_256(uint32_t a) {
+    return a + (a >> 7);
+}
+
+static void fill_32_c(uint32_t* dst, int count, uint32_t px) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = px;
+}
+
+static void blend_fill_32_c(uint32_t* dst, int count, uint32_t px, int alpha) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = blend_px(px, dst[i], alpha);
+}
+
+static void copy_32_c(uint32_t* dst, const uint32_t* src, int count, bool swap_rb, uint32_t or_mask) {
+    if (swap_rb) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = gr_swap_rb(src[i]) | or_mask;
+    } else if (or_mask) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = src[i] | or_mask;
+    } else {
+        memcpy(dst, src, count * 4);
+    }
+}
+
+static void reverse_32_c(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    const uint32_t* s = src + count;
+    if (swap_rb) {
+        for (int i = 0; i < count; ++i)
+            dst[i] = gr_swap_rb(*(--s));
+    } else {
+        for (int i = 0; i < count; ++i)
+            dst[i] = *(--s);
+    }
+}
+
+static void blend_32_c(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = src[i];
+        uint32_t a = s >> 24;
+        if (a == 0)
+            continue;
+        if (swap_rb)
+            s = gr_swap_rb(s);
+        dst[i] = (a == 255) ? s : blend_px(s, dst[i], alpha_256(a));
+    }
+}
+
+static void blend_mask_32_c(uint32_t* dst, const uint8_t* mask, int count, uint32_t px) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t a = mask[i];
+        if (a == 0)
+            continue;
+        dst[i] = (a == 255) ? px : blend_px(px, dst[i], alpha_256(a));
+    }
+}
+
+static void lerp_32_c(uint32_t* dst, const uint32_t* a, const uint32_t* b, int count, int weight) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = blend_px(b[i], a[i], weight);
+}
+
+static void fill_16_c(uint16_t* dst, int count, uint16_t px) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = px;
+}
+
+static void blend_fill_16_c(uint16_t* dst, int count, uint32_t px, int alpha) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = gr_pack_565(blend_px(px, gr_unpack_565(dst[i]), alpha));
+}
+
+static void copy_32_to_16_c(uint16_t* dst, const uint32_t* src, int count) {
+    for (int i = 0; i < count; ++i)
+        dst[i] = gr_pack_565(src[i]);
+}
+
+static void blend_32_to_16_c(uint16_t* dst, const uint32_t* src, int count) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t s = src[i];
+        uint32_t a = s >> 24;
+        if (a == 0)
+            continue;
+        dst[i] = gr_pack_565((a == 255) ? s : blend_px(s, gr_unpack_565(dst[i]), alpha_256(a)));
+    }
+}
+
+static void blend_mask_16_c(uint16_t* dst, const uint8_t* mask, int count, uint32_t px) {
+    for (int i = 0; i < count; ++i) {
+        uint32_t a = mask[i];
+        if (a == 0)
+            continue;
+        dst[i] = gr_pack_565((a == 255) ? px : blend_px(px, gr_unpack_565(dst[i]), alpha_256(a)));
+    }
+}
+
+static const gr_kernels gr_kernels_c = {
+    "c",
+    fill_32_c,
+    blend_fill_32_c,
+    copy_32_c,
+    reverse_32_c,
+    blend_32_c,
+    blend_mask_32_c,
+    lerp_32_c,
+    fill_16_c,
+    blend_fill_16_c,
+    copy_32_to_16_c,
+    blend_32_to_16_c,
+    blend_mask_16_c,
+};
+
+#if defined(__SSE2__)
+// Four pixels per iteration, the remainder of a row goes to the C loops.
+// 8 bit channels are widened to 16 bits for the multiplications, none of the
+// sums exceed 255 * 256.
+
+static inline __m128i swap_rb_sse2(__m128i v) {
+    const __m128i ag = _mm_set1_epi32((int)0xff00ff00);
+    const __m128i lo = _mm_set1_epi32(0xff);
+    return _mm_or_si128(_mm_and_si128(v, ag),
+                        _mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), lo),
+                                     _mm_slli_epi32(_mm_and_si128(v, lo), 16)));
+}
+
+// s * f + d * (256 - f) >> 8, with f set for each 16 bit channel
+static inline __m128i blend_sse2(__m128i s, __m128i d, __m128i f_lo, __m128i f_hi) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k256 = _mm_set1_epi16(256);
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), f_lo),
+                               _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), _mm_sub_epi16(k256, f_lo)));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), f_hi),
+                               _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), _mm_sub_epi16(k256, f_hi)));
+    return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+// Spreads four 0 to 256 alpha values, one per 32 bit lane, to the channels of
+// the two pixels in each half
+static inline void spread_alpha_sse2(__m128i f, __m128i* f_lo, __m128i* f_hi) {
+    f = _mm_or_si128(f, _mm_slli_epi32(f, 16));
+    *f_lo = _mm_unpacklo_epi32(f, f);
+    *f_hi = _mm_unpackhi_epi32(f, f);
+}
+
+static void fill_32_sse2(uint32_t* dst, int count, uint32_t px) {
+    const __m128i v = _mm_set1_epi32(px);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+        _mm_storeu_si128((__m128i*)(dst + i + 4), v);
+    }
+    fill_32_c(dst + i, count - i, px);
+}
+
+static void blend_fill_32_sse2(uint32_t* dst, int count, uint32_t px, int alpha) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sc = _mm_mullo_epi16(_mm_unpacklo_epi8(_mm_set1_epi32(px), zero), _mm_set1_epi16(alpha));
+    const __m128i inv = _mm_set1_epi16(256 - alpha);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        __m128i lo = _mm_add_epi16(sc, _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), inv));
+        __m128i hi = _mm_add_epi16(sc, _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), inv));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+    }
+    blend_fill_32_c(dst + i, count - i, px, alpha);
+}
+
+static void copy_32_sse2(uint32_t* dst, const uint32_t* src, int count, bool swap_rb, uint32_t or_mask) {
+    if (!swap_rb && !or_mask) {
+        memcpy(dst, src, count * 4);
+        return;
+    }
+    const __m128i m = _mm_set1_epi32(or_mask);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        if (swap_rb)
+            v = swap_rb_sse2(v);
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(v, m));
+    }
+    copy_32_c(dst + i, src + i, count - i, swap_rb, or_mask);
+}
+
+static void reverse_32_sse2(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + count - i - 4));
+        v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+        if (swap_rb)
+            v = swap_rb_sse2(v);
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    }
+    reverse_32_c(dst + i, src, count - i, swap_rb);
+}
+
+static void blend_32_sse2(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i opaque = _mm_set1_epi32(255);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i a = _mm_srli_epi32(s, 24);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xffff)
+            continue;
+        if (swap_rb)
+            s = swap_rb_sse2(s);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, opaque)) == 0xffff) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+        __m128i f_lo, f_hi;
+        spread_alpha_sse2(_mm_add_epi32(a, _mm_srli_epi32(a, 7)), &f_lo, &f_hi);
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(s, d, f_lo, f_hi));
+    }
+    blend_32_c(dst + i, src + i, count - i, swap_rb);
+}
+
+static void blend_mask_32_sse2(uint32_t* dst, const uint8_t* mask, int count, uint32_t px) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i s = _mm_set1_epi32(px);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32_t m;
+        memcpy(&m, mask + i, sizeof(m));
+        if (m == 0)
+            continue;
+        if (m == 0xffffffff) {
+            _mm_storeu_si128((__m128i*)(dst + i), s);
+            continue;
+        }
+        __m128i a = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(m), zero), zero);
+        __m128i f_lo, f_hi;
+        spread_alpha_sse2(_mm_add_epi32(a, _mm_srli_epi32(a, 7)), &f_lo, &f_hi);
+        __m128i d = _mm_loadu_si128((const __m128i*)(dst + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(s, d, f_lo, f_hi));
+    }
+    blend_mask_32_c(dst + i, mask + i, count - i, px);
+}
+
+static void lerp_32_sse2(uint32_t* dst, const uint32_t* a, const uint32_t* b, int count, int weight) {
+    const __m128i w = _mm_set1_epi16(weight);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        _mm_storeu_si128((__m128i*)(dst + i), blend_sse2(vb, va, w, w));
+    }
+    lerp_32_c(dst + i, a + i, b + i, count - i, weight);
+}
+
+static void fill_16_sse2(uint16_t* dst, int count, uint16_t px) {
+    const __m128i v = _mm_set1_epi16(px);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        _mm_storeu_si128((__m128i*)(dst + i), v);
+    fill_16_c(dst + i, count - i, px);
+}
+
+// The 565 blends keep to the C loops, converting between the formats costs
+// more than the blend itself
+static const gr_kernels gr_kernels_sse2 = {
+    "sse2",
+    fill_32_sse2,
+    blend_fill_32_sse2,
+    copy_32_sse2,
+    reverse_32_sse2,
+    blend_32_sse2,
+    blend_mask_32_sse2,
+    lerp_32_sse2,
+    fill_16_sse2,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+#endif
+
+// SIMD tables leave the loops they have no version of NULL
+static void fill_missing(gr_kernels* k) {
+#define FILL(f) if (!k->f) k->f = gr_kernels_c.f
+    FILL(fill_32);
+    FILL(blend_fill_32);
+    FILL(copy_32);
+    FILL(reverse_32);
+    FILL(blend_32);
+    FILL(blend_mask_32);
+    FILL(lerp_32);
+    FILL(fill_16);
+    FILL(blend_fill_16);
+    FILL(copy_32_to_16);
+    FILL(blend_32_to_16);
+    FILL(blend_mask_16);
+#undef FILL
+}
+
+static gr_kernels select_kernels() {
+    gr_kernels k = gr_kernels_c;
+#if defined(HAS_NEON_KERNELS)
+#if defined(__arm__)
+    // NEON is optional on ARMv7
+    if (getauxval(AT_HWCAP) & HWCAP_NEON)
+#endif
+        k = gr_kernels_neon;
+#elif defined(__SSE2__)
+    k = gr_kernels_sse2;
+#endif
+    fill_missing(&k);
+    return k;
+}
+
+const gr_kernels* gr_kernels_get() {
+    static const gr_kernels kernels = select_kernels();
+    return &kernels;
+}
+
+const gr_kernels* gr_kernels_generic() {
+    return &gr_kernels_c;
+}
+
+// Source position of the center of dst pixel i in 16.16, clamped to the image
+static inline int scale_pos(int i, int src_len, int dst_len) {
+    int64_t pos = ((int64_t)(2 * i + 1) * src_len << 16) / (2 * dst_len) - 0x8000;
+    if (pos < 0)
+        return 0;
+    if (pos > (int64_t)(src_len - 1) << 16)
+        return (src_len - 1) << 16;
+    return (int)pos;
+}
+
+static void scale_row_32(uint32_t* dst, int dst_w, const uint32_t* src, int src_w) {
+    for (int x = 0; x < dst_w; ++x) {
+        int pos = scale_pos(x, src_w, dst_w);
+        int x0 = pos >> 16;
+        int x1 = (x0 + 1 < src_w) ? x0 + 1 : x0;
+        dst[x] = blend_px(src[x1], src[x0], (pos >> 8) & 0xff);
+    }
+}
+
+void gr_kernels_scale_32(const gr_kernels* k,
+                         const uint8_t* src, int src_w, int src_h, int src_row_bytes,
+                         uint8_t* dst, int dst_w, int dst_h, int dst_row_bytes,
+                         uint32_t* tmp) {
+    // The two source rows of the current output row, scaled horizontally.
+    // Going down the image, each source row is scaled only once.
+    uint32_t* rows[2] = { tmp, tmp + dst_w };
+    int row_y[2] = { -1, -1 };
+
+    for (int y = 0; y < dst_h; ++y) {
+        int pos = scale_pos(y, src_h, dst_h);
+        int y0 = pos >> 16;
+        int y1 = (y0 + 1 < src_h) ? y0 + 1 : y0;
+        int want[2] = { y0, y1 };
+
+        for (int n = 0; n < 2; ++n) {
+            if (row_y[0] == want[n] || row_y[1] == want[n])
+                continue;
+            int slot = (row_y[0] == want[1 - n]) ? 1 : 0;
+            scale_row_32(rows[slot], dst_w, (const uint32_t*)(src + want[n] * src_row_bytes), src_w);
+            row_y[slot] = want[n];
+        }
+        k->lerp_32((uint32_t*)(dst + y * dst_row_bytes),
+                   rows[row_y[0] == y0 ? 0 : 1], rows[row_y[0] == y1 ? 0 : 1],
+                   dst_w, (pos >> 8) & 0xff);
+    }
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _GRAPHICS_KERNELS_H_
+#define _GRAPHICS_KERNELS_H_
+
+#include <stdint.h>
+
+// Row loops used instead of pixelflinger for the common drawing operations.
+//
+// 32 bit pixels are handled as four bytes, red in the low byte and alpha in
+// the high byte. swap_rb swaps red and blue of the source on the way, for
+// drawing RGBA images into a BGRA surface. Blending is the one used by the
+// GUI, src * alpha + dst * (1 - alpha), and applies to all four channels.
+// alpha is 0 to 256 where blending takes one, 8 bit alpha a is
+// a + (a >> 7).
+//
+// 16 bit pixels are RGB_565 with red in the high bits.
+struct gr_kernels {
+    const char* name;
+
+    void (*fill_32)(uint32_t* dst, int count, uint32_t px);
+    void (*blend_fill_32)(uint32_t* dst, int count, uint32_t px, int alpha);
+    // Sets the bits of or_mask in each pixel, 0xff000000 makes them opaque
+    void (*copy_32)(uint32_t* dst, const uint32_t* src, int count, bool swap_rb, uint32_t or_mask);
+    // Copies src into dst in reverse order, dst[0] = src[count - 1]
+    void (*reverse_32)(uint32_t* dst, const uint32_t* src, int count, bool swap_rb);
+    // Blends with the alpha of each source pixel
+    void (*blend_32)(uint32_t* dst, const uint32_t* src, int count, bool swap_rb);
+    // Blends px with the 8 bit alpha values of an A_8 mask
+    void (*blend_mask_32)(uint32_t* dst, const uint8_t* mask, int count, uint32_t px);
+    // dst = a * (256 - weight) + b * weight, for the vertical pass of scaling
+    void (*lerp_32)(uint32_t* dst, const uint32_t* a, const uint32_t* b, int count, int weight);
+
+    void (*fill_16)(uint16_t* dst, int count, uint16_t px);
+    void (*blend_fill_16)(uint16_t* dst, int count, uint32_t px, int alpha);
+    void (*copy_32_to_16)(uint16_t* dst, const uint32_t* src, int count);
+    void (*blend_32_to_16)(uint16_t* dst, const uint32_t* src, int count);
+    void (*blend_mask_16)(uint16_t* dst, const uint8_t* mask, int count, uint32_t px);
+};
+
+// The fastest kernels this CPU supports, chosen on the first call
+const gr_kernels* gr_kernels_get();
+
+// The portable C kernels, always available
+const gr_kernels* gr_kernels_generic();
+
+// Bilinear scaling of a 32 bit image, rows are row_bytes apart. Uses tmp,
+// 2 * dst_w pixels, for horizontally scaled source rows.
+void gr_kernels_scale_32(const gr_kernels* k,
+                         const uint8_t* src, int src_w, int src_h, int src_row_bytes,
+                         uint8_t* dst, int dst_w, int dst_h, int dst_row_bytes,
+                         uint32_t* tmp);
+
+static inline uint32_t gr_swap_rb(uint32_t px) {
+    return (px & 0xff00ff00) | ((px >> 16) & 0xff) | ((px & 0xff) << 16);
+}
+
+static inline uint16_t gr_pack_565(uint32_t px) {
+    return ((px & 0xf8) << 8) | ((px & 0xfc00) >> 5) | ((px & 0xf80000) >> 19);
+}
+
+static inline uint32_t gr_unpack_565(uint16_t px) {
+    uint32_t r = (px >> 11) & 0x1f, g = (px >> 5) & 0x3f, b = px & 0x1f;
+    return ((r << 3) | (r >> 2)) | (((g << 2) | (g >> 4)) << 8) |
+           (((b << 3) | (b >> 2)) << 16) | 0xff000000;
+}
+
+#ifdef HAS_NEON_KERNELS
+// In graphics_kernels_neon.cpp, the only file built with NEON enabled on arm
+extern const gr_kernels gr_kernels_neon;
+#endif
+
+#endif
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Times pixelflinger and the pixel kernels drawing the same things into a
+// memory surface, for each framebuffer format the kernels cover:
+//
+//   minuitwrp_kernels_benchmark [width height]
+//
+// The kernels are timed twice, the portable C loops and the ones picked for
+// this CPU.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pixelflinger/pixelflinger.h>
+#include "graphics_kernels.h"
+
+#define BENCH_MS 300
+
+static double now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Average time of one call, after one call to warm up
+template <typename F>
+static double time_ms(F f) {
+    f();
+    int iterations = 0;
+    double start = now_ms(), end;
+    do {
+        f();
+        ++iterations;
+        end = now_ms();
+    } while (end - start < BENCH_MS);
+    return (end - start) / iterations;
+}
+
+static GGLSurface* make_surface(int width, int height, int format, int bytes) {
+    GGLSurface* surface = (GGLSurface*)calloc(1, sizeof(GGLSurface));
+    surface->version = sizeof(*surface);
+    surface->width = width;
+    surface->height = height;
+    surface->stride = width;
+    surface->format = format;
+    surface->data = (GGLubyte*)malloc(width * height * bytes);
+    for (int i = 0; i < width * height * bytes; ++i)
+        surface->data[i] = rand();
+    return surface;
+}
+
+static void free_surface(GGLSurface* surface) {
+    free(surface->data);
+    free(surface);
+}
+
+static GGLContext* pf_init(GGLSurface* dst) {
+    GGLContext* gl;
+    gglInit(&gl);
+    gl->colorBuffer(gl, dst);
+    gl->activeTexture(gl, 0);
+    gl->enable(gl, GGL_BLEND);
+    gl->blendFunc(gl, GGL_SRC_ALPHA, GGL_ONE_MINUS_SRC_ALPHA);
+    return gl;
+}
+
+// The calls gr_color, gr_fill, gr_blit and gr_ttf_textExWH make
+static void pf_color(GGLContext* gl, uint32_t px) {
+    GGLint color[4];
+    for (int c = 0; c < 4; ++c) {
+        uint32_t v = (px >> (c * 8)) & 0xff;
+        color[c] = ((v << 8) | v) + 1;
+    }
+    gl->color4xv(gl, color);
+}
+
+static void pf_fill(GGLContext* gl, int w, int h, bool opaque) {
+    if (opaque)
+        gl->disable(gl, GGL_BLEND);
+    gl->recti(gl, 0, 0, w, h);
+    if (opaque)
+        gl->enable(gl, GGL_BLEND);
+}
+
+static void pf_blit(GGLContext* gl, GGLSurface* src) {
+    if (src->format == GGL_PIXEL_FORMAT_RGBX_8888)
+        gl->disable(gl, GGL_BLEND);
+    gl->bindTexture(gl, src);
+    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
+    gl->enable(gl, GGL_TEXTURE_2D);
+    gl->texCoord2i(gl, 0, 0);
+    gl->recti(gl, 0, 0, src->width, src->height);
+    gl->disable(gl, GGL_TEXTURE_2D);
+    if (src->format == GGL_PIXEL_FORMAT_RGBX_8888)
+        gl->enable(gl, GGL_BLEND);
+}
+
+// As res_scale_surface does it
+static void pf_scale(GGLSurface* src, GGLSurface* dst) {
+    GGLContext* gl;
+    gglInit(&gl);
+    gl->colorBuffer(gl, dst);
+    gl->activeTexture(gl, 0);
+    gl->enable(gl, GGL_BLEND);
+    gl->blendFunc(gl, GGL_ONE, GGL_ZERO);
+    gl->bindTexture(gl, src);
+    gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MIN_FILTER, GGL_LINEAR);
+    gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_MAG_FILTER, GGL_LINEAR);
+    gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_S, GGL_CLAMP);
+    gl->texParameteri(gl, GGL_TEXTURE_2D, GGL_TEXTURE_WRAP_T, GGL_CLAMP);
+    gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
+    gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    gl->texGeni(gl, GGL_T, GGL_TEXTURE_GEN_MODE, GGL_AUTOMATIC);
+    gl->enable(gl, GGL_TEXTURE_2D);
+    int32_t grad[8];
+    memset(grad, 0, sizeof(grad));
+    grad[1] = (float)src->width / dst->width * 65536;
+    grad[5] = (float)src->height / dst->height * 65536;
+    gl->texCoordGradScale8xv(gl, 0, grad);
+    gl->recti(gl, 0, 0, dst->width, dst->height);
+    gglUninit(gl);
+}
+
+// The row loops of graphics.cpp
+static void k_fill(const gr_kernels* k, GGLSurface* dst, int bytes, uint32_t px) {
+    uint32_t a = px >> 24;
+    int alpha = a + (a >> 7);
+    for (int y = 0; y < (int)dst->height; ++y) {
+        uint8_t* row = dst->data + y * dst->stride * bytes;
+        if (bytes == 4) {
+            if (a == 255)
+                k->fill_32((uint32_t*)row, dst->width, px);
+            else
+                k->blend_fill_32((uint32_t*)row, dst->width, px, alpha);
+        } else {
+            if (a == 255)
+                k->fill_16((uint16_t*)row, dst->width, gr_pack_565(px));
+            else
+                k->blend_fill_16((uint16_t*)row, dst->width, px, alpha);
+        }
+    }
+}
+
+static void k_blit(const gr_kernels* k, GGLSurface* dst, int bytes, GGLSurface* src, bool swap_rb) {
+    bool opaque = src->format == GGL_PIXEL_FORMAT_RGBX_8888;
+    for (int y = 0; y < (int)src->height; ++y) {
+        const uint32_t* s = (const uint32_t*)(src->data + y * src->stride * 4);
+        uint8_t* row = dst->data + y * dst->stride * bytes;
+        if (bytes == 4) {
+            if (opaque)
+                k->copy_32((uint32_t*)row, s, src->width, swap_rb, 0xff000000);
+            else
+                k->blend_32((uint32_t*)row, s, src->width, swap_rb);
+        } else {
+            if (opaque)
+                k->copy_32_to_16((uint16_t*)row, s, src->width);
+            else
+                k->blend_32_to_16((uint16_t*)row, s, src->width);
+        }
+    }
+}
+
+static void k_mask(const gr_kernels* k, GGLSurface* dst, int bytes, GGLSurface* mask, uint32_t px) {
+    for (int y = 0; y < (int)mask->height; ++y) {
+        const uint8_t* m = mask->data + y * mask->stride;
+        uint8_t* row = dst->data + y * dst->stride * bytes;
+        if (bytes == 4)
+            k->blend_mask_32((uint32_t*)row, m, mask->width, px);
+        else
+            k->blend_mask_16((uint16_t*)row, m, mask->width, px);
+    }
+}
+
+static void print_row(const char* what, double pf, double c, double simd) {
+    printf("  %-16s %10.3f %10.3f %10.3f   x%.1f\n", what, pf, c, simd, pf / simd);
+}
+
+static void bench_format(const char* name, int format, int bytes, int width, int height) {
+    const gr_kernels* c = gr_kernels_generic();
+    const gr_kernels* simd = gr_kernels_get();
+    bool swap_rb = format == GGL_PIXEL_FORMAT_BGRA_8888;
+    int img = width < height ? width / 2 : height / 2;
+
+    GGLSurface* dst = make_surface(width, height, format, bytes);
+    GGLSurface* opaque = make_surface(img, img, GGL_PIXEL_FORMAT_RGBX_8888, 4);
+    GGLSurface* alpha = make_surface(img, img, GGL_PIXEL_FORMAT_RGBA_8888, 4);
+    GGLSurface* mask = make_surface(width, 64, GGL_PIXEL_FORMAT_A_8, 1);
+    GGLContext* gl = pf_init(dst);
+
+    printf("%s %dx%d, ms per call   pixelflinger          c %10s\n", name, width, height, simd->name);
+
+    pf_color(gl, 0xff336699);
+    print_row("fill",
+              time_ms([&] { pf_fill(gl, width, height, true); }),
+              time_ms([&] { k_fill(c, dst, bytes, 0xff336699); }),
+              time_ms([&] { k_fill(simd, dst, bytes, 0xff336699); }));
+
+    pf_color(gl, 0x80336699);
+    print_row("fill alpha",
+              time_ms([&] { pf_fill(gl, width, height, false); }),
+              time_ms([&] { k_fill(c, dst, bytes, 0x80336699); }),
+              time_ms([&] { k_fill(simd, dst, bytes, 0x80336699); }));
+
+    print_row("blit opaque",
+              time_ms([&] { pf_blit(gl, opaque); }),
+              time_ms([&] { k_blit(c, dst, bytes, opaque, swap_rb); }),
+              time_ms([&] { k_blit(simd, dst, bytes, opaque, swap_rb); }));
+
+    print_row("blit alpha",
+              time_ms([&] { pf_blit(gl, alpha); }),
+              time_ms([&] { k_blit(c, dst, bytes, alpha, swap_rb); }),
+              time_ms([&] { k_blit(simd, dst, bytes, alpha, swap_rb); }));
+
+    pf_color(gl, 0xffffffff);
+    print_row("text",
+              time_ms([&] { pf_blit(gl, mask); }),
+              time_ms([&] { k_mask(c, dst, bytes, mask, 0xffffffff); }),
+              time_ms([&] { k_mask(simd, dst, bytes, mask, 0xffffffff); }));
+
+    gglUninit(gl);
+    free_surface(mask);
+    free_surface(alpha);
+    free_surface(opaque);
+    free_surface(dst);
+}
+
+static void bench_scale(int width, int height) {
+    int img = width < height ? width / 2 : height / 2;
+    int scaled = img * 3 / 2;
+    GGLSurface* src = make_surface(img, img, GGL_PIXEL_FORMAT_RGBA_8888, 4);
+    GGLSurface* dst = make_surface(scaled, scaled, GGL_PIXEL_FORMAT_RGBA_8888, 4);
+    uint32_t* tmp = (uint32_t*)malloc(2 * scaled * sizeof(uint32_t));
+
+    printf("scale %dx%d to %dx%d\n", img, img, scaled, scaled);
+    print_row("scale",
+              time_ms([&] { pf_scale(src, dst); }),
+              time_ms([&] { gr_kernels_scale_32(gr_kernels_generic(), src->data, img, img, img * 4,
+                                                dst->data, scaled, scaled, scaled * 4, tmp); }),
+              time_ms([&] { gr_kernels_scale_32(gr_kernels_get(), src->data, img, img, img * 4,
+                                                dst->data, scaled, scaled, scaled * 4, tmp); }));
+
+    free(tmp);
+    free_surface(dst);
+    free_surface(src);
+}
+
+int main(int argc, char** argv) {
+    int width = 1080, height = 1920;
+    if (argc == 3) {
+        width = atoi(argv[1]);
+        height = atoi(argv[2]);
+    }
+    if (width < 64 || height < 64) {
+        fprintf(stderr, "usage: %s [width height]\n", argv[0]);
+        return 1;
+    }
+
+    bench_format("RGBX_8888", GGL_PIXEL_FORMAT_RGBX_8888, 4, width, height);
+    bench_format("BGRA_8888", GGL_PIXEL_FORMAT_BGRA_8888, 4, width, height);
+    bench_format("RGB_565", GGL_PIXEL_FORMAT_RGB_565, 2, width, height);
+    bench_scale(width, height);
+    return 0;
+}
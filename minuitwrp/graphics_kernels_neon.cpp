@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "graphics_kernels.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+
+// Eight pixels per iteration where the channels are worked on separately,
+// loaded with vld4 so each register holds one channel. The remainder of a
+// row goes to the C loops.
+
+// (s * f + d * (256 - f)) >> 8 for eight 8 bit values, f is 0 to 256
+static inline uint8x8_t blend_neon(uint8x8_t s, uint8x8_t d, uint16x8_t f, uint16x8_t inv) {
+    return vshrn_n_u16(vmlaq_u16(vmulq_u16(vmovl_u8(s), f), vmovl_u8(d), inv), 8);
+}
+
+static inline uint32x4_t swap_rb_neon(uint32x4_t v) {
+    const uint32x4_t ag = vdupq_n_u32(0xff00ff00);
+    const uint32x4_t lo = vdupq_n_u32(0xff);
+    return vorrq_u32(vandq_u32(v, ag),
+                     vorrq_u32(vandq_u32(vshrq_n_u32(v, 16), lo),
+                               vshlq_n_u32(vandq_u32(v, lo), 16)));
+}
+
+static void fill_32_neon(uint32_t* dst, int count, uint32_t px) {
+    const uint32x4_t v = vdupq_n_u32(px);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        vst1q_u32(dst + i, v);
+        vst1q_u32(dst + i + 4, v);
+    }
+    gr_kernels_generic()->fill_32(dst + i, count - i, px);
+}
+
+static void blend_fill_32_neon(uint32_t* dst, int count, uint32_t px, int alpha) {
+    // The weights have to fit in 8 bits
+    if (alpha <= 0 || alpha >= 256) {
+        gr_kernels_generic()->blend_fill_32(dst, count, px, alpha);
+        return;
+    }
+    const uint8x8_t inv = vdup_n_u8(256 - alpha);
+    const uint8x8_t c = vreinterpret_u8_u32(vdup_n_u32(px));
+    const uint16x8_t sc = vmull_u8(c, vdup_n_u8(alpha));
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t d = vreinterpretq_u8_u32(vld1q_u32(dst + i));
+        uint8x8_t lo = vshrn_n_u16(vmlal_u8(sc, vget_low_u8(d), inv), 8);
+        uint8x8_t hi = vshrn_n_u16(vmlal_u8(sc, vget_high_u8(d), inv), 8);
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vcombine_u8(lo, hi)));
+    }
+    gr_kernels_generic()->blend_fill_32(dst + i, count - i, px, alpha);
+}
+
+static void copy_32_neon(uint32_t* dst, const uint32_t* src, int count, bool swap_rb, uint32_t or_mask) {
+    if (!swap_rb && !or_mask) {
+        memcpy(dst, src, count * 4);
+        return;
+    }
+    const uint32x4_t m = vdupq_n_u32(or_mask);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t v = vld1q_u32(src + i);
+        if (swap_rb)
+            v = swap_rb_neon(v);
+        vst1q_u32(dst + i, vorrq_u32(v, m));
+    }
+    gr_kernels_generic()->copy_32(dst + i, src + i, count - i, swap_rb, or_mask);
+}
+
+static void reverse_32_neon(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint32x4_t v = vrev64q_u32(vld1q_u32(src + count - i - 4));
+        v = vcombine_u32(vget_high_u32(v), vget_low_u32(v));
+        if (swap_rb)
+            v = swap_rb_neon(v);
+        vst1q_u32(dst + i, v);
+    }
+    gr_kernels_generic()->reverse_32(dst + i, src, count - i, swap_rb);
+}
+
+static void blend_32_neon(uint32_t* dst, const uint32_t* src, int count, bool swap_rb) {
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8x4_t s = vld4_u8((const uint8_t*)(src + i));
+        uint64_t a = vget_lane_u64(vreinterpret_u64_u8(s.val[3]), 0);
+        if (a == 0)
+            continue;
+        if (swap_rb) {
+            uint8x8_t t = s.val[0];
+            s.val[0] = s.val[2];
+            s.val[2] = t;
+        }
+        if (a != ~0ULL) {
+            uint16x8_t f = vaddw_u8(vmovl_u8(s.val[3]), vshr_n_u8(s.val[3], 7));
+            uint16x8_t inv = vsubq_u16(vdupq_n_u16(256), f);
+            uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+            for (int c = 0; c < 4; ++c)
+                s.val[c] = blend_neon(s.val[c], d.val[c], f, inv);
+        }
+        vst4_u8((uint8_t*)(dst + i), s);
+    }
+    gr_kernels_generic()->blend_32(dst + i, src + i, count - i, swap_rb);
+}
+
+static void blend_mask_32_neon(uint32_t* dst, const uint8_t* mask, int count, uint32_t px) {
+    const uint8x8_t c0 = vdup_n_u8(px & 0xff);
+    const uint8x8_t c1 = vdup_n_u8((px >> 8) & 0xff);
+    const uint8x8_t c2 = vdup_n_u8((px >> 16) & 0xff);
+    const uint8x8_t c3 = vdup_n_u8(px >> 24);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        uint8x8_t m = vld1_u8(mask + i);
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(m), 0);
+        if (bits == 0)
+            continue;
+        if (bits == ~0ULL) {
+            gr_kernels_generic()->fill_32(dst + i, 8, px);
+            continue;
+        }
+        uint16x8_t f = vaddw_u8(vmovl_u8(m), vshr_n_u8(m, 7));
+        uint16x8_t inv = vsubq_u16(vdupq_n_u16(256), f);
+        uint8x8x4_t d = vld4_u8((const uint8_t*)(dst + i));
+        d.val[0] = blend_neon(c0, d.val[0], f, inv);
+        d.val[1] = blend_neon(c1, d.val[1], f, inv);
+        d.val[2] = blend_neon(c2, d.val[2], f, inv);
+        d.val[3] = blend_neon(c3, d.val[3], f, inv);
+        vst4_u8((uint8_t*)(dst + i), d);
+    }
+    gr_kernels_generic()->blend_mask_32(dst + i, mask + i, count - i, px);
+}
+
+static void lerp_32_neon(uint32_t* dst, const uint32_t* a, const uint32_t* b, int count, int weight) {
+    // The weights have to fit in 8 bits
+    if (weight <= 0 || weight >= 256) {
+        memcpy(dst, weight <= 0 ? a : b, count * 4);
+        return;
+    }
+    const uint8x8_t wb = vdup_n_u8(weight);
+    const uint8x8_t wa = vdup_n_u8(256 - weight);
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t va = vreinterpretq_u8_u32(vld1q_u32(a + i));
+        uint8x16_t vb = vreinterpretq_u8_u32(vld1q_u32(b + i));
+        uint8x8_t lo = vshrn_n_u16(vmlal_u8(vmull_u8(vget_low_u8(va), wa), vget_low_u8(vb), wb), 8);
+        uint8x8_t hi = vshrn_n_u16(vmlal_u8(vmull_u8(vget_high_u8(va), wa), vget_high_u8(vb), wb), 8);
+        vst1q_u32(dst + i, vreinterpretq_u32_u8(vcombine_u8(lo, hi)));
+    }
+    gr_kernels_generic()->lerp_32(dst + i, a + i, b + i, count - i, weight);
+}
+
+static void fill_16_neon(uint16_t* dst, int count, uint16_t px) {
+    const uint16x8_t v = vdupq_n_u16(px);
+    int i = 0;
+    for (; i + 8 <= count; i += 8)
+        vst1q_u16(dst + i, v);
+    gr_kernels_generic()->fill_16(dst + i, count - i, px);
+}
+
+// As with SSE2, the 565 blends keep to the C loops
+const gr_kernels gr_kernels_neon = {
+    "neon",
+    fill_32_neon,
+    blend_fill_32_neon,
+    copy_32_neon,
+    reverse_32_neon,
+    blend_32_neon,
+    blend_mask_32_neon,
+    lerp_32_neon,
+    fill_16_neon,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+};
+#endif
@@ -88,6 +88,11 @@ int ev_has_mouse(void);
 int res_create_surface(const char* name, gr_surface* pSurface);
 void res_free_surface(gr_surface surface);
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h);
+// Surface around pixel data owned by the caller, e.g. a mapped resource cache.
+// res_free_surface frees only the surface, never the data.
+gr_surface res_wrap_surface(int width, int height, int stride, int format, unsigned char* data);
+// Returns the pixel data of a surface and its stride in pixels and pixel format.
+unsigned char* res_surface_data(gr_surface surface, int* stride, int* format);
 
 int vibrate(int timeout_ms);
 
@@ -37,6 +37,7 @@ extern "C" {
 }
 #endif
 #include "minui.h"
+#include "graphics_kernels.h"
 
 #define SURFACE_DATA_ALIGNMENT 8
 
@@ -379,6 +380,28 @@ void res_free_surface(gr_surface surface) {
     }
 }
 
+gr_surface res_wrap_surface(int width, int height, int stride, int format, unsigned char* data) {
+    GGLSurface* surface = reinterpret_cast<GGLSurface*>(malloc(sizeof(GGLSurface)));
+    if (surface == NULL) return NULL;
+
+    surface->version = sizeof(GGLSurface);
+    surface->width = width;
+    surface->height = height;
+    surface->stride = stride;
+    surface->data = data;
+    surface->format = format;
+    return (gr_surface) surface;
+}
+
+unsigned char* res_surface_data(gr_surface surface, int* stride, int* format) {
+    GGLSurface* pSurface = (GGLSurface*) surface;
+    if (!pSurface) return NULL;
+
+    *stride = pSurface->stride;
+    *format = pSurface->format;
+    return pSurface->data;
+}
+
 // Scale image function
 int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w, float scale_h) {
     GGLContext *gl = NULL;
@@ -398,6 +421,22 @@ int res_scale_surface(gr_surface source, gr_surface* destination, float scale_w,
     }
     sc_mem_surface->format = surface->format;
 
+    if (surface->format == GGL_PIXEL_FORMAT_RGBX_8888 ||
+            surface->format == GGL_PIXEL_FORMAT_RGBA_8888 ||
+            surface->format == GGL_PIXEL_FORMAT_BGRA_8888) {
+        uint32_t* tmp = (uint32_t*)malloc(2 * sc_mem_surface->width * sizeof(uint32_t));
+        if (tmp) {
+            gr_kernels_scale_32(gr_kernels_get(),
+                                surface->data, w, h, surface->stride * 4,
+                                sc_mem_surface->data, sc_mem_surface->width,
+                                sc_mem_surface->height, sc_mem_surface->stride * 4, tmp);
+            free(tmp);
+            *destination = (gr_surface*) sc_mem_surface;
+            res_free_surface(source);
+            return 0;
+        }
+    }
+
     // Initialize the context
     gglInit(&gl);
     gl->colorBuffer(gl, sc_mem_surface);
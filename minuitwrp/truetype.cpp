@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include "minui.h"
+#include "graphics.h"
 
 #include <cutils/hashmap.h>
 #include <ft2build.h>
@@ -732,6 +733,13 @@ int gr_ttf_textExWH(void *context, int x, int y, const char *s, void *pFont, int
         }
     }
 
+    gr_mark_rows(y, y_bottom);
+    if(gr_draw_mask(e->surface.data, e->surface.stride, x, y, e->surface.width, y_bottom - y))
+    {
+        pthread_mutex_unlock(&font->mutex);
+        return res;
+    }
+
     gl->bindTexture(gl, &e->surface);
     gl->texEnvi(gl, GGL_TEXTURE_ENV, GGL_TEXTURE_ENV_MODE, GGL_REPLACE);
     gl->texGeni(gl, GGL_S, GGL_TEXTURE_GEN_MODE, GGL_ONE_TO_ONE);
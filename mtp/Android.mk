@@ -21,6 +21,7 @@ LOCAL_SRC_FILES = \
     MtpDevice.cpp \
     MtpDeviceInfo.cpp \
     MtpEventPacket.cpp \
+    MtpHandleIndex.cpp \
     MtpObjectInfo.cpp \
     MtpPacket.cpp \
     MtpProperty.cpp \
@@ -61,6 +62,7 @@ LOCAL_SRC_FILES = \
     MtpDevice.cpp \
     MtpDeviceInfo.cpp \
     MtpEventPacket.cpp \
+    MtpHandleIndex.cpp \
     MtpObjectInfo.cpp \
     MtpPacket.cpp \
     MtpProperty.cpp \
@@ -203,6 +203,16 @@ void MtpDataPacket::putUInt32(uint32_t value) {
 		mPacketSize = mOffset;
 }
 
+int MtpDataPacket::putUInt32Placeholder() {
+	int offset = mOffset;
+	putUInt32(0);
+	return offset;
+}
+
+void MtpDataPacket::fillUInt32Placeholder(int offset, uint32_t value) {
+	MtpPacket::putUInt32(offset, value);
+}
+
 void MtpDataPacket::putInt64(int64_t value) {
 	allocate(mOffset + 8);
 	mBuffer[mOffset++] = (uint8_t)(value & 0xFF);
@@ -94,6 +94,11 @@ public:
     inline void         putEmptyString() { putUInt8(0); }
     inline void         putEmptyArray() { putUInt32(0); }
 
+    // reserves a UINT32 whose value is only known after what follows it has
+    // been written, returns its offset for fillUInt32Placeholder
+    int                 putUInt32Placeholder();
+    void                fillUInt32Placeholder(int offset, uint32_t value);
+
 
 #ifdef MTP_DEVICE
     // fill our buffer with data from the given file descriptor
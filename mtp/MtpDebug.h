@@ -44,6 +44,7 @@ public:
 	static const char* getObjectPropCodeName(MtpPropertyCode code);
 	static const char* getDevicePropCodeName(MtpPropertyCode code);
 	static void enableDebug();
+	static bool isDebugEnabled();
 };
 
 
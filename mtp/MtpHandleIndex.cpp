@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "MtpHandleIndex.hpp"
+#include "MtpDebug.h"
+
+#define INITIAL_CAPACITY 1024	// must be a power of 2
+
+MtpHandleIndex::MtpHandleIndex()
+	: used(0), count(0), shift(0)
+{
+	pthread_mutex_init(&lock, NULL);
+	Entry empty = { EMPTY, NULL, NULL, NULL };
+	table.assign(INITIAL_CAPACITY, empty);
+	setShift();
+}
+
+MtpHandleIndex::~MtpHandleIndex() {
+	pthread_mutex_destroy(&lock);
+}
+
+size_t MtpHandleIndex::slot(MtpObjectHandle handle) const {
+	// Handles are handed out in sequence. Taken as they are, the live ones end
+	// up in one long run that every new handle wrapping around the table would
+	// have to probe across, so scatter them with a multiplicative hash and use
+	// its top bits.
+	return (size_t)((uint32_t)(handle * 2654435769u) >> shift);
+}
+
+// Returns the slot holding handle, or the empty slot that ends its probe sequence
+size_t MtpHandleIndex::lookup(MtpObjectHandle handle) const {
+	size_t mask = table.size() - 1;
+	size_t i = slot(handle);
+	while (table[i].handle != EMPTY && table[i].handle != handle)
+		i = (i + 1) & mask;
+	return i;
+}
+
+void MtpHandleIndex::setShift() {
+	shift = 32;
+	for (size_t n = table.size(); n > 1; n >>= 1)
+		--shift;
+}
+
+void MtpHandleIndex::resize(size_t capacity) {
+	std::vector<Entry> old;
+	old.swap(table);
+	Entry empty = { EMPTY, NULL, NULL, NULL };
+	table.assign(capacity, empty);
+	setShift();
+	used = count;
+	for (size_t i = 0; i < old.size(); ++i) {
+		if (old[i].handle != EMPTY && old[i].handle != DELETED)
+			table[lookup(old[i].handle)] = old[i];
+	}
+}
+
+void MtpHandleIndex::add(MtpObjectHandle handle, MtpStorage* storage, Node* node, Tree* parent) {
+	if (handle == EMPTY || handle == DELETED) {
+		MTPE("MtpHandleIndex::add: not adding invalid handle %u\n", handle);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	// keep at least a quarter of the slots empty so probe sequences stay short
+	if ((used + 1) * 4 > table.size() * 3)
+		resize(count * 2 >= table.size() / 2 ? table.size() * 2 : table.size());
+	size_t i = lookup(handle);
+	if (table[i].handle == EMPTY) {
+		++used;
+		++count;
+	}
+	table[i].handle = handle;
+	table[i].storage = storage;
+	table[i].node = node;
+	table[i].parent = parent;
+	pthread_mutex_unlock(&lock);
+}
+
+void MtpHandleIndex::remove(MtpObjectHandle handle) {
+	if (handle == EMPTY || handle == DELETED)
+		return;
+	pthread_mutex_lock(&lock);
+	size_t i = lookup(handle);
+	if (table[i].handle == handle) {
+		table[i].handle = DELETED;
+		table[i].storage = NULL;
+		table[i].node = NULL;
+		table[i].parent = NULL;
+		--count;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void MtpHandleIndex::removeStorage(MtpStorage* storage) {
+	pthread_mutex_lock(&lock);
+	for (size_t i = 0; i < table.size(); ++i) {
+		if (table[i].storage == storage) {
+			table[i].handle = DELETED;
+			table[i].storage = NULL;
+			table[i].node = NULL;
+			table[i].parent = NULL;
+			--count;
+		}
+	}
+	resize(table.size());
+	pthread_mutex_unlock(&lock);
+}
+
+bool MtpHandleIndex::find(MtpObjectHandle handle, Entry& entry) {
+	if (handle == EMPTY || handle == DELETED)
+		return false;
+	pthread_mutex_lock(&lock);
+	size_t i = lookup(handle);
+	bool found = table[i].handle == handle;
+	if (found)
+		entry = table[i];
+	pthread_mutex_unlock(&lock);
+	return found;
+}
+
+MtpStorage* MtpHandleIndex::findStorage(MtpObjectHandle handle) {
+	Entry entry;
+	if (!find(handle, entry))
+		return NULL;
+	return entry.storage;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef MTPHANDLEINDEX_HPP
+#define MTPHANDLEINDEX_HPP
+
+#include <pthread.h>
+#include <stdint.h>
+#include <vector>
+#include "MtpTypes.h"
+
+class MtpStorage;
+class Node;
+class Tree;
+
+// Maps every object handle on every storage to its node, so per-object
+// operations don't have to search the trees of all storages. Open addressing
+// with linear probing, deleted entries are left as markers until the table is
+// rebuilt.
+//
+// The storages add and remove their nodes as the trees change. The index has
+// its own lock, as the inotify threads of different storages may update it
+// at the same time. The nodes it returns are only safe to use while holding
+// the lock of their storage.
+class MtpHandleIndex {
+public:
+	struct Entry {
+		MtpObjectHandle handle;
+		MtpStorage* storage;
+		Node* node;
+		Tree* parent;
+	};
+
+	MtpHandleIndex();
+	~MtpHandleIndex();
+
+	void add(MtpObjectHandle handle, MtpStorage* storage, Node* node, Tree* parent);
+	void remove(MtpObjectHandle handle);
+	// Drops all entries of a storage that is going away
+	void removeStorage(MtpStorage* storage);
+	bool find(MtpObjectHandle handle, Entry& entry);
+	// The storage of a handle, NULL if the handle is unknown
+	MtpStorage* findStorage(MtpObjectHandle handle);
+
+private:
+	// 0 is the root of each storage, which is not indexed, and 0xffffffff
+	// means all objects, so neither is ever a real handle
+	enum { EMPTY = 0, DELETED = 0xffffffff };
+
+	void setShift();
+	size_t slot(MtpObjectHandle handle) const;
+	size_t lookup(MtpObjectHandle handle) const;
+	void resize(size_t capacity);
+
+	std::vector<Entry> table;
+	size_t used;	// live and deleted slots
+	size_t count;	// live slots
+	int shift;	// 32 - log2 of the table size
+	pthread_mutex_t lock;
+};
+
+#endif
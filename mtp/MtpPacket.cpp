@@ -46,6 +46,14 @@ MtpPacket::~MtpPacket() {
 }
 
 void MtpPacket::reset() {
+	// give back what a large packet needed, rather than clearing it every time
+	if (mBufferSize > mAllocationIncrement) {
+		uint8_t* buffer = (uint8_t *)realloc(mBuffer, mAllocationIncrement);
+		if (buffer) {
+			mBuffer = buffer;
+			mBufferSize = mAllocationIncrement;
+		}
+	}
 	allocate(MTP_CONTAINER_HEADER_SIZE);
 	mPacketSize = MTP_CONTAINER_HEADER_SIZE;
 	memset(mBuffer, 0, mBufferSize);
@@ -53,7 +61,11 @@ void MtpPacket::reset() {
 
 void MtpPacket::allocate(int length) {
 	if (length > mBufferSize) {
+		// grow geometrically so building a large data packet, like a property
+		// list of a big folder, doesn't copy the buffer again every few KB
 		int newLength = length + mAllocationIncrement;
+		if (newLength < mBufferSize * 2)
+			newLength = mBufferSize * 2;
 		mBuffer = (uint8_t *)realloc(mBuffer, newLength);
 		if (!mBuffer) {
 			MTPE("out of memory!");
@@ -68,6 +80,9 @@ void MtpPacket::dump() {
 	char buffer[500];
 	char* bufptr = buffer;
 
+	if (!MtpDebug::isDebugEnabled())
+		return;
+
 	for (size_t i = 0; i < mPacketSize; i++) {
 		sprintf(bufptr, "%02X ", mBuffer[i]);
 		bufptr += strlen(bufptr);
@@ -30,7 +30,8 @@ protected:
     uint8_t*            mBuffer;
     // current size of the buffer
     int                 mBufferSize;
-    // number of bytes to add when resizing the buffer
+    // minimum number of bytes to add when resizing the buffer, also the
+    // size the buffer goes back to on reset
     int                 mAllocationIncrement;
     // size of the data in the packet
     unsigned            mPacketSize;
@@ -18,6 +18,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
@@ -94,6 +95,7 @@ static const MtpEventCode kSupportedEventCodes[] = {
 	MTP_EVENT_STORE_ADDED,
 	MTP_EVENT_STORE_REMOVED,
 	MTP_EVENT_OBJECT_PROP_CHANGED,
+	MTP_EVENT_STORAGE_INFO_CHANGED,
 };
 
 MtpServer::MtpServer(MtpDatabase* database, bool ptp,
@@ -110,9 +112,51 @@ MtpServer::MtpServer(MtpDatabase* database, bool ptp,
 		mSendObjectFileSize(0)
 {
 	mFD = -1;
+	mThreadsExit = false;
+	pthread_mutex_init(&mQueueMutex, NULL);
+	pthread_cond_init(&mEventCond, NULL);
+	pthread_cond_init(&mDeleteCond, NULL);
+	mEventThread = startThread(&MtpServer::eventThread);
+	mDeleteThread = startThread(&MtpServer::deleteThread);
 }
 
 MtpServer::~MtpServer() {
+	pthread_mutex_lock(&mQueueMutex);
+	mThreadsExit = true;
+	pthread_cond_signal(&mEventCond);
+	pthread_cond_signal(&mDeleteCond);
+	pthread_mutex_unlock(&mQueueMutex);
+	// the delete thread finishes what is queued before it exits
+	if (mEventThread)
+		pthread_join(mEventThread, NULL);
+	if (mDeleteThread)
+		pthread_join(mDeleteThread, NULL);
+	pthread_cond_destroy(&mDeleteCond);
+	pthread_cond_destroy(&mEventCond);
+	pthread_mutex_destroy(&mQueueMutex);
+}
+
+pthread_t MtpServer::startThread(ThreadPtr function) {
+	pthread_t thread;
+	pthread_attr_t tattr;
+
+	if (pthread_attr_init(&tattr)) {
+		MTPE("Unable to pthread_attr_init\n");
+		return 0;
+	}
+	if (pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_JOINABLE)) {
+		MTPE("Error setting pthread_attr_setdetachstate\n");
+		return 0;
+	}
+	PThreadPtr p = *(PThreadPtr*)&function;
+	if (pthread_create(&thread, &tattr, p, this)) {
+		MTPE("Unable to start MtpServer thread\n");
+		thread = 0;
+	}
+	if (pthread_attr_destroy(&tattr)) {
+		MTPE("Failed to pthread_attr_destroy\n");
+	}
+	return thread;
 }
 
 void MtpServer::addStorage(MtpStorage* storage) {
@@ -124,6 +168,7 @@ void MtpServer::addStorage(MtpStorage* storage) {
 	}
 	mDatabase->createDB(storage, storage->getStorageID());
 	mStorages.push(storage);
+	queueSweep(storage);
 	sendStoreAdded(storage->getStorageID());
 }
 
@@ -309,14 +354,49 @@ void MtpServer::sendStoreRemoved(MtpStorageID id) {
 }
 
 void MtpServer::sendEvent(MtpEventCode code, uint32_t param1) {
-	MTPD("MtpServer::sendEvent sending event code: %x\n", code);
+	sendEvent(code, param1, mRequest.getTransactionID());
+}
+
+void MtpServer::sendEvent(MtpEventCode code, uint32_t param1, MtpTransactionID transaction) {
+	MTPD("MtpServer::sendEvent queueing event code: %x\n", code);
 	if (mSessionOpen) {
-		mEvent.setEventCode(code);
-		mEvent.setTransactionID(mRequest.getTransactionID());
-		mEvent.setParameter(1, param1);
-		int ret = mEvent.write(mFD);
-		MTPD("mEvent.write returned %d\n", ret);
+		QueuedEvent event;
+		event.code = code;
+		event.param1 = param1;
+		event.transaction = transaction;
+		pthread_mutex_lock(&mQueueMutex);
+		mEventQueue.push_back(event);
+		pthread_cond_signal(&mEventCond);
+		pthread_mutex_unlock(&mQueueMutex);
+	}
+}
+
+int MtpServer::eventThread() {
+	MTPD("MtpServer event thread starting\n");
+	pthread_mutex_lock(&mQueueMutex);
+	while (!mThreadsExit) {
+		if (mEventQueue.empty()) {
+			pthread_cond_wait(&mEventCond, &mQueueMutex);
+			continue;
+		}
+		QueuedEvent event = mEventQueue.front();
+		mEventQueue.pop_front();
+		pthread_mutex_unlock(&mQueueMutex);
+
+		// events raised before a disconnect are of no use to the next session
+		if (mSessionOpen && mFD >= 0) {
+			MTPD("MtpServer::eventThread sending event code: %x\n", event.code);
+			mEvent.setEventCode(event.code);
+			mEvent.setTransactionID(event.transaction);
+			mEvent.setParameter(1, event.param1);
+			int ret = mEvent.write(mFD);
+			MTPD("mEvent.write returned %d\n", ret);
+		}
+		pthread_mutex_lock(&mQueueMutex);
 	}
+	pthread_mutex_unlock(&mQueueMutex);
+	MTPD("MtpServer event thread exiting\n");
+	return 0;
 }
 
 void MtpServer::addEditObject(MtpObjectHandle handle, MtpString& path,
@@ -1216,13 +1296,147 @@ MtpResponseCode MtpServer::doDeleteObject() {
 		result = mDatabase->deleteFile(handle);
 		// Don't delete the actual files unless the database deletion is allowed
 		if (result == MTP_RESPONSE_OK) {
-			deletePath((const char *)filePath);
+			queueDelete(handle, (const char *)filePath);
 		}
 	}
 	mDatabase->unlockMutex();
 	return result;
 }
 
+// Moves the object out of the way under a name the storages ignore and
+// leaves the actual delete to deleteThread. The object is already gone from
+// the database, and the host may create a new one with the same name right
+// away.
+void MtpServer::queueDelete(MtpObjectHandle handle, const char* path) {
+	QueuedDelete job;
+	job.storageID = 0;
+	job.transaction = mRequest.getTransactionID();
+	job.sweep = false;
+	for (size_t i = 0; i < mStorages.size(); i++) {
+		const char* storagePath = mStorages[i]->getPath();
+		size_t length = strlen(storagePath);
+		if (strncmp(path, storagePath, length) == 0 && (path[length] == '/' || path[length] == 0)) {
+			job.storageID = mStorages[i]->getStorageID();
+			break;
+		}
+	}
+
+	std::string dir = path;
+	size_t slash = dir.find_last_of('/');
+	dir = (slash == std::string::npos ? "." : dir.substr(0, slash));
+	char name[64];
+	snprintf(name, sizeof(name), "/" MTP_DELETING_PREFIX "%u", handle);
+	job.path = dir + name;
+	// renamed and queued in one go, so a sweep never finds a queued object unqueued
+	pthread_mutex_lock(&mQueueMutex);
+	if (rename(path, job.path.c_str()) != 0) {
+		pthread_mutex_unlock(&mQueueMutex);
+		MTPE("queueDelete: unable to rename '%s', deleting it now: %s\n", path, strerror(errno));
+		deletePath(path);
+		return;
+	}
+	mDeleteQueue.push_back(job);
+	pthread_cond_signal(&mDeleteCond);
+	pthread_mutex_unlock(&mQueueMutex);
+}
+
+// Objects renamed by queueDelete stay on disk if the server is stopped or
+// the storage removed before deleteThread got to them. They are hidden from
+// the host, so nothing else would ever remove them.
+void MtpServer::queueSweep(MtpStorage* storage) {
+	QueuedDelete job;
+	job.path = storage->getPath();
+	job.storageID = storage->getStorageID();
+	job.transaction = 0; // not part of any request
+	job.sweep = true;
+
+	pthread_mutex_lock(&mQueueMutex);
+	mDeleteQueue.push_back(job);
+	pthread_cond_signal(&mDeleteCond);
+	pthread_mutex_unlock(&mQueueMutex);
+}
+
+// Removes the leftovers of queueDelete below dir, returns true if there were any
+bool MtpServer::sweepDeleted(const std::string& dir) {
+	DIR* d = opendir(dir.c_str());
+	if (!d) {
+		MTPD("sweepDeleted: unable to open '%s': %s\n", dir.c_str(), strerror(errno));
+		return false;
+	}
+
+	bool found = false;
+	struct dirent* de;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		std::string path = dir + "/" + de->d_name;
+		if (strncmp(de->d_name, MTP_DELETING_PREFIX, sizeof(MTP_DELETING_PREFIX) - 1) == 0) {
+			bool queued = false;
+			pthread_mutex_lock(&mQueueMutex);
+			for (std::deque<QueuedDelete>::iterator it = mDeleteQueue.begin(); it != mDeleteQueue.end(); ++it) {
+				if (!it->sweep && it->path == path) {
+					queued = true;
+					break;
+				}
+			}
+			pthread_mutex_unlock(&mQueueMutex);
+			if (!queued) {
+				MTPD("MtpServer::sweepDeleted deleting '%s'\n", path.c_str());
+				deletePath(path.c_str());
+				found = true;
+			}
+			continue;
+		}
+
+		int type = de->d_type;
+		if (type == DT_UNKNOWN) {
+			struct stat st;
+			if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+				type = DT_DIR;
+		}
+		if (type == DT_DIR && sweepDeleted(path))
+			found = true;
+	}
+	closedir(d);
+	return found;
+}
+
+int MtpServer::deleteThread() {
+	MTPD("MtpServer delete thread starting\n");
+	pthread_mutex_lock(&mQueueMutex);
+	while (!mThreadsExit || !mDeleteQueue.empty()) {
+		if (mDeleteQueue.empty()) {
+			pthread_cond_wait(&mDeleteCond, &mQueueMutex);
+			continue;
+		}
+		QueuedDelete job = mDeleteQueue.front();
+		mDeleteQueue.pop_front();
+		// a sweep walks the whole storage, the next server start can do it
+		bool skip = job.sweep && mThreadsExit;
+		pthread_mutex_unlock(&mQueueMutex);
+
+		if (skip) {
+			MTPD("MtpServer::deleteThread exiting, not sweeping '%s'\n", job.path.c_str());
+		} else if (job.sweep) {
+			MTPD("MtpServer::deleteThread sweeping '%s'\n", job.path.c_str());
+			if (sweepDeleted(job.path)) {
+				MTPI("Removed unfinished deletes from '%s'\n", job.path.c_str());
+				sendEvent(MTP_EVENT_STORAGE_INFO_CHANGED, job.storageID, job.transaction);
+			}
+		} else {
+			MTPD("MtpServer::deleteThread deleting '%s'\n", job.path.c_str());
+			deletePath(job.path.c_str());
+			// the object itself was reported gone already, this is for the free space
+			if (job.storageID)
+				sendEvent(MTP_EVENT_STORAGE_INFO_CHANGED, job.storageID, job.transaction);
+		}
+		pthread_mutex_lock(&mQueueMutex);
+	}
+	pthread_mutex_unlock(&mQueueMutex);
+	MTPD("MtpServer delete thread exiting\n");
+	return 0;
+}
+
 MtpResponseCode MtpServer::doGetObjectPropDesc() {
 	MtpObjectProperty propCode = mRequest.getParameter(1);
 	MtpObjectFormat format = mRequest.getParameter(2);
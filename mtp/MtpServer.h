@@ -21,6 +21,8 @@
 
 #include <utils/threads.h>
 #include <utils/Vector.h>
+#include <deque>
+#include <string>
 #include "MtpRequestPacket.h"
 #include "MtpDatabase.h"
 #include "MtpDataPacket.h"
@@ -30,6 +32,10 @@
 #include "MtpUtils.h"
 
 
+// Objects deleted by the host are renamed to a name with this prefix and
+// removed from disk in the background. Storages skip such names.
+#define MTP_DELETING_PREFIX ".twrp_mtp_deleting."
+
 class MtpDatabase;
 class MtpStorage;
 
@@ -70,6 +76,32 @@ private:
 
 	pthread_mutex_t mtpMutex;
 
+    // Events are written by mEventThread, so whoever raises one, often an
+    // inotify thread holding the storage lock, never waits for the host to
+    // poll the interrupt endpoint. Deleted objects are removed from disk by
+    // mDeleteThread, so a big delete doesn't hold up the requests after it.
+    // A delete carries the transaction of the DeleteObject request, mRequest
+    // belongs to the main thread and has moved on by the time it is done.
+    struct QueuedEvent {
+        MtpEventCode        code;
+        uint32_t            param1;
+        MtpTransactionID    transaction;
+    };
+    struct QueuedDelete {
+        std::string         path;
+        MtpStorageID        storageID;
+        MtpTransactionID    transaction;
+        bool                sweep;      // path is a storage, remove what earlier runs left behind
+    };
+    std::deque<QueuedEvent>  mEventQueue;
+    std::deque<QueuedDelete> mDeleteQueue;
+    pthread_mutex_t     mQueueMutex;
+    pthread_cond_t      mEventCond;
+    pthread_cond_t      mDeleteCond;
+    pthread_t           mEventThread;
+    pthread_t           mDeleteThread;
+    bool                mThreadsExit;
+
     // represents an MTP object that is being edited using the android extensions
     // for direct editing (BeginEditObject, SendPartialObject, TruncateObject and EndEditObject)
     class ObjectEdit {
@@ -112,6 +144,16 @@ private:
     void                sendStoreAdded(MtpStorageID id);
     void                sendStoreRemoved(MtpStorageID id);
     void                sendEvent(MtpEventCode code, uint32_t param1);
+    void                sendEvent(MtpEventCode code, uint32_t param1, MtpTransactionID transaction);
+
+    typedef int (MtpServer::*ThreadPtr)(void);
+    typedef void* (*PThreadPtr)(void *);
+    pthread_t           startThread(ThreadPtr function);
+    int                 eventThread();
+    int                 deleteThread();
+    void                queueDelete(MtpObjectHandle handle, const char* path);
+    void                queueSweep(MtpStorage* storage);
+    bool                sweepDeleted(const std::string& dir);
 
     void                addEditObject(MtpObjectHandle handle, MtpString& path,
                                 uint64_t size, MtpObjectFormat format, int fd);
@@ -59,16 +59,12 @@ MtpStorage::MtpStorage(MtpStorageID id, const char* filePath,
 	inotify_thread_kill.set_value(0);
 	sendEvents = false;
 	handleCurrentlySending = 0;
+	handleIndex = NULL;
 	use_mutex = true;
 	if (pthread_mutex_init(&mtpMutex, NULL) != 0) {
 		MTPE("Failed to init mtpMutex\n");
 		use_mutex = false;
 	}
-	if (pthread_mutex_init(&inMutex, NULL) != 0) {
-		MTPE("Failed to init inMutex\n");
-		pthread_mutex_destroy(&mtpMutex);
-		use_mutex = false;
-	}
 }
 
 MtpStorage::~MtpStorage() {
@@ -92,7 +88,6 @@ MtpStorage::~MtpStorage() {
 		use_mutex = false;
 		MTPD("~MtpStorage destroying mutexes\n");
 		pthread_mutex_destroy(&mtpMutex);
-		pthread_mutex_destroy(&inMutex);
 	}
 }
 
@@ -308,6 +303,8 @@ int MtpStorage::readDir(const std::string& path, Tree* tree)
 			continue;
 		if (strcmp(de->d_name, "..") == 0)
 			continue;
+		if (strncmp(de->d_name, MTP_DELETING_PREFIX, sizeof(MTP_DELETING_PREFIX) - 1) == 0)
+			continue;
 		Node* node = addNewNode(st.st_mode & S_IFDIR, tree, de->d_name);
 		node->addProperties(item, storageID);
 		//if (sendEvents)
@@ -334,10 +331,7 @@ int MtpStorage::deleteFile(MtpObjectHandle handle) {
 		MTPE("parent tree for handle %u not found\n", parent);
 		return -1;
 	}
-	if (node->isDir()) {
-		MTPD("deleting tree from mtpmap: %u\n", handle);
-		mtpmap.erase(handle);
-	}
+	forgetNode(node);
 
 	MTPD("deleting handle: %u\n", handle);
 	tree->deleteNode(handle);
@@ -356,7 +350,7 @@ void MtpStorage::queryNodeProperties(std::vector<MtpStorage::PropEntry>& results
 	{
 		// add all properties
 		MTPD("MtpStorage::queryNodeProperties for all properties\n");
-		std::vector<Node::mtpProperty> mtpprop = node->getMtpProps();
+		const std::vector<Node::mtpProperty>& mtpprop = node->getMtpProps();
 		for (size_t i = 0; i < mtpprop.size(); ++i) {
 			pe.property = mtpprop[i].property;
 			pe.datatype = mtpprop[i].dataType;
@@ -417,110 +411,117 @@ void MtpStorage::queryNodeProperties(std::vector<MtpStorage::PropEntry>& results
 	results.push_back(pe);
 }
 
-int MtpStorage::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet) {
-	MTPD("MtpStorage::getObjectPropertyList handle: %u, format: %x, property: %x\n", handle, format, property);
-	if (groupCode != 0)
-	{
-		MTPE("getObjectPropertyList: groupCode unsupported\n");
-		return -1; // TODO: RESPONSE_SPECIFICATION_BY_GROUP_UNSUPPORTED
+// Serializes one ObjectPropList element
+static void putPropEntry(MtpDataPacket& packet, const MtpStorage::PropEntry& p)
+{
+	packet.putUInt32(p.handle);
+	packet.putUInt16(p.property);
+	packet.putUInt16(p.datatype);
+	switch (p.datatype) {
+		case MTP_TYPE_INT8:
+			packet.putInt8(p.intvalue);
+			break;
+		case MTP_TYPE_UINT8:
+			packet.putUInt8(p.intvalue);
+			break;
+		case MTP_TYPE_INT16:
+			packet.putInt16(p.intvalue);
+			break;
+		case MTP_TYPE_UINT16:
+			packet.putUInt16(p.intvalue);
+			break;
+		case MTP_TYPE_INT32:
+			packet.putInt32(p.intvalue);
+			break;
+		case MTP_TYPE_UINT32:
+			packet.putUInt32(p.intvalue);
+			break;
+		case MTP_TYPE_INT64:
+			packet.putInt64(p.intvalue);
+			break;
+		case MTP_TYPE_UINT64:
+			packet.putUInt64(p.intvalue);
+			break;
+		case MTP_TYPE_INT128:
+			packet.putInt128(p.intvalue);
+			break;
+		case MTP_TYPE_UINT128:
+			packet.putUInt128(p.intvalue);
+			break;
+		case MTP_TYPE_STR:
+			packet.putString(p.strvalue.c_str());
+			break;
+		default:
+			MTPE("bad or unsupported data type: %x in MyMtpDatabase::getObjectPropertyList", p.datatype);
+			break;
 	}
-	// TODO: support all the special stuff, like:
-	// handle == 0 -> all objects at the root level
-	// handle == 0xffffffff -> all objects (on all storages? how could we support that?)
-	// format == 0 -> all formats, otherwise filter by ObjectFormatCode
-	// property == 0xffffffff -> all properties except those with group code 0xffffffff
-	// if property == 0 then use groupCode
-	//   groupCode == 0 -> return Specification_By_Group_Unsupported
-	// depth == 0xffffffff -> all objects incl. and below handle
+}
 
-	std::vector<PropEntry> results;
+// Writes the requested properties of node to the packet, unless it is
+// filtered out by format. results is only scratch space, it is passed in so
+// a whole listing gets by with one vector.
+void MtpStorage::putNodeProperties(MtpDataPacket& packet, Node* node, uint32_t format, uint32_t property, std::vector<PropEntry>& results, uint32_t& count)
+{
+	if (format != 0 && node->getProperty(MTP_PROPERTY_OBJECT_FORMAT).valueInt != format)
+		return;
+	results.clear();
+	queryNodeProperties(results, node, property, 0, mStorageID);
+	for (size_t i = 0; i < results.size(); ++i)
+		putPropEntry(packet, results[i]);
+	count += results.size();
+}
 
-	if (handle == 0xffffffff) {
-		// TODO: all object on all storages (needs a different design, result packet needs to be built by server instead of storage)
-	} else if (handle == 0)	{
-		// all objects at the root level
-		Tree* root = mtpmap[0];
-		MtpObjectHandleList list;
-		root->getmtpids(&list);
-		for (MtpObjectHandleList::iterator it = list.begin(); it != list.end(); ++it) {
-			Node* node = root->findNode(*it);
-			if (!node) {
-				MTPE("BUG: node not found for root entry with handle %u\n", *it);
-				break;
-			}
-			queryNodeProperties(results, node, property, groupCode, mStorageID);
-		}
-	} else {
-		// single object
-		Node* node = findNode(handle);
+// Writes the properties of the objects in tree, and with recursive set of
+// everything below it, reading directories that were not read yet
+void MtpStorage::putTreeProperties(MtpDataPacket& packet, Tree* tree, uint32_t format, uint32_t property, bool recursive, std::vector<PropEntry>& results, uint32_t& count)
+{
+	if (!tree->wasAlreadyRead()) {
+		std::string path = getNodePath(tree);
+		MTPD("reading directory on demand for tree %p (%u), path: %s\n", tree, tree->Mtpid(), path.c_str());
+		readDir(path, tree);
+	}
+	MtpObjectHandleList list;
+	tree->getmtpids(&list);
+	for (MtpObjectHandleList::iterator it = list.begin(); it != list.end(); ++it) {
+		Node* node = tree->findNode(*it);
 		if (!node) {
-			// Item is not on this storage device
-			return -1;
-		}
-		queryNodeProperties(results, node, property, groupCode, mStorageID);
-	}
-
-	MTPD("count: %u\n", results.size());
-	packet.putUInt32(results.size());
-
-	for (size_t i = 0; i < results.size(); ++i) {
-		PropEntry& p = results[i];
-		MTPD("handle: %u, propertyCode: %x = %s, datatype: %x, value: %llu\n",
-				p.handle, p.property, MtpDebug::getObjectPropCodeName(p.property),
-				p.datatype, p.intvalue);
-		packet.putUInt32(p.handle);
-		packet.putUInt16(p.property);
-		packet.putUInt16(p.datatype);
-		switch (p.datatype) {
-			case MTP_TYPE_INT8:
-				MTPD("MTP_TYPE_INT8\n");
-				packet.putInt8(p.intvalue);
-				break;
-			case MTP_TYPE_UINT8:
-				MTPD("MTP_TYPE_UINT8\n");
-				packet.putUInt8(p.intvalue);
-				break;
-			case MTP_TYPE_INT16:
-				MTPD("MTP_TYPE_INT16\n");
-				packet.putInt16(p.intvalue);
-				break;
-			case MTP_TYPE_UINT16:
-				MTPD("MTP_TYPE_UINT16\n");
-				packet.putUInt16(p.intvalue);
-				break;
-			case MTP_TYPE_INT32:
-				MTPD("MTP_TYPE_INT32\n");
-				packet.putInt32(p.intvalue);
-				break;
-			case MTP_TYPE_UINT32:
-				MTPD("MTP_TYPE_UINT32\n");
-				packet.putUInt32(p.intvalue);
-				break;
-			case MTP_TYPE_INT64:
-				MTPD("MTP_TYPE_INT64\n");
-				packet.putInt64(p.intvalue);
-				break;
-			case MTP_TYPE_UINT64:
-				MTPD("MTP_TYPE_UINT64\n");
-				packet.putUInt64(p.intvalue);
-				break;
-			case MTP_TYPE_INT128:
-				MTPD("MTP_TYPE_INT128\n");
-				packet.putInt128(p.intvalue);
-				break;
-			case MTP_TYPE_UINT128:
-				MTPD("MTP_TYPE_UINT128\n");
-				packet.putUInt128(p.intvalue);
-				break;
-			case MTP_TYPE_STR:
-				MTPD("MTP_TYPE_STR: %s\n", p.strvalue.c_str());
-				packet.putString(p.strvalue.c_str());
-				break;
-			default:
-				MTPE("bad or unsupported data type: %x in MyMtpDatabase::getObjectPropertyList", p.datatype);
-				break;
+			MTPE("BUG: node not found for tree entry with handle %u\n", *it);
+			continue;
 		}
+		putNodeProperties(packet, node, format, property, results, count);
+		if (recursive && node->isDir())
+			putTreeProperties(packet, static_cast<Tree*>(node), format, property, recursive, results, count);
+	}
+}
+
+int MtpStorage::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int depth, MtpDataPacket& packet, uint32_t& count) {
+	MTPD("MtpStorage::getObjectPropertyList handle: %u, format: %x, property: %x, depth: %d\n", handle, format, property, depth);
+	// handle == 0 -> the objects at the root level, or all objects on the
+	//   storage with depth == 0xffffffff
+	// handle == 0xffffffff -> all objects on the storage
+	// format == 0 -> all formats, otherwise filter by ObjectFormatCode
+	// property == 0xffffffff -> all properties
+	// depth == 0 -> the object itself, 1 -> its children,
+	//   0xffffffff -> the object and everything below it
+	// Group codes and other depths are rejected by MyMtpDatabase.
+	std::vector<PropEntry> results;
+	bool recursive = (depth == -1);
+
+	if (handle == 0xffffffff || handle == 0) {
+		Tree* root = mtpmap[0];
+		putTreeProperties(packet, root, format, property, recursive || handle == 0xffffffff, results, count);
+		return 0;
 	}
+
+	Node* node = findNode(handle);
+	if (!node) {
+		// Item is not on this storage device
+		return -1;
+	}
+	if (depth != 1)
+		putNodeProperties(packet, node, format, property, results, count);
+	if (depth != 0 && node->isDir())
+		putTreeProperties(packet, static_cast<Tree*>(node), format, property, recursive, results, count);
 	return 0;
 }
 
@@ -530,20 +531,18 @@ int MtpStorage::renameObject(MtpObjectHandle handle, std::string newName) {
 		MTPE("parent == MTP_PARENT_ROOT, cannot rename root\n");
 		return -1;
 	} else {
-		for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-			Node* node = i->second->findNode(handle);
-			if (node != NULL) {
-				std::string oldName = getNodePath(node);
-				std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
-				std::string newFullName = parentdir + "/" + newName;
-				MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
-				if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
-					node->rename(newName);
-					return 0;
-				} else {
-					MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
-					return -1;
-				}
+		Node* node = findNode(handle);
+		if (node != NULL) {
+			std::string oldName = getNodePath(node);
+			std::string parentdir = oldName.substr(0, oldName.find_last_of('/'));
+			std::string newFullName = parentdir + "/" + newName;
+			MTPD("old: '%s', new: '%s'\n", oldName.c_str(), newFullName.c_str());
+			if (rename(oldName.c_str(), newFullName.c_str()) == 0) {
+				node->rename(newName);
+				return 0;
+			} else {
+				MTPE("MtpStorage::renameObject failed, handle: %u, new name: '%s'\n", handle, newName.c_str());
+				return -1;
 			}
 		}
 	}
@@ -552,22 +551,19 @@ int MtpStorage::renameObject(MtpObjectHandle handle, std::string newName) {
 }
 
 int MtpStorage::getObjectPropertyValue(MtpObjectHandle handle, MtpObjectProperty property, MtpStorage::PropEntry& pe) {
-	Node *node;
-	for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
-		node = i->second->findNode(handle);
-		if (node != NULL) {
-			const Node::mtpProperty& prop = node->getProperty(property);
-			if (prop.property != property) {
-				MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
-				return -1;
-			}
-			pe.datatype = prop.dataType;
-			pe.intvalue = prop.valueInt;
-			pe.strvalue = prop.valueStr;
-			pe.handle = handle;
-			pe.property = property;
-			return 0;
+	Node *node = findNode(handle);
+	if (node != NULL) {
+		const Node::mtpProperty& prop = node->getProperty(property);
+		if (prop.property != property) {
+			MTPD("getObjectPropertyValue: unknown property %x for handle %u\n", property, handle);
+			return -1;
 		}
+		pe.datatype = prop.dataType;
+		pe.intvalue = prop.valueInt;
+		pe.strvalue = prop.valueStr;
+		pe.handle = handle;
+		pe.property = property;
+		return 0;
 	}
 	// handle not found on this storage
 	return -1;
@@ -619,6 +615,10 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 	}
 	Tree* tree = it->second;
 	MTPD("inotify_t tree: %x '%s'\n", tree, tree->getName().c_str());
+	if (strncmp(event->name, MTP_DELETING_PREFIX, sizeof(MTP_DELETING_PREFIX) - 1) == 0) {
+		MTPD("ignoring inotify event for object being deleted: %s\n", event->name);
+		return;
+	}
 	Node* node = tree->findEntryByName(basename(event->name));
 	if (node && node->Mtpid() == handleCurrentlySending) {
 		MTPD("ignoring inotify event for currently uploading file, handle: %u\n", node->Mtpid());
@@ -649,17 +649,7 @@ void MtpStorage::handleInotifyEvent(struct inotify_event* event)
 		}
 		if (node)
 		{
-			if (event->mask & IN_ISDIR) {
-				for (std::map<int, Tree*>::iterator it = inotifymap.begin(); it != inotifymap.end(); ++it) {
-					if (it->second == node) {
-						inotify_rm_watch(inotify_fd, it->first);
-						MTPD("inotify_t removing watch on '%s'\n", getNodePath(it->second).c_str());
-						inotifymap.erase(it->first);
-						break;
-					}
-
-				}
-			}
+			// deleteFile also drops the watches on the directory and below
 			MtpObjectHandle handle = node->Mtpid();
 			deleteFile(handle);
 			mServer->sendObjectRemoved(handle);
@@ -790,10 +780,47 @@ Node* MtpStorage::addNewNode(bool isDir, Tree* tree, const std::string& name)
 	else
 		node = new Node(mtpid, parent, name);
 	tree->addEntry(node);
+	if (handleIndex)
+		handleIndex->add(mtpid, this, node, tree);
 	return node;
 }
 
+// Removes a node that is about to be deleted, and everything below it, from
+// mtpmap, the inotify watches and the handle index
+void MtpStorage::forgetNode(Node* node)
+{
+	MtpObjectHandle handle = node->Mtpid();
+	if (node->isDir()) {
+		Tree* tree = static_cast<Tree*>(node);
+		MtpObjectHandleList list;
+		tree->getmtpids(&list);
+		for (MtpObjectHandleList::iterator it = list.begin(); it != list.end(); ++it) {
+			Node* child = tree->findNode(*it);
+			if (child)
+				forgetNode(child);
+		}
+		for (std::map<int, Tree*>::iterator it = inotifymap.begin(); it != inotifymap.end(); ++it) {
+			if (it->second == tree) {
+				inotify_rm_watch(inotify_fd, it->first);
+				inotifymap.erase(it);
+				break;
+			}
+		}
+		MTPD("deleting tree from mtpmap: %u\n", handle);
+		mtpmap.erase(handle);
+	}
+	if (handleIndex)
+		handleIndex->remove(handle);
+}
+
 Node* MtpStorage::findNode(MtpObjectHandle handle) {
+	if (handleIndex) {
+		MtpHandleIndex::Entry entry;
+		if (handleIndex->find(handle, entry) && entry.storage == this)
+			return entry.node;
+		MTPD("MtpStorage::findNode: no node found for handle %u on storage %u\n", handle, mStorageID);
+		return NULL;
+	}
 	for (iter i = mtpmap.begin(); i != mtpmap.end(); i++) {
 		Node* node = i->second->findNode(handle);
 		if (node != NULL) {
@@ -826,31 +853,16 @@ std::string MtpStorage::getNodePath(Node* node) {
 	return path;
 }
 
+// The main mtp thread (thread_type 0) and the inotify thread (1) share one
+// mutex, so neither has to back off and sleep when the other holds it
 void MtpStorage::lockMutex(int thread_type) {
 	if (!use_mutex)
 		return; // mutex is disabled
-	if (thread_type) {
-		// inotify thread
-		pthread_mutex_lock(&inMutex);
-		while (pthread_mutex_trylock(&mtpMutex)) {
-			pthread_mutex_unlock(&inMutex);
-			usleep(32000);
-			pthread_mutex_lock(&inMutex);
-		}
-	} else {
-		// main mtp thread
-		pthread_mutex_lock(&mtpMutex);
-		while (pthread_mutex_trylock(&inMutex)) {
-			pthread_mutex_unlock(&mtpMutex);
-			usleep(13000);
-			pthread_mutex_lock(&mtpMutex);
-		}
-	}
+	pthread_mutex_lock(&mtpMutex);
 }
 
 void MtpStorage::unlockMutex(int thread_type) {
 	if (!use_mutex)
 		return; // mutex is disabled
-	pthread_mutex_unlock(&inMutex);
 	pthread_mutex_unlock(&mtpMutex);
 }
@@ -27,6 +27,7 @@
 #include <libgen.h>
 #include <pthread.h>
 #include "btree.hpp"
+#include "MtpHandleIndex.hpp"
 #include "MtpServer.h"
 #include "../tw_atomic.hpp"
 
@@ -77,12 +78,15 @@ public:
 	};
 
 	int readDir(const std::string& path, Tree* tree);
+	// Called before createDB, the index is shared by all storages
+	void setHandleIndex(MtpHandleIndex* index) { handleIndex = index; }
 	int createDB();
 	MtpObjectHandleList* getObjectList(MtpStorageID storageID, MtpObjectHandle parent);
 	int getObjectInfo(MtpObjectHandle handle, MtpObjectInfo& info);
 	MtpObjectHandle beginSendObject(const char* path, MtpObjectFormat format, MtpObjectHandle parent, uint64_t size, time_t modified);
 	void endSendObject(const char* path, MtpObjectHandle handle, MtpObjectFormat format, bool succeeded);
-	int getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet);
+	// Appends the ObjectPropList elements to packet and adds their number to count
+	int getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int depth, MtpDataPacket& packet, uint32_t& count);
 	int getObjectFilePath(MtpObjectHandle handle, MtpString& outFilePath, int64_t& outFileLength, MtpObjectFormat& outFormat);
 	int deleteFile(MtpObjectHandle handle);
 	int renameObject(MtpObjectHandle handle, std::string newName);
@@ -103,17 +107,20 @@ private:
 
 	bool sendEvents;
 	MtpObjectHandle handleCurrentlySending;
+	MtpHandleIndex* handleIndex;
 
 	Node* addNewNode(bool isDir, Tree* tree, const std::string& name);
+	void forgetNode(Node* node);
 	Node* findNode(MtpObjectHandle handle);
 	Node* findNodeByPath(const std::string& path);
 	std::string getNodePath(Node* node);
 
 	void queryNodeProperties(std::vector<PropEntry>& results, Node* node, uint32_t property, int groupCode, MtpStorageID storageID);
+	void putNodeProperties(MtpDataPacket& packet, Node* node, uint32_t format, uint32_t property, std::vector<PropEntry>& results, uint32_t& count);
+	void putTreeProperties(MtpDataPacket& packet, Tree* tree, uint32_t format, uint32_t property, bool recursive, std::vector<PropEntry>& results, uint32_t& count);
 
 	bool use_mutex;
-	pthread_mutex_t inMutex; // inotify mutex
-	pthread_mutex_t mtpMutex; // main mtp mutex
+	pthread_mutex_t mtpMutex; // shared by the main mtp and inotify threads
 	TWAtomicInt inotify_thread_kill;
 };
 
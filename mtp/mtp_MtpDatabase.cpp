@@ -227,14 +227,15 @@ void MyMtpDatabase::endSendObject(const char* path, MtpObjectHandle handle,
 		MTPE("endSendObject() failed, unlinking %s\n", path);
 		unlink(path);
 	}
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++)
-		storit->second->endSendObject(path, handle, format, succeeded);
+	MtpStorage* storage = handleIndex.findStorage(handle);
+	if (storage)
+		storage->endSendObject(path, handle, format, succeeded);
 }
 
 void MyMtpDatabase::createDB(MtpStorage* storage, MtpStorageID storageID) {
 	MTPD("MyMtpDatabase::createDB called\n");
 	storagemap[storageID] = storage;
+	storage->setHandleIndex(&handleIndex);
 	storage->createDB();
 }
 
@@ -242,6 +243,8 @@ void MyMtpDatabase::destroyDB(MtpStorageID storageID) {
 	MtpStorage* storage = storagemap[storageID];
 	storagemap.erase(storageID);
 	delete storage;
+	// after the delete, so nothing the inotify thread added is left behind
+	handleIndex.removeStorage(storage);
 }
 
 MtpObjectHandleList* MyMtpDatabase::getObjectList(MtpStorageID storageID,
@@ -343,13 +346,9 @@ MtpResponseCode MyMtpDatabase::getObjectPropertyValue(MtpObjectHandle handle,
 		MTPE("MyMtpDatabase::getObjectPropertyValue returning MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED\n");
 		return MTP_RESPONSE_OBJECT_PROP_NOT_SUPPORTED;
 	}
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-		if (storit->second->getObjectPropertyValue(handle, property, prop) == 0) {
-			result = MTP_RESPONSE_OK;
-			break;
-		}
-	}
+	MtpStorage* storage = handleIndex.findStorage(handle);
+	if (storage && storage->getObjectPropertyValue(handle, property, prop) == 0)
+		result = MTP_RESPONSE_OK;
 
 	if (result != MTP_RESPONSE_OK) {
 		MTPE("MyMtpDatabase::getObjectPropertyValue unable to locate handle: %u\n", handle);
@@ -495,13 +494,10 @@ MtpResponseCode MyMtpDatabase::setObjectPropertyValue(MtpObjectHandle handle,
 		case MTP_PROPERTY_OBJECT_FILE_NAME:
 			{
 				MTPD("MyMtpDatabase::setObjectPropertyValue renaming file, handle: %d, new name: '%s'\n", handle, stringValue.c_str());
-				std::map<int, MtpStorage*>::iterator storit;
-				for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-					if (storit->second->renameObject(handle, stringValue) == 0) {
-						MTPD("MTP_RESPONSE_OK\n");
-						result = MTP_RESPONSE_OK;
-						break;
-					}
+				MtpStorage* storage = handleIndex.findStorage(handle);
+				if (storage && storage->renameObject(handle, stringValue) == 0) {
+					MTPD("MTP_RESPONSE_OK\n");
+					result = MTP_RESPONSE_OK;
 				}
 			}
 			break;
@@ -637,25 +633,44 @@ MtpResponseCode MyMtpDatabase::resetDeviceProperty(MtpDeviceProperty property) {
 MtpResponseCode MyMtpDatabase::getObjectPropertyList(MtpObjectHandle handle, uint32_t format, uint32_t property, int groupCode, int depth, MtpDataPacket& packet) {
 	MTPD("getObjectPropertyList()\n");
 	MTPD("property: %x\n", property);
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-		MTPD("MyMtpDatabase::getObjectPropertyList calling getObjectPropertyList\n");
-		if (storit->second->getObjectPropertyList(handle, format, property, groupCode, depth, packet) == 0) {
-			MTPD("MTP_RESPONSE_OK\n");
-   			return MTP_RESPONSE_OK;
+	// the group code is only used with property == 0, and our properties have no groups
+	if (property == 0) {
+		MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPONSE_SPECIFICATION_BY_GROUP_UNSUPPORTED %x\n", groupCode);
+		return MTP_RESPONSE_SPECIFICATION_BY_GROUP_UNSUPPORTED;
+	}
+	if (depth != 0 && depth != 1 && depth != -1) {
+		MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPONSE_SPECIFICATION_BY_DEPTH_UNSUPPORTED %d\n", depth);
+		return MTP_RESPONSE_SPECIFICATION_BY_DEPTH_UNSUPPORTED;
+	}
+
+	// the number of elements is only known once they are all written
+	int countOffset = packet.putUInt32Placeholder();
+	uint32_t count = 0;
+	// 0 and 0xffffffff are not single objects, each storage answers for its own
+	if (handle != 0 && handle != 0xffffffff) {
+		MtpStorage* storage = handleIndex.findStorage(handle);
+		if (!storage || storage->getObjectPropertyList(handle, format, property, depth, packet, count) != 0) {
+			MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPOSNE_INVALID_OBJECT_HANDLE %i\n", handle);
+			packet.reset();
+			return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+		}
+	} else {
+		std::map<int, MtpStorage*>::iterator storit;
+		for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
+			MTPD("MyMtpDatabase::getObjectPropertyList calling getObjectPropertyList\n");
+			storit->second->getObjectPropertyList(handle, format, property, depth, packet, count);
 		}
 	}
-	MTPE("MyMtpDatabase::getObjectPropertyList MTP_RESPOSNE_INVALID_OBJECT_HANDLE %i\n", handle);
-	return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
+	packet.fillUInt32Placeholder(countOffset, count);
+	MTPD("MyMtpDatabase::getObjectPropertyList returning %u elements, MTP_RESPONSE_OK\n", count);
+	return MTP_RESPONSE_OK;
 }
 
 MtpResponseCode MyMtpDatabase::getObjectInfo(MtpObjectHandle handle, MtpObjectInfo& info) {
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-		if (storit->second->getObjectInfo(handle, info) == 0) {
-			MTPD("MTP_RESPONSE_OK\n");
-			return MTP_RESPONSE_OK;
-		}
+	MtpStorage* storage = handleIndex.findStorage(handle);
+	if (storage && storage->getObjectInfo(handle, info) == 0) {
+		MTPD("MTP_RESPONSE_OK\n");
+		return MTP_RESPONSE_OK;
 	}
 	MTPE("MyMtpDatabase::getObjectInfo MTP_RESPONSE_INVALID_OBJECT_HANDLE %i\n", handle);
 	return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
@@ -672,13 +687,10 @@ void* MyMtpDatabase::getThumbnail(MtpObjectHandle handle, size_t& outThumbSize)
 }
 
 MtpResponseCode MyMtpDatabase::getObjectFilePath(MtpObjectHandle handle, MtpString& outFilePath, int64_t& outFileLength, MtpObjectFormat& outFormat) {
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-		MTPD("MyMtpDatabase::getObjectFilePath calling getObjectFilePath\n");
-		if (storit->second->getObjectFilePath(handle, outFilePath, outFileLength, outFormat) == 0) {
-			MTPD("MTP_RESPONSE_OK\n");
-			return MTP_RESPONSE_OK;
-		}
+	MtpStorage* storage = handleIndex.findStorage(handle);
+	if (storage && storage->getObjectFilePath(handle, outFilePath, outFileLength, outFormat) == 0) {
+		MTPD("MTP_RESPONSE_OK\n");
+		return MTP_RESPONSE_OK;
 	}
 	MTPE("MyMtpDatabase::getObjectFilePath MTP_RESPOSNE_INVALID_OBJECT_HANDLE %i\n", handle);
 	return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
@@ -686,12 +698,10 @@ MtpResponseCode MyMtpDatabase::getObjectFilePath(MtpObjectHandle handle, MtpStri
 
 MtpResponseCode MyMtpDatabase::deleteFile(MtpObjectHandle handle) {
 	MTPD("deleteFile\n");
-	std::map<int, MtpStorage*>::iterator storit;
-	for (storit = storagemap.begin(); storit != storagemap.end(); storit++) {
-		if (storit->second->deleteFile(handle) == 0) {
-			MTPD("MTP_RESPONSE_OK\n");
-			return MTP_RESPONSE_OK;
-		}
+	MtpStorage* storage = handleIndex.findStorage(handle);
+	if (storage && storage->deleteFile(handle) == 0) {
+		MTPD("MTP_RESPONSE_OK\n");
+		return MTP_RESPONSE_OK;
 	}
 	MTPE("MyMtpDatabase::deleteFile MTP_RESPONSE_INVALID_OBJECT_HANDLE %i\n", handle);
 	return MTP_RESPONSE_INVALID_OBJECT_HANDLE;
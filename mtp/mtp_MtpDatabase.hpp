@@ -39,6 +39,7 @@
 #include "MtpProperty.h"
 #include "MtpStringBuffer.h"
 #include "MtpUtils.h"
+#include "MtpHandleIndex.hpp"
 #include "mtp.h"
 
 class MyMtpDatabase : public MtpDatabase {
@@ -56,6 +57,7 @@ private:
 	int count;
 	std::string lastfile;
 	std::map<int, MtpStorage*> storagemap;
+	MtpHandleIndex handleIndex;
 	void countDirs(std::string path);
 	int readParentDirs(std::string path, int storageID);
 
@@ -52,6 +52,7 @@
 #include "gui/pages.hpp"
 #include "orscmd/orscmd.h"
 #include "twinstall.h"
+#include "twrpTaskGraph.hpp"
 extern "C" {
 	#include "gui/gui.h"
 	#include "cutils/properties.h"
@@ -92,326 +93,426 @@ int OpenRecoveryScript::copy_script_file(string filename) {
 	return 0;
 }
 
-int OpenRecoveryScript::run_script_file(void) {
-	int ret_val = 0, cindex, line_len, i, remove_nl, install_cmd = 0, sideload = 0;
+// Reads SCRIPT_FILE_TMP into steps and works out which partitions each of them changes
+bool OpenRecoveryScript::parse_script_file(vector<ORS_Step>& steps) {
+	int cindex, line_len, i, remove_nl;
 	char script_line[SCRIPT_COMMAND_SIZE], command[SCRIPT_COMMAND_SIZE],
-	     value[SCRIPT_COMMAND_SIZE], mount[SCRIPT_COMMAND_SIZE],
-	     value1[SCRIPT_COMMAND_SIZE], value2[SCRIPT_COMMAND_SIZE];
-	char *val_start, *tok;
+	     value[SCRIPT_COMMAND_SIZE];
+	char *val_start;
 
 	FILE *fp = fopen(SCRIPT_FILE_TMP, "r");
-	if (fp != NULL) {
-		DataManager::SetValue(TW_SIMULATE_ACTIONS, 0);
-		DataManager::SetValue("ui_progress", 0); // Reset the progress bar
-		while (fgets(script_line, SCRIPT_COMMAND_SIZE, fp) != NULL && ret_val == 0) {
-			cindex = 0;
-			line_len = strlen(script_line);
-			if (line_len < 2)
-				continue; // there's a blank line or line is too short to contain a command
-			//gui_print("script line: '%s'\n", script_line);
-			for (i=0; i<line_len; i++) {
-				if ((int)script_line[i] == 32) {
-					cindex = i;
-					i = line_len;
-				}
+	if (fp == NULL)
+		return false;
+	while (fgets(script_line, SCRIPT_COMMAND_SIZE, fp) != NULL) {
+		cindex = 0;
+		line_len = strlen(script_line);
+		if (line_len < 2)
+			continue; // there's a blank line or line is too short to contain a command
+		//gui_print("script line: '%s'\n", script_line);
+		for (i=0; i<line_len; i++) {
+			if ((int)script_line[i] == 32) {
+				cindex = i;
+				i = line_len;
 			}
-			memset(command, 0, sizeof(command));
-			memset(value, 0, sizeof(value));
-			if ((int)script_line[line_len - 1] == 10)
-				remove_nl = 2;
-			else
-				remove_nl = 1;
-			if (cindex != 0) {
-				strncpy(command, script_line, cindex);
-				LOGINFO("command is: '%s'\n", command);
-				val_start = script_line;
-				val_start += cindex + 1;
-				if ((int) *val_start == 32)
-					val_start++; //get rid of space
-				if ((int) *val_start == 51)
-					val_start++; //get rid of = at the beginning
-				if ((int) *val_start == 32)
-					val_start++; //get rid of space
-				strncpy(value, val_start, line_len - cindex - remove_nl);
-				LOGINFO("value is: '%s'\n", value);
-			} else {
-				strncpy(command, script_line, line_len - remove_nl + 1);
-				gui_print("command is: '%s' and there is no value\n", command);
+		}
+		memset(command, 0, sizeof(command));
+		memset(value, 0, sizeof(value));
+		if ((int)script_line[line_len - 1] == 10)
+			remove_nl = 2;
+		else
+			remove_nl = 1;
+		if (cindex != 0) {
+			strncpy(command, script_line, cindex);
+			LOGINFO("command is: '%s'\n", command);
+			val_start = script_line;
+			val_start += cindex + 1;
+			if ((int) *val_start == 32)
+				val_start++; //get rid of space
+			if ((int) *val_start == 51)
+				val_start++; //get rid of = at the beginning
+			if ((int) *val_start == 32)
+				val_start++; //get rid of space
+			strncpy(value, val_start, line_len - cindex - remove_nl);
+			LOGINFO("value is: '%s'\n", value);
+		} else {
+			strncpy(command, script_line, line_len - remove_nl + 1);
+			gui_print("command is: '%s' and there is no value\n", command);
+		}
+
+		// Only mkdir, mount and unmount stay on their own partitions. Everything else may
+		// mount, unmount or size all partitions or changes settings later steps depend on.
+		// Wipes run by themselves too, formatting and the progress bar are process wide.
+		ORS_Step step;
+		step.command = command;
+		step.value = value;
+		step.has_value = cindex != 0;
+		step.exclusive = true;
+		step.ret = -1;
+		if (step.command == "mkdir" || step.command == "mount" || step.command == "unmount" || step.command == "umount") {
+			if (step.has_value) {
+				step.partitions.push_back(Partition_Key(step.value));
+				step.exclusive = false;
 			}
-			if (strcmp(command, "install") == 0) {
-				// Install Zip
-				DataManager::SetValue("tw_action_text2", "Installing Zip");
-				ret_val = Install_Command(value);
-				install_cmd = -1;
-			} else if (strcmp(command, "wipe") == 0) {
-				// Wipe
-				if (strcmp(value, "cache") == 0 || strcmp(value, "/cache") == 0) {
-					PartitionManager.Wipe_By_Path("/cache");
-				} else if (strcmp(value, "system") == 0 || strcmp(value, "/system") == 0) {
-					PartitionManager.Wipe_By_Path("/system");
-				} else if (strcmp(value, "dalvik") == 0 || strcmp(value, "dalvick") == 0 || strcmp(value, "dalvikcache") == 0 || strcmp(value, "dalvickcache") == 0) {
-					PartitionManager.Wipe_Dalvik_Cache();
-				} else if (strcmp(value, "data") == 0 || strcmp(value, "/data") == 0 || strcmp(value, "factory") == 0 || strcmp(value, "factoryreset") == 0) {
-					PartitionManager.Factory_Reset();
-				} else {
-					LOGERR("Error with wipe command value: '%s'\n", value);
-					ret_val = 1;
-				}
-			} else if (strcmp(command, "backup") == 0) {
-				// Backup
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@backing}"));
-				tok = strtok(value, " ");
-				strcpy(value1, tok);
-				tok = strtok(NULL, " ");
-				if (tok != NULL) {
-					memset(value2, 0, sizeof(value2));
-					strcpy(value2, tok);
-					line_len = strlen(tok);
-					if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13) {
-						if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13)
-							remove_nl = 2;
-						else
-							remove_nl = 1;
-					} else
-						remove_nl = 0;
-					strncpy(value2, tok, line_len - remove_nl);
-					DataManager::SetValue(TW_BACKUP_NAME, value2);
-					gui_msg(Msg("backup_folder_set=Backup folder set to '{1}'")(value2));
-					if (PartitionManager.Check_Backup_Name(true) != 0) {
-						ret_val = 1;
-						continue;
-					}
-				} else {
-					char empt[50];
-					strcpy(empt, "(Current Date)");
-					DataManager::SetValue(TW_BACKUP_NAME, empt);
-				}
-				ret_val = Backup_Command(value1);
-			} else if (strcmp(command, "restore") == 0) {
-				// Restore
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@restore}"));
-				PartitionManager.Mount_All_Storage();
-				DataManager::SetValue(TW_SKIP_DIGEST_CHECK_VAR, 0);
-				char folder_path[512], partitions[512];
-
-				string val = value, restore_folder, restore_partitions;
-				size_t pos = val.find_last_of(" ");
-				if (pos == string::npos) {
-					restore_folder = value;
-					partitions[0] = '\0';
-				} else {
-					restore_folder = val.substr(0, pos);
-					restore_partitions = val.substr(pos + 1, val.size() - pos - 1);
-					strcpy(partitions, restore_partitions.c_str());
-				}
-				strcpy(folder_path, restore_folder.c_str());
-				LOGINFO("Restore folder is: '%s' and partitions: '%s'\n", folder_path, partitions);
-				gui_msg(Msg("restoring=Restoring {1}...")(folder_path));
-
-				if (folder_path[0] != '/') {
-					char backup_folder[512];
-					string folder_var;
-					std::vector<PartitionList> Storage_List;
-
-					PartitionManager.Get_Partition_List("storage", &Storage_List);
-					int listSize = Storage_List.size();
-					for (int i = 0; i < listSize; i++) {
-						if (PartitionManager.Is_Mounted_By_Path(Storage_List.at(i).Mount_Point)) {
-							DataManager::SetValue("tw_storage_path", Storage_List.at(i).Mount_Point);
-							DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
-							sprintf(backup_folder, "%s/%s", folder_var.c_str(), folder_path);
-							if (TWFunc::Path_Exists(backup_folder)) {
-								strcpy(folder_path, backup_folder);
-								break;
-							}
-						}
-					}
-				} else {
-					if (folder_path[strlen(folder_path) - 1] == '/')
-						strcat(folder_path, ".");
-					else
-						strcat(folder_path, "/.");
-				}
-				if (!TWFunc::Path_Exists(folder_path)) {
-					gui_msg(Msg(msg::kError, "locate_backup_err=Unable to locate backup '{1}'")(folder_path));
-					ret_val = 1;
-					continue;
-				}
-				DataManager::SetValue("tw_restore", folder_path);
-
-				PartitionManager.Set_Restore_Files(folder_path);
-				string Partition_List;
-				int is_encrypted = 0;
-				DataManager::GetValue("tw_restore_encrypted", is_encrypted);
-				DataManager::GetValue("tw_restore_list", Partition_List);
-				if (strlen(partitions) != 0) {
-					string Restore_List;
-
-					memset(value2, 0, sizeof(value2));
-					strcpy(value2, partitions);
-					gui_msg(Msg("set_restore_opt=Setting restore options: '{1}':")(value2));
-					line_len = strlen(value2);
-					for (i=0; i<line_len; i++) {
-						if ((value2[i] == 'S' || value2[i] == 's') && Partition_List.find("/system;") != string::npos) {
-							Restore_List += "/system;";
-							gui_msg("system=System");
-						} else if ((value2[i] == 'D' || value2[i] == 'd') && Partition_List.find("/data;") != string::npos) {
-							Restore_List += "/data;";
-							gui_msg("data=Data");
-						} else if ((value2[i] == 'C' || value2[i] == 'c') && Partition_List.find("/cache;") != string::npos) {
-							Restore_List += "/cache;";
-							gui_msg("cache=Cache");
-						} else if ((value2[i] == 'R' || value2[i] == 'r') && Partition_List.find("/recovery;") != string::npos) {
-							Restore_List += "/recovery;";
-							gui_msg("recovery=Recovery");
-						} else if ((value2[i] == 'B' || value2[i] == 'b') && Partition_List.find("/boot;") != string::npos) {
-							Restore_List += "/boot;";
-							gui_msg("boot=Boot");
-						} else if ((value2[i] == 'A' || value2[i] == 'a')  && Partition_List.find("/and-sec;") != string::npos) {
-							Restore_List += "/and-sec;";
-							gui_msg("android_secure=Android Secure");
-						} else if ((value2[i] == 'E' || value2[i] == 'e')  && Partition_List.find("/sd-ext;") != string::npos) {
-							Restore_List += "/sd-ext;";
-							gui_msg("sdext=SD-EXT");
-						} else if (value2[i] == 'M' || value2[i] == 'm') {
-							DataManager::SetValue(TW_SKIP_DIGEST_CHECK_VAR, 1);
-							gui_msg("digest_check_skip=Digest check skip is on");
-						}
-					}
+		}
+		steps.push_back(step);
+	}
+	fclose(fp);
+	return true;
+}
 
-					DataManager::SetValue("tw_restore_selected", Restore_List);
-				} else {
-					DataManager::SetValue("tw_restore_selected", Partition_List);
-				}
-				if (is_encrypted) {
-					gui_err("ors_encrypt_restore_err=Unable to use OpenRecoveryScript to restore an encrypted backup.");
-					ret_val = 1;
-				} else if (!PartitionManager.Run_Restore(folder_path))
-					ret_val = 1;
-				else
-					gui_msg("done=Done.");
-			} else if (strcmp(command, "remountrw") == 0) {
-				ret_val = remountrw();
-			} else if (strcmp(command, "mount") == 0) {
-				// Mount
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@mounting}"));
-				if (value[0] != '/') {
-					strcpy(mount, "/");
-					strcat(mount, value);
-				} else
-					strcpy(mount, value);
-				if (PartitionManager.Mount_By_Path(mount, true))
-					gui_msg(Msg("mounted=Mounted '{1}'")(mount));
-			} else if (strcmp(command, "unmount") == 0 || strcmp(command, "umount") == 0) {
-				// Unmount
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@unmounting}"));
-				if (value[0] != '/') {
-					strcpy(mount, "/");
-					strcat(mount, value);
-				} else
-					strcpy(mount, value);
-				if (PartitionManager.UnMount_By_Path(mount, true))
-					gui_msg(Msg("unmounted=Unounted '{1}'")(mount));
-			} else if (strcmp(command, "set") == 0) {
-				// Set value
-				size_t len = strlen(value);
-				tok = strtok(value, " ");
-				strcpy(value1, tok);
-				if (len > strlen(value1) + 1) {
-					char *val2 = value + strlen(value1) + 1;
-					gui_msg(Msg("setting=Setting '{1}' to '{2}'")(value1)(val2));
-					DataManager::SetValue(value1, val2);
-				} else {
-					gui_msg(Msg("setting_empty=Setting '{1}' to empty")(value1));
-					DataManager::SetValue(value1, "");
-				}
-			} else if (strcmp(command, "mkdir") == 0) {
-				// Make directory (recursive)
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@making_dir1}"));
-				gui_msg(Msg("making_dir2=Making directory: '{1}'")(value));
-				if (!TWFunc::Recursive_Mkdir(value)) {
-					// error message already displayed by Recursive_Mkdir
-					ret_val = 1;
-				}
-			} else if (strcmp(command, "reboot") == 0) {
-				if (strlen(value) && strcmp(value, "recovery") == 0)
-					TWFunc::tw_reboot(rb_recovery);
-				else if (strlen(value) && strcmp(value, "poweroff") == 0)
-					TWFunc::tw_reboot(rb_poweroff);
-				else if (strlen(value) && strcmp(value, "bootloader") == 0)
-					TWFunc::tw_reboot(rb_bootloader);
-				else if (strlen(value) && strcmp(value, "download") == 0)
-					TWFunc::tw_reboot(rb_download);
-				else
-					TWFunc::tw_reboot(rb_system);
-			} else if (strcmp(command, "cmd") == 0) {
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@running_command}"));
-				if (cindex != 0) {
-					TWFunc::Exec_Cmd(value);
-				} else {
-					LOGERR("No value given for cmd\n");
-				}
-			} else if (strcmp(command, "print") == 0) {
-				gui_print("%s\n", value);
-			} else if (strcmp(command, "sideload") == 0) {
-				// ADB Sideload
-				DataManager::SetValue("tw_action_text2", gui_parse_text("{@sideload}"));
-				install_cmd = -1;
+// The partition a path is on by backup name, so that e.g. /sdcard and /data match
+string OpenRecoveryScript::Partition_Key(const string& Path) {
+	TWPartition* Part = PartitionManager.Find_Partition_By_Path(Path);
+	if (Part)
+		return Part->Get_Backup_Name();
+	return TWFunc::Get_Root_Path(Path);
+}
 
-				int wipe_cache = 0;
-				string result;
-				pid_t sideload_child_pid;
-
-				gui_msg("start_sideload=Starting ADB sideload feature...");
-				ret_val = apply_from_adb("/", &sideload_child_pid);
-				if (ret_val != 0) {
-					if (ret_val == -2)
-						gui_err("need_new_adb=You need adb 1.0.32 or newer to sideload to this device.");
-					ret_val = 1; // failure
-				} else if (TWinstall_zip(FUSE_SIDELOAD_HOST_PATHNAME, &wipe_cache) == 0) {
-					if (wipe_cache)
-						PartitionManager.Wipe_By_Path("/cache");
-				} else {
-					ret_val = 1; // failure
-				}
-				sideload = 1; // Causes device to go to the home screen afterwards
-				if (sideload_child_pid != 0) {
-					LOGINFO("Signaling child sideload process to exit.\n");
-					struct stat st;
-					// Calling stat() on this magic filename signals the minadbd
-					// subprocess to shut down.
-					stat(FUSE_SIDELOAD_HOST_EXIT_PATHNAME, &st);
-					int status;
-					LOGINFO("Waiting for child sideload process to exit.\n");
-					waitpid(sideload_child_pid, &status, 0);
+bool OpenRecoveryScript::Steps_Conflict(const ORS_Step& a, const ORS_Step& b) {
+	for (size_t i = 0; i < a.partitions.size(); i++) {
+		if (std::find(b.partitions.begin(), b.partitions.end(), a.partitions[i]) != b.partitions.end())
+			return true;
+	}
+	return false;
+}
+
+bool OpenRecoveryScript::Run_Step_Task(void *cookie) {
+	ORS_Step *step = (ORS_Step*)cookie;
+	step->ret = run_script_command(*step);
+	return step->ret == 0;
+}
+
+// Runs steps first to last - 1, none of them exclusive, each as soon as the earlier steps
+// sharing a partition with it are done
+int OpenRecoveryScript::run_concurrent_steps(vector<ORS_Step>& steps, size_t first, size_t last) {
+	twrpTaskGraph graph;
+	char title[64];
+
+	// as when running them one by one, nothing new starts once a step failed
+	graph.Stop_On_Failure();
+
+	for (size_t i = first; i < last; i++) {
+		int task = graph.Add_Task(steps[i].command + " " + steps[i].value, Run_Step_Task, &steps[i]);
+		for (size_t j = first; j < i; j++) {
+			if (Steps_Conflict(steps[j], steps[i]))
+				graph.Add_Dependency(task, j - first);
+		}
+	}
+	bool ret = graph.Run();
+	sprintf(title, "OpenRecoveryScript steps %i to %i", (int)first + 1, (int)last);
+	graph.Log_Timing(title);
+	return ret ? 0 : 1;
+}
+
+int OpenRecoveryScript::run_script_command(ORS_Step& step) {
+	int ret_val = 0, line_len, i, remove_nl;
+	char command[SCRIPT_COMMAND_SIZE], value[SCRIPT_COMMAND_SIZE], mount[SCRIPT_COMMAND_SIZE],
+	     value1[SCRIPT_COMMAND_SIZE], value2[SCRIPT_COMMAND_SIZE];
+	char *tok;
+
+	strlcpy(command, step.command.c_str(), sizeof(command));
+	strlcpy(value, step.value.c_str(), sizeof(value));
+	if (strcmp(command, "install") == 0) {
+		// Install Zip
+		DataManager::SetValue("tw_action_text2", "Installing Zip");
+		ret_val = Install_Command(value);
+	} else if (strcmp(command, "wipe") == 0) {
+		// Wipe
+		if (strcmp(value, "cache") == 0 || strcmp(value, "/cache") == 0) {
+			PartitionManager.Wipe_By_Path("/cache");
+		} else if (strcmp(value, "system") == 0 || strcmp(value, "/system") == 0) {
+			PartitionManager.Wipe_By_Path("/system");
+		} else if (strcmp(value, "dalvik") == 0 || strcmp(value, "dalvick") == 0 || strcmp(value, "dalvikcache") == 0 || strcmp(value, "dalvickcache") == 0) {
+			PartitionManager.Wipe_Dalvik_Cache();
+		} else if (strcmp(value, "data") == 0 || strcmp(value, "/data") == 0 || strcmp(value, "factory") == 0 || strcmp(value, "factoryreset") == 0) {
+			PartitionManager.Factory_Reset();
+		} else {
+			LOGERR("Error with wipe command value: '%s'\n", value);
+			ret_val = 1;
+		}
+	} else if (strcmp(command, "backup") == 0) {
+		// Backup
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@backing}"));
+		tok = strtok(value, " ");
+		strcpy(value1, tok);
+		tok = strtok(NULL, " ");
+		if (tok != NULL) {
+			memset(value2, 0, sizeof(value2));
+			strcpy(value2, tok);
+			line_len = strlen(tok);
+			if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13) {
+				if ((int)value2[line_len - 1] == 10 || (int)value2[line_len - 1] == 13)
+					remove_nl = 2;
+				else
+					remove_nl = 1;
+			} else
+				remove_nl = 0;
+			strncpy(value2, tok, line_len - remove_nl);
+			DataManager::SetValue(TW_BACKUP_NAME, value2);
+			gui_msg(Msg("backup_folder_set=Backup folder set to '{1}'")(value2));
+			if (PartitionManager.Check_Backup_Name(true) != 0) {
+				return 1;
+			}
+		} else {
+			char empt[50];
+			strcpy(empt, "(Current Date)");
+			DataManager::SetValue(TW_BACKUP_NAME, empt);
+		}
+		ret_val = Backup_Command(value1);
+	} else if (strcmp(command, "restore") == 0) {
+		// Restore
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@restore}"));
+		PartitionManager.Mount_All_Storage();
+		DataManager::SetValue(TW_SKIP_DIGEST_CHECK_VAR, 0);
+		char folder_path[512], partitions[512];
+
+		string val = value, restore_folder, restore_partitions;
+		size_t pos = val.find_last_of(" ");
+		if (pos == string::npos) {
+			restore_folder = value;
+			partitions[0] = '\0';
+		} else {
+			restore_folder = val.substr(0, pos);
+			restore_partitions = val.substr(pos + 1, val.size() - pos - 1);
+			strcpy(partitions, restore_partitions.c_str());
+		}
+		strcpy(folder_path, restore_folder.c_str());
+		LOGINFO("Restore folder is: '%s' and partitions: '%s'\n", folder_path, partitions);
+		gui_msg(Msg("restoring=Restoring {1}...")(folder_path));
+
+		if (folder_path[0] != '/') {
+			char backup_folder[512];
+			string folder_var;
+			std::vector<PartitionList> Storage_List;
+
+			PartitionManager.Get_Partition_List("storage", &Storage_List);
+			int listSize = Storage_List.size();
+			for (int i = 0; i < listSize; i++) {
+				if (PartitionManager.Is_Mounted_By_Path(Storage_List.at(i).Mount_Point)) {
+					DataManager::SetValue("tw_storage_path", Storage_List.at(i).Mount_Point);
+					DataManager::GetValue(TW_BACKUPS_FOLDER_VAR, folder_var);
+					sprintf(backup_folder, "%s/%s", folder_var.c_str(), folder_path);
+					if (TWFunc::Path_Exists(backup_folder)) {
+						strcpy(folder_path, backup_folder);
+						break;
+					}
 				}
-				property_set("ctl.start", "adbd");
-				gui_msg("done=Done.");
-			} else if (strcmp(command, "fixperms") == 0 || strcmp(command, "fixpermissions") == 0 || strcmp(command, "fixcontexts") == 0) {
-				ret_val = PartitionManager.Fix_Contexts();
-				if (ret_val != 0)
-					ret_val = 1; // failure
-			} else if (strcmp(command, "decrypt") == 0) {
-				if (*value) {
-					ret_val = PartitionManager.Decrypt_Device(value);
-					if (ret_val != 0)
-						ret_val = 1; // failure
-				} else {
-					gui_err("no_pwd=No password provided.");
-					ret_val = 1; // failure
+			}
+		} else {
+			if (folder_path[strlen(folder_path) - 1] == '/')
+				strcat(folder_path, ".");
+			else
+				strcat(folder_path, "/.");
+		}
+		if (!TWFunc::Path_Exists(folder_path)) {
+			gui_msg(Msg(msg::kError, "locate_backup_err=Unable to locate backup '{1}'")(folder_path));
+			return 1;
+		}
+		DataManager::SetValue("tw_restore", folder_path);
+
+		PartitionManager.Set_Restore_Files(folder_path);
+		string Partition_List;
+		int is_encrypted = 0;
+		DataManager::GetValue("tw_restore_encrypted", is_encrypted);
+		DataManager::GetValue("tw_restore_list", Partition_List);
+		if (strlen(partitions) != 0) {
+			string Restore_List;
+
+			memset(value2, 0, sizeof(value2));
+			strcpy(value2, partitions);
+			gui_msg(Msg("set_restore_opt=Setting restore options: '{1}':")(value2));
+			line_len = strlen(value2);
+			for (i=0; i<line_len; i++) {
+				if ((value2[i] == 'S' || value2[i] == 's') && Partition_List.find("/system;") != string::npos) {
+					Restore_List += "/system;";
+					gui_msg("system=System");
+				} else if ((value2[i] == 'D' || value2[i] == 'd') && Partition_List.find("/data;") != string::npos) {
+					Restore_List += "/data;";
+					gui_msg("data=Data");
+				} else if ((value2[i] == 'C' || value2[i] == 'c') && Partition_List.find("/cache;") != string::npos) {
+					Restore_List += "/cache;";
+					gui_msg("cache=Cache");
+				} else if ((value2[i] == 'R' || value2[i] == 'r') && Partition_List.find("/recovery;") != string::npos) {
+					Restore_List += "/recovery;";
+					gui_msg("recovery=Recovery");
+				} else if ((value2[i] == 'B' || value2[i] == 'b') && Partition_List.find("/boot;") != string::npos) {
+					Restore_List += "/boot;";
+					gui_msg("boot=Boot");
+				} else if ((value2[i] == 'A' || value2[i] == 'a')  && Partition_List.find("/and-sec;") != string::npos) {
+					Restore_List += "/and-sec;";
+					gui_msg("android_secure=Android Secure");
+				} else if ((value2[i] == 'E' || value2[i] == 'e')  && Partition_List.find("/sd-ext;") != string::npos) {
+					Restore_List += "/sd-ext;";
+					gui_msg("sdext=SD-EXT");
+				} else if (value2[i] == 'M' || value2[i] == 'm') {
+					DataManager::SetValue(TW_SKIP_DIGEST_CHECK_VAR, 1);
+					gui_msg("digest_check_skip=Digest check skip is on");
 				}
-			} else {
-				LOGERR("Unrecognized script command: '%s'\n", command);
-				ret_val = 1;
 			}
+
+			DataManager::SetValue("tw_restore_selected", Restore_List);
+		} else {
+			DataManager::SetValue("tw_restore_selected", Partition_List);
+		}
+		if (is_encrypted) {
+			gui_err("ors_encrypt_restore_err=Unable to use OpenRecoveryScript to restore an encrypted backup.");
+			ret_val = 1;
+		} else if (!PartitionManager.Run_Restore(folder_path))
+			ret_val = 1;
+		else
+			gui_msg("done=Done.");
+	} else if (strcmp(command, "remountrw") == 0) {
+		ret_val = remountrw();
+	} else if (strcmp(command, "mount") == 0) {
+		// Mount
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@mounting}"));
+		if (value[0] != '/') {
+			strcpy(mount, "/");
+			strcat(mount, value);
+		} else
+			strcpy(mount, value);
+		if (PartitionManager.Mount_By_Path(mount, true))
+			gui_msg(Msg("mounted=Mounted '{1}'")(mount));
+	} else if (strcmp(command, "unmount") == 0 || strcmp(command, "umount") == 0) {
+		// Unmount
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@unmounting}"));
+		if (value[0] != '/') {
+			strcpy(mount, "/");
+			strcat(mount, value);
+		} else
+			strcpy(mount, value);
+		if (PartitionManager.UnMount_By_Path(mount, true))
+			gui_msg(Msg("unmounted=Unounted '{1}'")(mount));
+	} else if (strcmp(command, "set") == 0) {
+		// Set value
+		size_t len = strlen(value);
+		tok = strtok(value, " ");
+		strcpy(value1, tok);
+		if (len > strlen(value1) + 1) {
+			char *val2 = value + strlen(value1) + 1;
+			gui_msg(Msg("setting=Setting '{1}' to '{2}'")(value1)(val2));
+			DataManager::SetValue(value1, val2);
+		} else {
+			gui_msg(Msg("setting_empty=Setting '{1}' to empty")(value1));
+			DataManager::SetValue(value1, "");
+		}
+	} else if (strcmp(command, "mkdir") == 0) {
+		// Make directory (recursive)
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@making_dir1}"));
+		gui_msg(Msg("making_dir2=Making directory: '{1}'")(value));
+		if (!TWFunc::Recursive_Mkdir(value)) {
+			// error message already displayed by Recursive_Mkdir
+			ret_val = 1;
+		}
+	} else if (strcmp(command, "reboot") == 0) {
+		if (strlen(value) && strcmp(value, "recovery") == 0)
+			TWFunc::tw_reboot(rb_recovery);
+		else if (strlen(value) && strcmp(value, "poweroff") == 0)
+			TWFunc::tw_reboot(rb_poweroff);
+		else if (strlen(value) && strcmp(value, "bootloader") == 0)
+			TWFunc::tw_reboot(rb_bootloader);
+		else if (strlen(value) && strcmp(value, "download") == 0)
+			TWFunc::tw_reboot(rb_download);
+		else
+			TWFunc::tw_reboot(rb_system);
+	} else if (strcmp(command, "cmd") == 0) {
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@running_command}"));
+		if (step.has_value) {
+			TWFunc::Exec_Cmd(value);
+		} else {
+			LOGERR("No value given for cmd\n");
+		}
+	} else if (strcmp(command, "print") == 0) {
+		gui_print("%s\n", value);
+	} else if (strcmp(command, "sideload") == 0) {
+		// ADB Sideload
+		DataManager::SetValue("tw_action_text2", gui_parse_text("{@sideload}"));
+
+		int wipe_cache = 0;
+		string result;
+		pid_t sideload_child_pid;
+
+		gui_msg("start_sideload=Starting ADB sideload feature...");
+		ret_val = apply_from_adb("/", &sideload_child_pid);
+		if (ret_val != 0) {
+			if (ret_val == -2)
+				gui_err("need_new_adb=You need adb 1.0.32 or newer to sideload to this device.");
+			ret_val = 1; // failure
+		} else if (TWinstall_zip(FUSE_SIDELOAD_HOST_PATHNAME, &wipe_cache) == 0) {
+			if (wipe_cache)
+				PartitionManager.Wipe_By_Path("/cache");
+		} else {
+			ret_val = 1; // failure
+		}
+		if (sideload_child_pid != 0) {
+			LOGINFO("Signaling child sideload process to exit.\n");
+			struct stat st;
+			// Calling stat() on this magic filename signals the minadbd
+			// subprocess to shut down.
+			stat(FUSE_SIDELOAD_HOST_EXIT_PATHNAME, &st);
+			int status;
+			LOGINFO("Waiting for child sideload process to exit.\n");
+			waitpid(sideload_child_pid, &status, 0);
+		}
+		property_set("ctl.start", "adbd");
+		gui_msg("done=Done.");
+	} else if (strcmp(command, "fixperms") == 0 || strcmp(command, "fixpermissions") == 0 || strcmp(command, "fixcontexts") == 0) {
+		ret_val = PartitionManager.Fix_Contexts();
+		if (ret_val != 0)
+			ret_val = 1; // failure
+	} else if (strcmp(command, "decrypt") == 0) {
+		if (*value) {
+			ret_val = PartitionManager.Decrypt_Device(value);
+			if (ret_val != 0)
+				ret_val = 1; // failure
+		} else {
+			gui_err("no_pwd=No password provided.");
+			ret_val = 1; // failure
 		}
-		fclose(fp);
-		unlink(SCRIPT_FILE_TMP);
-		gui_msg("done_ors=Done processing script file");
 	} else {
+		LOGERR("Unrecognized script command: '%s'\n", command);
+		ret_val = 1;
+	}
+	return ret_val;
+}
+
+int OpenRecoveryScript::run_script_file(void) {
+	int ret_val = 0, install_cmd = 0, sideload = 0;
+	vector<ORS_Step> steps;
+
+	if (!parse_script_file(steps)) {
 		gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(SCRIPT_FILE_TMP)(strerror(errno)));
 		return 1;
 	}
+	DataManager::SetValue(TW_SIMULATE_ACTIONS, 0);
+	DataManager::SetValue("ui_progress", 0); // Reset the progress bar
+
+	// Runs of steps that are not exclusive go to a task graph together, every other step
+	// runs by itself in script order. The script stops after the first run with a failure.
+	size_t next = 0;
+	while (next < steps.size() && ret_val == 0) {
+		size_t last = next;
+		while (last < steps.size() && !steps[last].exclusive)
+			last++;
+		if (last - next > 1) {
+			ret_val = run_concurrent_steps(steps, next, last);
+		} else {
+			last = next + 1;
+			uint64_t start = twrpTaskGraph::Now_Ms();
+			ret_val = steps[next].ret = run_script_command(steps[next]);
+			LOGINFO("OpenRecoveryScript step %i '%s' took %llums\n", (int)next + 1, steps[next].command.c_str(),
+				(unsigned long long)(twrpTaskGraph::Now_Ms() - start));
+		}
+		for (size_t i = next; i < last; i++) {
+			if (steps[i].command == "install" || steps[i].command == "sideload")
+				install_cmd = -1;
+			if (steps[i].command == "sideload")
+				sideload = 1; // Causes device to go to the home screen afterwards
+		}
+		next = last;
+	}
+	unlink(SCRIPT_FILE_TMP);
+	gui_msg("done_ors=Done processing script file");
 
 	if (install_cmd && DataManager::GetIntValue(TW_HAS_INJECTTWRP) == 1 && DataManager::GetIntValue(TW_INJECT_AFTER_ZIP) == 1) {
 		gui_msg("injecttwrp=Injecting TWRP into boot image...");
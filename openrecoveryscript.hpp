@@ -20,9 +20,20 @@
 #define _OPENRECOVERYSCRIPT_HPP
 
 #include <string>
+#include <vector>
 
 using namespace std;
 
+// One line of a script
+struct ORS_Step {
+	string command;
+	string value;
+	bool has_value;
+	vector<string> partitions;                                                     // partitions the step changes, by backup name
+	bool exclusive;                                                                // may touch any partition or global state, runs by itself
+	int ret;                                                                       // result once run, -1 before
+};
+
 class OpenRecoveryScript
 {
 	typedef void (*VoidFunction)();
@@ -31,6 +42,12 @@ class OpenRecoveryScript
 	static int check_for_script_file();                                            // Checks to see if the ORS file is present in /cache
 	static int copy_script_file(string filename);                                  // Copies a script file to the temp folder
 	static int run_script_file();                                                  // Executes the commands in the ORS file
+	static bool parse_script_file(vector<ORS_Step>& steps);                        // Reads the ORS file into steps
+	static int run_script_command(ORS_Step& step);                                 // Executes one command, returns non-zero on failure
+	static int run_concurrent_steps(vector<ORS_Step>& steps, size_t first, size_t last); // Runs non-exclusive steps that don't share partitions concurrently
+	static bool Run_Step_Task(void *cookie);                                       // twrpTaskGraph task for a step
+	static bool Steps_Conflict(const ORS_Step& a, const ORS_Step& b);              // Steps change a common partition
+	static string Partition_Key(const string& Path);                               // Backup name of the partition a path is on
 	static int Install_Command(string Zip);                                        // Installs a zip
 	static string Locate_Zip_File(string Path, string File);                       // Attempts to locate the zip file in storage
 	static int Backup_Command(string Options);                                     // Runs a backup
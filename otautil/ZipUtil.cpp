@@ -18,9 +18,17 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <android-base/logging.h>
 #include <android-base/unique_fd.h>
@@ -33,6 +41,56 @@
 static constexpr mode_t UNZIP_DIRMODE = 0755;
 static constexpr mode_t UNZIP_FILEMODE = 0644;
 
+// Upper bound on the number of extraction threads. Inflating is CPU bound, but past a handful of
+// threads the fsync() of each file on flash storage dominates.
+static constexpr size_t MAX_EXTRACT_THREADS = 8;
+
+struct ExtractJob {
+    ZipEntry entry;
+    std::string path;
+    std::string error;
+};
+
+static bool ExtractOneEntry(ZipArchiveHandle zip, ExtractJob* job,
+                            const struct utimbuf* timestamp, struct selabel_handle* sehnd) {
+    const std::string& path = job->path;
+
+    // setfscreatecon() applies to the calling thread only, so each worker labels its own files.
+    char *secontext = NULL;
+    if (sehnd) {
+        selabel_lookup(sehnd, &secontext, path.c_str(), UNZIP_FILEMODE);
+        setfscreatecon(secontext);
+    }
+    android::base::unique_fd fd(open(path.c_str(), O_CREAT|O_WRONLY|O_TRUNC, UNZIP_FILEMODE));
+    int saved_errno = errno;
+    if (secontext) {
+        freecon(secontext);
+        setfscreatecon(NULL);
+    }
+    if (fd == -1) {
+        job->error = "Can't create target file \"" + path + "\": " + strerror(saved_errno);
+        return false;
+    }
+
+    int err = ExtractEntryToFile(zip, &job->entry, fd);
+    if (err != 0) {
+        job->error = "Error extracting \"" + path + "\" : " + ErrorCodeString(err);
+        return false;
+    }
+
+    if (fsync(fd) != 0) {
+        job->error = "Error syncing file descriptor when extracting \"" + path + "\": " +
+                strerror(errno);
+        return false;
+    }
+
+    if (timestamp != nullptr && utime(path.c_str(), timestamp)) {
+        job->error = "Error touching \"" + path + "\": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
 bool ExtractPackageRecursive(ZipArchiveHandle zip, const std::string& zip_path,
                              const std::string& dest_path, const struct utimbuf* timestamp,
                              struct selabel_handle* sehnd) {
@@ -62,60 +120,72 @@ bool ExtractPackageRecursive(ZipArchiveHandle zip, const std::string& zip_path,
         return false;
     }
 
-    std::unique_ptr<void, decltype(&EndIteration)> guard(cookie, EndIteration);
-    ZipEntry entry;
-    ZipString name;
-    int extractCount = 0;
-    while (Next(cookie, &entry, &name) == 0) {
-        std::string entry_name(name.name, name.name + name.name_length);
-        CHECK_LE(prefix_path.size(), entry_name.size());
-        std::string path = target_dir + entry_name.substr(prefix_path.size());
-        // Skip dir.
-        if (path.back() == '/') {
-            continue;
-        }
-        //TODO(b/31917448) handle the symlink.
-
-        if (dirCreateHierarchy(path.c_str(), UNZIP_DIRMODE, timestamp, true, sehnd) != 0) {
-            LOG(ERROR) << "failed to create dir for " << path;
-            return false;
-        }
-
-        char *secontext = NULL;
-        if (sehnd) {
-            selabel_lookup(sehnd, &secontext, path.c_str(), UNZIP_FILEMODE);
-            setfscreatecon(secontext);
-        }
-        android::base::unique_fd fd(open(path.c_str(), O_CREAT|O_WRONLY|O_TRUNC, UNZIP_FILEMODE));
-        if (fd == -1) {
-            PLOG(ERROR) << "Can't create target file \"" << path << "\"";
-            return false;
-        }
-        if (secontext) {
-            freecon(secontext);
-            setfscreatecon(NULL);
-        }
-
-        int err = ExtractEntryToFile(zip, &entry, fd);
-        if (err != 0) {
-            LOG(ERROR) << "Error extracting \"" << path << "\" : " << ErrorCodeString(err);
-            return false;
+    // Walk the central directory once to collect the work, creating each parent directory only
+    // the first time it is seen.
+    std::vector<ExtractJob> jobs;
+    {
+        std::unique_ptr<void, decltype(&EndIteration)> guard(cookie, EndIteration);
+        std::set<std::string> created_dirs;
+        ZipEntry entry;
+        ZipString name;
+        while (Next(cookie, &entry, &name) == 0) {
+            std::string entry_name(name.name, name.name + name.name_length);
+            CHECK_LE(prefix_path.size(), entry_name.size());
+            std::string path = target_dir + entry_name.substr(prefix_path.size());
+            // Skip dir.
+            if (path.back() == '/') {
+                continue;
+            }
+            //TODO(b/31917448) handle the symlink.
+
+            std::string parent = path.substr(0, path.rfind('/') + 1);
+            if (created_dirs.find(parent) == created_dirs.end()) {
+                if (dirCreateHierarchy(path.c_str(), UNZIP_DIRMODE, timestamp, true, sehnd) != 0) {
+                    LOG(ERROR) << "failed to create dir for " << path;
+                    return false;
+                }
+                created_dirs.insert(parent);
+            }
+
+            jobs.push_back({ entry, path, "" });
         }
+    }
 
-        if (fsync(fd) != 0) {
-            PLOG(ERROR) << "Error syncing file descriptor when extracting \"" << path << "\"";
-            return false;
+    // Entries are independent once their directories exist, so inflate them concurrently. Workers
+    // claim entries in central directory order; after a failure no new entries are claimed, and
+    // the error reported is always the one for the earliest failing entry.
+    std::atomic<size_t> next_job(0);
+    std::atomic<bool> failed(false);
+    auto worker = [&]() {
+        size_t i;
+        while (!failed && (i = next_job++) < jobs.size()) {
+            if (!ExtractOneEntry(zip, &jobs[i], timestamp, sehnd)) {
+                failed = true;
+            }
         }
+    };
+
+    size_t thread_count = std::min<size_t>(
+            std::max(1u, std::thread::hardware_concurrency()), MAX_EXTRACT_THREADS);
+    thread_count = std::min(thread_count, jobs.size());
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto& t : threads) {
+        t.join();
+    }
 
-        if (timestamp != nullptr && utime(path.c_str(), timestamp)) {
-            PLOG(ERROR) << "Error touching \"" << path << "\"";
+    size_t done = std::min(next_job.load(), jobs.size());
+    for (size_t i = 0; i < done; ++i) {
+        if (!jobs[i].error.empty()) {
+            LOG(ERROR) << jobs[i].error;
             return false;
         }
-
-        LOG(INFO) << "Extracted file \"" << path << "\"";
-        ++extractCount;
+        LOG(INFO) << "Extracted file \"" << jobs[i].path << "\"";
     }
 
-    LOG(INFO) << "Extracted " << extractCount << " file(s)";
+    LOG(INFO) << "Extracted " << jobs.size() << " file(s) using " << thread_count << " thread(s)";
     return true;
 }
@@ -48,6 +48,9 @@
  *
  * If timestamp is non-NULL, file timestamps will be set accordingly.
  *
+ * Files are inflated on several threads; if any of them fails, the error
+ * for the first failing entry in archive order is logged.
+ *
  * Returns true on success, false on failure.
  */
 bool ExtractPackageRecursive(ZipArchiveHandle zip, const std::string& zip_path,
@@ -35,7 +35,6 @@
 	#include "cutils/properties.h"
 #endif
 
-#include "libblkid/include/blkid.h"
 #include "variables.h"
 #include "twcommon.h"
 #include "partitions.hpp"
@@ -50,10 +49,6 @@
 extern "C" {
 	#include "mtdutils/mtdutils.h"
 	#include "mtdutils/mounts.h"
-#ifdef USE_EXT4
-	// #include "make_ext4fs.h" TODO need ifdef for android8
-	#include <ext4_utils/make_ext4fs.h>
-#endif
 
 #ifdef TW_INCLUDE_CRYPTO
 	#include "crypto/lollipop/cryptfs.h"
@@ -74,12 +69,15 @@ extern "C" {
 #endif
 #include <sparse_format.h>
 #include "progresstracking.hpp"
+#include "twrpTelemetry.hpp"
+#include "twrpProbeCache.hpp"
+#include "twrpWipe.hpp"
+#include "twrpFormat.hpp"
 
 using namespace std;
 
 static int auto_index = 0; // v2 fstab allows you to specify a mount point of "auto" with no /. These items are given a mount point of /auto* where * == auto_index
 
-extern struct selabel_handle *selinux_handle;
 extern bool datamedia;
 
 struct flag_list {
@@ -227,6 +225,9 @@ TWPartition::TWPartition() {
 	Used = 0;
 	Free = 0;
 	Backup_Size = 0;
+	Size_Signature = 0;
+	Folder_Size = 0;
+	Folder_Size_Signature = 0;
 	Can_Be_Encrypted = false;
 	Is_Encrypted = false;
 	Is_Decrypted = false;
@@ -254,6 +255,7 @@ TWPartition::TWPartition() {
 	Format_Block_Size = 0;
 	Ignore_Blkid = false;
 	Retain_Layout_Version = false;
+	Secure_Discard = false;
 	Crypto_Key_Location = "footer";
 	MTP_Storage_ID = 0;
 	Can_Flash_Img = false;
@@ -1207,11 +1209,11 @@ bool TWPartition::Get_Size_Via_df(bool Display_Error) {
 		return false;
 
 	min_len = Actual_Block_Device.size() + 2;
-	sprintf(command, "df %s > /tmp/dfoutput.txt", Mount_Point.c_str());
-	TWFunc::Exec_Cmd(command);
-	fp = fopen("/tmp/dfoutput.txt", "rt");
+	// read df directly, sizes of several partitions may be updated at once
+	sprintf(command, "df %s", Mount_Point.c_str());
+	fp = popen(command, "r");
 	if (fp == NULL) {
-		LOGINFO("Unable to open /tmp/dfoutput.txt.\n");
+		LOGINFO("Unable to run '%s'.\n", command);
 		return false;
 	}
 
@@ -1244,10 +1246,67 @@ bool TWPartition::Get_Size_Via_df(bool Display_Error) {
 		Free = available * 1024ULL;
 		Backup_Size = Used;
 	}
-	fclose(fp);
+	pclose(fp);
 	return true;
 }
 
+// FNV-1a over the bytes of a file system's state
+static uint64_t Size_Signature_Hash(uint64_t hash, const void* data, size_t len) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+uint64_t TWPartition::Get_Superblock_Signature(void) {
+	unsigned char sb[1024];
+
+	if (Current_File_System != "ext4" && Current_File_System != "ext3" && Current_File_System != "ext2")
+		return 0;
+	int fd = open(Actual_Block_Device.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	ssize_t len = pread(fd, sb, sizeof(sb), 1024);
+	close(fd);
+	if (len != (ssize_t)sizeof(sb) || sb[0x38] != 0x53 || sb[0x39] != 0xEF)
+		return 0;
+
+	// free counts, mount and write times, mount count, state, uuid and lifetime writes all
+	// change once anything mounts the file system read-write
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = Size_Signature_Hash(hash, sb + 0x0C, 8);     // s_free_blocks_count_lo, s_free_inodes_count
+	hash = Size_Signature_Hash(hash, sb + 0x2C, 10);    // s_mtime, s_wtime, s_mnt_count
+	hash = Size_Signature_Hash(hash, sb + 0x3A, 2);     // s_state
+	hash = Size_Signature_Hash(hash, sb + 0x68, 16);    // s_uuid
+	hash = Size_Signature_Hash(hash, sb + 0x158, 4);    // s_free_blocks_count_hi
+	hash = Size_Signature_Hash(hash, sb + 0x178, 8);    // s_kbytes_written
+	return hash ? hash : 1;
+}
+
+uint64_t TWPartition::Get_Statfs_Signature(void) {
+	struct statfs st;
+	string Local_Path = Mount_Point + "/.";
+
+	if (statfs(Local_Path.c_str(), &st) != 0)
+		return 0;
+	uint64_t counts[] = { (uint64_t)st.f_blocks, (uint64_t)st.f_bfree, (uint64_t)st.f_files, (uint64_t)st.f_ffree };
+	uint64_t hash = Size_Signature_Hash(0xcbf29ce484222325ULL, counts, sizeof(counts));
+	hash = Size_Signature_Hash(hash, &st.f_fsid, sizeof(st.f_fsid));
+	return hash ? hash : 1;
+}
+
+uint64_t TWPartition::Get_Folder_Size_Cached(const string& Path) {
+	// the folder walk is the slow part of a size update, skip it while statfs shows no change
+	uint64_t signature = Get_Statfs_Signature();
+	if (signature == 0 || signature != Folder_Size_Signature) {
+		Folder_Size = backup_exclusions.Get_Folder_Size(Path);
+		Folder_Size_Signature = signature;
+	}
+	return Folder_Size;
+}
+
 unsigned long long TWPartition::IOCTL_Get_Block_Size() {
 	Find_Actual_Block_Device();
 
@@ -1583,6 +1642,7 @@ bool TWPartition::Wipe(string New_File_System) {
 		}
 		update_crypt = wiped;
 	}
+	twrpProbeCache::Invalidate(Actual_Block_Device);
 
 	if (wiped) {
 		if (Mount_Point == "/cache")
@@ -1630,7 +1690,8 @@ bool TWPartition::Wipe_AndSec(void) {
 		return false;
 
 	gui_msg(Msg("wiping=Wiping {1}")(Backup_Display_Name));
-	TWFunc::removeDir(Mount_Point + "/.android_secure/", true);
+	twrpWipe wipe;
+	wipe.Remove_Tree(Mount_Point + "/.android_secure/", false);
 	return true;
 }
 
@@ -1950,7 +2011,11 @@ bool TWPartition::Wipe_Encryption() {
 			LOGINFO("Crypto key location reports size < 16K so not wiping crypto footer.\n");
 		}
 	}
-	if (Wipe(Fstab_File_System)) {
+	// the keys are gone, the format may as well securely discard all of the old data
+	Secure_Discard = true;
+	bool wiped = Wipe(Fstab_File_System);
+	Secure_Discard = false;
+	if (wiped) {
 		Has_Data_Media = Save_Data_Media;
 		if (Has_Data_Media && !Symlink_Mount_Point.empty()) {
 			Recreate_Media_Folder();
@@ -1973,8 +2038,7 @@ bool TWPartition::Wipe_Encryption() {
 }
 
 void TWPartition::Check_FS_Type() {
-	const char* type;
-	blkid_probe pr;
+	Probe_Result probe;
 
 	if (Fstab_File_System == "yaffs2" || Fstab_File_System == "mtd" || Fstab_File_System == "bml" || Ignore_Blkid)
 		return; // Running blkid on some mtd devices causes a massive crash or needs to be skipped
@@ -1983,21 +2047,10 @@ void TWPartition::Check_FS_Type() {
 	if (!Is_Present)
 		return;
 
-	pr = blkid_new_probe_from_filename(Actual_Block_Device.c_str());
-	if (blkid_do_fullprobe(pr)) {
-		blkid_free_probe(pr);
-		LOGINFO("Can't probe device %s\n", Actual_Block_Device.c_str());
+	if (!twrpProbeCache::Probe(Actual_Block_Device, probe))
 		return;
-	}
 
-	if (blkid_probe_lookup_value(pr, "TYPE", &type, NULL) < 0) {
-		blkid_free_probe(pr);
-		LOGINFO("can't find filesystem on device %s\n", Actual_Block_Device.c_str());
-		return;
-	}
-
-	Current_File_System = type;
-	blkid_free_probe(pr);
+	Current_File_System = probe.type;
 	if (fs_flags.size() > 1) {
 		std::vector<partition_fs_flags_struct>::iterator iter;
 		std::vector<partition_fs_flags_struct>::iterator found = fs_flags.begin();
@@ -2021,14 +2074,10 @@ bool TWPartition::Wipe_EXT23(string File_System) {
 	if (!UnMount(true))
 		return false;
 
-	if (TWFunc::Path_Exists("/sbin/mke2fs")) {
-		string command;
-
-		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("mke2fs"));
+	if (twrpFormat::Can_Format(File_System)) {
+		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name(File_System)));
 		Find_Actual_Block_Device();
-		command = "mke2fs -t " + File_System + " -m 0 " + Actual_Block_Device;
-		LOGINFO("mke2fs command: %s\n", command.c_str());
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		if (Format_Block_Device(File_System)) {
 			Current_File_System = File_System;
 			Recreate_AndSec_Folder();
 			gui_msg("done=Done.");
@@ -2052,74 +2101,35 @@ bool TWPartition::Wipe_EXT4() {
 	}
 	if (!UnMount(true))
 		return false;
+	if (!twrpFormat::Can_Format("ext4"))
+		return Wipe_RMRF();
 
-#if defined(USE_EXT4)
-	int ret;
-	char *secontext = NULL;
-
-	gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("make_ext4fs"));
-
-	if (!selinux_handle || selabel_lookup(selinux_handle, &secontext, Mount_Point.c_str(), S_IFDIR) < 0) {
-		LOGINFO("Cannot lookup security context for '%s'\n", Mount_Point.c_str());
-		ret = make_ext4fs(Actual_Block_Device.c_str(), Length, Mount_Point.c_str(), NULL);
-	} else {
-		ret = make_ext4fs(Actual_Block_Device.c_str(), Length, Mount_Point.c_str(), selinux_handle);
-	}
-	if (ret != 0) {
+	gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name("ext4")));
+	Find_Actual_Block_Device();
+	if (!Format_Block_Device("ext4")) {
 		gui_msg(Msg(msg::kError, "unable_to_wipe=Unable to wipe {1}.")(Display_Name));
 		return false;
-	} else {
-		string sedir = Mount_Point + "/lost+found";
-		PartitionManager.Mount_By_Path(sedir.c_str(), true);
-		rmdir(sedir.c_str());
-		mkdir(sedir.c_str(), S_IRWXU | S_IRWXG | S_IWGRP | S_IXGRP);
-		return true;
 	}
-#else
-	if (TWFunc::Path_Exists("/sbin/make_ext4fs")) {
-		string Command;
-
-		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("make_ext4fs"));
-		Find_Actual_Block_Device();
-		Command = "make_ext4fs";
-		if (!Is_Decrypted && Length != 0) {
-			// Only use length if we're not decrypted
-			char len[32];
-			sprintf(len, "%i", Length);
-			Command += " -l ";
-			Command += len;
-		}
-		if (TWFunc::Path_Exists("/file_contexts")) {
-			Command += " -S /file_contexts";
-		}
-		Command += " -a " + Mount_Point + " " + Actual_Block_Device;
-		LOGINFO("make_ext4fs command: %s\n", Command.c_str());
-		if (TWFunc::Exec_Cmd(Command) == 0) {
-			Current_File_System = "ext4";
-			Recreate_AndSec_Folder();
-			gui_msg("done=Done.");
-			return true;
-		} else {
-			gui_msg(Msg(msg::kError, "unable_to_wipe=Unable to wipe {1}.")(Display_Name));
-			return false;
-		}
-	} else
-		return Wipe_EXT23("ext4");
+#if defined(USE_EXT4)
+	string sedir = Mount_Point + "/lost+found";
+	PartitionManager.Mount_By_Path(sedir.c_str(), true);
+	rmdir(sedir.c_str());
+	mkdir(sedir.c_str(), S_IRWXU | S_IRWXG | S_IWGRP | S_IXGRP);
 #endif
-	return false;
+	Current_File_System = "ext4";
+	Recreate_AndSec_Folder();
+	gui_msg("done=Done.");
+	return true;
 }
 
 bool TWPartition::Wipe_FAT() {
-	string command;
-
-	if (TWFunc::Path_Exists("/sbin/mkfs.fat")) {
+	if (twrpFormat::Can_Format("vfat")) {
 		if (!UnMount(true))
 			return false;
 
-		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("mkfs.fat"));
+		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name("vfat")));
 		Find_Actual_Block_Device();
-		command = "mkfs.fat " + Actual_Block_Device;
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		if (Format_Block_Device("vfat")) {
 			Current_File_System = "vfat";
 			Recreate_AndSec_Folder();
 			gui_msg("done=Done.");
@@ -2137,16 +2147,13 @@ bool TWPartition::Wipe_FAT() {
 }
 
 bool TWPartition::Wipe_EXFAT() {
-	string command;
-
-	if (TWFunc::Path_Exists("/sbin/mkexfatfs")) {
+	if (twrpFormat::Can_Format("exfat")) {
 		if (!UnMount(true))
 			return false;
 
-		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("mkexfatfs"));
+		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name("exfat")));
 		Find_Actual_Block_Device();
-		command = "mkexfatfs " + Actual_Block_Device;
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		if (Format_Block_Device("exfat")) {
 			Recreate_AndSec_Folder();
 			gui_msg("done=Done.");
 			return true;
@@ -2202,33 +2209,20 @@ bool TWPartition::Wipe_RMRF() {
 		PartitionManager.Remove_MTP_Storage(MTP_Storage_ID);
 
 	gui_msg(Msg("remove_all=Removing all files under '{1}'")(Mount_Point));
-	TWFunc::removeDir(Mount_Point, true);
+	twrpWipe wipe;
+	wipe.Remove_Tree(Mount_Point, false);
 	Recreate_AndSec_Folder();
 	return true;
 }
 
 bool TWPartition::Wipe_F2FS() {
-	string command;
-
-	if (TWFunc::Path_Exists("/sbin/mkfs.f2fs")) {
+	if (twrpFormat::Can_Format("f2fs")) {
 		if (!UnMount(true))
 			return false;
 
-		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)("mkfs.f2fs"));
+		gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name("f2fs")));
 		Find_Actual_Block_Device();
-		command = "mkfs.f2fs -t 0";
-		if (!Is_Decrypted && Length != 0) {
-			// Only use length if we're not decrypted
-			char len[32];
-			int mod_length = Length;
-			if (Length < 0)
-				mod_length *= -1;
-			sprintf(len, "%i", mod_length);
-			command += " -r ";
-			command += len;
-		}
-		command += " " + Actual_Block_Device;
-		if (TWFunc::Exec_Cmd(command) == 0) {
+		if (Format_Block_Device("f2fs")) {
 			Recreate_AndSec_Folder();
 			gui_msg("done=Done.");
 			return true;
@@ -2238,30 +2232,22 @@ bool TWPartition::Wipe_F2FS() {
 		}
 		return true;
 	} else {
-		LOGINFO("mkfs.f2fs binary not found, using rm -rf to wipe.\n");
+		LOGINFO("Nothing can make f2fs, using rm -rf to wipe.\n");
 		return Wipe_RMRF();
 	}
 	return false;
 }
 
 bool TWPartition::Wipe_NTFS() {
-	string command;
-	string Ntfsmake_Binary;
-
-	if (TWFunc::Path_Exists("/sbin/mkntfs"))
-		Ntfsmake_Binary = "mkntfs";
-	else if (TWFunc::Path_Exists("/sbin/mkfs.ntfs"))
-		Ntfsmake_Binary = "mkfs.ntfs";
-	else
+	if (!twrpFormat::Can_Format("ntfs"))
 		return false;
 
 	if (!UnMount(true))
 		return false;
 
-	gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(Ntfsmake_Binary));
+	gui_msg(Msg("formatting_using=Formatting {1} using {2}...")(Display_Name)(twrpFormat::Tool_Name("ntfs")));
 	Find_Actual_Block_Device();
-	command = "/sbin/" + Ntfsmake_Binary + " " + Actual_Block_Device;
-	if (TWFunc::Exec_Cmd(command) == 0) {
+	if (Format_Block_Device("ntfs")) {
 		Recreate_AndSec_Folder();
 		gui_msg("done=Done.");
 		return true;
@@ -2290,40 +2276,43 @@ bool TWPartition::Wipe_Data_Without_Wiping_Media() {
 #endif // ifdef TW_OEM_BUILD
 }
 
-bool TWPartition::Wipe_Data_Without_Wiping_Media_Func(const string& parent __unused) {
-	string dir;
+bool TWPartition::Wipe_Data_Without_Wiping_Media_Func(const string& parent) {
+	twrpWipe wipe;
 
-	DIR* d;
-	d = opendir(parent.c_str());
-	if (d != NULL) {
-		struct dirent* de;
-		while ((de = readdir(d)) != NULL) {
-			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)	 continue;
+	wipe.Set_Exclusions(&wipe_exclusions);
+	return wipe.Remove_Tree(parent, false);
+}
 
-			dir = parent;
-			dir.append(de->d_name);
-			if (wipe_exclusions.check_skip_dirs(dir)) {
-				LOGINFO("skipped '%s'\n", dir.c_str());
-				continue;
-			}
-			if (de->d_type == DT_DIR) {
-				dir.append("/");
-				if (!Wipe_Data_Without_Wiping_Media_Func(dir)) {
-					closedir(d);
-					return false;
-				}
-				rmdir(dir.c_str());
-			} else if (de->d_type == DT_REG || de->d_type == DT_LNK || de->d_type == DT_FIFO || de->d_type == DT_SOCK) {
-				if (unlink(dir.c_str()) != 0)
-					LOGINFO("Unable to unlink '%s': %s\n", dir.c_str(), strerror(errno));
-			}
-		}
-		closedir(d);
+bool TWPartition::Format_Block_Device(const string& File_System) {
+	Format_Options options;
+	options.block_device = Actual_Block_Device;
+	options.file_system = File_System;
+	options.mount_point = Mount_Point;
+	options.length = Length;
+	options.use_length = !Is_Decrypted; // Only use length if we're not decrypted
+	options.secure_discard = Secure_Discard;
+	options.size = TWFunc::IOCTL_Get_Block_Size(Actual_Block_Device.c_str());
+	options.discard_length = Get_Discard_Length(options.size);
+	ProgressTracking progress(options.size);
+	options.progress = &progress;
+	return twrpFormat::Format(options);
+}
 
-		return true;
+uint64_t TWPartition::Get_Discard_Length(uint64_t end) {
+	if (!Is_Present || Actual_Block_Device.empty())
+		return 0;
+	if (!Secure_Discard) {
+		// keep whatever the file system leaves free at the end, e.g. a crypto footer
+		if (Is_Decrypted)
+			return 0; // dm-crypt mostly refuses discards and Length is for the raw device
+		if (Length > 0 && (uint64_t)Length < end)
+			end = Length;
+		else if (Length < 0 && (uint64_t)(-(int64_t)Length) < end)
+			end -= -(int64_t)Length;
+		else if (Length == 0 && Crypto_Key_Location == "footer" && end > CRYPT_FOOTER_OFFSET)
+			end -= CRYPT_FOOTER_OFFSET;
 	}
-	gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(Mount_Point)(strerror(errno)));
-	return false;
+	return end & ~4095ULL;
 }
 
 bool TWPartition::Backup_Tar(PartitionSettings *part_settings, pid_t *tar_fork_pid) {
@@ -2420,6 +2409,7 @@ bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 	}
 	else {
 		destfn = Actual_Block_Device;
+		twrpProbeCache::Invalidate(destfn);
 		if (part_settings->adbbackup) {
 			srcfn = TW_ADB_RESTORE;
 		} else {
@@ -2463,14 +2453,19 @@ bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 	while (Remain > 0) {
 		if (Remain < RW_Block_Size)
 			bs = (ssize_t)(Remain);
+		uint64_t start = twrpTelemetry::Now();
 		if (read(src_fd, buffer, bs) != bs) {
 			LOGINFO("Error reading source fd (%s)\n", strerror(errno));
 			goto exit;
 		}
+		uint64_t now = twrpTelemetry::Now();
+		twrpTelemetry::Add(TELEMETRY_MAIN_SLOT, TELEMETRY_READ, now - start, bs);
+		start = now;
 		if (write(dest_fd, buffer, bs) != bs) {
 			LOGINFO("Error writing destination fd (%s)\n", strerror(errno));
 			goto exit;
 		}
+		twrpTelemetry::Add(TELEMETRY_MAIN_SLOT, TELEMETRY_WRITE, twrpTelemetry::Now() - start, bs);
 		backedup_size += (unsigned long long)(bs);
 		Remain -= (unsigned long long)(bs);
 		if (part_settings->progress)
@@ -2480,7 +2475,11 @@ bool TWPartition::Raw_Read_Write(PartitionSettings *part_settings) {
 	}
 	if (part_settings->progress)
 		part_settings->progress->UpdateDisplayDetails(true);
-	fsync(dest_fd);
+	{
+		twrpStageTimer fsync_timer(TELEMETRY_FSYNC);
+		fsync(dest_fd);
+		fsync_timer.Stop(backedup_size);
+	}
 
 	if (!part_settings->adbbackup && part_settings->PM_Method == PM_BACKUP) {
 		tw_set_default_metadata(destfn.c_str());
@@ -2675,6 +2674,11 @@ bool TWPartition::Update_Size(bool Display_Error) {
 	}
 
 	Was_Already_Mounted = Is_Mounted();
+	if (!Was_Already_Mounted && Size_Signature != 0 && Get_Superblock_Signature() == Size_Signature) {
+		LOGINFO("%s has not changed since its sizes were last read\n", Mount_Point.c_str());
+		return true;
+	}
+	Size_Signature = 0;
 	if (Removable || Is_Encrypted) {
 		if (!Mount(false))
 			return true;
@@ -2692,7 +2696,7 @@ bool TWPartition::Update_Size(bool Display_Error) {
 
 	if (Has_Data_Media) {
 		if (Mount(Display_Error)) {
-			Used = backup_exclusions.Get_Folder_Size(Mount_Point);
+			Used = Get_Folder_Size_Cached(Mount_Point);
 			Backup_Size = Used;
 			int bak = (int)(Used / 1048576LLU);
 			int fre = (int)(Free / 1048576LLU);
@@ -2704,15 +2708,19 @@ bool TWPartition::Update_Size(bool Display_Error) {
 		}
 	} else if (Has_Android_Secure) {
 		if (Mount(Display_Error))
-			Backup_Size = backup_exclusions.Get_Folder_Size(Backup_Path);
+			Backup_Size = Get_Folder_Size_Cached(Backup_Path);
 		else {
 			if (!Was_Already_Mounted)
 				UnMount(false);
 			return false;
 		}
 	}
-	if (!Was_Already_Mounted)
+	if (!Was_Already_Mounted) {
 		UnMount(false);
+		// an untouched file system need not be mounted again for the next update
+		if (!Is_Mounted())
+			Size_Signature = Get_Superblock_Signature();
+	}
 	return true;
 }
 
@@ -2953,6 +2961,7 @@ bool TWPartition::Flash_Sparse_Image(const string& Filename) {
 	Command = "simg2img '" + Filename + "' '" + Actual_Block_Device + "'";
 	LOGINFO("Flash command: '%s'\n", Command.c_str());
 	TWFunc::Exec_Cmd(Command);
+	twrpProbeCache::Invalidate(Actual_Block_Device);
 	return true;
 }
 
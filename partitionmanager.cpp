@@ -34,6 +34,7 @@
 #include <sys/wait.h>
 #include <linux/fs.h>
 #include <sys/mount.h>
+#include <pthread.h>
 
 #include <sys/poll.h>
 #include <sys/socket.h>
@@ -52,6 +53,11 @@
 #include "gui/gui.hpp"
 #include "progresstracking.hpp"
 #include "twrpDigestDriver.hpp"
+#include "twrpTelemetry.hpp"
+#include "twrpBackupManifest.hpp"
+#include "twrpProbeCache.hpp"
+#include "twrpWipe.hpp"
+#include "infomanager.hpp"
 #include "adbbu/libtwadbbu.hpp"
 
 #ifdef TW_HAS_MTP
@@ -82,8 +88,17 @@ extern "C" {
 #include <hardware/boot_control.h>
 #endif
 
+// Size updates mostly wait on mounts and folder walks, more workers than this only add contention
+#define MAX_SIZE_UPDATE_THREADS 4
+
 extern bool datamedia;
 
+#ifndef PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP
+pthread_mutex_t TWPartitionManager::mtp_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER;
+#else
+pthread_mutex_t TWPartitionManager::mtp_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+#endif
+
 TWPartitionManager::TWPartitionManager(void) {
 	mtp_was_enabled = false;
 	mtp_write_fd = -1;
@@ -102,7 +117,7 @@ TWPartitionManager::TWPartitionManager(void) {
 #endif
 }
 
-int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error) {
+int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error, bool Update_Details) {
 	FILE *fstabFile;
 	char fstab_line[MAX_FSTAB_LINE_LENGTH];
 	TWPartition* settings_partition = NULL;
@@ -305,8 +320,10 @@ int TWPartitionManager::Process_Fstab(string Fstab_Filename, bool Display_Error)
 		Decrypt_Adopted();
 	}
 #endif
-	Update_System_Details();
-	UnMount_Main_Partitions();
+	if (Update_Details) {
+		Update_System_Details();
+		UnMount_Main_Partitions();
+	}
 #ifdef AB_OTA_UPDATER
 	DataManager::SetValue("tw_active_slot", Get_Active_Slot_Display());
 #endif
@@ -622,10 +639,59 @@ int TWPartitionManager::Check_Backup_Name(bool Display_Error) {
 	return 0;
 }
 
+// Flushes a finished partition backup to storage, counted as the fsync stage.
+static void Sync_Backup(void) {
+	twrpStageTimer fsync_timer(TELEMETRY_FSYNC);
+	sync();
+	sync();
+}
+
+static bool Timed_Make_Digest(const string& Backup_Folder, const string& Backup_FileName, const string& Full_Filename) {
+	twrpStageTimer digest_timer(TELEMETRY_DIGEST);
+	bool ret = twrpDigestDriver::Make_Digest(Full_Filename);
+	digest_timer.Stop(twrpTelemetry::Archive_Bytes(Backup_Folder, Backup_FileName));
+	return ret;
+}
+
+// Digests are checked before any partition is restored; the time is booked on the
+// partition's record, which Restore_Partition adds to later.
+static bool Timed_Check_Digest(const string& Backup_Name, const string& Backup_Folder, const string& Backup_FileName) {
+	twrpTelemetry::Begin_Partition(Backup_Name);
+	twrpStageTimer digest_timer(TELEMETRY_DIGEST);
+	bool ret = twrpDigestDriver::Check_Digest(Backup_Folder + "/" + Backup_FileName);
+	digest_timer.Stop(twrpTelemetry::Archive_Bytes(Backup_Folder, Backup_FileName));
+	twrpTelemetry::End_Partition(0);
+	return ret;
+}
+
+// Records a partition that was just backed up in the manifest of the backup
+void TWPartitionManager::Add_Manifest_Entry(PartitionSettings *part_settings, TWPartition *Part) {
+	if (part_settings->manifest == NULL)
+		return;
+
+	Backup_Manifest_Entry entry;
+	entry.backup_name = Part->Backup_Name;
+	entry.file_name = Part->Backup_FileName;
+	entry.sub_partition = Part->Is_SubPartition;
+	entry.archive_size = twrpTelemetry::Archive_Bytes(part_settings->Backup_Folder, Part->Backup_FileName);
+	entry.backup_size = entry.archive_size;
+	entry.backup_type = -1;
+	entry.digest = part_settings->generate_digest;
+	if (Part->Backup_Method == BM_FILES) {
+		InfoManager backup_info(part_settings->Backup_Folder + "/" + Part->Backup_Name + ".info");
+		if (backup_info.LoadValues() == 0) {
+			backup_info.GetValue("backup_size", entry.backup_size);
+			backup_info.GetValue("backup_type", entry.backup_type);
+		}
+	}
+	part_settings->manifest->entries.push_back(entry);
+}
+
 bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 	time_t start, stop;
 	int use_compression;
 	string backup_log = part_settings->Backup_Folder + "/recovery.log";
+	string Backup_FileName;
 
 	if (part_settings->Part == NULL)
 		return true;
@@ -634,15 +700,17 @@ bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 
 	TWFunc::SetPerformanceMode(true);
 	time(&start);
+	twrpTelemetry::Begin_Partition(part_settings->Part->Backup_Name);
 
 	if (part_settings->Part->Backup(part_settings, &tar_fork_pid)) {
-		sync();
-		sync();
-		string Full_Filename = part_settings->Backup_Folder + "/" + part_settings->Part->Backup_FileName;
+		Sync_Backup();
+		Backup_FileName = part_settings->Part->Backup_FileName;
+		string Full_Filename = part_settings->Backup_Folder + "/" + Backup_FileName;
 		if (!part_settings->adbbackup && part_settings->generate_digest) {
-			if (!twrpDigestDriver::Make_Digest(Full_Filename))
+			if (!Timed_Make_Digest(part_settings->Backup_Folder, Backup_FileName, Full_Filename))
 				goto backup_error;
 		}
+		Add_Manifest_Entry(part_settings, part_settings->Part);
 
 		if (part_settings->Part->Has_SubPartition) {
 			std::vector<TWPartition*>::iterator subpart;
@@ -654,13 +722,13 @@ bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 					if (!(*subpart)->Backup(part_settings, &tar_fork_pid)) {
 						goto backup_error;
 					}
-					sync();
-					sync();
+					Sync_Backup();
 					if (!part_settings->adbbackup && part_settings->generate_digest) {
-						if (!twrpDigestDriver::Make_Digest(Full_Filename)) {
+						if (!Timed_Make_Digest(part_settings->Backup_Folder, Backup_FileName, Full_Filename)) {
 							goto backup_error;
 						}
 					}
+					Add_Manifest_Entry(part_settings, *subpart);
 				}
 			}
 		}
@@ -676,10 +744,12 @@ bool TWPartitionManager::Backup_Partition(PartitionSettings *part_settings) {
 
 		}
 
+		twrpTelemetry::End_Partition(part_settings->adbbackup ? 0 : twrpTelemetry::Archive_Bytes(part_settings->Backup_Folder, Backup_FileName));
 		TWFunc::SetPerformanceMode(false);
 		return true;
 	}
 backup_error:
+	twrpTelemetry::End_Partition(0);
 	Clean_Backup_Folder(part_settings->Backup_Folder);
 	TWFunc::copy_file("/tmp/recovery.log", backup_log, 0644);
 	tw_set_default_metadata(backup_log.c_str());
@@ -753,6 +823,7 @@ int TWPartitionManager::Cancel_Backup() {
 
 int TWPartitionManager::Run_Backup(bool adbbackup) {
 	PartitionSettings part_settings;
+	twrpBackupManifest manifest;
 	int partition_count = 0, disable_free_space_check = 0, skip_digest = 0;
 	string Backup_Name, Backup_List, backup_path;
 	unsigned long long total_bytes = 0, free_space = 0;
@@ -774,7 +845,9 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 	part_settings.PM_Method = PM_BACKUP;
 
 	part_settings.adbbackup = adbbackup;
+	part_settings.manifest = adbbackup ? NULL : &manifest;
 	time(&total_start);
+	twrpTelemetry::Start_Operation("backup");
 
 	Update_System_Details();
 
@@ -948,9 +1021,18 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 	Update_System_Details();
 	UnMount_Main_Partitions();
 	gui_msg(Msg(msg::kHighlight, "backup_completed=[BACKUP COMPLETED IN {1} SECONDS]")(total_time)); // the end
+	twrpTelemetry::Publish();
+	if (!part_settings.adbbackup)
+		twrpTelemetry::Write_Report(part_settings.Backup_Folder + "/telemetry.json");
 	string backup_log = part_settings.Backup_Folder + "/recovery.log";
 	TWFunc::copy_file("/tmp/recovery.log", backup_log, 0644);
 	tw_set_default_metadata(backup_log.c_str());
+	if (!part_settings.adbbackup) {
+		// written last so the index sees the final state of the backup folder
+		manifest.date = total_stop;
+		if (!manifest.Save(part_settings.Backup_Folder))
+			LOGINFO("Unable to save the backup manifest\n");
+	}
 
 	if (part_settings.adbbackup) {
 		if (twadbbu::Write_ADB_Stream_Trailer() == false) {
@@ -965,18 +1047,22 @@ int TWPartitionManager::Run_Backup(bool adbbackup) {
 
 bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 	time_t Start, Stop;
+	string Backup_FileName;
 
 	if (part_settings->adbbackup) {
 		std::string partName = part_settings->Part->Backup_Name + "." + part_settings->Part->Current_File_System + ".win";
 		LOGINFO("setting backup name: %s\n", partName.c_str());
 		part_settings->Part->Set_Backup_FileName(part_settings->Part->Backup_Name + "." + part_settings->Part->Current_File_System + ".win");
 	}
+	Backup_FileName = part_settings->Part->Backup_FileName;
 
 	TWFunc::SetPerformanceMode(true);
 
 	time(&Start);
+	twrpTelemetry::Begin_Partition(part_settings->Part->Backup_Name);
 
 	if (!part_settings->Part->Restore(part_settings)) {
+		twrpTelemetry::End_Partition(0);
 		TWFunc::SetPerformanceMode(false);
 		return false;
 	}
@@ -990,12 +1076,14 @@ bool TWPartitionManager::Restore_Partition(PartitionSettings *part_settings) {
 				part_settings->Part = (*subpart);
 				part_settings->Part->Set_Backup_FileName(part_settings->Part->Backup_Name + "." + part_settings->Part->Current_File_System + ".win");
 				if (!(*subpart)->Restore(part_settings)) {
+					twrpTelemetry::End_Partition(0);
 					TWFunc::SetPerformanceMode(false);
 					return false;
 				}
 			}
 		}
 	}
+	twrpTelemetry::End_Partition(part_settings->adbbackup ? 0 : twrpTelemetry::Archive_Bytes(part_settings->Backup_Folder, Backup_FileName));
 	time(&Stop);
 	TWFunc::SetPerformanceMode(false);
 	gui_msg(Msg("restore_part_done=[{1} done ({2} seconds)]")(part_settings->Part->Backup_Display_Name)((int)difftime(Stop, Start)));
@@ -1018,6 +1106,7 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 	part_settings.total_restore_size = 0;
 	part_settings.adbbackup = false;
 	part_settings.PM_Method = PM_RESTORE;
+	twrpTelemetry::Start_Operation("restore");
 
 	gui_msg("restore_started=[RESTORE STARTED]");
 	gui_msg(Msg("restore_folder=Restore folder: '{1}'")(Restore_Name));
@@ -1047,9 +1136,7 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 					return false;
 				}
 
-				string Full_Filename = part_settings.Backup_Folder + "/" + part_settings.Part->Backup_FileName;
-
-				if (check_digest > 0 && !twrpDigestDriver::Check_Digest(Full_Filename))
+				if (check_digest > 0 && !Timed_Check_Digest(part_settings.Part->Backup_Name, part_settings.Backup_Folder, part_settings.Part->Backup_FileName))
 					return false;
 				part_settings.partition_count++;
 				part_settings.total_restore_size += part_settings.Part->Get_Restore_Size(&part_settings);
@@ -1060,7 +1147,7 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 					for (subpart = Partitions.begin(); subpart != Partitions.end(); subpart++) {
 						part_settings.Part = *subpart;
 						if ((*subpart)->Is_SubPartition && (*subpart)->SubPartition_Of == parentPart->Mount_Point) {
-							if (check_digest > 0 && !twrpDigestDriver::Check_Digest(Full_Filename))
+							if (check_digest > 0 && !Timed_Check_Digest(parentPart->Backup_Name, part_settings.Backup_Folder, parentPart->Backup_FileName))
 								return false;
 							part_settings.total_restore_size += (*subpart)->Get_Restore_Size(&part_settings);
 						}
@@ -1109,6 +1196,8 @@ int TWPartitionManager::Run_Restore(const string& Restore_Name) {
 	UnMount_Main_Partitions();
 	time(&rStop);
 	gui_msg(Msg(msg::kHighlight, "restore_completed=[RESTORE COMPLETED IN {1} SECONDS]")((int)difftime(rStop,rStart)));
+	twrpTelemetry::Publish();
+	twrpTelemetry::Write_Report(Restore_Name + "/restore_telemetry.json");
 	DataManager::SetValue("tw_file_progress", "");
 
 	return true;
@@ -1119,6 +1208,7 @@ void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 	string Restore_List;
 	bool get_date = true, check_encryption = true;
 	bool adbbackup = false;
+	twrpBackupManifest manifest;
 
 	DataManager::SetValue("tw_restore_encrypted", 0);
 	if (twadbbu::Check_ADB_Backup_File(Restore_Name)) {
@@ -1135,6 +1225,22 @@ void TWPartitionManager::Set_Restore_Files(string Restore_Name) {
 		}
 		DataManager::SetValue("tw_enable_adb_backup", 1);
 	}
+	else if (manifest.Load(Restore_Name)) {
+		// The manifest has everything the folder scan below would find, without opening the archives
+		string backup_date = ctime(&manifest.date);
+		DataManager::SetValue(TW_RESTORE_FILE_DATE, backup_date);
+		DataManager::SetValue("tw_restore_encrypted", manifest.Encrypted() ? 1 : 0);
+		for (std::vector<Backup_Manifest_Entry>::iterator entry = manifest.entries.begin(); entry != manifest.entries.end(); ++entry) {
+			TWPartition* Part = Find_Partition_By_Path(entry->backup_name);
+			if (Part == NULL) {
+				gui_msg(Msg(msg::kError, "unable_locate_part_backup_name=Unable to locate partition by backup name: '{1}'")(entry->backup_name));
+				continue;
+			}
+			Part->Backup_FileName = entry->file_name;
+			if (!Part->Is_SubPartition)
+				Restore_List += Part->Backup_Path + ";";
+		}
+	}
 	else {
 		DIR* d;
 		d = opendir(Restore_Name.c_str());
@@ -1334,7 +1440,8 @@ int TWPartitionManager::Wipe_Dalvik_Cache(void) {
 	gui_msg("wiping_dalvik=Wiping Dalvik Cache Directories...");
 	for (unsigned i = 0; i < dir.size(); ++i) {
 		if (stat(dir.at(i).c_str(), &st) == 0) {
-			TWFunc::removeDir(dir.at(i), false);
+			twrpWipe wipe;
+			wipe.Remove_Tree(dir.at(i), true);
 			gui_msg(Msg("cleaned=Cleaned: {1}...")(dir.at(i)));
 		}
 	}
@@ -1415,7 +1522,8 @@ int TWPartitionManager::Wipe_Media_From_Data(void) {
 
 		gui_msg("wiping_datamedia=Wiping internal storage -- /data/media...");
 		Remove_MTP_Storage(dat->MTP_Storage_ID);
-		TWFunc::removeDir("/data/media", false);
+		twrpWipe wipe;
+		wipe.Remove_Tree("/data/media", true);
 		dat->Recreate_Media_Folder();
 		Add_MTP_Storage(dat->MTP_Storage_ID);
 		return true;
@@ -1482,70 +1590,154 @@ int TWPartitionManager::Resize_By_Path(string Path, bool Display_Error) {
 	return false;
 }
 
+// Partitions sharing a block device, or with one mount point inside the other, are mounted
+// and unmounted by the same worker so they never race each other.
+static bool Path_Contains(const string& Outer, const string& Inner) {
+	if (Outer.empty() || Inner.empty())
+		return false;
+	return Outer == Inner || (Inner.size() > Outer.size() && Inner.compare(0, Outer.size(), Outer) == 0 && Inner[Outer.size()] == '/');
+}
+
+bool TWPartitionManager::Size_Update_Related(TWPartition* A, TWPartition* B) {
+	if (!A->Actual_Block_Device.empty() && A->Actual_Block_Device == B->Actual_Block_Device)
+		return true;
+	if (A->SubPartition_Of == B->Mount_Point || B->SubPartition_Of == A->Mount_Point)
+		return true;
+	if (Path_Contains(A->Mount_Point, B->Mount_Point) || Path_Contains(B->Mount_Point, A->Mount_Point))
+		return true;
+	return Path_Contains(A->Symlink_Mount_Point, B->Mount_Point) || Path_Contains(B->Symlink_Mount_Point, A->Mount_Point)
+		|| Path_Contains(A->Mount_Point, B->Symlink_Mount_Point) || Path_Contains(B->Mount_Point, A->Symlink_Mount_Point);
+}
+
+struct Size_Update_Work {
+	std::vector<std::vector<TWPartition*> > groups;
+	volatile int next;
+	int data_size;
+};
+
+void* TWPartitionManager::Size_Update_Thread(void* cookie) {
+	Size_Update_Work* work = (Size_Update_Work*)cookie;
+
+	for (;;) {
+		int index = __sync_fetch_and_add(&work->next, 1);
+		if (index >= (int)work->groups.size())
+			break;
+		for (size_t i = 0; i < work->groups[index].size(); i++) {
+			TWPartition* Part = work->groups[index][i];
+			Part->Update_Size(true);
+			// publish each result right away so the GUI fills in while the rest are scanned
+			PartitionManager.Update_Partition_Details(Part, &work->data_size);
+		}
+	}
+	return NULL;
+}
+
+void TWPartitionManager::Update_Partition_Details(TWPartition* Part, int* data_size) {
+	if (Part->Can_Be_Mounted) {
+		if (Part->Mount_Point == "/system") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_SYSTEM_SIZE, backup_display_size);
+		} else if (Part->Mount_Point == "/data" || Part->Mount_Point == "/datadata") {
+			__sync_fetch_and_add(data_size, (int)(Part->Backup_Size / 1048576LLU));
+		} else if (Part->Mount_Point == "/cache") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_CACHE_SIZE, backup_display_size);
+		} else if (Part->Mount_Point == "/sd-ext") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_SDEXT_SIZE, backup_display_size);
+			if (Part->Backup_Size == 0) {
+				DataManager::SetValue(TW_HAS_SDEXT_PARTITION, 0);
+				DataManager::SetValue(TW_BACKUP_SDEXT_VAR, 0);
+			} else
+				DataManager::SetValue(TW_HAS_SDEXT_PARTITION, 1);
+		} else if (Part->Has_Android_Secure) {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_ANDSEC_SIZE, backup_display_size);
+			if (Part->Backup_Size == 0) {
+				DataManager::SetValue(TW_HAS_ANDROID_SECURE, 0);
+				DataManager::SetValue(TW_BACKUP_ANDSEC_VAR, 0);
+			} else
+				DataManager::SetValue(TW_HAS_ANDROID_SECURE, 1);
+		} else if (Part->Mount_Point == "/boot") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_BOOT_SIZE, backup_display_size);
+			if (Part->Backup_Size == 0) {
+				DataManager::SetValue("tw_has_boot_partition", 0);
+				DataManager::SetValue(TW_BACKUP_BOOT_VAR, 0);
+			} else
+				DataManager::SetValue("tw_has_boot_partition", 1);
+		}
+	} else {
+		// Handle unmountable partitions in case we reset defaults
+		if (Part->Mount_Point == "/boot") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_BOOT_SIZE, backup_display_size);
+			if (Part->Backup_Size == 0) {
+				DataManager::SetValue(TW_HAS_BOOT_PARTITION, 0);
+				DataManager::SetValue(TW_BACKUP_BOOT_VAR, 0);
+			} else
+				DataManager::SetValue(TW_HAS_BOOT_PARTITION, 1);
+		} else if (Part->Mount_Point == "/recovery") {
+			int backup_display_size = (int)(Part->Backup_Size / 1048576LLU);
+			DataManager::SetValue(TW_BACKUP_RECOVERY_SIZE, backup_display_size);
+			if (Part->Backup_Size == 0) {
+				DataManager::SetValue(TW_HAS_RECOVERY_PARTITION, 0);
+				DataManager::SetValue(TW_BACKUP_RECOVERY_VAR, 0);
+			} else
+				DataManager::SetValue(TW_HAS_RECOVERY_PARTITION, 1);
+		} else if (Part->Mount_Point == "/data") {
+			__sync_fetch_and_add(data_size, (int)(Part->Backup_Size / 1048576LLU));
+		}
+	}
+}
+
 void TWPartitionManager::Update_System_Details(void) {
 	std::vector<TWPartition*>::iterator iter;
-	int data_size = 0;
+	Size_Update_Work work;
 
 	gui_msg("update_part_details=Updating partition details...");
+
+	// group related partitions, keeping fstab order within a group
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
-		(*iter)->Update_Size(true);
-		if ((*iter)->Can_Be_Mounted) {
-			if ((*iter)->Mount_Point == "/system") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_SYSTEM_SIZE, backup_display_size);
-			} else if ((*iter)->Mount_Point == "/data" || (*iter)->Mount_Point == "/datadata") {
-				data_size += (int)((*iter)->Backup_Size / 1048576LLU);
-			} else if ((*iter)->Mount_Point == "/cache") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_CACHE_SIZE, backup_display_size);
-			} else if ((*iter)->Mount_Point == "/sd-ext") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_SDEXT_SIZE, backup_display_size);
-				if ((*iter)->Backup_Size == 0) {
-					DataManager::SetValue(TW_HAS_SDEXT_PARTITION, 0);
-					DataManager::SetValue(TW_BACKUP_SDEXT_VAR, 0);
-				} else
-					DataManager::SetValue(TW_HAS_SDEXT_PARTITION, 1);
-			} else if ((*iter)->Has_Android_Secure) {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_ANDSEC_SIZE, backup_display_size);
-				if ((*iter)->Backup_Size == 0) {
-					DataManager::SetValue(TW_HAS_ANDROID_SECURE, 0);
-					DataManager::SetValue(TW_BACKUP_ANDSEC_VAR, 0);
-				} else
-					DataManager::SetValue(TW_HAS_ANDROID_SECURE, 1);
-			} else if ((*iter)->Mount_Point == "/boot") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_BOOT_SIZE, backup_display_size);
-				if ((*iter)->Backup_Size == 0) {
-					DataManager::SetValue("tw_has_boot_partition", 0);
-					DataManager::SetValue(TW_BACKUP_BOOT_VAR, 0);
-				} else
-					DataManager::SetValue("tw_has_boot_partition", 1);
-			}
-		} else {
-			// Handle unmountable partitions in case we reset defaults
-			if ((*iter)->Mount_Point == "/boot") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_BOOT_SIZE, backup_display_size);
-				if ((*iter)->Backup_Size == 0) {
-					DataManager::SetValue(TW_HAS_BOOT_PARTITION, 0);
-					DataManager::SetValue(TW_BACKUP_BOOT_VAR, 0);
-				} else
-					DataManager::SetValue(TW_HAS_BOOT_PARTITION, 1);
-			} else if ((*iter)->Mount_Point == "/recovery") {
-				int backup_display_size = (int)((*iter)->Backup_Size / 1048576LLU);
-				DataManager::SetValue(TW_BACKUP_RECOVERY_SIZE, backup_display_size);
-				if ((*iter)->Backup_Size == 0) {
-					DataManager::SetValue(TW_HAS_RECOVERY_PARTITION, 0);
-					DataManager::SetValue(TW_BACKUP_RECOVERY_VAR, 0);
-				} else
-					DataManager::SetValue(TW_HAS_RECOVERY_PARTITION, 1);
-			} else if ((*iter)->Mount_Point == "/data") {
-				data_size += (int)((*iter)->Backup_Size / 1048576LLU);
+		(*iter)->Find_Actual_Block_Device();
+		int group = -1;
+		for (size_t g = 0; g < work.groups.size(); g++) {
+			for (size_t i = 0; i < work.groups[g].size(); i++) {
+				if (Size_Update_Related(*iter, work.groups[g][i])) {
+					if (group < 0) {
+						group = g;
+						work.groups[g].push_back(*iter);
+					} else if ((int)g != group) {
+						// joins two groups that were independent so far
+						work.groups[group].insert(work.groups[group].end(), work.groups[g].begin(), work.groups[g].end());
+						work.groups[g].clear();
+					}
+					break;
+				}
 			}
 		}
+		if (group < 0)
+			work.groups.push_back(std::vector<TWPartition*>(1, *iter));
+	}
+	work.next = 0;
+	work.data_size = 0;
+
+	int thread_count = sysconf(_SC_NPROCESSORS_ONLN);
+	if (thread_count > MAX_SIZE_UPDATE_THREADS)
+		thread_count = MAX_SIZE_UPDATE_THREADS;
+	if (thread_count > (int)work.groups.size())
+		thread_count = work.groups.size();
+	std::vector<pthread_t> threads;
+	for (int i = 1; i < thread_count; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, Size_Update_Thread, &work) == 0)
+			threads.push_back(thread);
 	}
+	Size_Update_Thread(&work);
+	for (size_t i = 0; i < threads.size(); i++)
+		pthread_join(threads[i], NULL);
+	int data_size = work.data_size;
+
 	gui_msg("update_part_details_done=...done");
 	DataManager::SetValue(TW_BACKUP_DATA_SIZE, data_size);
 	string current_storage_path = DataManager::GetCurrentStoragePath();
@@ -2202,7 +2394,16 @@ TWPartition *TWPartitionManager::Get_Default_Storage_Partition()
 	return res;
 }
 
+// MTP is started behind the UI at boot, so it can race GUI and ORS toggles and the storage
+// changes of wipes. mtp_lock is recursive because enabling adds all storage.
 bool TWPartitionManager::Enable_MTP(void) {
+	pthread_mutex_lock(&mtp_lock);
+	bool ret = Enable_MTP_Locked();
+	pthread_mutex_unlock(&mtp_lock);
+	return ret;
+}
+
+bool TWPartitionManager::Enable_MTP_Locked(void) {
 #ifdef TW_HAS_MTP
 	if (mtppid) {
 		gui_err("mtp_already_enabled=MTP already enabled");
@@ -2258,19 +2459,27 @@ void TWPartitionManager::Add_All_MTP_Storage(void) {
 #ifdef TW_HAS_MTP
 	std::vector<TWPartition*>::iterator iter;
 
-	if (!mtppid)
-		return; // MTP is not enabled
-
-	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
-		if ((*iter)->Is_Storage && (*iter)->Is_Present && (*iter)->Mount(false))
-			Add_Remove_MTP_Storage((*iter), MTP_MESSAGE_ADD_STORAGE);
+	pthread_mutex_lock(&mtp_lock);
+	if (mtppid) { // otherwise MTP is not enabled
+		for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
+			if ((*iter)->Is_Storage && (*iter)->Is_Present && (*iter)->Mount(false))
+				Add_Remove_MTP_Storage_Locked((*iter), MTP_MESSAGE_ADD_STORAGE);
+		}
 	}
+	pthread_mutex_unlock(&mtp_lock);
 #else
 	return;
 #endif
 }
 
 bool TWPartitionManager::Disable_MTP(void) {
+	pthread_mutex_lock(&mtp_lock);
+	bool ret = Disable_MTP_Locked();
+	pthread_mutex_unlock(&mtp_lock);
+	return ret;
+}
+
+bool TWPartitionManager::Disable_MTP_Locked(void) {
 	char old_value[PROPERTY_VALUE_MAX];
 	property_get("sys.usb.config", old_value, "");
 	if (strcmp(old_value, "adb") != 0) {
@@ -2316,6 +2525,13 @@ TWPartition* TWPartitionManager::Find_Partition_By_MTP_Storage_ID(unsigned int S
 }
 
 bool TWPartitionManager::Add_Remove_MTP_Storage(TWPartition* Part, int message_type) {
+	pthread_mutex_lock(&mtp_lock);
+	bool ret = Add_Remove_MTP_Storage_Locked(Part, message_type);
+	pthread_mutex_unlock(&mtp_lock);
+	return ret;
+}
+
+bool TWPartitionManager::Add_Remove_MTP_Storage_Locked(TWPartition* Part, int message_type) {
 #ifdef TW_HAS_MTP
 	struct mtpmsg mtp_message;
 
@@ -2746,6 +2962,9 @@ void TWPartitionManager::Remove_Uevent_Devices(const string& Mount_Point) {
 void TWPartitionManager::Handle_Uevent(const Uevent_Block_Data& uevent_data) {
 	std::vector<TWPartition*>::iterator iter;
 
+	// a disk coming or going may reuse device numbers of another one
+	twrpProbeCache::Invalidate_All();
+
 	for (iter = Partitions.begin(); iter != Partitions.end(); iter++) {
 		if (!(*iter)->Sysfs_Entry.empty()) {
 			string device;
@@ -62,6 +62,8 @@ enum PartitionManager_Op {                                                    //
 
 class TWPartition;
 
+class twrpBackupManifest;
+
 struct PartitionSettings {                                                    // Settings for backup session
 	TWPartition* Part;                                                        // Partition to pass to the partition backup loop
 	std::string Backup_Folder;                                                // Path to restore folder
@@ -79,6 +81,7 @@ struct PartitionSettings {                                                    //
 	int partition_count;                                                      // Number of partitions to restore
 	ProgressTracking *progress;                                               // Keep track of progress in GUI
 	enum PartitionManager_Op PM_Method;                                       // Current operation of backup or restore
+	twrpBackupManifest *manifest;                                             // Collects the partitions backed up, NULL if not needed
 };
 
 enum Backup_Method_enum {
@@ -173,6 +176,8 @@ private:
 	bool Wipe_NTFS();                                                         // Uses mkntfs to wipe
 	bool Wipe_Data_Without_Wiping_Media();                                    // Uses rm -rf to wipe but does not wipe /data/media
 	bool Wipe_Data_Without_Wiping_Media_Func(const string& parent);           // Uses rm -rf to wipe but does not wipe /data/media
+	bool Format_Block_Device(const string& File_System);                      // Discards and formats the actual block device with twrpFormat
+	uint64_t Get_Discard_Length(uint64_t end);                                // Bytes of the device a format may discard, end is the device size
 	bool Backup_Tar(PartitionSettings *part_settings, pid_t *tar_fork_pid);   // Backs up using tar for file systems
 	bool Backup_Image(PartitionSettings *part_settings);                      // Backs up using raw read/write for emmc memory types
 	bool Raw_Read_Write(PartitionSettings *part_settings);
@@ -183,6 +188,9 @@ private:
 	bool Check_Restore_File_MD5(const string& Filename);                      // Verifies MD5 matches for a file before restoration
 	bool Get_Size_Via_statfs(bool Display_Error);                             // Get Partition size, used, and free space using statfs
 	bool Get_Size_Via_df(bool Display_Error);                                 // Get Partition size, used, and free space using df command
+	uint64_t Get_Superblock_Signature(void);                                  // Hash of the ext2/3/4 superblock state of an unmounted partition, 0 if unknown
+	uint64_t Get_Statfs_Signature(void);                                      // Hash of the statfs counts of a mounted partition, 0 if unknown
+	uint64_t Get_Folder_Size_Cached(const string& Path);                      // Folder size for backups, reused while statfs is unchanged
 	bool Make_Dir(string Path, bool Display_Error);                           // Creates a directory if it doesn't already exist
 	bool Find_MTD_Block_Device(string MTD_Name);                              // Finds the mtd block device based on the name from the fstab
 	void Recreate_AndSec_Folder(void);                                        // Recreates the .android_secure folder
@@ -218,6 +226,9 @@ private:
 	unsigned long long Free;                                                  // Overall free space
 	unsigned long long Backup_Size;                                           // Backup size -- may be different than used space especially when /data/media is present
 	unsigned long long Restore_Size;                                          // Restore size of the current restore operation
+	uint64_t Size_Signature;                                                  // Superblock state the sizes were read in, lets Update_Size skip mounting
+	uint64_t Folder_Size;                                                     // Result of the last folder size walk
+	uint64_t Folder_Size_Signature;                                           // statfs state of the last folder size walk
 	bool Can_Be_Encrypted;                                                    // This partition might be encrypted, affects error handling, can only be true if crypto support is compiled in
 	bool Is_Encrypted;                                                        // This partition is thought to be encrypted -- it wouldn't mount for some reason, only avialble with crypto support
 	bool Is_Decrypted;                                                        // This partition has successfully been decrypted
@@ -240,6 +251,7 @@ private:
 	unsigned long Format_Block_Size;                                          // Block size for formatting
 	bool Ignore_Blkid;                                                        // Ignore blkid results due to superblocks lying to us on certain devices / partitions
 	bool Retain_Layout_Version;                                               // Retains the .layout_version file during a wipe (needed on devices like Sony Xperia T where /data and /data/media are separate partitions)
+	bool Secure_Discard;                                                      // Set while wiping encryption, formats then securely discard the whole device
 	bool Can_Flash_Img;                                                       // Indicates if this partition can have images flashed to it via the GUI
 	bool Mount_Read_Only;                                                     // Only mount this partition as read-only
 	bool Is_Adopted_Storage;                                                  // Indicates that this partition is for adopted storage (android_expand)
@@ -269,7 +281,7 @@ public:
 	~TWPartitionManager() {}
 
 public:
-	int Process_Fstab(string Fstab_Filename, bool Display_Error);             // Parses the fstab and populates the partitions
+	int Process_Fstab(string Fstab_Filename, bool Display_Error, bool Update_Details = true); // Parses the fstab and populates the partitions, leaves size scanning to the caller if !Update_Details
 	int Write_Fstab();                                                        // Creates /etc/fstab file that's used by the command line for mount commands
 	void Output_Partition_Logging();                                          // Outputs partition information to the log
 	void Output_Partition(TWPartition* Part);                                 // Outputs partition details to the log
@@ -345,16 +357,24 @@ private:
 	void Setup_Settings_Storage_Partition(TWPartition* Part);                 // Sets up settings storage
 	void Setup_Android_Secure_Location(TWPartition* Part);                    // Sets up .android_secure if needed
 	bool Backup_Partition(struct PartitionSettings *part_settings);           // Backup the partitions based on type
+	static void Add_Manifest_Entry(PartitionSettings *part_settings, TWPartition *Part); // Adds a backed up partition to part_settings->manifest
 	TWPartition* Find_Partition_By_MTP_Storage_ID(unsigned int Storage_ID);   // Returns a pointer to a partition based on MTP Storage ID
 	bool Add_Remove_MTP_Storage(TWPartition* Part, int message_type);         // Adds or removes an MTP Storage partition
+	bool Enable_MTP_Locked();                                                 // Enable_MTP with mtp_lock held
+	bool Disable_MTP_Locked();                                                // Disable_MTP with mtp_lock held
+	bool Add_Remove_MTP_Storage_Locked(TWPartition* Part, int message_type);  // Add_Remove_MTP_Storage with mtp_lock held
 	TWPartition* Find_Next_Storage(string Path, bool Exclude_Data_Media);
 	int Open_Lun_File(string Partition_Path, string Lun_File);
 	void Post_Decrypt(const string& Block_Device);                            // Completes various post-decrypt tasks
 	void Coldboot_Scan(std::vector<string> *sysfs_entries, const string& Path, int depth); // Scans subfolders to find matches to the paths stored in sysfs_entries so we can trigger the uevent system to "re-add" devices
 	void Coldboot();                                                          // Starts the scan of the /sys/block folder
+	static bool Size_Update_Related(TWPartition* A, TWPartition* B);          // Partitions that must not be mounted concurrently while updating sizes
+	static void* Size_Update_Thread(void* cookie);                            // Worker for Update_System_Details
+	void Update_Partition_Details(TWPartition* Part, int* data_size);         // Publishes the sizes of one partition
 	pid_t mtppid;
 	bool mtp_was_enabled;
 	int mtp_write_fd;
+	static pthread_mutex_t mtp_lock;                                          // Serializes MTP startup, GUI and ORS toggles and storage changes
 	pid_t tar_fork_pid;                                                       // PID of twrpTar fork
 	Backup_Method_enum Backup_Method;                                         // Method used for backup
 
@@ -29,7 +29,7 @@ unsigned buffer_size = 4096;
 unsigned buffer_loc = 0;
 int buffer_status = 0;
 int prog_pipe = -1;
-const unsigned long long progress_size = (unsigned long long)(T_BLOCKSIZE);
+static const unsigned long long progress_size = (unsigned long long)(T_BLOCKSIZE);
 
 void reinit_libtar_buffer(void) {
 	flush = 0;
@@ -222,3 +222,68 @@ LOCAL_STATIC_LIBRARIES := \
 LOCAL_SHARED_LIBRARIES := \
     liblog
 include $(BUILD_HOST_NATIVE_TEST)
+
+# twrpTar and what it needs outside of recovery, for the twrpTar tests and the backup benchmark
+twrptar_src_files := \
+    ../twrp-functions.cpp \
+    ../twrpTar.cpp \
+    ../twrpRestorePipeline.cpp \
+    ../twrpAes.cpp \
+    ../twrpTelemetry.cpp \
+    ../tarWrite.c \
+    ../exclude.cpp \
+    ../progresstracking.cpp \
+    ../gui/twmsg.cpp
+
+twrptar_static_libraries := \
+    libtar_static \
+    libcrecovery \
+    libselinux \
+    libz \
+    libBionicGtestMain
+
+twrptar_cflags := -Wall -DBUILD_TWRPTAR_MAIN
+ifeq ($(TW_EXCLUDE_ENCRYPTED_BACKUPS), true)
+    twrptar_cflags += -DTW_EXCLUDE_ENCRYPTED_BACKUPS
+endif
+
+# twrpTar tests, they need root for a folder directly below /
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := $(twrptar_cflags)
+LOCAL_MODULE := recovery_twrptar_test
+LOCAL_C_INCLUDES := \
+    $(commands_recovery_local_path) \
+    $(commands_recovery_local_path)/libtar
+LOCAL_SRC_FILES := \
+    component/twrptar_test.cpp \
+    $(twrptar_src_files)
+LOCAL_STATIC_LIBRARIES := $(twrptar_static_libraries)
+include $(BUILD_NATIVE_TEST)
+
+# Backup benchmark
+backup_benchmark_src_files := \
+    benchmark/backup_benchmark.cpp \
+    $(twrptar_src_files)
+backup_benchmark_static_libraries := $(twrptar_static_libraries)
+backup_benchmark_cflags := $(twrptar_cflags)
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := $(backup_benchmark_cflags)
+LOCAL_MODULE := recovery_backup_benchmark
+LOCAL_C_INCLUDES := \
+    $(commands_recovery_local_path) \
+    $(commands_recovery_local_path)/libtar
+LOCAL_SRC_FILES := $(backup_benchmark_src_files)
+LOCAL_STATIC_LIBRARIES := $(backup_benchmark_static_libraries)
+include $(BUILD_NATIVE_TEST)
+
+include $(CLEAR_VARS)
+LOCAL_CFLAGS := $(backup_benchmark_cflags)
+LOCAL_MODULE := recovery_backup_benchmark_host
+LOCAL_MODULE_HOST_OS := linux
+LOCAL_C_INCLUDES := \
+    $(commands_recovery_local_path) \
+    $(commands_recovery_local_path)/libtar
+LOCAL_SRC_FILES := $(backup_benchmark_src_files)
+LOCAL_STATIC_LIBRARIES := $(backup_benchmark_static_libraries)
+include $(BUILD_HOST_NATIVE_TEST)
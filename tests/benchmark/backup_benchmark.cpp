@@ -0,0 +1,901 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// End to end backup and restore benchmark. Generates a tree of many small files, a few large
+// ones, hardlinks, symlinks and file capabilities on a file backed ext4 image, then in every
+// archive mode backs it up with twrpTar, wipes it, restores it and checks the result against
+// the generated tree. Reports MB/s, files/s, CPU time and read/write syscalls of each run.
+// Falls back to a plain directory when the image can't be loop mounted.
+//
+// Environment:
+//   BACKUP_BENCHMARK_DIR        work directory for the image, the backups and the log,
+//                               default /data/local/tmp/backup_benchmark on the device and
+//                               /tmp/backup_benchmark on the host
+//   BACKUP_BENCHMARK_MOUNT      where the image is mounted, default /twrp_benchmark. Must be
+//                               directly below / like the partitions twrpTar is made for.
+//   BACKUP_BENCHMARK_SCALE      multiplies the file counts and sizes, default 1
+//   BACKUP_BENCHMARK_BASELINE   results file to compare against, default baseline.txt in the
+//                               work directory
+//   BACKUP_BENCHMARK_SAVE       if set, this run's results replace the baseline
+//   BACKUP_BENCHMARK_TOLERANCE  allowed MB/s drop against the baseline, default 0.2
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/loop.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/xattr.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/xattr.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "exclude.hpp"
+#include "gui/gui.hpp"
+#include "gui/twmsg.h"
+#include "partitions.hpp"
+#include "progresstracking.hpp"
+#include "twrp-functions.hpp"
+#include "twrpTar.hpp"
+#include "twrpTelemetry.hpp"
+#include "variables.h"
+
+// twrpTar reports through the GUI, which is not part of the standalone build. Its output goes
+// to the log file the runs are redirected to.
+void gui_msg(Message msg) {
+  std::string output = msg;
+  output += "\n";
+  fputs(output.c_str(), stdout);
+}
+
+void gui_msg(const char* text) {
+  if (text) gui_msg(Msg(text));
+}
+
+void gui_warn(const char* text) {
+  if (text) gui_msg(Msg(msg::kWarning, text));
+}
+
+void gui_err(const char* text) {
+  if (text) gui_msg(Msg(msg::kError, text));
+}
+
+void gui_highlight(const char* text) {
+  if (text) gui_msg(Msg(msg::kHighlight, text));
+}
+
+static const std::string kPassword = "benchmark";
+static const std::string kBackupName = "data.ext4.win";
+
+struct BenchmarkMode {
+  const char* name;
+  bool compress;
+  bool encrypt;
+  bool userdata_encryption;  // app and dalvik-cache stay plain, the rest is encrypted per core
+  bool split;
+};
+
+static const BenchmarkMode kPlain = { "plain", false, false, false, false };
+static const BenchmarkMode kGzip = { "gzip", true, false, false, false };
+static const BenchmarkMode kEncrypted = { "encrypted", false, true, false, false };
+static const BenchmarkMode kSplit = { "split", false, false, false, true };
+static const BenchmarkMode kMultithreaded = { "multithreaded", true, true, true, false };
+
+struct BenchmarkResult {
+  std::string mode;
+  std::string op;
+  double seconds;
+  double mb_per_s;
+  double files_per_s;
+  double cpu_seconds;
+  uint64_t syscalls;
+  uint64_t archive_bytes;
+};
+
+// xorshift64*, so every run generates the same tree
+class Random {
+ public:
+  explicit Random(uint64_t seed) : state_(seed) {}
+
+  uint64_t Next() {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * 2685821657736338717ULL;
+  }
+
+  size_t Range(size_t low, size_t high) {
+    return low + Next() % (high - low + 1);
+  }
+
+ private:
+  uint64_t state_;
+};
+
+// ---------------------------------------------------------------------------------------------
+// Synthetic tree
+
+struct TreeStats {
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  uint64_t hardlinks = 0;
+  uint64_t symlinks = 0;
+  uint64_t capabilities = 0;
+};
+
+// Alternates random and repetitive 4 KiB blocks, so about half of the data compresses.
+static bool write_file(const std::string& path, size_t size, Random* random, TreeStats* stats) {
+  static std::vector<uint8_t> buffer(1024 * 1024);
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    return false;
+  }
+  size_t remain = size;
+  while (remain > 0) {
+    size_t len = std::min(remain, buffer.size());
+    for (size_t block = 0; block < len; block += 4096) {
+      size_t block_len = std::min<size_t>(4096, len - block);
+      uint64_t value = random->Next();
+      if (value & 1) {
+        for (size_t i = 0; i < block_len; i += sizeof(value)) {
+          value = random->Next();
+          memcpy(&buffer[block + i], &value, std::min(sizeof(value), block_len - i));
+        }
+      } else {
+        for (size_t i = 0; i < block_len; i++) {
+          buffer[block + i] = "twrp backup benchmark\n"[(i + value) % 22];
+        }
+      }
+    }
+    if (write(fd, buffer.data(), len) != static_cast<ssize_t>(len)) {
+      close(fd);
+      return false;
+    }
+    remain -= len;
+  }
+  close(fd);
+  stats->files++;
+  stats->bytes += size;
+  return true;
+}
+
+static bool make_dir(const std::string& path) {
+  return mkdir(path.c_str(), 0771) == 0 || errno == EEXIST;
+}
+
+// Gives the file a capability the way libtar stores them, e.g. for run-as or ping.
+static bool set_capability(const std::string& path) {
+  struct vfs_cap_data cap_data;
+  memset(&cap_data, 0, sizeof(cap_data));
+  cap_data.magic_etc = VFS_CAP_REVISION_2 | VFS_CAP_FLAGS_EFFECTIVE;
+  cap_data.data[0].permitted = 1 << CAP_NET_RAW;
+  return setxattr(path.c_str(), XATTR_NAME_CAPS, &cap_data, sizeof(cap_data), 0) == 0;
+}
+
+// Lays out a /data like tree: apps and dalvik-cache with medium files, many small files
+// under user/0, a few large media files, hardlinks, symlinks and file capabilities.
+static bool generate_tree(const std::string& root, int scale, TreeStats* stats) {
+  Random random(0x5457525042454e43ULL);
+  std::vector<std::string> small_files;
+
+  if (!make_dir(root + "/app") || !make_dir(root + "/dalvik-cache") ||
+      !make_dir(root + "/dalvik-cache/arm64") || !make_dir(root + "/user") ||
+      !make_dir(root + "/user/0") || !make_dir(root + "/media") ||
+      !make_dir(root + "/links")) {
+    return false;
+  }
+  for (int i = 0; i < 20 * scale; i++) {
+    std::string app = root + "/app/com.example.app" + std::to_string(i) + "-1";
+    if (!make_dir(app) || !write_file(app + "/base.apk", random.Range(256, 1024) * 1024, &random, stats) ||
+        !write_file(root + "/dalvik-cache/arm64/app" + std::to_string(i) + "@classes.dex",
+                    random.Range(128, 512) * 1024, &random, stats)) {
+      return false;
+    }
+  }
+  for (int i = 0; i < 100 * scale; i++) {
+    std::string pkg = root + "/user/0/com.example.app" + std::to_string(i);
+    if (!make_dir(pkg) || !make_dir(pkg + "/files") || !make_dir(pkg + "/shared_prefs")) {
+      return false;
+    }
+    if (symlink(("/data/app/com.example.app" + std::to_string(i) + "-1/lib").c_str(),
+                (pkg + "/lib").c_str()) == 0) {
+      stats->symlinks++;
+    }
+    for (int j = 0; j < 40; j++) {
+      std::string file = pkg + (j % 4 ? "/files/" : "/shared_prefs/") + std::to_string(j);
+      if (!write_file(file, random.Range(512, 16 * 1024), &random, stats)) {
+        return false;
+      }
+      small_files.push_back(file);
+    }
+  }
+  for (int i = 0; i < 3; i++) {
+    if (!write_file(root + "/media/huge" + std::to_string(i) + ".bin",
+                    48ULL * 1024 * 1024 * scale, &random, stats)) {
+      return false;
+    }
+  }
+  for (size_t i = 0; i < small_files.size(); i += 20) {
+    if (link(small_files[i].c_str(), (root + "/links/" + std::to_string(i)).c_str()) == 0) {
+      stats->hardlinks++;
+    }
+  }
+  for (size_t i = 0; i < small_files.size(); i += 50) {
+    if (set_capability(small_files[i])) {
+      stats->capabilities++;
+    }
+  }
+  return true;
+}
+
+// Removes everything below path, and path itself if remove_path is set.
+static bool remove_tree(const std::string& path, bool remove_path) {
+  DIR* d = opendir(path.c_str());
+  if (d == nullptr) {
+    return errno == ENOENT;
+  }
+  bool ret = true;
+  struct dirent* de;
+  while ((de = readdir(d)) != nullptr) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) {
+      continue;
+    }
+    std::string child = path + "/" + de->d_name;
+    if (de->d_type == DT_DIR) {
+      ret = remove_tree(child, true) && ret;
+    } else if (unlink(child.c_str()) != 0) {
+      ret = false;
+    }
+  }
+  closedir(d);
+  if (remove_path && rmdir(path.c_str()) != 0) {
+    ret = false;
+  }
+  return ret;
+}
+
+// What a restore has to bring back for each entry of the partition.
+struct ManifestEntry {
+  mode_t mode;
+  uid_t uid;
+  gid_t gid;
+  off_t size;
+  nlink_t nlink;
+  uint64_t hash;  // FNV-1a of the contents or of the symlink target
+  std::string capabilities;
+};
+
+typedef std::map<std::string, ManifestEntry> Manifest;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t len) {
+  const uint8_t* p = static_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ p[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+static bool hash_file(const std::string& path, uint64_t* hash) {
+  static std::vector<uint8_t> buffer(1024 * 1024);
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    return false;
+  }
+  ssize_t len;
+  *hash = 14695981039346656037ULL;
+  while ((len = read(fd, buffer.data(), buffer.size())) > 0) {
+    *hash = fnv1a(*hash, buffer.data(), len);
+  }
+  close(fd);
+  return len == 0;
+}
+
+// Records every entry below root, keyed by its path relative to root.
+static bool scan_tree(const std::string& root, const std::string& rel, Manifest* manifest) {
+  std::string dir = root + rel;
+  DIR* d = opendir(dir.c_str());
+  if (d == nullptr) {
+    return false;
+  }
+  bool ret = true;
+  struct dirent* de;
+  while (ret && (de = readdir(d)) != nullptr) {
+    if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0 ||
+        (rel.empty() && strcmp(de->d_name, "lost+found") == 0)) {
+      continue;
+    }
+    std::string name = rel + "/" + de->d_name;
+    std::string path = root + name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+      ret = false;
+      break;
+    }
+    ManifestEntry& entry = (*manifest)[name];
+    entry.mode = st.st_mode;
+    entry.uid = st.st_uid;
+    entry.gid = st.st_gid;
+    entry.size = S_ISDIR(st.st_mode) ? 0 : st.st_size;
+    entry.nlink = S_ISDIR(st.st_mode) ? 0 : st.st_nlink;
+    entry.hash = 0;
+    if (S_ISDIR(st.st_mode)) {
+      ret = scan_tree(root, name, manifest);
+    } else if (S_ISLNK(st.st_mode)) {
+      char target[PATH_MAX];
+      ssize_t len = readlink(path.c_str(), target, sizeof(target));
+      ret = len >= 0;
+      entry.hash = fnv1a(14695981039346656037ULL, target, len > 0 ? len : 0);
+    } else if (S_ISREG(st.st_mode)) {
+      ret = hash_file(path, &entry.hash);
+      struct vfs_cap_data cap_data;
+      ssize_t len = getxattr(path.c_str(), XATTR_NAME_CAPS, &cap_data, sizeof(cap_data));
+      if (len > 0) {
+        entry.capabilities.assign(reinterpret_cast<const char*>(&cap_data), len);
+      }
+    }
+  }
+  closedir(d);
+  return ret;
+}
+
+// Describes the first difference between the two, or returns an empty string.
+static std::string compare_manifests(const Manifest& expected, const Manifest& actual) {
+  for (const auto& it : expected) {
+    auto found = actual.find(it.first);
+    if (found == actual.end()) {
+      return it.first + " is missing";
+    }
+    const ManifestEntry& a = it.second;
+    const ManifestEntry& b = found->second;
+    if ((a.mode & (S_IFMT | 07777)) != (b.mode & (S_IFMT | 07777))) {
+      char modes[64];
+      snprintf(modes, sizeof(modes), " (%o, restored as %o)", a.mode, b.mode);
+      return it.first + " has a different type or mode" + modes;
+    }
+    if (a.uid != b.uid || a.gid != b.gid) {
+      return it.first + " has a different owner";
+    }
+    if (a.size != b.size || a.hash != b.hash) {
+      return it.first + " has different contents";
+    }
+    if (a.nlink != b.nlink) {
+      return it.first + " has a different link count";
+    }
+    if (a.capabilities != b.capabilities) {
+      return it.first + " has different capabilities";
+    }
+  }
+  for (const auto& it : actual) {
+    if (expected.find(it.first) == expected.end()) {
+      return it.first + " was not in the backup";
+    }
+  }
+  return "";
+}
+
+// ---------------------------------------------------------------------------------------------
+// File backed partitions
+
+// Runs a tool from PATH with its output discarded. Returns true if it exited with 0.
+static bool run_command(std::vector<const char*> args) {
+  args.push_back(nullptr);
+  pid_t pid = fork();
+  if (pid == -1) {
+    return false;
+  }
+  if (pid == 0) {
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd != -1) {
+      dup2(null_fd, STDOUT_FILENO);
+      dup2(null_fd, STDERR_FILENO);
+    }
+    execvp(args[0], const_cast<char* const*>(args.data()));
+    _exit(127);
+  }
+  int status;
+  if (TEMP_FAILURE_RETRY(waitpid(pid, &status, 0)) != pid) {
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// An ext4 image loop mounted on a directory, or just the directory if that is not possible,
+// e.g. without root or loop devices.
+class ImagePartition {
+ public:
+  ImagePartition() : loop_fd_(-1), mounted_(false) {}
+  ~ImagePartition() {
+    Destroy();
+  }
+
+  bool Create(const std::string& image, const std::string& mount_point, uint64_t size) {
+    image_ = image;
+    mount_point_ = mount_point;
+    if (!make_dir(mount_point_)) {
+      return false;
+    }
+    if (Mount_Image(size)) {
+      return true;
+    }
+    GTEST_LOG_(INFO) << "Unable to loop mount " << image_ << ", using the directory "
+                     << mount_point_ << " instead.";
+    Destroy();
+    return true;
+  }
+
+  // Wipes the partition the way a restore does before extracting.
+  bool Wipe() {
+    return remove_tree(mount_point_, false);
+  }
+
+  void Destroy() {
+    if (mounted_) {
+      umount2(mount_point_.c_str(), MNT_DETACH);
+      mounted_ = false;
+    }
+    if (loop_fd_ != -1) {
+      ioctl(loop_fd_, LOOP_CLR_FD, 0);
+      close(loop_fd_);
+      loop_fd_ = -1;
+    }
+    if (!image_.empty()) {
+      unlink(image_.c_str());
+    }
+  }
+
+  const std::string& path() const {
+    return mount_point_;
+  }
+
+  const char* type() const {
+    return mounted_ ? "ext4 image" : "directory";
+  }
+
+ private:
+  bool Mount_Image(uint64_t size) {
+    int fd = open(image_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+      return false;
+    }
+    bool ok = ftruncate(fd, size) == 0;
+    close(fd);
+    if (!ok || !run_command({ "mke2fs", "-q", "-F", "-t", "ext4", image_.c_str() })) {
+      return false;
+    }
+
+    int control = open("/dev/loop-control", O_RDWR | O_CLOEXEC);
+    if (control == -1) {
+      return false;
+    }
+    int n = ioctl(control, LOOP_CTL_GET_FREE);
+    close(control);
+    if (n < 0) {
+      return false;
+    }
+    std::string loop_device = "/dev/block/loop" + std::to_string(n);
+    if (access(loop_device.c_str(), F_OK) != 0) {
+      loop_device = "/dev/loop" + std::to_string(n);
+    }
+    loop_fd_ = open(loop_device.c_str(), O_RDWR | O_CLOEXEC);
+    if (loop_fd_ == -1) {
+      return false;
+    }
+    fd = open(image_.c_str(), O_RDWR | O_CLOEXEC);
+    ok = fd != -1 && ioctl(loop_fd_, LOOP_SET_FD, fd) == 0;
+    if (fd != -1) {
+      close(fd);
+    }
+    if (!ok) {
+      close(loop_fd_);
+      loop_fd_ = -1;
+      return false;
+    }
+    mounted_ = mount(loop_device.c_str(), mount_point_.c_str(), "ext4", MS_NOATIME, "") == 0;
+    return mounted_;
+  }
+
+  std::string image_;
+  std::string mount_point_;
+  int loop_fd_;
+  bool mounted_;
+};
+
+// ---------------------------------------------------------------------------------------------
+// Measurements
+
+// twrpTar works in a forked child. CPU time and I/O accounting of children are added to
+// ours when they are reaped, so the deltas around createTarFork / extractTarFork cover the
+// archiver, its threads and any pigz it ran.
+class Meter {
+ public:
+  void Start() {
+    Read(&start_cpu_ns_, &start_syscalls_);
+    clock_gettime(CLOCK_MONOTONIC, &start_);
+  }
+
+  void Stop(double* seconds, double* cpu_seconds, uint64_t* syscalls) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t cpu_ns, calls;
+    Read(&cpu_ns, &calls);
+    *seconds = (now.tv_sec - start_.tv_sec) + (now.tv_nsec - start_.tv_nsec) / 1e9;
+    *cpu_seconds = (cpu_ns - start_cpu_ns_) / 1e9;
+    *syscalls = calls - start_syscalls_;
+  }
+
+ private:
+  static uint64_t Usage_Ns(int who) {
+    struct rusage usage;
+    getrusage(who, &usage);
+    return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL +
+           (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+  }
+
+  // syscr and syscw of /proc/self/io, the read and write style syscalls
+  static uint64_t Syscalls() {
+    FILE* fp = fopen("/proc/self/io", "re");
+    if (fp == nullptr) {
+      return 0;
+    }
+    char line[128];
+    unsigned long long value, total = 0;
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+      if (sscanf(line, "syscr: %llu", &value) == 1 || sscanf(line, "syscw: %llu", &value) == 1) {
+        total += value;
+      }
+    }
+    fclose(fp);
+    return total;
+  }
+
+  static void Read(uint64_t* cpu_ns, uint64_t* syscalls) {
+    *cpu_ns = Usage_Ns(RUSAGE_SELF) + Usage_Ns(RUSAGE_CHILDREN);
+    *syscalls = Syscalls();
+  }
+
+  struct timespec start_;
+  uint64_t start_cpu_ns_;
+  uint64_t start_syscalls_;
+};
+
+// Writes back what is dirty and empties the page cache, so every run starts cold. Needs root,
+// without it runs after the first one may be served from the cache.
+static void drop_caches() {
+  sync();
+  int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+  if (fd != -1) {
+    write(fd, "3\n", 2);
+    close(fd);
+  }
+}
+
+// Sends twrpTar's console output to a log instead of the test output.
+class Redirect_Stdout {
+ public:
+  explicit Redirect_Stdout(const std::string& log) {
+    fflush(stdout);
+    saved_ = dup(STDOUT_FILENO);
+    int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd != -1) {
+      dup2(fd, STDOUT_FILENO);
+      close(fd);
+    }
+  }
+
+  ~Redirect_Stdout() {
+    fflush(stdout);
+    if (saved_ != -1) {
+      dup2(saved_, STDOUT_FILENO);
+      close(saved_);
+    }
+  }
+
+ private:
+  int saved_;
+};
+
+static bool have_pigz() {
+  const char* path = getenv("PATH");
+  std::string dirs = path ? path : "/sbin:/system/bin:/usr/bin:/bin";
+  size_t start = 0;
+  while (start <= dirs.size()) {
+    size_t end = dirs.find(':', start);
+    if (end == std::string::npos) end = dirs.size();
+    if (access((dirs.substr(start, end - start) + "/pigz").c_str(), X_OK) == 0) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
+}
+
+// ---------------------------------------------------------------------------------------------
+// Environment
+
+class BackupBenchmarkEnvironment : public ::testing::Environment {
+ public:
+  void SetUp() override {
+    const char* dir = getenv("BACKUP_BENCHMARK_DIR");
+#ifdef __ANDROID__
+    work_dir = dir ? dir : "/data/local/tmp/backup_benchmark";
+#else
+    work_dir = dir ? dir : "/tmp/backup_benchmark";
+#endif
+    const char* scale_str = getenv("BACKUP_BENCHMARK_SCALE");
+    scale = scale_str ? std::max(1, atoi(scale_str)) : 1;
+    const char* baseline_str = getenv("BACKUP_BENCHMARK_BASELINE");
+    baseline_file = baseline_str ? baseline_str : work_dir + "/baseline.txt";
+    save_baseline = getenv("BACKUP_BENCHMARK_SAVE") != nullptr;
+    const char* tolerance_str = getenv("BACKUP_BENCHMARK_TOLERANCE");
+    tolerance = tolerance_str ? atof(tolerance_str) : 0.2;
+    const char* mount_str = getenv("BACKUP_BENCHMARK_MOUNT");
+    std::string mount_point = mount_str ? mount_str : "/twrp_benchmark";
+    log_file = work_dir + "/twrpTar.log";
+    backup_folder = work_dir + "/backup";
+
+    // twrpTar stores paths below the first component of the backed up folder and restores
+    // split and encrypted archives to their absolute paths, as for /data or /system.
+    ASSERT_TRUE(mount_point.size() > 1 && mount_point[0] == '/' &&
+                mount_point.find('/', 1) == std::string::npos)
+        << mount_point << " is not directly below /";
+
+    ASSERT_TRUE(make_dir(work_dir)) << "Unable to create " << work_dir;
+    unlink(log_file.c_str());
+    Load_Baseline();
+
+    // 3 large files of 48 MiB and about 50 MiB of the rest per scale step, plus room for
+    // the file system
+    uint64_t image_size = (256ULL << 20) * scale;
+    ASSERT_TRUE(partition.Create(work_dir + "/data.img", mount_point, image_size));
+    Create_Tree();
+    printf("Backup benchmark: %llu files, %.1f MiB, %llu hardlinks, %llu symlinks, "
+           "%llu capabilities on %s\n",
+           (unsigned long long)tree.files, tree.bytes / 1048576.0,
+           (unsigned long long)tree.hardlinks, (unsigned long long)tree.symlinks,
+           (unsigned long long)tree.capabilities, partition.type());
+  }
+
+  void TearDown() override {
+    printf("\n%-14s %-8s %9s %10s %9s %9s %12s %11s\n", "mode", "op", "seconds", "MB/s",
+           "files/s", "cpu s", "r/w calls", "archive MiB");
+    for (const auto& r : results) {
+      printf("%-14s %-8s %9.2f %10.1f %9.0f %9.2f %12llu %11.1f\n", r.mode.c_str(), r.op.c_str(),
+             r.seconds, r.mb_per_s, r.files_per_s, r.cpu_seconds, (unsigned long long)r.syscalls,
+             r.archive_bytes / 1048576.0);
+    }
+    if (save_baseline) {
+      Save_Baseline();
+    }
+    partition.Wipe();
+    partition.Destroy();
+    rmdir(partition.path().c_str());
+    remove_tree(backup_folder, true);
+  }
+
+  // Generates the tree on the wiped partition and records what every restore must reproduce.
+  void Create_Tree() {
+    tree_intact = false;
+    tree = TreeStats();
+    manifest.clear();
+    ASSERT_TRUE(partition.Wipe());
+    ASSERT_TRUE(generate_tree(partition.path(), scale, &tree)) << "Unable to generate the tree";
+    ASSERT_TRUE(scan_tree(partition.path(), "", &manifest));
+    sync();
+    tree_intact = true;
+  }
+
+  // Compares a result with the baseline, if there is one for it, and keeps it for the summary.
+  void Add_Result(const BenchmarkResult& result) {
+    results.push_back(result);
+    auto it = baseline.find(result.mode + " " + result.op);
+    if (it == baseline.end() || save_baseline) {
+      return;
+    }
+    const BenchmarkResult& base = it->second;
+    printf("%s %s: %.1f MB/s (baseline %.1f), %.2f cpu s (baseline %.2f)\n",
+           result.mode.c_str(), result.op.c_str(), result.mb_per_s, base.mb_per_s,
+           result.cpu_seconds, base.cpu_seconds);
+    EXPECT_GE(result.mb_per_s, base.mb_per_s * (1 - tolerance))
+        << result.mode << " " << result.op << " is slower than the baseline in "
+        << baseline_file;
+  }
+
+  std::string work_dir;
+  std::string backup_folder;
+  std::string log_file;
+  int scale;
+  ImagePartition partition;
+  TreeStats tree;
+  Manifest manifest;
+  bool tree_intact = false;  // false while a mode that failed left the partition wiped
+
+ private:
+  // One result per line: mode op seconds MB/s files/s cpu-seconds syscalls archive-bytes
+  void Load_Baseline() {
+    FILE* fp = fopen(baseline_file.c_str(), "re");
+    if (fp == nullptr) {
+      return;
+    }
+    char mode[64], op[64];
+    BenchmarkResult r;
+    unsigned long long syscalls, archive_bytes;
+    while (fscanf(fp, "%63s %63s %lf %lf %lf %lf %llu %llu", mode, op, &r.seconds, &r.mb_per_s,
+                  &r.files_per_s, &r.cpu_seconds, &syscalls, &archive_bytes) == 8) {
+      r.mode = mode;
+      r.op = op;
+      r.syscalls = syscalls;
+      r.archive_bytes = archive_bytes;
+      baseline[r.mode + " " + r.op] = r;
+    }
+    fclose(fp);
+  }
+
+  void Save_Baseline() {
+    FILE* fp = fopen(baseline_file.c_str(), "we");
+    if (fp == nullptr) {
+      printf("Unable to write the baseline to %s: %s\n", baseline_file.c_str(), strerror(errno));
+      return;
+    }
+    for (const auto& r : results) {
+      fprintf(fp, "%s %s %.3f %.3f %.3f %.3f %llu %llu\n", r.mode.c_str(), r.op.c_str(),
+              r.seconds, r.mb_per_s, r.files_per_s, r.cpu_seconds,
+              (unsigned long long)r.syscalls, (unsigned long long)r.archive_bytes);
+    }
+    fclose(fp);
+    printf("Saved the baseline to %s\n", baseline_file.c_str());
+  }
+
+  std::string baseline_file;
+  bool save_baseline;
+  double tolerance;
+  std::map<std::string, BenchmarkResult> baseline;
+  std::vector<BenchmarkResult> results;
+};
+
+static BackupBenchmarkEnvironment* env = static_cast<BackupBenchmarkEnvironment*>(
+    ::testing::AddGlobalTestEnvironment(new BackupBenchmarkEnvironment));
+
+// ---------------------------------------------------------------------------------------------
+// Runs
+
+// Backs the partition up, wipes it, restores it and checks the result.
+static void run_mode(const BenchmarkMode& mode) {
+  if (mode.compress && !have_pigz()) {
+    GTEST_LOG_(INFO) << "Skipping " << mode.name << ", pigz is not in PATH.";
+    return;
+  }
+#ifdef TW_EXCLUDE_ENCRYPTED_BACKUPS
+  if (mode.encrypt) {
+    GTEST_LOG_(INFO) << "Skipping " << mode.name << ", encrypted backups are not supported.";
+    return;
+  }
+#endif
+  if (!env->tree_intact) {
+    env->Create_Tree();
+    ASSERT_TRUE(env->tree_intact);
+  }
+  ASSERT_TRUE(remove_tree(env->backup_folder, true));
+  ASSERT_TRUE(make_dir(env->backup_folder));
+  std::string archive = env->backup_folder + "/" + kBackupName;
+
+  ProgressTracking progress(env->tree.bytes);
+  PartitionSettings part_settings = PartitionSettings();
+  part_settings.progress = &progress;
+
+  TWExclude exclude;
+  exclude.add_absolute_dir(env->partition.path() + "/lost+found");
+  BenchmarkResult result;
+  Meter meter;
+  int ret;
+
+  twrpTar backup;
+  backup.setdir(env->partition.path());
+  backup.setfn(archive);
+  // Above MAX_ARCHIVE_SIZE twrpTar splits into numbered archives of at most that size
+  backup.setsize(mode.split ? MAX_ARCHIVE_SIZE + 1 : env->tree.bytes);
+  backup.use_compression = mode.compress;
+  backup.use_encryption = mode.encrypt;
+  backup.userdata_encryption = mode.userdata_encryption;
+  if (mode.encrypt) {
+    backup.setpassword(kPassword);
+  }
+  backup.backup_exclusions = &exclude;
+  backup.part_settings = &part_settings;
+  backup.partition_name = "data";
+  backup.backup_folder = env->backup_folder;
+
+  drop_caches();
+  pid_t tar_fork_pid = 0;
+  meter.Start();
+  {
+    Redirect_Stdout redirect(env->log_file);
+    ret = backup.createTarFork(&tar_fork_pid);
+  }
+  result.mode = mode.name;
+  result.op = "backup";
+  meter.Stop(&result.seconds, &result.cpu_seconds, &result.syscalls);
+  ASSERT_EQ(0, ret) << mode.name << " backup failed, see " << env->log_file;
+  result.archive_bytes = twrpTelemetry::Archive_Bytes(env->backup_folder, kBackupName);
+  result.mb_per_s = env->tree.bytes / 1e6 / result.seconds;
+  result.files_per_s = env->tree.files / result.seconds;
+  env->Add_Result(result);
+
+  env->tree_intact = false;
+  ASSERT_TRUE(env->partition.Wipe());
+  twrpTar restore;
+  restore.setdir(env->partition.path());
+  restore.setfn(archive);
+  if (mode.encrypt) {
+    restore.setpassword(kPassword);
+  }
+  restore.backup_exclusions = &exclude;
+  restore.part_settings = &part_settings;
+  restore.partition_name = "data";
+  restore.backup_folder = env->backup_folder;
+
+  drop_caches();
+  meter.Start();
+  {
+    Redirect_Stdout redirect(env->log_file);
+    ret = restore.extractTarFork();
+  }
+  result.op = "restore";
+  meter.Stop(&result.seconds, &result.cpu_seconds, &result.syscalls);
+  ASSERT_EQ(0, ret) << mode.name << " restore failed, see " << env->log_file;
+  result.mb_per_s = env->tree.bytes / 1e6 / result.seconds;
+  result.files_per_s = env->tree.files / result.seconds;
+  env->Add_Result(result);
+
+  Manifest restored;
+  ASSERT_TRUE(scan_tree(env->partition.path(), "", &restored));
+  std::string diff = compare_manifests(env->manifest, restored);
+  ASSERT_TRUE(diff.empty()) << mode.name << ": " << diff;
+  env->tree_intact = true;
+}
+
+TEST(BackupBenchmark, plain) {
+  run_mode(kPlain);
+}
+
+TEST(BackupBenchmark, gzip) {
+  run_mode(kGzip);
+}
+
+TEST(BackupBenchmark, encrypted) {
+  run_mode(kEncrypted);
+}
+
+TEST(BackupBenchmark, split) {
+  run_mode(kSplit);
+}
+
+TEST(BackupBenchmark, multithreaded) {
+  run_mode(kMultithreaded);
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2017 TeamWin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "exclude.hpp"
+#include "gui/gui.hpp"
+#include "gui/twmsg.h"
+#include "partitions.hpp"
+#include "progresstracking.hpp"
+#include "twrpTar.hpp"
+
+// twrpTar reports through the GUI, which is not part of the standalone build
+void gui_msg(Message msg) {
+  std::string output = msg;
+  output += "\n";
+  fputs(output.c_str(), stdout);
+}
+
+void gui_msg(const char* text) {
+  if (text) gui_msg(Msg(text));
+}
+
+void gui_warn(const char* text) {
+  if (text) gui_msg(Msg(msg::kWarning, text));
+}
+
+void gui_err(const char* text) {
+  if (text) gui_msg(Msg(msg::kError, text));
+}
+
+void gui_highlight(const char* text) {
+  if (text) gui_msg(Msg(msg::kHighlight, text));
+}
+
+// twrpTar is made for partitions mounted directly below /
+static const std::string kPartition = "/twrptar_test";
+static const std::string kPassword = "twrptar_test";
+static const std::string kBackupName = "data.ext4.win";
+
+static bool remove_tree(const std::string& path) {
+  std::string command = "rm -rf '" + path + "'";
+  return system(command.c_str()) == 0;
+}
+
+static bool write_file(const std::string& path) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return false;
+  bool ok = write(fd, path.data(), path.size()) == static_cast<ssize_t>(path.size());
+  return close(fd) == 0 && ok;
+}
+
+// Top level folders with modes that mkdirhier would not give them
+struct TopLevelFolder {
+  const char* name;
+  mode_t mode;
+};
+
+static const TopLevelFolder kFolders[] = {
+  { "app", 0751 },       // in the unencrypted part of userdata encrypted backups
+  { "dalvik-cache", 0771 },
+  { "media", 0770 },     // in the encrypted part
+  { "misc", 0711 },
+};
+
+class TwrpTarTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    char backup_folder[] = "/tmp/twrptar_test_backup.XXXXXX";
+    ASSERT_TRUE(mkdtemp(backup_folder) != nullptr);
+    backup_folder_ = backup_folder;
+    ASSERT_TRUE(remove_tree(kPartition));
+    ASSERT_EQ(0, mkdir(kPartition.c_str(), 0755));
+  }
+
+  void TearDown() override {
+    remove_tree(kPartition);
+    remove_tree(backup_folder_);
+  }
+
+  void Create_Tree() {
+    for (const auto& folder : kFolders) {
+      std::string path = kPartition + "/" + folder.name;
+      ASSERT_EQ(0, mkdir(path.c_str(), 0755));
+      ASSERT_TRUE(write_file(path + "/file"));
+      ASSERT_EQ(0, chmod(path.c_str(), folder.mode));
+    }
+  }
+
+  void Backup_And_Restore(bool userdata_encryption) {
+    std::string archive = backup_folder_ + "/" + kBackupName;
+    ProgressTracking progress(1024 * 1024);
+    PartitionSettings part_settings = PartitionSettings();
+    part_settings.progress = &progress;
+    TWExclude exclude;
+
+    twrpTar backup;
+    backup.setdir(kPartition);
+    backup.setfn(archive);
+    backup.setsize(1024 * 1024);
+    backup.use_encryption = true;
+    backup.userdata_encryption = userdata_encryption;
+    backup.setpassword(kPassword);
+    backup.backup_exclusions = &exclude;
+    backup.part_settings = &part_settings;
+    backup.partition_name = "data";
+    backup.backup_folder = backup_folder_;
+    pid_t tar_fork_pid = 0;
+    ASSERT_EQ(0, backup.createTarFork(&tar_fork_pid));
+
+    ASSERT_TRUE(remove_tree(kPartition));
+    ASSERT_EQ(0, mkdir(kPartition.c_str(), 0755));
+
+    twrpTar restore;
+    restore.setdir(kPartition);
+    restore.setfn(archive);
+    restore.setpassword(kPassword);
+    restore.backup_exclusions = &exclude;
+    restore.part_settings = &part_settings;
+    restore.partition_name = "data";
+    restore.backup_folder = backup_folder_;
+    ASSERT_EQ(0, restore.extractTarFork());
+  }
+
+  void Check_Tree() {
+    for (const auto& folder : kFolders) {
+      std::string path = kPartition + "/" + folder.name;
+      struct stat st;
+      ASSERT_EQ(0, stat(path.c_str(), &st)) << path;
+      EXPECT_EQ(folder.mode, st.st_mode & 07777) << path << " restored without its own mode";
+      EXPECT_EQ(0, access((path + "/file").c_str(), F_OK)) << path;
+    }
+  }
+
+  std::string backup_folder_;
+};
+
+#ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
+TEST_F(TwrpTarTest, encrypted_backup_keeps_top_level_folders) {
+  Create_Tree();
+  Backup_And_Restore(false);
+  Check_Tree();
+}
+
+TEST_F(TwrpTarTest, userdata_encrypted_backup_keeps_top_level_folders) {
+  Create_Tree();
+  Backup_And_Restore(true);
+  Check_Tree();
+}
+#endif
@@ -50,7 +50,7 @@
 #include <sys/reboot.h>
 #endif // ndef BUILD_TWRPTAR_MAIN
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
-	#include "openaes/inc/oaes_lib.h"
+	#include "twrpAes.hpp"
 #endif
 #include "set_metadata.h"
 
@@ -118,10 +118,10 @@ string TWFunc::Get_Path(const string& Path) {
 		return Path;
 }
 
-int TWFunc::Wait_For_Child(pid_t pid, int *status, string Child_Name) {
+int TWFunc::Wait_For_Child(pid_t pid, int *status, string Child_Name, struct rusage *usage) {
 	pid_t rc_pid;
 
-	rc_pid = waitpid(pid, status, 0);
+	rc_pid = wait4(pid, status, 0, usage);
 	if (rc_pid > 0) {
 		if (WIFSIGNALED(*status)) {
 			gui_msg(Msg(msg::kError, "pid_signal={1} process ended with signal: {2}")(Child_Name)(WTERMSIG(*status))); // Seg fault or some other non-graceful termination
@@ -206,75 +206,40 @@ Archive_Type TWFunc::Get_File_Type(string fn) {
 
 int TWFunc::Try_Decrypting_File(string fn, string password) {
 #ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
-	OAES_CTX * ctx = NULL;
-	uint8_t _key_data[32] = "";
+	twrpAes aes;
 	FILE *f;
-	uint8_t buffer[4096];
-	uint8_t *buffer_out = NULL;
+	uint8_t buffer[TWAES_FRAME_SIZE];
+	uint8_t buffer_out[TWAES_FRAME_SIZE];
 	uint8_t *ptr = NULL;
 	size_t read_len = 0, out_len = 0;
 	int firstbyte = 0, secondbyte = 0;
-	size_t _j = 0;
-	size_t _key_data_len = 0;
-
-	// mostly kanged from OpenAES oaes.c
-	for ( _j = 0; _j < 32; _j++ )
-		_key_data[_j] = _j + 1;
-	_key_data_len = password.size();
-	if ( 16 >= _key_data_len )
-		_key_data_len = 16;
-	else if ( 24 >= _key_data_len )
-		_key_data_len = 24;
-	else
-		_key_data_len = 32;
-	memcpy(_key_data, password.c_str(), password.size());
-
-	ctx = oaes_alloc();
-	if (ctx == NULL) {
-		LOGERR("Failed to allocate OAES\n");
-		return -1;
-	}
 
-	oaes_key_import_data(ctx, _key_data, _key_data_len);
+	aes.Set_Key(password);
 
 	f = fopen(fn.c_str(), "rb");
 	if (f == NULL) {
 		LOGERR("Failed to open '%s' to try decrypt: %s\n", fn.c_str(), strerror(errno));
-		oaes_free(&ctx);
 		return -1;
 	}
-	read_len = fread(buffer, sizeof(uint8_t), 4096, f);
+	read_len = fread(buffer, sizeof(uint8_t), sizeof(buffer), f);
 	if (read_len <= 0) {
 		LOGERR("Read size during try decrypt failed: %s\n", strerror(errno));
 		fclose(f);
-		oaes_free(&ctx);
-		return -1;
-	}
-	if (oaes_decrypt(ctx, buffer, read_len, NULL, &out_len) != OAES_RET_SUCCESS) {
-		LOGERR("Error: Failed to retrieve required buffer size for trying decryption.\n");
-		fclose(f);
-		oaes_free(&ctx);
 		return -1;
 	}
-	buffer_out = (uint8_t *) calloc(out_len, sizeof(char));
-	if (buffer_out == NULL) {
-		LOGERR("Failed to allocate output buffer for try decrypt.\n");
+	if (read_len % TWAES_BLOCK_SIZE != 0) {
+		LOGERR("Error: '%s' is not a whole number of AES blocks.\n", fn.c_str());
 		fclose(f);
-		oaes_free(&ctx);
 		return -1;
 	}
-	if (oaes_decrypt(ctx, buffer, read_len, buffer_out, &out_len) != OAES_RET_SUCCESS) {
+	if (!aes.Decrypt_Frame(buffer, read_len, buffer_out, &out_len)) {
 		LOGERR("Failed to decrypt file '%s'\n", fn.c_str());
 		fclose(f);
-		free(buffer_out);
-		oaes_free(&ctx);
 		return 0;
 	}
 	fclose(f);
-	oaes_free(&ctx);
 	if (out_len < 2) {
 		LOGINFO("Successfully decrypted '%s' but read length too small.\n", fn.c_str());
-		free(buffer_out);
 		return 1; // Decrypted successfully
 	}
 	ptr = buffer_out;
@@ -283,18 +248,15 @@ int TWFunc::Try_Decrypting_File(string fn, string password) {
 	secondbyte = *ptr & 0xff;
 	if (firstbyte == 0x1f && secondbyte == 0x8b) {
 		LOGINFO("Successfully decrypted '%s' and file is compressed.\n", fn.c_str());
-		free(buffer_out);
 		return 3; // Compressed
 	}
 	if (out_len >= 262) {
 		ptr = buffer_out + 257;
 		if (strncmp((char*)ptr, "ustar", 5) == 0) {
 			LOGINFO("Successfully decrypted '%s' and file is tar format.\n", fn.c_str());
-			free(buffer_out);
 			return 2; // Tar
 		}
 	}
-	free(buffer_out);
 	LOGINFO("No errors decrypting '%s' but no known file format.\n", fn.c_str());
 	return 1; // Decrypted successfully
 #else
@@ -21,6 +21,7 @@
 
 #include <string>
 #include <vector>
+#include <sys/resource.h>
 
 #include "twrpDigest/twrpDigest.hpp"
 
@@ -53,7 +54,7 @@ public:
 
 	static int Exec_Cmd(const string& cmd, string &result);                     //execute a command and return the result as a string by reference
 	static int Exec_Cmd(const string& cmd);                                     //execute a command
-	static int Wait_For_Child(pid_t pid, int *status, string Child_Name);       // Waits for pid to exit and checks exit status
+	static int Wait_For_Child(pid_t pid, int *status, string Child_Name, struct rusage *usage = NULL); // Waits for pid to exit and checks exit status, optionally returning its resource usage
 	static int Wait_For_Child_Timeout(pid_t pid, int *status, const string& Child_Name, int timeout); // Waits for a pid to exit until the timeout is hit. If timeout is hit, kill the chilld.
 	static bool Path_Exists(string Path);                                       // Returns true if the path exists
 	static Archive_Type Get_File_Type(string fn);                               // Determines file type, 0 for unknown, 1 for gzip, 2 for OAES encrypted
@@ -21,6 +21,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <signal.h>
+#include <pthread.h>
 #include "gui/twmsg.h"
 
 #include "cutils/properties.h"
@@ -46,6 +47,7 @@ extern "C" {
 #include "openrecoveryscript.hpp"
 #include "variables.h"
 #include "twrpAdbBuFifo.hpp"
+#include "twrpTaskGraph.hpp"
 #ifdef TW_USE_NEW_MINADBD
 #include "minadbd/minadbd.h"
 #else
@@ -67,10 +69,117 @@ static void Print_Prop(const char *key, const char *name, void *cookie) {
 	printf("%s=%s\n", key, name);
 }
 
+static bool Startup_UI(void *cookie __unused) {
+	printf("Starting the UI...\n");
+	gui_init();
+	return true;
+}
+
+static bool Startup_Fstab(void *cookie) {
+	std::string *fstab_filename = (std::string*)cookie;
+
+	printf("=> Linking mtab\n");
+	symlink("/proc/mounts", "/etc/mtab");
+	printf("=> Processing %s\n", fstab_filename->c_str());
+	if (!PartitionManager.Process_Fstab(*fstab_filename, 1, false))
+		return false;
+	PartitionManager.Output_Partition_Logging();
+	// Mount storage before the theme loader and the size scan both try to
+	if (DataManager::GetIntValue(TW_IS_ENCRYPTED) == 0)
+		PartitionManager.Mount_Settings_Storage(false);
+	return true;
+}
+
+static bool Startup_Resources(void *cookie __unused) {
+	// Load up all the resources
+	return gui_loadResources() == 0;
+}
+
+static bool Startup_Partition_Sizes(void *cookie __unused) {
+	PartitionManager.Update_System_Details();
+	PartitionManager.UnMount_Main_Partitions();
+	return true;
+}
+
+static bool Startup_File_Contexts(void *cookie __unused) {
+	if (TWFunc::Path_Exists("/prebuilt_file_contexts")) {
+		if (TWFunc::Path_Exists("/file_contexts")) {
+			printf("Renaming regular /file_contexts -> /file_contexts.bak\n");
+			rename("/file_contexts", "/file_contexts.bak");
+		}
+		printf("Moving /prebuilt_file_contexts -> /file_contexts\n");
+		rename("/prebuilt_file_contexts", "/file_contexts");
+	}
+	struct selinux_opt selinux_options[] = {
+		{ SELABEL_OPT_PATH, "/file_contexts" }
+	};
+	selinux_handle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
+	if (!selinux_handle)
+		printf("No file contexts for SELinux\n");
+	else
+		printf("SELinux contexts loaded from /file_contexts\n");
+	return true;
+}
+
+static bool Startup_Cache(void *cookie __unused) {
+	{ // Check to ensure SELinux can be supported by the kernel
+		char *contexts = NULL;
+
+		if (PartitionManager.Mount_By_Path("/cache", false) && TWFunc::Path_Exists("/cache/recovery")) {
+			lgetfilecon("/cache/recovery", &contexts);
+			if (!contexts) {
+				lsetfilecon("/cache/recovery", "test");
+				lgetfilecon("/cache/recovery", &contexts);
+			}
+		} else {
+			LOGINFO("Could not check /cache/recovery SELinux contexts, using /sbin/teamwin instead which may be inaccurate.\n");
+			lgetfilecon("/sbin/teamwin", &contexts);
+		}
+		if (!contexts) {
+			gui_warn("no_kernel_selinux=Kernel does not have support for reading SELinux contexts.");
+		} else {
+			free(contexts);
+			gui_msg("full_selinux=Full SELinux support is present.");
+		}
+	}
+
+	PartitionManager.Mount_By_Path("/cache", false);
+	return true;
+}
+
+#ifdef TW_HAS_MTP
+static void *Startup_MTP(void *cookie) {
+	int crash_counter = *(int*)cookie;
+
+	char mtp_crash_check[PROPERTY_VALUE_MAX];
+	property_get("mtp.crash_check", mtp_crash_check, "0");
+	if (DataManager::GetIntValue("tw_mtp_enabled")
+			&& !strcmp(mtp_crash_check, "0") && !crash_counter
+			&& (!DataManager::GetIntValue(TW_IS_ENCRYPTED) || DataManager::GetIntValue(TW_IS_DECRYPTED))) {
+		property_set("mtp.crash_check", "1");
+		LOGINFO("Starting MTP\n");
+		if (!PartitionManager.Enable_MTP())
+			PartitionManager.Disable_MTP();
+		else
+			gui_msg("mtp_enabled=MTP Enabled");
+		property_set("mtp.crash_check", "0");
+	} else if (strcmp(mtp_crash_check, "0")) {
+		gui_warn("mtp_crash=MTP Crashed, not starting MTP on boot.");
+		DataManager::SetValue("tw_mtp_enabled", 0);
+		PartitionManager.Disable_MTP();
+	} else if (crash_counter == 1) {
+		LOGINFO("TWRP crashed; disabling MTP as a precaution.\n");
+		PartitionManager.Disable_MTP();
+	}
+	return NULL;
+}
+#endif
+
 int main(int argc, char **argv) {
 	// Recovery needs to install world-readable files, so clear umask
 	// set by init
 	umask(0);
+	uint64_t Start_Ms = twrpTaskGraph::Now_Ms();
 
 	Log_Offset = 0;
 
@@ -112,61 +221,32 @@ int main(int argc, char **argv) {
 
 	// Load default values to set DataManager constants and handle ifdefs
 	DataManager::SetDefaultValues();
-	printf("Starting the UI...\n");
-	gui_init();
-	printf("=> Linking mtab\n");
-	symlink("/proc/mounts", "/etc/mtab");
+
+	// Bring up the UI, the partitions and SELinux side by side
 	std::string fstab_filename = "/etc/twrp.fstab";
 	if (!TWFunc::Path_Exists(fstab_filename)) {
 		fstab_filename = "/etc/recovery.fstab";
 	}
-	printf("=> Processing %s\n", fstab_filename.c_str());
-	if (!PartitionManager.Process_Fstab(fstab_filename, 1)) {
+	twrpTaskGraph startup;
+	int ui_task = startup.Add_Task("ui", Startup_UI, NULL);
+	int fstab_task = startup.Add_Task("fstab", Startup_Fstab, &fstab_filename);
+	int contexts_task = startup.Add_Task("file_contexts", Startup_File_Contexts, NULL);
+	int resources_task = startup.Add_Task("resources", Startup_Resources, NULL);
+	int sizes_task = startup.Add_Task("partition_sizes", Startup_Partition_Sizes, NULL);
+	int cache_task = startup.Add_Task("cache", Startup_Cache, NULL);
+	// the theme may come from storage, so it waits for the fstab, and it needs the screen size
+	startup.Add_Dependency(resources_task, ui_task);
+	startup.Add_Dependency(resources_task, fstab_task);
+	startup.Add_Dependency(sizes_task, fstab_task);
+	// the size scan mounts and unmounts /cache itself
+	startup.Add_Dependency(cache_task, sizes_task);
+	startup.Add_Dependency(cache_task, contexts_task);
+	startup.Run();
+	startup.Log_Timing("Startup");
+	if (!startup.Succeeded(fstab_task)) {
 		LOGERR("Failing out of recovery due to problem with fstab.\n");
 		return -1;
 	}
-	PartitionManager.Output_Partition_Logging();
-	// Load up all the resources
-	gui_loadResources();
-
-	if (TWFunc::Path_Exists("/prebuilt_file_contexts")) {
-		if (TWFunc::Path_Exists("/file_contexts")) {
-			printf("Renaming regular /file_contexts -> /file_contexts.bak\n");
-			rename("/file_contexts", "/file_contexts.bak");
-		}
-		printf("Moving /prebuilt_file_contexts -> /file_contexts\n");
-		rename("/prebuilt_file_contexts", "/file_contexts");
-	}
-	struct selinux_opt selinux_options[] = {
-		{ SELABEL_OPT_PATH, "/file_contexts" }
-	};
-	selinux_handle = selabel_open(SELABEL_CTX_FILE, selinux_options, 1);
-	if (!selinux_handle)
-		printf("No file contexts for SELinux\n");
-	else
-		printf("SELinux contexts loaded from /file_contexts\n");
-	{ // Check to ensure SELinux can be supported by the kernel
-		char *contexts = NULL;
-
-		if (PartitionManager.Mount_By_Path("/cache", false) && TWFunc::Path_Exists("/cache/recovery")) {
-			lgetfilecon("/cache/recovery", &contexts);
-			if (!contexts) {
-				lsetfilecon("/cache/recovery", "test");
-				lgetfilecon("/cache/recovery", &contexts);
-			}
-		} else {
-			LOGINFO("Could not check /cache/recovery SELinux contexts, using /sbin/teamwin instead which may be inaccurate.\n");
-			lgetfilecon("/sbin/teamwin", &contexts);
-		}
-		if (!contexts) {
-			gui_warn("no_kernel_selinux=Kernel does not have support for reading SELinux contexts.");
-		} else {
-			free(contexts);
-			gui_msg("full_selinux=Full SELinux support is present.");
-		}
-	}
-
-	PartitionManager.Mount_By_Path("/cache", false);
 
 	bool Shutdown = false;
 	bool SkipDecryption = false;
@@ -309,26 +389,11 @@ int main(int argc, char **argv) {
 	}
 
 #ifdef TW_HAS_MTP
-	char mtp_crash_check[PROPERTY_VALUE_MAX];
-	property_get("mtp.crash_check", mtp_crash_check, "0");
-	if (DataManager::GetIntValue("tw_mtp_enabled")
-			&& !strcmp(mtp_crash_check, "0") && !crash_counter
-			&& (!DataManager::GetIntValue(TW_IS_ENCRYPTED) || DataManager::GetIntValue(TW_IS_DECRYPTED))) {
-		property_set("mtp.crash_check", "1");
-		LOGINFO("Starting MTP\n");
-		if (!PartitionManager.Enable_MTP())
-			PartitionManager.Disable_MTP();
-		else
-			gui_msg("mtp_enabled=MTP Enabled");
-		property_set("mtp.crash_check", "0");
-	} else if (strcmp(mtp_crash_check, "0")) {
-		gui_warn("mtp_crash=MTP Crashed, not starting MTP on boot.");
-		DataManager::SetValue("tw_mtp_enabled", 0);
-		PartitionManager.Disable_MTP();
-	} else if (crash_counter == 1) {
-		LOGINFO("TWRP crashed; disabling MTP as a precaution.\n");
-		PartitionManager.Disable_MTP();
-	}
+	// Enabling MTP can take a while, so it happens behind the UI
+	pthread_t mtp_thread;
+	bool mtp_started = pthread_create(&mtp_thread, NULL, Startup_MTP, &crash_counter) == 0;
+	if (!mtp_started)
+		Startup_MTP(&crash_counter);
 #endif
 
 #ifndef TW_OEM_BUILD
@@ -360,9 +425,20 @@ int main(int argc, char **argv) {
 	twrpAdbBuFifo *adb_bu_fifo = new twrpAdbBuFifo();
 	adb_bu_fifo->threadAdbBuFifo();
 
+	struct timespec boot_time;
+	clock_gettime(CLOCK_BOOTTIME, &boot_time);
+	LOGINFO("UI ready %llums after boot, %llums after recovery started\n",
+		(unsigned long long)boot_time.tv_sec * 1000 + boot_time.tv_nsec / 1000000,
+		(unsigned long long)(twrpTaskGraph::Now_Ms() - Start_Ms));
+
 	// Launch the main GUI
 	gui_start();
 
+#ifdef TW_HAS_MTP
+	if (mtp_started)
+		pthread_join(mtp_thread, NULL);
+#endif
+
 #ifndef TW_OEM_BUILD
 	// Disable flashing of stock recovery
 	TWFunc::Disable_Stock_Recovery_Replace();
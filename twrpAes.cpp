@@ -0,0 +1,606 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+#include "twrpAes.hpp"
+#include "twrpTelemetry.hpp"
+#include "twcommon.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#define TWAES_HAVE_AESNI
+#endif
+
+#if defined(__aarch64__)
+// Only the CE functions are built for the Crypto Extensions, the rest of the file keeps the
+// target's -march. Older clang declares the AES intrinsics only when the whole file targets
+// crypto, so claim the feature for the header; the functions using them carry the target.
+#if defined(__clang__) && !defined(__ARM_FEATURE_CRYPTO)
+#define __ARM_FEATURE_CRYPTO 1
+#endif
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#ifdef __clang__
+#define TWAES_CE_TARGET __attribute__((target("crypto")))
+#else
+#define TWAES_CE_TARGET __attribute__((target("+crypto")))
+#endif
+#define TWAES_HAVE_ARMV8_CE
+#endif
+
+// openaes frame header: "OAES", version 1, type 2 (data), 16 bit options, 8 bit flags
+#define OAES_OPTION_ECB 0x0001
+#define OAES_OPTION_CBC 0x0002
+#define OAES_OPTION_STEP_ON 0x0004
+#define OAES_OPTION_STEP_OFF 0x0008
+#define OAES_FLAG_PAD 0x01
+
+#define WRITER_BATCH_FRAMES 32
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+// Engine entry points. CBC encryption is serial by nature; decryption works on a run of
+// independent blocks so the hardware versions can keep several in flight.
+typedef void (*cbc_encrypt_func)(const twrpAesKeySchedule *key, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks);
+typedef void (*ecb_decrypt_func)(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out, size_t blocks);
+
+static pthread_once_t engine_once = PTHREAD_ONCE_INIT;
+static cbc_encrypt_func engine_cbc_encrypt;
+static ecb_decrypt_func engine_ecb_decrypt;
+static const char *engine_name;
+
+static uint8_t sbox[256], inv_sbox[256];
+static uint32_t te[4][256], td[4][256];
+
+#define GETU32(p) (((uint32_t)(p)[0] << 24) | ((uint32_t)(p)[1] << 16) | ((uint32_t)(p)[2] << 8) | (uint32_t)(p)[3])
+#define PUTU32(p, v) { (p)[0] = (uint8_t)((v) >> 24); (p)[1] = (uint8_t)((v) >> 16); (p)[2] = (uint8_t)((v) >> 8); (p)[3] = (uint8_t)(v); }
+
+static inline uint32_t ror32(uint32_t v, int n) {
+	return n ? (v >> n) | (v << (32 - n)) : v;
+}
+
+static inline uint8_t rotl8(uint8_t v, int n) {
+	return (uint8_t)((v << n) | (v >> (8 - n)));
+}
+
+static uint8_t gf_mul(uint8_t a, uint8_t b) {
+	uint8_t r = 0;
+
+	while (b) {
+		if (b & 1)
+			r ^= a;
+		a = (uint8_t)((a << 1) ^ (a & 0x80 ? 0x1b : 0));
+		b >>= 1;
+	}
+	return r;
+}
+
+static void Build_Tables(void) {
+	uint8_t p = 1, q = 1;
+
+	// Walk the multiplicative group with generator 3; q tracks the inverse of p.
+	do {
+		p = (uint8_t)(p ^ (p << 1) ^ (p & 0x80 ? 0x1b : 0));
+		q ^= (uint8_t)(q << 1);
+		q ^= (uint8_t)(q << 2);
+		q ^= (uint8_t)(q << 4);
+		if (q & 0x80)
+			q ^= 0x09;
+		sbox[p] = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4) ^ 0x63;
+	} while (p != 1);
+	sbox[0] = 0x63;
+
+	for (int i = 0; i < 256; i++)
+		inv_sbox[sbox[i]] = (uint8_t)i;
+
+	for (int i = 0; i < 256; i++) {
+		uint8_t s = sbox[i], si = inv_sbox[i];
+		uint32_t e = ((uint32_t)gf_mul(s, 2) << 24) | ((uint32_t)s << 16) | ((uint32_t)s << 8) | gf_mul(s, 3);
+		uint32_t d = ((uint32_t)gf_mul(si, 0x0e) << 24) | ((uint32_t)gf_mul(si, 0x09) << 16) | ((uint32_t)gf_mul(si, 0x0d) << 8) | gf_mul(si, 0x0b);
+		for (int t = 0; t < 4; t++) {
+			te[t][i] = ror32(e, 8 * t);
+			td[t][i] = ror32(d, 8 * t);
+		}
+	}
+}
+
+static void Soft_Encrypt_Block(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out) {
+	const uint32_t *rk = key->enc;
+	uint32_t s0 = GETU32(in) ^ rk[0], s1 = GETU32(in + 4) ^ rk[1], s2 = GETU32(in + 8) ^ rk[2], s3 = GETU32(in + 12) ^ rk[3];
+	uint32_t t0, t1, t2, t3;
+
+	for (int r = 1; r < key->rounds; r++) {
+		rk += 4;
+		t0 = te[0][s0 >> 24] ^ te[1][(s1 >> 16) & 0xff] ^ te[2][(s2 >> 8) & 0xff] ^ te[3][s3 & 0xff] ^ rk[0];
+		t1 = te[0][s1 >> 24] ^ te[1][(s2 >> 16) & 0xff] ^ te[2][(s3 >> 8) & 0xff] ^ te[3][s0 & 0xff] ^ rk[1];
+		t2 = te[0][s2 >> 24] ^ te[1][(s3 >> 16) & 0xff] ^ te[2][(s0 >> 8) & 0xff] ^ te[3][s1 & 0xff] ^ rk[2];
+		t3 = te[0][s3 >> 24] ^ te[1][(s0 >> 16) & 0xff] ^ te[2][(s1 >> 8) & 0xff] ^ te[3][s2 & 0xff] ^ rk[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+	rk += 4;
+	t0 = ((uint32_t)sbox[s0 >> 24] << 24) ^ ((uint32_t)sbox[(s1 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s2 >> 8) & 0xff] << 8) ^ sbox[s3 & 0xff] ^ rk[0];
+	t1 = ((uint32_t)sbox[s1 >> 24] << 24) ^ ((uint32_t)sbox[(s2 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s3 >> 8) & 0xff] << 8) ^ sbox[s0 & 0xff] ^ rk[1];
+	t2 = ((uint32_t)sbox[s2 >> 24] << 24) ^ ((uint32_t)sbox[(s3 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s0 >> 8) & 0xff] << 8) ^ sbox[s1 & 0xff] ^ rk[2];
+	t3 = ((uint32_t)sbox[s3 >> 24] << 24) ^ ((uint32_t)sbox[(s0 >> 16) & 0xff] << 16) ^ ((uint32_t)sbox[(s1 >> 8) & 0xff] << 8) ^ sbox[s2 & 0xff] ^ rk[3];
+	PUTU32(out, t0);
+	PUTU32(out + 4, t1);
+	PUTU32(out + 8, t2);
+	PUTU32(out + 12, t3);
+}
+
+static void Soft_Decrypt_Block(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out) {
+	const uint32_t *rk = key->dec;
+	uint32_t s0 = GETU32(in) ^ rk[0], s1 = GETU32(in + 4) ^ rk[1], s2 = GETU32(in + 8) ^ rk[2], s3 = GETU32(in + 12) ^ rk[3];
+	uint32_t t0, t1, t2, t3;
+
+	for (int r = 1; r < key->rounds; r++) {
+		rk += 4;
+		t0 = td[0][s0 >> 24] ^ td[1][(s3 >> 16) & 0xff] ^ td[2][(s2 >> 8) & 0xff] ^ td[3][s1 & 0xff] ^ rk[0];
+		t1 = td[0][s1 >> 24] ^ td[1][(s0 >> 16) & 0xff] ^ td[2][(s3 >> 8) & 0xff] ^ td[3][s2 & 0xff] ^ rk[1];
+		t2 = td[0][s2 >> 24] ^ td[1][(s1 >> 16) & 0xff] ^ td[2][(s0 >> 8) & 0xff] ^ td[3][s3 & 0xff] ^ rk[2];
+		t3 = td[0][s3 >> 24] ^ td[1][(s2 >> 16) & 0xff] ^ td[2][(s1 >> 8) & 0xff] ^ td[3][s0 & 0xff] ^ rk[3];
+		s0 = t0; s1 = t1; s2 = t2; s3 = t3;
+	}
+	rk += 4;
+	t0 = ((uint32_t)inv_sbox[s0 >> 24] << 24) ^ ((uint32_t)inv_sbox[(s3 >> 16) & 0xff] << 16) ^ ((uint32_t)inv_sbox[(s2 >> 8) & 0xff] << 8) ^ inv_sbox[s1 & 0xff] ^ rk[0];
+	t1 = ((uint32_t)inv_sbox[s1 >> 24] << 24) ^ ((uint32_t)inv_sbox[(s0 >> 16) & 0xff] << 16) ^ ((uint32_t)inv_sbox[(s3 >> 8) & 0xff] << 8) ^ inv_sbox[s2 & 0xff] ^ rk[1];
+	t2 = ((uint32_t)inv_sbox[s2 >> 24] << 24) ^ ((uint32_t)inv_sbox[(s1 >> 16) & 0xff] << 16) ^ ((uint32_t)inv_sbox[(s0 >> 8) & 0xff] << 8) ^ inv_sbox[s3 & 0xff] ^ rk[2];
+	t3 = ((uint32_t)inv_sbox[s3 >> 24] << 24) ^ ((uint32_t)inv_sbox[(s2 >> 16) & 0xff] << 16) ^ ((uint32_t)inv_sbox[(s1 >> 8) & 0xff] << 8) ^ inv_sbox[s0 & 0xff] ^ rk[3];
+	PUTU32(out, t0);
+	PUTU32(out + 4, t1);
+	PUTU32(out + 8, t2);
+	PUTU32(out + 12, t3);
+}
+
+static void Soft_Cbc_Encrypt(const twrpAesKeySchedule *key, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks) {
+	uint8_t block[TWAES_BLOCK_SIZE];
+
+	for (size_t b = 0; b < blocks; b++) {
+		for (int i = 0; i < TWAES_BLOCK_SIZE; i++)
+			block[i] = in[i] ^ iv[i];
+		Soft_Encrypt_Block(key, block, out);
+		memcpy(iv, out, TWAES_BLOCK_SIZE);
+		in += TWAES_BLOCK_SIZE;
+		out += TWAES_BLOCK_SIZE;
+	}
+}
+
+static void Soft_Ecb_Decrypt(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+	for (size_t b = 0; b < blocks; b++)
+		Soft_Decrypt_Block(key, in + b * TWAES_BLOCK_SIZE, out + b * TWAES_BLOCK_SIZE);
+}
+
+#ifdef TWAES_HAVE_AESNI
+__attribute__((target("aes,sse2")))
+static void Aesni_Cbc_Encrypt(const twrpAesKeySchedule *key, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks) {
+	__m128i rk[15];
+	int rounds = key->rounds;
+
+	for (int r = 0; r <= rounds; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)(key->enc_bytes + 16 * r));
+	__m128i state = _mm_loadu_si128((const __m128i*)iv);
+	for (size_t b = 0; b < blocks; b++) {
+		state = _mm_xor_si128(state, _mm_loadu_si128((const __m128i*)(in + 16 * b)));
+		state = _mm_xor_si128(state, rk[0]);
+		for (int r = 1; r < rounds; r++)
+			state = _mm_aesenc_si128(state, rk[r]);
+		state = _mm_aesenclast_si128(state, rk[rounds]);
+		_mm_storeu_si128((__m128i*)(out + 16 * b), state);
+	}
+	_mm_storeu_si128((__m128i*)iv, state);
+}
+
+__attribute__((target("aes,sse2")))
+static void Aesni_Ecb_Decrypt(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+	__m128i rk[15];
+	int rounds = key->rounds;
+	size_t b = 0;
+
+	for (int r = 0; r <= rounds; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)(key->dec_bytes + 16 * r));
+	for (; b + 4 <= blocks; b += 4) {
+		__m128i s0 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * b)), rk[0]);
+		__m128i s1 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * b + 16)), rk[0]);
+		__m128i s2 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * b + 32)), rk[0]);
+		__m128i s3 = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * b + 48)), rk[0]);
+		for (int r = 1; r < rounds; r++) {
+			s0 = _mm_aesdec_si128(s0, rk[r]);
+			s1 = _mm_aesdec_si128(s1, rk[r]);
+			s2 = _mm_aesdec_si128(s2, rk[r]);
+			s3 = _mm_aesdec_si128(s3, rk[r]);
+		}
+		_mm_storeu_si128((__m128i*)(out + 16 * b), _mm_aesdeclast_si128(s0, rk[rounds]));
+		_mm_storeu_si128((__m128i*)(out + 16 * b + 16), _mm_aesdeclast_si128(s1, rk[rounds]));
+		_mm_storeu_si128((__m128i*)(out + 16 * b + 32), _mm_aesdeclast_si128(s2, rk[rounds]));
+		_mm_storeu_si128((__m128i*)(out + 16 * b + 48), _mm_aesdeclast_si128(s3, rk[rounds]));
+	}
+	for (; b < blocks; b++) {
+		__m128i s = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(in + 16 * b)), rk[0]);
+		for (int r = 1; r < rounds; r++)
+			s = _mm_aesdec_si128(s, rk[r]);
+		_mm_storeu_si128((__m128i*)(out + 16 * b), _mm_aesdeclast_si128(s, rk[rounds]));
+	}
+}
+
+static bool Cpu_Has_Aesni(void) {
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (ecx & (1 << 25)) != 0;
+}
+#endif
+
+#ifdef TWAES_HAVE_ARMV8_CE
+// AESE/AESD fold the round key addition in front of the S-box step, so the last round key
+// is a plain XOR at the end.
+TWAES_CE_TARGET
+static void Ce_Cbc_Encrypt(const twrpAesKeySchedule *key, uint8_t *iv, const uint8_t *in, uint8_t *out, size_t blocks) {
+	uint8x16_t rk[15];
+	int rounds = key->rounds;
+
+	for (int r = 0; r <= rounds; r++)
+		rk[r] = vld1q_u8(key->enc_bytes + 16 * r);
+	uint8x16_t state = vld1q_u8(iv);
+	for (size_t b = 0; b < blocks; b++) {
+		state = veorq_u8(state, vld1q_u8(in + 16 * b));
+		for (int r = 0; r < rounds - 1; r++)
+			state = vaesmcq_u8(vaeseq_u8(state, rk[r]));
+		state = veorq_u8(vaeseq_u8(state, rk[rounds - 1]), rk[rounds]);
+		vst1q_u8(out + 16 * b, state);
+	}
+	vst1q_u8(iv, state);
+}
+
+TWAES_CE_TARGET
+static void Ce_Ecb_Decrypt(const twrpAesKeySchedule *key, const uint8_t *in, uint8_t *out, size_t blocks) {
+	uint8x16_t rk[15];
+	int rounds = key->rounds;
+	size_t b = 0;
+
+	for (int r = 0; r <= rounds; r++)
+		rk[r] = vld1q_u8(key->dec_bytes + 16 * r);
+	for (; b + 4 <= blocks; b += 4) {
+		uint8x16_t s0 = vld1q_u8(in + 16 * b);
+		uint8x16_t s1 = vld1q_u8(in + 16 * b + 16);
+		uint8x16_t s2 = vld1q_u8(in + 16 * b + 32);
+		uint8x16_t s3 = vld1q_u8(in + 16 * b + 48);
+		for (int r = 0; r < rounds - 1; r++) {
+			s0 = vaesimcq_u8(vaesdq_u8(s0, rk[r]));
+			s1 = vaesimcq_u8(vaesdq_u8(s1, rk[r]));
+			s2 = vaesimcq_u8(vaesdq_u8(s2, rk[r]));
+			s3 = vaesimcq_u8(vaesdq_u8(s3, rk[r]));
+		}
+		vst1q_u8(out + 16 * b, veorq_u8(vaesdq_u8(s0, rk[rounds - 1]), rk[rounds]));
+		vst1q_u8(out + 16 * b + 16, veorq_u8(vaesdq_u8(s1, rk[rounds - 1]), rk[rounds]));
+		vst1q_u8(out + 16 * b + 32, veorq_u8(vaesdq_u8(s2, rk[rounds - 1]), rk[rounds]));
+		vst1q_u8(out + 16 * b + 48, veorq_u8(vaesdq_u8(s3, rk[rounds - 1]), rk[rounds]));
+	}
+	for (; b < blocks; b++) {
+		uint8x16_t s = vld1q_u8(in + 16 * b);
+		for (int r = 0; r < rounds - 1; r++)
+			s = vaesimcq_u8(vaesdq_u8(s, rk[r]));
+		vst1q_u8(out + 16 * b, veorq_u8(vaesdq_u8(s, rk[rounds - 1]), rk[rounds]));
+	}
+}
+#endif
+
+static void Select_Engine(void) {
+	Build_Tables();
+	engine_cbc_encrypt = Soft_Cbc_Encrypt;
+	engine_ecb_decrypt = Soft_Ecb_Decrypt;
+	engine_name = "software AES";
+#ifdef TWAES_HAVE_AESNI
+	if (Cpu_Has_Aesni()) {
+		engine_cbc_encrypt = Aesni_Cbc_Encrypt;
+		engine_ecb_decrypt = Aesni_Ecb_Decrypt;
+		engine_name = "AES-NI";
+	}
+#endif
+#ifdef TWAES_HAVE_ARMV8_CE
+	if (getauxval(AT_HWCAP) & HWCAP_AES) {
+		engine_cbc_encrypt = Ce_Cbc_Encrypt;
+		engine_ecb_decrypt = Ce_Ecb_Decrypt;
+		engine_name = "ARMv8 Crypto Extensions";
+	}
+#endif
+	if (getenv("TW_AES_SOFTWARE")) {
+		engine_cbc_encrypt = Soft_Cbc_Encrypt;
+		engine_ecb_decrypt = Soft_Ecb_Decrypt;
+		engine_name = "software AES";
+	}
+}
+
+const char *twrpAes::Engine_Name(void) {
+	pthread_once(&engine_once, Select_Engine);
+	return engine_name;
+}
+
+twrpAes::twrpAes(void) {
+	memset(&key, 0, sizeof(key));
+	memset(iv, 0, sizeof(iv));
+}
+
+void twrpAes::Set_Key(const std::string& password) {
+	uint8_t key_data[32];
+	size_t key_len = password.size();
+	int nk;
+
+	pthread_once(&engine_once, Select_Engine);
+
+	// Same key padding as the openaes tool
+	for (size_t i = 0; i < sizeof(key_data); i++)
+		key_data[i] = i + 1;
+	memcpy(key_data, password.c_str(), key_len > sizeof(key_data) ? sizeof(key_data) : key_len);
+	if (key_len <= 16)
+		key_len = 16;
+	else if (key_len <= 24)
+		key_len = 24;
+	else
+		key_len = 32;
+
+	nk = key_len / 4;
+	key.rounds = nk + 6;
+	int words = 4 * (key.rounds + 1);
+	uint32_t rcon = 0x01000000;
+	for (int i = 0; i < nk; i++)
+		key.enc[i] = GETU32(key_data + 4 * i);
+	for (int i = nk; i < words; i++) {
+		uint32_t t = key.enc[i - 1];
+		if (i % nk == 0) {
+			t = (t << 8) | (t >> 24);
+			t = ((uint32_t)sbox[t >> 24] << 24) | ((uint32_t)sbox[(t >> 16) & 0xff] << 16) | ((uint32_t)sbox[(t >> 8) & 0xff] << 8) | sbox[t & 0xff];
+			t ^= rcon;
+			rcon = (uint32_t)gf_mul((uint8_t)(rcon >> 24), 2) << 24;
+		} else if (nk > 6 && i % nk == 4) {
+			t = ((uint32_t)sbox[t >> 24] << 24) | ((uint32_t)sbox[(t >> 16) & 0xff] << 16) | ((uint32_t)sbox[(t >> 8) & 0xff] << 8) | sbox[t & 0xff];
+		}
+		key.enc[i] = key.enc[i - nk] ^ t;
+	}
+
+	// Equivalent inverse cipher: round keys in reverse with InvMixColumns applied to all
+	// but the first and last. td[] has the inverse S-box built in, so feed it S-box output.
+	for (int r = 0; r <= key.rounds; r++) {
+		for (int c = 0; c < 4; c++) {
+			uint32_t w = key.enc[4 * (key.rounds - r) + c];
+			if (r > 0 && r < key.rounds)
+				w = td[0][sbox[w >> 24]] ^ td[1][sbox[(w >> 16) & 0xff]] ^ td[2][sbox[(w >> 8) & 0xff]] ^ td[3][sbox[w & 0xff]];
+			key.dec[4 * r + c] = w;
+		}
+	}
+	for (int i = 0; i < words; i++) {
+		PUTU32(key.enc_bytes + 4 * i, key.enc[i]);
+		PUTU32(key.dec_bytes + 4 * i, key.dec[i]);
+	}
+	memset(key_data, 0, sizeof(key_data));
+}
+
+bool twrpAes::Random_IV(void) {
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		LOGINFO("twrpAes: unable to open /dev/urandom: %s\n", strerror(errno));
+		return false;
+	}
+	ssize_t len = read(fd, iv, sizeof(iv));
+	close(fd);
+	if (len != (ssize_t)sizeof(iv)) {
+		LOGINFO("twrpAes: unable to read IV\n");
+		return false;
+	}
+	return true;
+}
+
+size_t twrpAes::Encrypt_Frame(const uint8_t *in, size_t len, uint8_t *out) {
+	size_t full = len & ~(size_t)(TWAES_BLOCK_SIZE - 1);
+	size_t pad = full == len ? 0 : TWAES_BLOCK_SIZE - (len - full);
+	uint16_t options = OAES_OPTION_CBC | OAES_OPTION_STEP_OFF;  // what "openaes enc" writes
+
+	memset(out, 0, TWAES_BLOCK_SIZE);
+	memcpy(out, "OAES\x01\x02", 6);
+	memcpy(out + 6, &options, sizeof(options));
+	out[8] = pad ? OAES_FLAG_PAD : 0;
+	memcpy(out + TWAES_BLOCK_SIZE, iv, TWAES_BLOCK_SIZE);
+
+	uint8_t *data = out + 2 * TWAES_BLOCK_SIZE;
+	engine_cbc_encrypt(&key, iv, in, data, full / TWAES_BLOCK_SIZE);
+	if (pad) {
+		// openaes pads with 1, 2, 3, ... so the last byte holds the pad length
+		uint8_t block[TWAES_BLOCK_SIZE];
+		size_t tail = len - full;
+		memcpy(block, in + full, tail);
+		for (size_t i = 0; i < pad; i++)
+			block[tail + i] = i + 1;
+		engine_cbc_encrypt(&key, iv, block, data + full, 1);
+	}
+	return 2 * TWAES_BLOCK_SIZE + full + (pad ? TWAES_BLOCK_SIZE : 0);
+}
+
+bool twrpAes::Decrypt_Frame(const uint8_t *in, size_t len, uint8_t *out, size_t *out_len) {
+	uint16_t options;
+	uint8_t flags;
+
+	if (len < 2 * TWAES_BLOCK_SIZE || len % TWAES_BLOCK_SIZE != 0)
+		return false;
+	if (memcmp(in, "OAES\x01\x02", 6) != 0)
+		return false;
+	memcpy(&options, in + 6, sizeof(options));
+	flags = in[8];
+	if (options & ~(OAES_OPTION_ECB | OAES_OPTION_CBC | OAES_OPTION_STEP_ON | OAES_OPTION_STEP_OFF))
+		return false;
+	if (options == 0 || (options & (OAES_OPTION_ECB | OAES_OPTION_CBC)) == (OAES_OPTION_ECB | OAES_OPTION_CBC))
+		return false;
+	if (flags & ~OAES_FLAG_PAD)
+		return false;
+
+	const uint8_t *data = in + 2 * TWAES_BLOCK_SIZE;
+	size_t data_len = len - 2 * TWAES_BLOCK_SIZE;
+	engine_ecb_decrypt(&key, data, out, data_len / TWAES_BLOCK_SIZE);
+	if (options & OAES_OPTION_CBC) {
+		// Each block is XORed with the ciphertext before it, the first with the frame IV.
+		const uint8_t *prev = in + TWAES_BLOCK_SIZE;
+		for (size_t i = 0; i < data_len; i++) {
+			out[i] ^= prev[i];
+		}
+	}
+	*out_len = data_len;
+
+	if (flags & OAES_FLAG_PAD) {
+		if (data_len == 0)
+			return false;
+		uint8_t pad = out[data_len - 1];
+		if (pad == 0 || pad >= TWAES_BLOCK_SIZE)
+			return false;
+		for (size_t i = 0; i < pad; i++)
+			if (out[data_len - 1 - i] != pad - i)
+				return false;
+		*out_len = data_len - pad;
+	}
+	return true;
+}
+
+twrpAesWriter::twrpAesWriter(void) {
+	input_fd = -1;
+	output_fd = -1;
+	started = false;
+	result = 0;
+	telemetry_slot = TELEMETRY_MAIN_SLOT;
+}
+
+twrpAesWriter::~twrpAesWriter() {
+	Finish();
+}
+
+int twrpAesWriter::Start(int out_fd, const std::string& password) {
+	int pipes[2];
+
+	aes.Set_Key(password);
+	if (!aes.Random_IV())
+		return -1;
+	if (pipe2(pipes, O_CLOEXEC) < 0) {
+		LOGINFO("twrpAesWriter: unable to create pipe: %s\n", strerror(errno));
+		return -1;
+	}
+	fcntl(pipes[1], F_SETPIPE_SZ, TWAES_FRAME_DATA_SIZE * WRITER_BATCH_FRAMES);
+	input_fd = pipes[0];
+	output_fd = out_fd;
+	result = 0;
+	telemetry_slot = twrpTelemetry::Get_Thread_Slot();
+	if (pthread_create(&thread, NULL, Encrypt_Thread, this) != 0) {
+		LOGINFO("twrpAesWriter: unable to start encrypt thread\n");
+		close(pipes[0]);
+		close(pipes[1]);
+		input_fd = -1;
+		return -1;
+	}
+	started = true;
+	LOGINFO("Encrypting with %s\n", twrpAes::Engine_Name());
+	return pipes[1];
+}
+
+int twrpAesWriter::Finish(void) {
+	if (started) {
+		pthread_join(thread, NULL);
+		started = false;
+	}
+	if (input_fd >= 0) {
+		close(input_fd);
+		input_fd = -1;
+	}
+	return result;
+}
+
+void *twrpAesWriter::Encrypt_Thread(void *cookie) {
+	twrpAesWriter *writer = (twrpAesWriter*) cookie;
+	const size_t in_size = TWAES_FRAME_DATA_SIZE * WRITER_BATCH_FRAMES;
+	uint8_t *in = (uint8_t*) malloc(in_size);
+	uint8_t *out = (uint8_t*) malloc(TWAES_FRAME_SIZE * WRITER_BATCH_FRAMES);
+	bool eof = false;
+
+	if (in == NULL || out == NULL) {
+		LOGINFO("twrpAesWriter: out of memory\n");
+		writer->result = -1;
+	}
+	while (writer->result == 0 && !eof) {
+		size_t filled = 0;
+		while (filled < in_size) {
+			ssize_t len = read(writer->input_fd, in + filled, in_size - filled);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0) {
+				if (len < 0) {
+					LOGINFO("twrpAesWriter: read failed: %s\n", strerror(errno));
+					writer->result = -1;
+				}
+				eof = true;
+				break;
+			}
+			filled += len;
+		}
+		if (writer->result != 0 || filled == 0)
+			break;
+
+		// Only the last chunk of the stream can be short, same as openaes reading stdin.
+		size_t out_len = 0;
+		twrpStageTimer encrypt_timer(TELEMETRY_ENCRYPT, writer->telemetry_slot);
+		for (size_t pos = 0; pos < filled; pos += TWAES_FRAME_DATA_SIZE) {
+			size_t chunk = filled - pos < TWAES_FRAME_DATA_SIZE ? filled - pos : TWAES_FRAME_DATA_SIZE;
+			out_len += writer->aes.Encrypt_Frame(in + pos, chunk, out + out_len);
+		}
+		encrypt_timer.Stop(filled);
+		twrpStageTimer write_timer(TELEMETRY_WRITE, writer->telemetry_slot);
+		size_t written = 0;
+		while (written < out_len) {
+			ssize_t len = write(writer->output_fd, out + written, out_len - written);
+			if (len < 0 && errno == EINTR)
+				continue;
+			if (len <= 0) {
+				LOGINFO("twrpAesWriter: write failed: %s\n", strerror(errno));
+				writer->result = -1;
+				break;
+			}
+			written += len;
+		}
+		write_timer.Stop(written);
+	}
+	if (!eof) {
+		// Keep draining after a failure so whoever writes the plain data does not block on a
+		// full pipe; Finish reports the error.
+		uint8_t drain[4096];
+		ssize_t len;
+		while ((len = read(writer->input_fd, drain, sizeof(drain))) != 0) {
+			if (len < 0 && errno != EINTR)
+				break;
+		}
+	}
+	free(in);
+	free(out);
+	return NULL;
+}
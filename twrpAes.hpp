@@ -0,0 +1,92 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPAES_HPP
+#define TWRPAES_HPP
+
+#include <string>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+// openaes encrypts 4064 byte chunks into 4096 byte frames: a 16 byte header, a 16 byte IV
+// and the AES-CBC ciphertext, with the last frame padded to a whole block.
+#define TWAES_BLOCK_SIZE 16
+#define TWAES_FRAME_SIZE 4096
+#define TWAES_FRAME_DATA_SIZE (TWAES_FRAME_SIZE - 2 * TWAES_BLOCK_SIZE)
+
+struct twrpAesKeySchedule {
+	uint32_t enc[60];                                  // encryption round keys as words
+	uint32_t dec[60];                                  // equivalent inverse cipher round keys
+	uint8_t enc_bytes[240];                            // the same keys in AES byte order
+	uint8_t dec_bytes[240];
+	int rounds;
+};
+
+// In process replacement for the openaes tool. Reads and writes the same frame format, so
+// backups stay interchangeable with the openaes binary, but uses the ARMv8 Crypto
+// Extensions or AES-NI when the CPU has them. An object holds the key and the CBC chain of
+// one stream; use one per thread.
+class twrpAes {
+public:
+	twrpAes(void);
+
+	// Expands the key the way "openaes --key" does.
+	void Set_Key(const std::string& password);
+	// Picks a random IV for the first frame; needed before encrypting.
+	bool Random_IV(void);
+	// Encrypts up to TWAES_FRAME_DATA_SIZE bytes into out, which must hold
+	// TWAES_FRAME_SIZE bytes. Returns the frame length.
+	size_t Encrypt_Frame(const uint8_t *in, size_t len, uint8_t *out);
+	// Decrypts one frame into out, which must hold len bytes. Returns false if the frame
+	// header or the padding is invalid, which is also how a wrong password shows up.
+	bool Decrypt_Frame(const uint8_t *in, size_t len, uint8_t *out, size_t *out_len);
+	// Name of the AES implementation in use, for the log.
+	static const char *Engine_Name(void);
+
+private:
+	twrpAesKeySchedule key;
+	uint8_t iv[TWAES_BLOCK_SIZE];                      // chains across frames while encrypting
+};
+
+// Encrypts a stream on a thread of its own in place of an "openaes enc" child: whatever is
+// written to the fd returned by Start comes out of output_fd as openaes frames.
+class twrpAesWriter {
+public:
+	twrpAesWriter(void);
+	~twrpAesWriter();
+
+	// Does not take ownership of output_fd. Returns the fd to write plain data to, or -1.
+	// Closing every copy of that fd ends the stream.
+	int Start(int output_fd, const std::string& password);
+	// Waits for the last frame to be written. Returns 0 on success.
+	int Finish(void);
+
+private:
+	static void *Encrypt_Thread(void *cookie);
+
+	twrpAes aes;
+	int input_fd;
+	int output_fd;
+	pthread_t thread;
+	bool started;
+	int result;
+	unsigned telemetry_slot;                           // twrpTelemetry slot of the thread that started us
+};
+
+#endif // TWRPAES_HPP
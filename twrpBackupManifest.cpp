@@ -0,0 +1,256 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+
+#include "twrpBackupManifest.hpp"
+#include "twrp-functions.hpp"
+#include "twcommon.h"
+#include "set_metadata.h"
+
+// Both files are plain text. A manifest holds one backup:
+//   twrp_backup_manifest 1
+//   date <seconds>
+//   part <backup name> <file name> <subpartition> <backup size> <archive size> <backup type> <digest>
+// The index holds the same lines for every backup, each block starting with
+//   backup <folder mtime in ns> <folder name>
+// A block is only used while the mtime of its backup folder still matches, so backups that
+// were changed or replaced since fall back to the manifest file or the folder scan.
+#define MANIFEST_HEADER "twrp_backup_manifest 1"
+#define INDEX_HEADER "twrp_backup_index 1"
+
+// Seconds are too coarse, a restore report can be added in the second the index was written
+static long long Folder_Mtime(const struct stat& st) {
+	return (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+}
+
+// "/path/BACKUPS/serial/name/." and "/path/BACKUPS/serial/name/" are both "/path/BACKUPS/serial/name"
+static std::string Trim_Folder(const std::string& Folder) {
+	std::string ret = Folder;
+	for (;;) {
+		if (ret.size() > 1 && ret[ret.size() - 1] == '/')
+			ret.resize(ret.size() - 1);
+		else if (ret.size() > 2 && ret.compare(ret.size() - 2, 2, "/.") == 0)
+			ret.resize(ret.size() - 2);
+		else
+			return ret;
+	}
+}
+
+static void Write_Entries(FILE* fp, time_t date, const std::vector<Backup_Manifest_Entry>& entries) {
+	fprintf(fp, "date %lld\n", (long long)date);
+	for (std::vector<Backup_Manifest_Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		fprintf(fp, "part %s %s %d %llu %llu %d %d\n", it->backup_name.c_str(), it->file_name.c_str(), it->sub_partition ? 1 : 0,
+			it->backup_size, it->archive_size, it->backup_type, it->digest ? 1 : 0);
+	}
+}
+
+// Writes the lines to a temporary file first, so a reader never sees half of a file
+static bool Write_File(const std::string& filename, const std::string& header, const std::string& body) {
+	std::string tmp = filename + ".tmp";
+	FILE* fp = fopen(tmp.c_str(), "w");
+	if (fp == NULL) {
+		LOGINFO("Unable to write '%s': %s\n", tmp.c_str(), strerror(errno));
+		return false;
+	}
+	fprintf(fp, "%s\n", header.c_str());
+	fputs(body.c_str(), fp);
+	if (fclose(fp) != 0 || rename(tmp.c_str(), filename.c_str()) != 0) {
+		LOGINFO("Unable to write '%s': %s\n", filename.c_str(), strerror(errno));
+		unlink(tmp.c_str());
+		return false;
+	}
+	tw_set_default_metadata(filename.c_str());
+	return true;
+}
+
+twrpBackupManifest::twrpBackupManifest(void) {
+	date = 0;
+}
+
+bool twrpBackupManifest::Save(const std::string& Backup_Folder) {
+	std::string folder = Trim_Folder(Backup_Folder);
+	std::string body;
+	char *buf = NULL;
+	size_t len = 0;
+	FILE* fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return false;
+	Write_Entries(fp, date, entries);
+	fclose(fp);
+	body.assign(buf, len);
+	free(buf);
+
+	if (!Write_File(folder + "/" TW_BACKUP_MANIFEST_FILE, MANIFEST_HEADER, body))
+		return false;
+
+	// the mtime is taken after the last file was added to the folder
+	struct stat st;
+	if (stat(folder.c_str(), &st) != 0)
+		return false;
+	return Update_Index(TWFunc::Get_Path(folder), TWFunc::Get_Filename(folder), Folder_Mtime(st));
+}
+
+bool twrpBackupManifest::Load(const std::string& Backup_Folder) {
+	std::string folder = Trim_Folder(Backup_Folder);
+	std::string Backups_Folder = TWFunc::Get_Path(folder);
+	std::string name = TWFunc::Get_Filename(folder);
+	struct stat st;
+
+	if (stat(folder.c_str(), &st) != 0)
+		return false;
+	if (Load_Index(folder, st)) {
+		LOGINFO("Using backup index for '%s'\n", folder.c_str());
+		return true;
+	}
+
+	// Files were added to or removed from the folder since the index was written, e.g. by a
+	// restore writing its report; the manifest is still good if all of its archives are there.
+	if (!Read_File(folder + "/" TW_BACKUP_MANIFEST_FILE, "", 0) || !Files_Exist(folder)) {
+		entries.clear();
+		return false;
+	}
+	LOGINFO("Using backup manifest for '%s'\n", folder.c_str());
+	Update_Index(Backups_Folder, name, Folder_Mtime(st));
+	return true;
+}
+
+bool twrpBackupManifest::Load_Index(const std::string& Backup_Folder, const struct stat& st) {
+	std::string folder = Trim_Folder(Backup_Folder);
+	return Read_File(TWFunc::Get_Path(folder) + TW_BACKUP_INDEX_FILE, TWFunc::Get_Filename(folder), Folder_Mtime(st));
+}
+
+unsigned long long twrpBackupManifest::Total_Size(void) const {
+	unsigned long long total = 0;
+	for (std::vector<Backup_Manifest_Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		total += it->backup_size;
+	return total;
+}
+
+bool twrpBackupManifest::Encrypted(void) const {
+	for (std::vector<Backup_Manifest_Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		if (it->backup_type == ENCRYPTED || it->backup_type == COMPRESSED_ENCRYPTED)
+			return true;
+	}
+	return false;
+}
+
+// With an empty name, reads a manifest file. Otherwise reads the block of the index that
+// belongs to name, if it was written for the folder's current mtime.
+bool twrpBackupManifest::Read_File(const std::string& filename, const std::string& name, long long folder_mtime) {
+	FILE* fp = fopen(filename.c_str(), "r");
+	if (fp == NULL)
+		return false;
+
+	char line[1024];
+	const char* header = name.empty() ? MANIFEST_HEADER : INDEX_HEADER;
+	bool in_block = name.empty();
+	bool found = false;
+	entries.clear();
+	date = 0;
+	if (fgets(line, sizeof(line), fp) == NULL || strncmp(line, header, strlen(header)) != 0) {
+		fclose(fp);
+		return false;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "backup ", 7) == 0) {
+			if (found)
+				break;
+			long long mtime;
+			int pos = 0;
+			in_block = !name.empty() && sscanf(line, "backup %lld %n", &mtime, &pos) == 1 && pos > 0 && mtime == folder_mtime && name == line + pos;
+			continue;
+		}
+		if (!in_block)
+			continue;
+		found = true;
+
+		long long value;
+		char backup_name[256], file_name[256];
+		int sub_partition, backup_type, digest;
+		Backup_Manifest_Entry entry;
+		if (sscanf(line, "date %lld", &value) == 1) {
+			date = (time_t)value;
+		} else if (sscanf(line, "part %255s %255s %d %llu %llu %d %d", backup_name, file_name, &sub_partition, &entry.backup_size, &entry.archive_size, &backup_type, &digest) == 7) {
+			entry.backup_name = backup_name;
+			entry.file_name = file_name;
+			entry.sub_partition = sub_partition != 0;
+			entry.backup_type = backup_type;
+			entry.digest = digest != 0;
+			entries.push_back(entry);
+		}
+	}
+	fclose(fp);
+	return found && !entries.empty();
+}
+
+bool twrpBackupManifest::Files_Exist(const std::string& Backup_Folder) const {
+	for (std::vector<Backup_Manifest_Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it) {
+		std::string path = Backup_Folder + "/" + it->file_name;
+		if (!TWFunc::Path_Exists(path) && !TWFunc::Path_Exists(path + "000"))
+			return false;
+	}
+	return true;
+}
+
+// Replaces the block of name in the index and drops blocks of backups that were deleted
+bool twrpBackupManifest::Update_Index(const std::string& Backups_Folder, const std::string& name, long long folder_mtime) const {
+	std::string filename = Backups_Folder + TW_BACKUP_INDEX_FILE;
+	std::string body;
+	FILE* fp = fopen(filename.c_str(), "r");
+	if (fp != NULL) {
+		char line[1024];
+		bool keep = false;
+		if (fgets(line, sizeof(line), fp) != NULL && strncmp(line, INDEX_HEADER, strlen(INDEX_HEADER)) == 0) {
+			while (fgets(line, sizeof(line), fp) != NULL) {
+				if (strncmp(line, "backup ", 7) == 0) {
+					long long mtime;
+					int pos = 0;
+					keep = false;
+					if (sscanf(line, "backup %lld %n", &mtime, &pos) == 1 && pos > 0) {
+						std::string other(line + pos, strcspn(line + pos, "\n"));
+						keep = other != name && TWFunc::Path_Exists(Backups_Folder + other);
+					}
+				}
+				if (keep)
+					body += line;
+			}
+		}
+		fclose(fp);
+	}
+
+	char *buf = NULL;
+	size_t len = 0;
+	fp = open_memstream(&buf, &len);
+	if (fp == NULL)
+		return false;
+	fprintf(fp, "backup %lld %s\n", folder_mtime, name.c_str());
+	Write_Entries(fp, date, entries);
+	fclose(fp);
+	body.append(buf, len);
+	free(buf);
+	return Write_File(filename, INDEX_HEADER, body);
+}
@@ -0,0 +1,69 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPBACKUPMANIFEST_HPP
+#define TWRPBACKUPMANIFEST_HPP
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sys/stat.h>
+
+#define TW_BACKUP_MANIFEST_FILE "backup.manifest"          // in each backup folder
+#define TW_BACKUP_INDEX_FILE ".backup_index"               // in the backups folder, covers all backups in it
+
+struct Backup_Manifest_Entry {
+	std::string backup_name;                           // partition backup name, e.g. "system"
+	std::string file_name;                             // e.g. "system.ext4.win", without the split suffix
+	bool sub_partition;
+	unsigned long long backup_size;                    // bytes once restored, as backup_size in the .info file
+	unsigned long long archive_size;                   // bytes on storage, all split archives together
+	int backup_type;                                   // Archive_Type of the archive, -1 for images
+	bool digest;                                       // a digest was created
+};
+
+// Summary of one backup folder, written when a backup completes: what the backup contains,
+// how big it is and how it is stored. Each backup folder gets its manifest and the backups
+// folder gets an index of all of their manifests, so building the restore list is a single
+// read of the index and one stat of the backup folder instead of a scan of the archives.
+class twrpBackupManifest {
+public:
+	twrpBackupManifest(void);
+
+	// Writes the manifest into the backup folder and adds it to the index of the folder above.
+	bool Save(const std::string& Backup_Folder);
+	// Fills in the manifest of Backup_Folder from the index, or from the manifest file in the
+	// folder if the index is out of date. Returns false for backups made without a manifest or
+	// changed since it was written.
+	bool Load(const std::string& Backup_Folder);
+	// Only the index part of Load(), for a backup folder the caller already stat()ed. Never
+	// writes, so it is safe while listing the backups folder.
+	bool Load_Index(const std::string& Backup_Folder, const struct stat& st);
+	unsigned long long Total_Size(void) const;
+	bool Encrypted(void) const;
+
+	time_t date;
+	std::vector<Backup_Manifest_Entry> entries;
+
+private:
+	bool Read_File(const std::string& filename, const std::string& name, long long folder_mtime);
+	bool Files_Exist(const std::string& Backup_Folder) const;
+	bool Update_Index(const std::string& Backups_Folder, const std::string& name, long long folder_mtime) const;
+};
+
+#endif // TWRPBACKUPMANIFEST_HPP
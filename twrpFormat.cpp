@@ -0,0 +1,235 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "twrpFormat.hpp"
+#include "twrpTaskGraph.hpp"
+#include "twrpWipe.hpp"
+#include "twrp-functions.hpp"
+#include "twcommon.h"
+#include <selinux/selinux.h>
+#include <selinux/label.h>
+#ifdef USE_EXT4
+extern "C" {
+	#include <ext4_utils/make_ext4fs.h>
+}
+#endif
+
+extern struct selabel_handle *selinux_handle;
+
+std::string twrpFormat::Tool_Path(const std::string& file_system) {
+	const char *tools[3] = { NULL, NULL, NULL };
+
+	if (file_system == "ext4") {
+		tools[0] = "/sbin/make_ext4fs";
+		tools[1] = "/sbin/mke2fs";
+	} else if (file_system == "ext2" || file_system == "ext3") {
+		tools[0] = "/sbin/mke2fs";
+	} else if (file_system == "f2fs") {
+		tools[0] = "/sbin/mkfs.f2fs";
+	} else if (file_system == "vfat") {
+		tools[0] = "/sbin/mkfs.fat";
+	} else if (file_system == "exfat") {
+		tools[0] = "/sbin/mkexfatfs";
+	} else if (file_system == "ntfs") {
+		tools[0] = "/sbin/mkntfs";
+		tools[1] = "/sbin/mkfs.ntfs";
+	}
+	for (int i = 0; tools[i]; i++) {
+		if (TWFunc::Path_Exists(tools[i]))
+			return tools[i];
+	}
+	return "";
+}
+
+bool twrpFormat::Can_Format(const std::string& file_system) {
+#ifdef USE_EXT4
+	if (file_system == "ext4")
+		return true;
+#endif
+	return !Tool_Path(file_system).empty();
+}
+
+std::string twrpFormat::Tool_Name(const std::string& file_system) {
+#ifdef USE_EXT4
+	if (file_system == "ext4")
+		return "make_ext4fs";
+#endif
+	return TWFunc::Get_Filename(Tool_Path(file_system));
+}
+
+bool twrpFormat::Format(const Format_Options& options) {
+	const std::string& fs = options.file_system;
+	std::string tool = Tool_Path(fs), name = Tool_Name(fs);
+	std::vector<std::string> args;
+	bool discarded = false, ret = false;
+	char len[32];
+
+	if (name.empty()) {
+		LOGERR("Unable to format '%s', nothing can make %s\n", options.block_device.c_str(), fs.c_str());
+		return false;
+	}
+
+	uint64_t start = twrpTaskGraph::Now_Ms();
+	if (options.discard_length)
+		discarded = twrpWipe::Discard(options.block_device, 0, options.discard_length, options.secure_discard);
+	if (options.progress)
+		options.progress->SetPartitionSize(options.size);
+
+	sprintf(len, "%i", options.length);
+#ifdef USE_EXT4
+	if (fs == "ext4") {
+		char *secontext = NULL;
+		// make_ext4fs as called here neither discards nor zeroes
+		if (!selinux_handle || selabel_lookup(selinux_handle, &secontext, options.mount_point.c_str(), S_IFDIR) < 0) {
+			LOGINFO("Cannot lookup security context for '%s'\n", options.mount_point.c_str());
+			ret = make_ext4fs(options.block_device.c_str(), options.length, options.mount_point.c_str(), NULL) == 0;
+		} else {
+			freecon(secontext);
+			ret = make_ext4fs(options.block_device.c_str(), options.length, options.mount_point.c_str(), selinux_handle) == 0;
+		}
+	} else
+#endif
+	{
+		args.push_back(tool);
+		if (name == "make_ext4fs") {
+			if (options.use_length && options.length != 0) {
+				args.push_back("-l");
+				args.push_back(len);
+			}
+			if (TWFunc::Path_Exists("/file_contexts")) {
+				args.push_back("-S");
+				args.push_back("/file_contexts");
+			}
+			args.push_back("-a");
+			args.push_back(options.mount_point);
+		} else if (name == "mke2fs") {
+			args.push_back("-t");
+			args.push_back(fs);
+			args.push_back("-m");
+			args.push_back("0");
+			args.push_back("-E");
+			args.push_back(discarded ? "lazy_itable_init=1,lazy_journal_init=1,nodiscard" : "lazy_itable_init=1,lazy_journal_init=1");
+		} else if (name == "mkfs.f2fs") {
+			args.push_back("-t");
+			args.push_back("0");
+			if (options.use_length && options.length != 0) {
+				sprintf(len, "%i", options.length < 0 ? -options.length : options.length);
+				args.push_back("-r");
+				args.push_back(len);
+			}
+		} else if (name == "mkntfs" || name == "mkfs.ntfs") {
+			args.push_back("-Q");              // the full format zeroes the whole device
+		}
+		args.push_back(options.block_device);
+		ret = Run_Tool(args, options);
+	}
+
+	if (options.progress) {
+		options.progress->UpdateSize(options.size);
+		options.progress->UpdateDisplayDetails(true);
+	}
+	LOGINFO("%s '%s' as %s using %s in %llums%s\n", ret ? "Formatted" : "Failed to format", options.block_device.c_str(),
+		fs.c_str(), name.c_str(), (unsigned long long)(twrpTaskGraph::Now_Ms() - start), discarded ? ", discarded first" : "");
+	return ret;
+}
+
+void twrpFormat::Update_Progress(const std::string& line, const Format_Options& options) {
+	unsigned long long done, total;
+
+	// mke2fs counts the block groups as "Writing inode tables:  12/400" using backspaces
+	if (!options.progress || options.size == 0 || line.compare(0, 20, "Writing inode tables") != 0)
+		return;
+	size_t pos = line.find(':');
+	if (pos == std::string::npos || sscanf(line.c_str() + pos + 1, "%llu/%llu", &done, &total) != 2)
+		return;
+	if (total > 0 && done <= total)
+		options.progress->UpdateSize(options.size / total * done);
+}
+
+bool twrpFormat::Run_Tool(const std::vector<std::string>& args, const Format_Options& options) {
+	std::vector<char*> argv;
+	std::string command;
+	int pipefd[2];
+
+	for (size_t i = 0; i < args.size(); i++) {
+		argv.push_back((char*)args[i].c_str());
+		command += (i ? " " : "") + args[i];
+	}
+	argv.push_back(NULL);
+	LOGINFO("Format command: %s\n", command.c_str());
+
+	if (pipe2(pipefd, O_CLOEXEC) != 0) {
+		LOGERR("Unable to create a pipe for %s: %s\n", args[0].c_str(), strerror(errno));
+		return false;
+	}
+	pid_t pid = fork();
+	if (pid < 0) {
+		LOGERR("Unable to fork for %s: %s\n", args[0].c_str(), strerror(errno));
+		close(pipefd[0]);
+		close(pipefd[1]);
+		return false;
+	}
+	if (pid == 0) {
+		dup2(pipefd[1], STDOUT_FILENO);
+		dup2(pipefd[1], STDERR_FILENO);
+		execv(argv[0], argv.data());
+		_exit(127);
+	}
+	close(pipefd[1]);
+
+	// log the output line by line, following the \r and \b progress updates along the way
+	std::string line;
+	char buf[512];
+	ssize_t len;
+	while ((len = read(pipefd[0], buf, sizeof(buf))) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		for (ssize_t i = 0; i < len; i++) {
+			if (buf[i] == '\n') {
+				if (!line.empty())
+					LOGINFO("%s\n", line.c_str());
+				line.clear();
+			} else if (buf[i] == '\r') {
+				line.clear();
+			} else if (buf[i] == '\b') {
+				if (!line.empty())
+					line.erase(line.size() - 1);
+			} else {
+				line += buf[i];
+			}
+		}
+		Update_Progress(line, options);
+	}
+	if (!line.empty())
+		LOGINFO("%s\n", line.c_str());
+	close(pipefd[0]);
+
+	int status;
+	return TWFunc::Wait_For_Child(pid, &status, TWFunc::Get_Filename(args[0])) == 0;
+}
@@ -0,0 +1,57 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPFORMAT_HPP
+#define TWRPFORMAT_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include "progresstracking.hpp"
+
+struct Format_Options {
+	std::string block_device;
+	std::string file_system;                           // ext2, ext3, ext4, f2fs, vfat, exfat or ntfs
+	std::string mount_point;                           // make_ext4fs labels the root of the file system with its context
+	int length;                                        // as TWPartition::Length, negative reserves space at the end of the device
+	bool use_length;                                   // false when formatting a decrypted device with an external tool
+	uint64_t discard_length;                           // bytes to discard from the start of the device first, 0 for none
+	bool secure_discard;
+	ProgressTracking *progress;                        // may be NULL
+	uint64_t size;                                     // device size for the progress bar
+};
+
+// Formats block devices. Whatever the options allow is discarded first, after which the
+// formatters are told not to discard or zero anything themselves: mke2fs initializes inode
+// tables and the journal lazily, mkfs.f2fs skips its discard and mkntfs does a quick format.
+// ext4 is made in-process with libext4_utils when it is linked in. The other formatters are
+// executed directly instead of through a shell, with their output going to the log and
+// mke2fs' inode table count driving the progress bar.
+class twrpFormat {
+public:
+	static bool Can_Format(const std::string& file_system);
+	static std::string Tool_Name(const std::string& file_system);  // for messages, empty if nothing can format it
+	static bool Format(const Format_Options& options);
+
+private:
+	static std::string Tool_Path(const std::string& file_system);
+	static bool Run_Tool(const std::vector<std::string>& args, const Format_Options& options);
+	static void Update_Progress(const std::string& line, const Format_Options& options);
+};
+
+#endif // TWRPFORMAT_HPP
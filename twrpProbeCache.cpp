@@ -0,0 +1,165 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include "twrpProbeCache.hpp"
+#include "twcommon.h"
+#include "libblkid/include/blkid.h"
+
+#define PROBE_SIGNATURE_SIZE 2048
+
+std::map<dev_t, twrpProbeCache::Entry> twrpProbeCache::cache;
+pthread_mutex_t twrpProbeCache::lock = PTHREAD_MUTEX_INITIALIZER;
+
+// FNV-1a
+static uint64_t Probe_Hash(uint64_t hash, const unsigned char* bytes, size_t len) {
+	for (size_t i = 0; i < len; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+bool twrpProbeCache::Get_Device(const std::string& block_device, dev_t& device) {
+	struct stat st;
+
+	if (stat(block_device.c_str(), &st) != 0 || !S_ISBLK(st.st_mode))
+		return false;
+	device = st.st_rdev;
+	return true;
+}
+
+uint64_t twrpProbeCache::Read_Signature(const std::string& block_device) {
+	unsigned char buf[PROBE_SIGNATURE_SIZE];
+
+	int fd = open(block_device.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+	ssize_t len = pread(fd, buf, sizeof(buf), 0);
+	close(fd);
+	if (len != (ssize_t)sizeof(buf))
+		return 0;
+
+	// Only the parts that say which file system is there count, the rest changes every
+	// time the file system is mounted or written to.
+	// The first sector holds the FAT, exFAT and NTFS boot sectors. exFAT keeps its dirty
+	// flag and percentage in use in there.
+	if (memcmp(buf + 3, "EXFAT   ", 8) == 0) {
+		memset(buf + 0x6A, 0, 2);
+		buf[0x70] = 0;
+	}
+	uint64_t hash = Probe_Hash(0xcbf29ce484222325ULL, buf, 512);
+	// The second sector is the FAT32 FSInfo sector with its free cluster count, skip it.
+	// At 1024 is the ext2/3/4 or F2FS superblock. The ext one changes on every mount, so
+	// just take its size, features, uuid and label.
+	const unsigned char* sb = buf + 1024;
+	if (sb[0x38] == 0x53 && sb[0x39] == 0xEF) {
+		hash = Probe_Hash(hash, sb + 0x04, 4);       // s_blocks_count_lo
+		hash = Probe_Hash(hash, sb + 0x18, 4);       // s_log_block_size
+		hash = Probe_Hash(hash, sb + 0x38, 2);       // s_magic
+		hash = Probe_Hash(hash, sb + 0x5C, 12);      // s_feature_compat, incompat, ro_compat
+		hash = Probe_Hash(hash, sb + 0x68, 32);      // s_uuid, s_volume_name
+	} else {
+		hash = Probe_Hash(hash, sb, 1024);
+	}
+	return hash ? hash : 1;
+}
+
+bool twrpProbeCache::Full_Probe(const std::string& block_device, Probe_Result& result) {
+	const char* value;
+	blkid_probe pr;
+
+	pr = blkid_new_probe_from_filename(block_device.c_str());
+	if (!pr) {
+		LOGINFO("Can't probe device %s\n", block_device.c_str());
+		return false;
+	}
+	if (blkid_do_fullprobe(pr)) {
+		blkid_free_probe(pr);
+		LOGINFO("Can't probe device %s\n", block_device.c_str());
+		return false;
+	}
+
+	if (blkid_probe_lookup_value(pr, "TYPE", &value, NULL) < 0) {
+		blkid_free_probe(pr);
+		LOGINFO("can't find filesystem on device %s\n", block_device.c_str());
+		return false;
+	}
+	result.type = value;
+	result.uuid.clear();
+	result.label.clear();
+	if (blkid_probe_lookup_value(pr, "UUID", &value, NULL) == 0)
+		result.uuid = value;
+	if (blkid_probe_lookup_value(pr, "LABEL", &value, NULL) == 0)
+		result.label = value;
+	blkid_free_probe(pr);
+	return true;
+}
+
+bool twrpProbeCache::Probe(const std::string& block_device, Probe_Result& result) {
+	dev_t device;
+	uint64_t signature = 0;
+
+	if (Get_Device(block_device, device))
+		signature = Read_Signature(block_device);
+	if (signature) {
+		pthread_mutex_lock(&lock);
+		std::map<dev_t, Entry>::iterator found = cache.find(device);
+		bool hit = found != cache.end() && found->second.signature == signature;
+		if (hit)
+			result = found->second.result;
+		pthread_mutex_unlock(&lock);
+		if (hit)
+			return true;
+	}
+
+	bool probed = Full_Probe(block_device, result);
+	if (signature) {
+		pthread_mutex_lock(&lock);
+		if (probed) {
+			Entry& entry = cache[device];
+			entry.signature = signature;
+			entry.result = result;
+		} else {
+			cache.erase(device);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+	return probed;
+}
+
+void twrpProbeCache::Invalidate(const std::string& block_device) {
+	dev_t device;
+
+	if (!Get_Device(block_device, device))
+		return;
+	pthread_mutex_lock(&lock);
+	cache.erase(device);
+	pthread_mutex_unlock(&lock);
+}
+
+void twrpProbeCache::Invalidate_All(void) {
+	pthread_mutex_lock(&lock);
+	cache.clear();
+	pthread_mutex_unlock(&lock);
+}
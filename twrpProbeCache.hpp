@@ -0,0 +1,61 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPPROBECACHE_HPP
+#define TWRPPROBECACHE_HPP
+
+#include <map>
+#include <string>
+#include <pthread.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+struct Probe_Result {
+	std::string type;
+	std::string uuid;                                  // empty if the file system has none
+	std::string label;
+};
+
+// Remembers what libblkid found on each block device, keyed by device number, so mounting
+// the same partition again doesn't run the full probe chain. Every lookup reads the start
+// of the device and compares the parts of the boot sector and superblock that identify the
+// file system against what was there when it was probed, so a file system written by
+// something else (mkfs in a script, a restored image) is probed again. Wiping, formatting,
+// flashing and block uevents drop entries explicitly. Files and devices that can't be read
+// are probed every time.
+class twrpProbeCache {
+public:
+	static bool Probe(const std::string& block_device, Probe_Result& result);  // cached or full probe, false if no file system was found
+	static void Invalidate(const std::string& block_device);
+	static void Invalidate_All(void);
+
+private:
+	struct Entry {
+		uint64_t signature;
+		Probe_Result result;
+	};
+
+	static bool Full_Probe(const std::string& block_device, Probe_Result& result);
+	static uint64_t Read_Signature(const std::string& block_device);
+	static bool Get_Device(const std::string& block_device, dev_t& device);
+
+	static std::map<dev_t, Entry> cache;
+	static pthread_mutex_t lock;
+};
+
+#endif // TWRPPROBECACHE_HPP
@@ -0,0 +1,428 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <string>
+#include "twrpRestorePipeline.hpp"
+#include "twrpAes.hpp"
+#include "twrpTelemetry.hpp"
+#include "twcommon.h"
+
+#define RING_BUFFER_SIZE (1024 * 1024)
+#define READ_CHUNK_SIZE (128 * 1024)
+#define INFLATE_OUT_SIZE (256 * 1024)
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+
+twrpRingBuffer::twrpRingBuffer(size_t size) {
+	buffer = (unsigned char*) malloc(size);
+	capacity = size;
+	head = 0;
+	count = 0;
+	closed = false;
+	aborted = (buffer == NULL);
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&readable, NULL);
+	pthread_cond_init(&writable, NULL);
+}
+
+twrpRingBuffer::~twrpRingBuffer() {
+	pthread_cond_destroy(&writable);
+	pthread_cond_destroy(&readable);
+	pthread_mutex_destroy(&lock);
+	free(buffer);
+}
+
+bool twrpRingBuffer::Write(const void *data, size_t len) {
+	const unsigned char *src = (const unsigned char*) data;
+
+	pthread_mutex_lock(&lock);
+	while (len > 0) {
+		while (count == capacity && !aborted)
+			pthread_cond_wait(&writable, &lock);
+		if (aborted) {
+			pthread_mutex_unlock(&lock);
+			return false;
+		}
+		size_t tail = (head + count) % capacity;
+		size_t space = capacity - count;
+		size_t chunk = capacity - tail;
+		if (chunk > space)
+			chunk = space;
+		if (chunk > len)
+			chunk = len;
+		memcpy(buffer + tail, src, chunk);
+		count += chunk;
+		src += chunk;
+		len -= chunk;
+		pthread_cond_signal(&readable);
+	}
+	pthread_mutex_unlock(&lock);
+	return true;
+}
+
+ssize_t twrpRingBuffer::Read(void *data, size_t len) {
+	pthread_mutex_lock(&lock);
+	while (count == 0 && !closed && !aborted)
+		pthread_cond_wait(&readable, &lock);
+	if (aborted) {
+		pthread_mutex_unlock(&lock);
+		return -1;
+	}
+	size_t chunk = capacity - head;
+	if (chunk > count)
+		chunk = count;
+	if (chunk > len)
+		chunk = len;
+	memcpy(data, buffer + head, chunk);
+	head = (head + chunk) % capacity;
+	count -= chunk;
+	pthread_cond_signal(&writable);
+	pthread_mutex_unlock(&lock);
+	return (ssize_t) chunk;
+}
+
+ssize_t twrpRingBuffer::Read_Full(void *data, size_t len) {
+	size_t total = 0;
+
+	while (total < len) {
+		ssize_t ret = Read((unsigned char*) data + total, len - total);
+		if (ret < 0)
+			return -1;
+		if (ret == 0)
+			break;
+		total += ret;
+	}
+	return (ssize_t) total;
+}
+
+void twrpRingBuffer::Close(void) {
+	pthread_mutex_lock(&lock);
+	closed = true;
+	pthread_cond_broadcast(&readable);
+	pthread_mutex_unlock(&lock);
+}
+
+void twrpRingBuffer::Abort(void) {
+	pthread_mutex_lock(&lock);
+	aborted = true;
+	pthread_cond_broadcast(&readable);
+	pthread_cond_broadcast(&writable);
+	pthread_mutex_unlock(&lock);
+}
+
+// Writes to a pipe whose reader has gone away must return EPIPE instead of killing the process.
+static void Block_Sigpipe(void) {
+	sigset_t set;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+twrpRestorePipeline::twrpRestorePipeline(void) {
+	input_fd = -1;
+	output_fd = -1;
+	use_decrypt = false;
+	use_inflate = false;
+	read_ring = NULL;
+	plain_ring = NULL;
+	thread_count = 0;
+	telemetry_slot = TELEMETRY_MAIN_SLOT;
+	reader_gone = false;
+}
+
+twrpRestorePipeline::~twrpRestorePipeline() {
+	if (thread_count > 0)
+		Finish();
+	delete read_ring;
+	delete plain_ring;
+}
+
+int twrpRestorePipeline::Start(int fd, bool decrypt, bool inflate, const std::string& pass) {
+	int pipefd[2];
+
+	input_fd = fd;
+	telemetry_slot = twrpTelemetry::Get_Thread_Slot();
+	use_decrypt = decrypt;
+	use_inflate = inflate;
+	password = pass;
+#ifdef TW_EXCLUDE_ENCRYPTED_BACKUPS
+	if (use_decrypt) {
+		LOGINFO("twrpRestorePipeline: encrypted backups are not supported in this build\n");
+		close(input_fd);
+		return -1;
+	}
+#endif
+	if (pipe(pipefd) < 0) {
+		LOGINFO("twrpRestorePipeline: error creating pipe: %s\n", strerror(errno));
+		close(input_fd);
+		return -1;
+	}
+	// Fewer, larger hops into libtar; failure just leaves the default pipe size.
+	fcntl(pipefd[1], F_SETPIPE_SZ, READ_CHUNK_SIZE * 8);
+	output_fd = pipefd[1];
+
+	read_ring = new twrpRingBuffer(RING_BUFFER_SIZE);
+	if (use_decrypt && use_inflate)
+		plain_ring = new twrpRingBuffer(RING_BUFFER_SIZE);
+
+	void *(*stages[3])(void *);
+	int stage_count = 0;
+	stages[stage_count++] = Read_Thread;
+	if (use_decrypt)
+		stages[stage_count++] = Decrypt_Thread;
+	if (use_inflate)
+		stages[stage_count++] = Inflate_Thread;
+
+	for (int i = 0; i < stage_count; i++) {
+		if (pthread_create(&threads[i], NULL, stages[i], this) != 0) {
+			LOGINFO("twrpRestorePipeline: unable to create stage thread %i\n", i);
+			if (thread_count == 0)
+				close(input_fd);
+			read_ring->Abort();
+			if (plain_ring)
+				plain_ring->Abort();
+			Finish();
+			Close_Output();
+			close(pipefd[0]);
+			return -1;
+		}
+		thread_count++;
+	}
+	return pipefd[0];
+}
+
+int twrpRestorePipeline::Finish(void) {
+	int ret = 0;
+
+	for (int i = 0; i < thread_count; i++) {
+		void *thread_return;
+		if (pthread_join(threads[i], &thread_return) != 0 || thread_return != NULL)
+			ret = -1;
+	}
+	thread_count = 0;
+	if (ret != 0 && reader_gone) {
+		// The tar reader stopped early, upstream stages were aborted as a consequence.
+		ret = 0;
+	}
+	return ret;
+}
+
+bool twrpRestorePipeline::Write_Output(const void *data, size_t len) {
+	const char *src = (const char*) data;
+
+	while (len > 0) {
+		ssize_t ret = write(output_fd, src, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EPIPE)
+				reader_gone = true;
+			else
+				LOGINFO("twrpRestorePipeline: write error: %s\n", strerror(errno));
+			return false;
+		}
+		src += ret;
+		len -= ret;
+	}
+	return true;
+}
+
+void twrpRestorePipeline::Close_Output(void) {
+	if (output_fd >= 0) {
+		close(output_fd);
+		output_fd = -1;
+	}
+}
+
+void *twrpRestorePipeline::Read_Thread(void *cookie) {
+	twrpRestorePipeline *pipeline = (twrpRestorePipeline*) cookie;
+	char *buf = (char*) malloc(READ_CHUNK_SIZE);
+	void *ret = NULL;
+
+	if (buf == NULL) {
+		pipeline->read_ring->Abort();
+		close(pipeline->input_fd);
+		return (void*)-1;
+	}
+	while (true) {
+		uint64_t start = twrpTelemetry::Now();
+		ssize_t len = read(pipeline->input_fd, buf, READ_CHUNK_SIZE);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len > 0)
+			twrpTelemetry::Add(pipeline->telemetry_slot, TELEMETRY_READ, twrpTelemetry::Now() - start, len);
+		if (len < 0) {
+			LOGINFO("twrpRestorePipeline: read error: %s\n", strerror(errno));
+			pipeline->read_ring->Abort();
+			ret = (void*)-1;
+			break;
+		}
+		if (len == 0) {
+			pipeline->read_ring->Close();
+			break;
+		}
+		if (!pipeline->read_ring->Write(buf, len)) {
+			ret = (void*)-1;
+			break;
+		}
+	}
+	free(buf);
+	close(pipeline->input_fd);
+	pipeline->input_fd = -1;
+	return ret;
+}
+
+void *twrpRestorePipeline::Decrypt_Thread(void *cookie) {
+#ifndef TW_EXCLUDE_ENCRYPTED_BACKUPS
+	twrpRestorePipeline *pipeline = (twrpRestorePipeline*) cookie;
+	twrpRingBuffer *next = pipeline->plain_ring;
+	uint8_t frame[TWAES_FRAME_SIZE], plain[TWAES_FRAME_SIZE];
+	twrpAes aes;
+	void *ret = NULL;
+
+	Block_Sigpipe();
+
+	// Every frame carries its own IV, so each one decrypts on its own.
+	aes.Set_Key(pipeline->password);
+	LOGINFO("Decrypting with %s\n", twrpAes::Engine_Name());
+
+	while (true) {
+		ssize_t len = pipeline->read_ring->Read_Full(frame, sizeof(frame));
+		if (len < 0) {
+			ret = (void*)-1;
+			break;
+		}
+		if (len == 0)
+			break;
+		size_t plain_len;
+		twrpStageTimer timer(TELEMETRY_ENCRYPT, pipeline->telemetry_slot);
+		if (!aes.Decrypt_Frame(frame, len, plain, &plain_len)) {
+			LOGINFO("twrpRestorePipeline: failed to decrypt frame\n");
+			ret = (void*)-1;
+			break;
+		}
+		timer.Stop(plain_len);
+		bool written = next ? next->Write(plain, plain_len) : pipeline->Write_Output(plain, plain_len);
+		if (!written) {
+			ret = (void*)-1;
+			break;
+		}
+	}
+
+	if (ret != NULL)
+		pipeline->read_ring->Abort();
+	if (next) {
+		if (ret != NULL)
+			next->Abort();
+		else
+			next->Close();
+	} else {
+		pipeline->Close_Output();
+	}
+	return ret;
+#else
+	return (void*)-1;
+#endif
+}
+
+void *twrpRestorePipeline::Inflate_Thread(void *cookie) {
+	twrpRestorePipeline *pipeline = (twrpRestorePipeline*) cookie;
+	twrpRingBuffer *prev = pipeline->plain_ring ? pipeline->plain_ring : pipeline->read_ring;
+	unsigned char *in = (unsigned char*) malloc(READ_CHUNK_SIZE);
+	unsigned char *out = (unsigned char*) malloc(INFLATE_OUT_SIZE);
+	z_stream strm;
+	void *ret = NULL;
+	bool stream_end = false;
+
+	Block_Sigpipe();
+
+	memset(&strm, 0, sizeof(strm));
+	// 16 + MAX_WBITS: expect a gzip header, as written by pigz.
+	if (in == NULL || out == NULL || inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) {
+		free(in);
+		free(out);
+		prev->Abort();
+		pipeline->Close_Output();
+		return (void*)-1;
+	}
+
+	while (ret == NULL) {
+		ssize_t len = prev->Read(in, READ_CHUNK_SIZE);
+		if (len < 0) {
+			ret = (void*)-1;
+			break;
+		}
+		if (len == 0) {
+			if (!stream_end) {
+				LOGINFO("twrpRestorePipeline: compressed stream is truncated\n");
+				ret = (void*)-1;
+			}
+			break;
+		}
+		strm.next_in = in;
+		strm.avail_in = len;
+		bool more = true;
+		while (more) {
+			if (stream_end) {
+				if (strm.avail_in == 0)
+					break;
+				// pigz may write several gzip members back to back.
+				inflateReset(&strm);
+				stream_end = false;
+			}
+			strm.next_out = out;
+			strm.avail_out = INFLATE_OUT_SIZE;
+			twrpStageTimer timer(TELEMETRY_COMPRESS, pipeline->telemetry_slot);
+			int zret = inflate(&strm, Z_NO_FLUSH);
+			if (zret != Z_OK && zret != Z_STREAM_END && zret != Z_BUF_ERROR) {
+				LOGINFO("twrpRestorePipeline: inflate error %i\n", zret);
+				ret = (void*)-1;
+				break;
+			}
+			size_t have = INFLATE_OUT_SIZE - strm.avail_out;
+			timer.Stop(have);
+			if (have > 0 && !pipeline->Write_Output(out, have)) {
+				ret = (void*)-1;
+				break;
+			}
+			if (zret == Z_STREAM_END)
+				stream_end = true;
+			// A full output buffer means zlib may still hold pending output.
+			more = strm.avail_in > 0 || strm.avail_out == 0;
+		}
+	}
+	inflateEnd(&strm);
+	free(in);
+	free(out);
+
+	if (ret != NULL)
+		prev->Abort();
+	pipeline->Close_Output();
+	return ret;
+}
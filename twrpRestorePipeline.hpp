@@ -0,0 +1,90 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPRESTOREPIPELINE_HPP
+#define TWRPRESTOREPIPELINE_HPP
+
+#include <string>
+#include <pthread.h>
+#include <sys/types.h>
+
+// Bounded single producer / single consumer byte queue between two pipeline stages.
+class twrpRingBuffer {
+public:
+	twrpRingBuffer(size_t size);
+	~twrpRingBuffer();
+
+	// Blocks until all of len is queued. Returns false if the reader aborted.
+	bool Write(const void *data, size_t len);
+	// Blocks until at least one byte is available. Returns the byte count, 0 once the writer
+	// has closed and the queue is drained, or -1 if the writer aborted.
+	ssize_t Read(void *data, size_t len);
+	// Like Read but fills all of len unless the stream ends first.
+	ssize_t Read_Full(void *data, size_t len);
+	void Close(void);  // writer is done, reader sees EOF after the queued data
+	void Abort(void);  // either side failed, wake and fail the other one
+
+private:
+	unsigned char *buffer;
+	size_t capacity;
+	size_t head;                                       // next byte to read
+	size_t count;                                      // bytes queued
+	bool closed;
+	bool aborted;
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+};
+
+// Turns an encrypted and/or gzip compressed archive into a plain tar stream in process.
+// Reading, AES decryption and inflating each run on their own thread and hand data to the
+// next stage through a twrpRingBuffer, so none of them waits on a pipe to an external
+// openaes or pigz process. The plain tar stream comes out of a pipe so libtar can read it
+// like any other fd.
+class twrpRestorePipeline {
+public:
+	twrpRestorePipeline(void);
+	~twrpRestorePipeline();
+
+	// Takes ownership of input_fd. Returns the fd to hand to libtar or -1 on error.
+	int Start(int input_fd, bool decrypt, bool inflate, const std::string& password);
+	// Waits for all stages. Returns 0 if every stage succeeded; a reader that stopped early
+	// (libtar is done at the end-of-archive blocks) is not an error.
+	int Finish(void);
+
+private:
+	static void *Read_Thread(void *cookie);
+	static void *Decrypt_Thread(void *cookie);
+	static void *Inflate_Thread(void *cookie);
+	bool Write_Output(const void *data, size_t len);
+	void Close_Output(void);
+
+	int input_fd;
+	int output_fd;
+	bool use_decrypt;
+	bool use_inflate;
+	std::string password;
+	twrpRingBuffer *read_ring;                         // raw file data
+	twrpRingBuffer *plain_ring;                        // decrypted data, only when both stages run
+	pthread_t threads[3];
+	int thread_count;
+	unsigned telemetry_slot;                           // twrpTelemetry slot of the thread that started us
+	bool reader_gone;                                  // set by the stage that writes output_fd
+};
+
+#endif // TWRPRESTOREPIPELINE_HPP
@@ -47,6 +47,7 @@ extern "C" {
 #include "twrp-functions.hpp"
 #include "gui/gui.hpp"
 #include "progresstracking.hpp"
+#include "twrpTelemetry.hpp"
 #ifndef BUILD_TWRPTAR_MAIN
 #include "data.hpp"
 #include "infomanager.hpp"
@@ -62,13 +63,20 @@ extern "C" {
 
 using namespace std;
 
+// Time and bytes the calling thread spent in the libtar write functions since tarList last
+// looked, so the rest of tar_append_file can be counted as reading.
+static __thread uint64_t tar_write_ns = 0;
+static __thread uint64_t tar_write_bytes = 0;
+
 twrpTar::twrpTar(void) {
 	use_encryption = 0;
 	userdata_encryption = 0;
 	use_compression = 0;
 	split_archives = 0;
 	pigz_pid = 0;
-	oaes_pid = 0;
+	archive_plain_bytes = 0;
+	aes_writer = NULL;
+	restore_pipeline = NULL;
 	Total_Backup_Size = 0;
 	Archive_Current_Size = 0;
 	include_root_dir = true;
@@ -84,7 +92,8 @@ twrpTar::twrpTar(void) {
 }
 
 twrpTar::~twrpTar(void) {
-	// Do nothing
+	delete restore_pipeline;
+	delete aes_writer;
 }
 
 void twrpTar::setfn(string fn) {
@@ -148,6 +157,7 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 		signal(SIGUSR2, twrpTar::Signal_Kill);
 		close(progress_pipe[0]);
 		progress_pipe_fd = progress_pipe[1];
+		twrpTelemetry::Set_Thread_Slot(0);
 
 		if (use_encryption || userdata_encryption) {
 			LOGINFO("Using encryption\n");
@@ -171,6 +181,7 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 				core_count = 8;
 			LOGINFO("   Core Count      : %u\n", core_count);
 			Archive_Current_Size = 0;
+			twrpStageTimer scan_timer(TELEMETRY_SCAN);
 
 			d = opendir(tardir.c_str());
 			if (d == NULL) {
@@ -187,6 +198,10 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 				if (de->d_type == DT_DIR) {
 					item_len = strlen(de->d_name);
 					if (userdata_encryption && ((item_len >= 3 && strncmp(de->d_name, "app", 3) == 0) || (item_len >= 6 && strncmp(de->d_name, "dalvik", 6) == 0))) {
+						// The folder itself too, so that it restores with its own mode and owner
+						TarItem.fn = FileName;
+						TarItem.thread_id = regular_thread_id;
+						RegularList.push_back(TarItem);
 						ret = Generate_TarList(FileName, &RegularList, &target_size, &regular_thread_id);
 						if (ret < 0) {
 							LOGINFO("Error in Generate_TarList with regular list!\n");
@@ -238,6 +253,9 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 						// Do nothing, we added these to RegularList earlier
 					} else {
 						FileName = tardir + "/" + de->d_name;
+						TarItem.fn = FileName;
+						TarItem.thread_id = enc_thread_id;
+						EncryptList.push_back(TarItem);
 						ret = Generate_TarList(FileName, &EncryptList, &target_size, &enc_thread_id);
 						if (ret < 0) {
 							LOGINFO("Error in Generate_TarList with encrypted list!\n");
@@ -274,6 +292,7 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 			write(progress_pipe_fd, &file_count, sizeof(file_count));
 			// Send backup size to parent
 			total_size = regular_size + encrypt_size;
+			scan_timer.Stop(total_size);
 			write(progress_pipe_fd, &total_size, sizeof(total_size));
 
 			if (userdata_encryption) {
@@ -388,7 +407,9 @@ int twrpTar::createTarFork(pid_t *tar_fork_pid) {
 			int ret;
 
 			// Generate list of files to back up
+			twrpStageTimer scan_timer(TELEMETRY_SCAN);
 			ret = Generate_TarList(tardir, &FileList, &target_size, &thread_id);
+			scan_timer.Stop(target_size);
 			if (ret < 0) {
 				LOGINFO("Error in Generate_TarList!\n");
 				gui_err("backup_error=Error creating backup.");
@@ -497,6 +518,7 @@ int twrpTar::extractTarFork() {
 		{
 			close(progress_pipe[0]);
 			progress_pipe_fd = progress_pipe[1];
+			twrpTelemetry::Set_Thread_Slot(0);
 			if (TWFunc::Path_Exists(tarfn) || part_settings->adbbackup) {
 				LOGINFO("Single archive\n");
 				if (extract() != 0)
@@ -510,7 +532,6 @@ int twrpTar::extractTarFork() {
 				char actual_filename[255];
 				twrpTar tars[9];
 				pthread_t tar_thread[9];
-				pthread_attr_t tattr;
 				unsigned thread_count = 0, i, start_thread_id = 1;
 				int ret, thread_error = 0;
 				void *thread_return;
@@ -539,79 +560,68 @@ int twrpTar::extractTarFork() {
 				} else {
 					start_thread_id = 0;
 				}
-				// Start threading encrypted restores
-				if (pthread_attr_init(&tattr)) {
-					LOGINFO("Unable to pthread_attr_init\n");
-					gui_err("restore_error=Error during restore process.");
-					close(progress_pipe_fd);
-					_exit(-1);
-				}
-				if (pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_JOINABLE)) {
-					LOGINFO("Error setting pthread_attr_setdetachstate\n");
-					gui_err("restore_error=Error during restore process.");
-					close(progress_pipe_fd);
-					_exit(-1);
-				}
-				if (pthread_attr_setscope(&tattr, PTHREAD_SCOPE_SYSTEM)) {
-					LOGINFO("Error setting pthread_attr_setscope\n");
-					gui_err("restore_error=Error during restore process.");
-					close(progress_pipe_fd);
-					_exit(-1);
-				}
-				/*if (pthread_attr_setstacksize(&tattr, 524288)) {
-					LOGERR("Error setting pthread_attr_setstacksize\n");
-					close(progress_pipe_fd);
-					_exit(-1);
-				}*/
+				// Restore the remaining archive chains on a pool of threads, largest chain first so
+				// that one big chain does not start last and leave the other cores idle at the end.
+				struct RestoreQueueStruct queue;
+				std::vector<unsigned long long> chain_sizes;
+				unsigned core_count = sysconf(_SC_NPROCESSORS_ONLN);
+				if (core_count < 1)
+					core_count = 1;
+				if (core_count > 8)
+					core_count = 8;
 				for (i = start_thread_id; i < 9; i++) {
 					sprintf(actual_filename, temp.c_str(), i, 0);
-					if (TWFunc::Path_Exists(actual_filename)) {
-						thread_count++;
-						tars[i].basefn = basefn;
-						tars[i].setpassword(password);
-						tars[i].thread_id = i;
-						tars[i].progress_pipe_fd = progress_pipe_fd;
-						tars[i].part_settings = part_settings;
-						LOGINFO("Creating extract thread ID %i\n", i);
-						ret = pthread_create(&tar_thread[i], &tattr, extractMulti, (void*)&tars[i]);
-						if (ret) {
-							LOGINFO("Unable to create %i thread for extraction! %i\nContinuing in same thread (restore will be slower).\n", i, ret);
-							if (extractMulti((void*)&tars[i]) != 0) {
-								LOGINFO("Error extracting backup in thread %i.\n", i);
-								gui_err("restore_error=Error during restore process.");
-								close(progress_pipe_fd);
-								_exit(-1);
-							} else {
-								tars[i].thread_id = i + 1;
-							}
-						}
-						usleep(100000); // Need a short delay before starting the next thread or the threads will never finish for some reason.
-					} else {
+					if (!TWFunc::Path_Exists(actual_filename))
 						break;
+					unsigned long long chain_size = 0;
+					for (int archive_count = 0; archive_count < 100; archive_count++) {
+						sprintf(actual_filename, temp.c_str(), i, archive_count);
+						if (!TWFunc::Path_Exists(actual_filename))
+							break;
+						chain_size += TWFunc::Get_File_Size(actual_filename);
 					}
+					tars[i].basefn = basefn;
+					tars[i].setpassword(password);
+					tars[i].thread_id = i;
+					tars[i].progress_pipe_fd = progress_pipe_fd;
+					tars[i].part_settings = part_settings;
+					size_t pos = 0;
+					while (pos < chain_sizes.size() && chain_sizes[pos] >= chain_size)
+						pos++;
+					chain_sizes.insert(chain_sizes.begin() + pos, chain_size);
+					queue.tars.insert(queue.tars.begin() + pos, &tars[i]);
 				}
-				for (i = start_thread_id; i < thread_count + start_thread_id; i++) {
-					if (tars[i].thread_id == i) {
-						if (pthread_join(tar_thread[i], &thread_return)) {
-							LOGINFO("Error joining thread %i\n", i);
-							gui_err("restore_error=Error during restore process.");
-							close(progress_pipe_fd);
-							_exit(-1);
-						} else {
-							LOGINFO("Joined thread %i.\n", i);
-							ret = (int)(intptr_t)thread_return;
-							if (ret != 0) {
-								thread_error = 1;
-								LOGINFO("Thread %i returned an error %i.\n", i, ret);
-								gui_err("restore_error=Error during restore process.");
-								close(progress_pipe_fd);
-								_exit(-1);
-							}
-						}
+				queue.next = 0;
+				pthread_mutex_init(&queue.lock, NULL);
+				unsigned worker_count = queue.tars.size() < core_count ? queue.tars.size() : core_count;
+				LOGINFO("Restoring %zu archive chain(s) with %u thread(s)\n", queue.tars.size(), worker_count);
+				for (i = 0; i < worker_count; i++) {
+					ret = pthread_create(&tar_thread[thread_count], NULL, extractQueue, (void*)&queue);
+					if (ret) {
+						LOGINFO("Unable to create extract thread %i! %i\n", i, ret);
+						break;
+					}
+					thread_count++;
+				}
+				if (thread_count == 0) {
+					LOGINFO("Continuing in same thread (restore will be slower).\n");
+					if (extractQueue((void*)&queue) != NULL)
+						thread_error = 1;
+				}
+				for (i = 0; i < thread_count; i++) {
+					if (pthread_join(tar_thread[i], &thread_return)) {
+						LOGINFO("Error joining thread %i\n", i);
+						thread_error = 1;
 					} else {
-						LOGINFO("Skipping joining thread %i because of pthread failure.\n", i);
+						LOGINFO("Joined thread %i.\n", i);
+						ret = (int)(intptr_t)thread_return;
+						if (ret != 0) {
+							thread_error = 1;
+							LOGINFO("Thread %i returned an error %i.\n", i, ret);
+						}
 					}
 				}
+				pthread_mutex_destroy(&queue.lock);
 				if (thread_error) {
 					LOGINFO("Error returned by one or more threads.\n");
 					gui_err("restore_error=Error during restore process.");
@@ -697,18 +707,42 @@ int twrpTar::Generate_TarList(string Path, std::vector<TarListStruct> *TarList,
 	return file_count;
 }
 
+int twrpTar::Finish_Restore_Pipeline() {
+	int ret = 0;
+
+	if (restore_pipeline != NULL) {
+		ret = restore_pipeline->Finish();
+		delete restore_pipeline;
+		restore_pipeline = NULL;
+	}
+	return ret;
+}
+
 int twrpTar::extractTar() {
 	char* charRootDir = (char*) tardir.c_str();
 	if (openTar() == -1)
 		return -1;
+	// Extraction writes the restored files; with a restore pipeline it also waits on it.
+	twrpStageTimer write_timer(TELEMETRY_WRITE);
 	if (tar_extract_all(t, charRootDir, &progress_pipe_fd) != 0) {
 		LOGINFO("Unable to extract tar archive '%s'\n", tarfn.c_str());
 		gui_err("restore_error=Error during restore process.");
+		tar_close(t);
+		Finish_Restore_Pipeline();
 		return -1;
 	}
 	if (tar_close(t) != 0) {
 		LOGINFO("Unable to close tar file\n");
 		gui_err("restore_error=Error during restore process.");
+		Finish_Restore_Pipeline();
+		return -1;
+	}
+	write_timer.Stop(part_settings->adbbackup ? 0 : TWFunc::Get_File_Size(tarfn));
+	// A decrypt or inflate failure ends the tar stream early, which libtar may take for a
+	// normal end of archive.
+	if (Finish_Restore_Pipeline() != 0) {
+		LOGINFO("Unable to decrypt or decompress '%s'\n", tarfn.c_str());
+		gui_err("restore_error=Error during restore process.");
 		return -1;
 	}
 #ifndef BUILD_TWRPTAR_MAIN
@@ -768,6 +802,7 @@ int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 	char actual_filename[PATH_MAX];
 	unsigned long long fs;
 
+	twrpTelemetry::Set_Thread_Slot(thread_id);
 	if (split_archives) {
 		basefn = tarfn;
 		temp = basefn + "%i%02i";
@@ -823,11 +858,18 @@ int twrpTar::tarList(std::vector<TarListStruct> *TarList, unsigned thread_id) {
 				write(progress_pipe_fd, &fs, sizeof(fs));
 			}
 			LOGINFO("addFile '%s' including root: %i\n", buf, include_root_dir);
+			uint64_t start = twrpTelemetry::Now();
+			tar_write_ns = 0;
+			tar_write_bytes = 0;
 			if (addFile(buf, include_root_dir) != 0) {
 				LOGINFO("Error adding file '%s' to '%s'\n", buf, tarfn.c_str());
 				gui_err("backup_error=Error creating backup.");
 				return -1;
 			}
+			uint64_t elapsed = twrpTelemetry::Now() - start;
+			twrpTelemetry::Add(thread_id, TELEMETRY_READ, elapsed - tar_write_ns, S_ISREG(st.st_mode) ? st.st_size : 0);
+			twrpTelemetry::Add(thread_id, TELEMETRY_WRITE, tar_write_ns, tar_write_bytes);
+			archive_plain_bytes += tar_write_bytes;
 		}
 		i++;
 	}
@@ -855,6 +897,7 @@ void* twrpTar::extractMulti(void *cookie) {
 	int archive_count = 0;
 	string temp = threadTar->basefn + "%i%02i";
 	char actual_filename[255];
+	twrpTelemetry::Set_Thread_Slot(threadTar->thread_id);
 	sprintf(actual_filename, temp.c_str(), threadTar->thread_id, archive_count);
 	while (TWFunc::Path_Exists(actual_filename)) {
 		threadTar->tarfn = actual_filename;
@@ -871,6 +914,28 @@ void* twrpTar::extractMulti(void *cookie) {
 	return (void*)0;
 }
 
+void* twrpTar::extractQueue(void *cookie) {
+	struct RestoreQueueStruct* queue = (struct RestoreQueueStruct*) cookie;
+
+	while (true) {
+		twrpTar* threadTar = NULL;
+		pthread_mutex_lock(&queue->lock);
+		if (queue->next < queue->tars.size())
+			threadTar = queue->tars[queue->next++];
+		pthread_mutex_unlock(&queue->lock);
+		if (threadTar == NULL)
+			break;
+		if (extractMulti((void*)threadTar) != NULL) {
+			// Stop handing out chains, the restore has failed anyway
+			pthread_mutex_lock(&queue->lock);
+			queue->next = queue->tars.size();
+			pthread_mutex_unlock(&queue->lock);
+			return (void*)-2;
+		}
+	}
+	return (void*)0;
+}
+
 int twrpTar::addFilesToExistingTar(vector <string> files, string fn) {
 	char* charTarFile = (char*) fn.c_str();
 
@@ -899,23 +964,30 @@ int twrpTar::createTar() {
 		// Compressed and encrypted
 		current_archive_type = COMPRESSED_ENCRYPTED;
 		LOGINFO("Using encryption and compression...\n");
-		int i, pipes[4];
+		int pipes[2], enc_fd;
 
 		if (pipe(pipes) < 0) {
-			LOGINFO("Error creating first pipe\n");
-			gui_err("backup_error=Error creating backup.");
-			return -1;
-		}
-		if (pipe(pipes + 2) < 0) {
-			LOGINFO("Error creating second pipe\n");
+			LOGINFO("Error creating pipe\n");
 			gui_err("backup_error=Error creating backup.");
 			return -1;
 		}
 		output_fd = open(tarfn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
 		if (output_fd < 0) {
 			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(tarfn)(strerror(errno)));
-			for (i = 0; i < 4; i++)
-				close(pipes[i]); // close all
+			close(pipes[0]);
+			close(pipes[1]);
+			return -1;
+		}
+		// pigz writes into the encrypt thread instead of an openaes child
+		aes_writer = new twrpAesWriter();
+		enc_fd = aes_writer->Start(output_fd, password);
+		if (enc_fd < 0) {
+			LOGINFO("Unable to start encryption\n");
+			gui_err("backup_error=Error creating backup.");
+			delete aes_writer;
+			aes_writer = NULL;
+			close(pipes[0]);
+			close(pipes[1]);
 			return -1;
 		}
 		pigz_pid = fork();
@@ -923,73 +995,43 @@ int twrpTar::createTar() {
 		if (pigz_pid < 0) {
 			LOGINFO("pigz fork() failed\n");
 			gui_err("backup_error=Error creating backup.");
-			close(output_fd);
-			for (i = 0; i < 4; i++)
-				close(pipes[i]); // close all
+			close(enc_fd);
+			close(pipes[0]);
+			close(pipes[1]);
+			aes_writer->Finish();
+			delete aes_writer;
+			aes_writer = NULL;
 			return -1;
 		} else if (pigz_pid == 0) {
 			// pigz Child
 			close(pipes[1]);
-			close(pipes[2]);
 			int stdinfd = fileno(stdin);
 			int stdoutfd = fileno(stdout);
 			close(stdinfd);
 			dup2(pipes[0], stdinfd);
 			close(stdoutfd);
-			dup2(pipes[3], stdoutfd);
+			dup2(enc_fd, stdoutfd);
 			if (execlp("pigz", "pigz", "-", NULL) < 0) {
 				LOGINFO("execlp pigz ERROR!\n");
 				gui_err("backup_error=Error creating backup.");
-				close(output_fd);
 				close(pipes[0]);
-				close(pipes[3]);
+				close(enc_fd);
 				_exit(-1);
 			}
 		} else {
 			// Parent
-			oaes_pid = fork();
-
-			if (oaes_pid < 0) {
-				LOGINFO("openaes fork() failed\n");
+			close(pipes[0]);
+			close(enc_fd);
+			fd = pipes[1];
+			init_libtar_no_buffer(progress_pipe_fd);
+			tar_type.writefunc = write_tar_no_buffer;
+			if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
+				close(fd);
+				LOGINFO("tar_fdopen failed\n");
 				gui_err("backup_error=Error creating backup.");
-				close(output_fd);
-				for (i = 0; i < 4; i++)
-					close(pipes[i]); // close all
 				return -1;
-			} else if (oaes_pid == 0) {
-				// openaes Child
-				close(pipes[0]);
-				close(pipes[1]);
-				close(pipes[3]);
-				int stdinfd = fileno(stdin);
-				int stdoutfd = fileno(stdout);
-				close(stdinfd);
-				dup2(pipes[2], stdinfd);
-				close(stdoutfd);
-				dup2(output_fd, stdoutfd);
-				if (execlp("openaes", "openaes", "enc", "--key", password.c_str(), NULL) < 0) {
-					LOGINFO("execlp openaes ERROR!\n");
-					gui_err("backup_error=Error creating backup.");
-					close(pipes[2]);
-					close(output_fd);
-					_exit(-1);
-				}
-			} else {
-				// Parent
-				close(pipes[0]);
-				close(pipes[2]);
-				close(pipes[3]);
-				fd = pipes[1];
-				init_libtar_no_buffer(progress_pipe_fd);
-				tar_type.writefunc = write_tar_no_buffer;
-				if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
-					close(fd);
-					LOGINFO("tar_fdopen failed\n");
-					gui_err("backup_error=Error creating backup.");
-					return -1;
-				}
-				return 0;
 			}
+			return 0;
 		}
 	} else if (use_compression) {
 		// Compressed
@@ -1053,53 +1095,29 @@ int twrpTar::createTar() {
 		// Encrypted
 		current_archive_type = ENCRYPTED;
 		LOGINFO("Using encryption...\n");
-		int oaesfd[2];
 		output_fd = open(tarfn.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH);
 		if (output_fd < 0) {
 			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(tarfn)(strerror(errno)));
 			return -1;
 		}
-		if (pipe(oaesfd) < 0) {
-			LOGINFO("Error creating pipe\n");
+		aes_writer = new twrpAesWriter();
+		fd = aes_writer->Start(output_fd, password);
+		if (fd < 0) {
+			LOGINFO("Unable to start encryption\n");
 			gui_err("backup_error=Error creating backup.");
-			close(output_fd);
+			delete aes_writer;
+			aes_writer = NULL;
 			return -1;
 		}
-		oaes_pid = fork();
-
-		if (oaes_pid < 0) {
-			LOGINFO("fork() failed\n");
+		init_libtar_no_buffer(progress_pipe_fd);
+		tar_type.writefunc = write_tar_no_buffer;
+		if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
+			close(fd);
+			LOGINFO("tar_fdopen failed\n");
 			gui_err("backup_error=Error creating backup.");
-			close(output_fd);
-			close(oaesfd[0]);
-			close(oaesfd[1]);
 			return -1;
-		} else if (oaes_pid == 0) {
-			// Child
-			close(oaesfd[1]);   // close unused
-			dup2(oaesfd[0], fileno(stdin)); // remap stdin
-			dup2(output_fd, fileno(stdout)); // remap stdout to output file
-			if (execlp("openaes", "openaes", "enc", "--key", password.c_str(), NULL) < 0) {
-				LOGINFO("execlp openaes ERROR!\n");
-				gui_err("backup_error=Error creating backup.");
-				close(output_fd);
-				close(oaesfd[0]);
-				_exit(-1);
-			}
-		} else {
-			// Parent
-			close(oaesfd[0]); // close parent input
-			fd = oaesfd[1];   // copy parent output
-			init_libtar_no_buffer(progress_pipe_fd);
-			tar_type.writefunc = write_tar_no_buffer;
-			if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_WRONLY | O_CREAT | O_EXCL | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
-				close(fd);
-				LOGINFO("tar_fdopen failed\n");
-				gui_err("backup_error=Error creating backup.");
-				return -1;
-			}
-			return 0;
 		}
+		return 0;
 	} else {
 		// Not compressed or encrypted
 		current_archive_type = UNCOMPRESSED;
@@ -1126,158 +1144,42 @@ int twrpTar::createTar() {
 	return 0;
 }
 
+// libtar reads one 512 byte block at a time and fails on a short read. The restore pipeline
+// writes whole decrypted frames and inflate output, neither of them a multiple of 512 bytes,
+// so a read from its pipe can come back short in the middle of the archive.
+static ssize_t read_tar_full(int fd, void *buffer, size_t size) {
+	size_t total = 0;
+
+	while (total < size) {
+		ssize_t ret = read(fd, (char*)buffer + total, size - total);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		if (ret == 0)
+			break;
+		total += ret;
+	}
+	return (ssize_t)total;
+}
+
 int twrpTar::openTar() {
 	char* charRootDir = (char*) tardir.c_str();
 	char* charTarFile = (char*) tarfn.c_str();
 	string Password;
 
-	if (current_archive_type == COMPRESSED_ENCRYPTED) {
-		LOGINFO("Opening encrypted and compressed backup...\n");
-		int i, pipes[4];
-		input_fd = open(tarfn.c_str(), O_RDONLY | O_LARGEFILE);
-		if (input_fd < 0) {
-			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(tarfn)(strerror(errno)));
-			return -1;
-		}
-
-		if (pipe(pipes) < 0) {
-			LOGINFO("Error creating first pipe\n");
-			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
-			return -1;
-		}
-		if (pipe(pipes + 2) < 0) {
-			LOGINFO("Error creating second pipe\n");
-			gui_err("restore_error=Error during restore process.");
-			close(pipes[0]);
-			close(pipes[1]);
-			close(input_fd);
-			return -1;
-		}
-		oaes_pid = fork();
-
-		if (oaes_pid < 0) {
-			LOGINFO("pigz fork() failed\n");
-			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
-			for (i = 0; i < 4; i++)
-				close(pipes[i]); // close all
-			return -1;
-		} else if (oaes_pid == 0) {
-			// openaes Child
-			close(pipes[0]); // Close pipes that are not used by this child
-			close(pipes[2]);
-			close(pipes[3]);
-			int stdinfd = fileno(stdin);
-			int stdoutfd = fileno(stdout);
-			close(stdinfd);
-			dup2(input_fd, stdinfd);
-			close(stdoutfd);
-			dup2(pipes[1], stdoutfd);
-			if (execlp("openaes", "openaes", "dec", "--key", password.c_str(), NULL) < 0) {
-				LOGINFO("execlp openaes ERROR!\n");
-				gui_err("restore_error=Error during restore process.");
-				close(input_fd);
-				close(pipes[1]);
-				_exit(-1);
-			}
-		} else {
-			// Parent
-			pigz_pid = fork();
-
-			if (pigz_pid < 0) {
-				LOGINFO("openaes fork() failed\n");
-				gui_err("restore_error=Error during restore process.");
-				close(input_fd);
-				for (i = 0; i < 4; i++)
-					close(pipes[i]); // close all
-				return -1;
-			} else if (pigz_pid == 0) {
-				// pigz Child
-				close(pipes[1]); // Close pipes not used by this child
-				close(pipes[2]);
-				int stdinfd = fileno(stdin);
-				int stdoutfd = fileno(stdout);
-				close(stdinfd);
-				dup2(pipes[0], stdinfd);
-				close(stdoutfd);
-				dup2(pipes[3], stdoutfd);
-				if (execlp("pigz", "pigz", "-d", "-c", NULL) < 0) {
-					LOGINFO("execlp pigz ERROR!\n");
-					gui_err("restore_error=Error during restore process.");
-					close(input_fd);
-					close(pipes[0]);
-					close(pipes[3]);
-					_exit(-1);
-				}
-			} else {
-				// Parent
-				close(pipes[0]); // Close pipes not used by parent
-				close(pipes[1]);
-				close(pipes[3]);
-				fd = pipes[2];
-				if (tar_fdopen(&t, fd, charRootDir, NULL, O_RDONLY | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
-					close(fd);
-					LOGINFO("tar_fdopen failed\n");
-					gui_err("restore_error=Error during restore process.");
-					return -1;
-				}
-			}
-		}
-	} else if (current_archive_type == ENCRYPTED) {
-		LOGINFO("Opening encrypted backup...\n");
-		int oaesfd[2];
-		input_fd = open(tarfn.c_str(), O_RDONLY | O_LARGEFILE);
-		if (input_fd < 0) {
-			gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(tarfn)(strerror(errno)));
-			return -1;
-		}
-
-		if (pipe(oaesfd) < 0) {
-			LOGINFO("Error creating pipe\n");
-			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
-			return -1;
-		}
-
-		oaes_pid = fork();
-		if (oaes_pid < 0) {
-			LOGINFO("fork() failed\n");
-			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
-			close(oaesfd[0]);
-			close(oaesfd[1]);
-			return -1;
-		} else if (oaes_pid == 0) {
-			// Child
-			close(oaesfd[0]); // Close unused pipe
-			int stdinfd = fileno(stdin);
-			close(stdinfd);   // close stdin
-			dup2(oaesfd[1], fileno(stdout)); // remap stdout
-			dup2(input_fd, stdinfd); // remap input fd to stdin
-			if (execlp("openaes", "openaes", "dec", "--key", password.c_str(), NULL) < 0) {
-				LOGINFO("execlp openaes ERROR!\n");
-				gui_err("restore_error=Error during restore process.");
-				close(input_fd);
-				close(oaesfd[1]);
-				_exit(-1);
-			}
-		} else {
-			// Parent
-			close(oaesfd[1]); // close parent output
-			fd = oaesfd[0];   // copy parent input
-			if (tar_fdopen(&t, fd, charRootDir, NULL, O_RDONLY | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
-				close(fd);
-				LOGINFO("tar_fdopen failed\n");
-				gui_err("restore_error=Error during restore process.");
-				return -1;
-			}
-		}
-	} else if (current_archive_type == COMPRESSED) {
-		int pigzfd[2];
+	if (current_archive_type == COMPRESSED_ENCRYPTED || current_archive_type == ENCRYPTED || current_archive_type == COMPRESSED) {
+		bool decrypt = (current_archive_type != COMPRESSED);
+		bool inflate = (current_archive_type != ENCRYPTED);
 
-		LOGINFO("Opening gzip compressed tar...\n");
-		if (part_settings->adbbackup)  {
+		if (current_archive_type == COMPRESSED_ENCRYPTED)
+			LOGINFO("Opening encrypted and compressed backup...\n");
+		else if (current_archive_type == ENCRYPTED)
+			LOGINFO("Opening encrypted backup...\n");
+		else
+			LOGINFO("Opening gzip compressed tar...\n");
+		if (part_settings->adbbackup && current_archive_type == COMPRESSED) {
 			LOGINFO("opening TW_ADB_RESTORE compressed stream\n");
 			input_fd = open(TW_ADB_RESTORE, O_RDONLY | O_LARGEFILE);
 		}
@@ -1289,43 +1191,24 @@ int twrpTar::openTar() {
 			return -1;
 		}
 
-		if (pipe(pigzfd) < 0) {
-			LOGINFO("Error creating pipe\n");
+		// Decrypt and inflate in process instead of through openaes and pigz children
+		restore_pipeline = new twrpRestorePipeline();
+		fd = restore_pipeline->Start(input_fd, decrypt, inflate, password);
+		input_fd = -1; // now owned by the pipeline
+		if (fd < 0) {
+			LOGINFO("Unable to start restore pipeline\n");
 			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
+			delete restore_pipeline;
+			restore_pipeline = NULL;
 			return -1;
 		}
-
-		pigz_pid = fork();
-		if (pigz_pid < 0) {
-			LOGINFO("fork() failed\n");
+		tar_type.readfunc = read_tar_full;
+		if (tar_fdopen(&t, fd, charRootDir, &tar_type, O_RDONLY | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
+			close(fd);
+			Finish_Restore_Pipeline();
+			LOGINFO("tar_fdopen failed\n");
 			gui_err("restore_error=Error during restore process.");
-			close(input_fd);
-			close(pigzfd[0]);
-			close(pigzfd[1]);
 			return -1;
-		} else if (pigz_pid == 0) {
-			// Child
-			close(pigzfd[0]);
-			dup2(pigzfd[1], fileno(stdout)); // remap stdout
-			dup2(input_fd, fileno(stdin)); // remap input fd to stdin
-			if (execlp("pigz", "pigz", "-d", "-c", NULL) < 0) {
-				close(pigzfd[1]);
-				close(input_fd);
-				LOGINFO("execlp openaes ERROR!\n");
-				gui_err("restore_error=Error during restore process.");
-				_exit(-1);
-			}
-		} else {
-			// Parent
-			close(pigzfd[1]); // close parent output
-			fd = pigzfd[0];   // copy parent input
-			if (tar_fdopen(&t, fd, charRootDir, NULL, O_RDONLY | O_LARGEFILE, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH, TWTAR_FLAGS) != 0) {
-				close(fd);
-				LOGINFO("tar_fdopen failed\n");
-				gui_err("restore_error=Error during restore process.");
-				return -1;
-			}
 		}
 	} else  {
 		if (part_settings->adbbackup) {
@@ -1397,10 +1280,26 @@ int twrpTar::closeTar() {
 	if (current_archive_type > 0) {
 		close(fd);
 		int status;
-		if (pigz_pid > 0 && TWFunc::Wait_For_Child(pigz_pid, &status, "pigz") != 0)
-			return -1;
-		if (oaes_pid > 0 && TWFunc::Wait_For_Child(oaes_pid, &status, "openaes") != 0)
+		struct rusage usage;
+		memset(&usage, 0, sizeof(usage));
+		if (pigz_pid > 0 && TWFunc::Wait_For_Child(pigz_pid, &status, "pigz", &usage) != 0)
 			return -1;
+		if (pigz_pid > 0) {
+			// pigz runs out of process, so its CPU time stands in for the compress stage
+			uint64_t cpu_ns = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000000ULL
+				+ (uint64_t)(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1000ULL;
+			twrpTelemetry::Add(twrpTelemetry::Get_Thread_Slot(), TELEMETRY_COMPRESS, cpu_ns, archive_plain_bytes);
+		}
+		archive_plain_bytes = 0;
+		if (aes_writer != NULL) {
+			int ret = aes_writer->Finish();
+			delete aes_writer;
+			aes_writer = NULL;
+			if (ret != 0) {
+				LOGINFO("Encrypting '%s' failed\n", tarfn.c_str());
+				return -1;
+			}
+		}
 	}
 	free_libtar_buffer();
 	if (!part_settings->adbbackup) {
@@ -1569,9 +1468,19 @@ unsigned long long twrpTar::uncompressedSize(string filename) {
 }
 
 extern "C" ssize_t write_tar(int fd, const void *buffer, size_t size) {
-	return (ssize_t) write_libtar_buffer(fd, buffer, size);
+	uint64_t start = twrpTelemetry::Now();
+	ssize_t ret = (ssize_t) write_libtar_buffer(fd, buffer, size);
+	tar_write_ns += twrpTelemetry::Now() - start;
+	if (ret > 0)
+		tar_write_bytes += ret;
+	return ret;
 }
 
 extern "C" ssize_t write_tar_no_buffer(int fd, const void *buffer, size_t size) {
-	return (ssize_t) write_libtar_no_buffer(fd, buffer, size);
+	uint64_t start = twrpTelemetry::Now();
+	ssize_t ret = (ssize_t) write_libtar_no_buffer(fd, buffer, size);
+	tar_write_ns += twrpTelemetry::Now() - start;
+	if (ret > 0)
+		tar_write_bytes += ret;
+	return ret;
 }
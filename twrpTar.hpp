@@ -31,6 +31,8 @@ extern "C" {
 #include "progresstracking.hpp"
 #include "partitions.hpp"
 #include "twrp-functions.hpp"
+#include "twrpRestorePipeline.hpp"
+#include "twrpAes.hpp"
 
 using namespace std;
 
@@ -44,6 +46,15 @@ struct thread_data_struct {
 	unsigned thread_id;
 };
 
+class twrpTar;
+
+// Archive chains (all parts of one backup thread ID) waiting to be restored, largest first
+struct RestoreQueueStruct {
+	std::vector<twrpTar*> tars;
+	size_t next;
+	pthread_mutex_t lock;
+};
+
 class twrpTar {
 public:
 	twrpTar();
@@ -83,6 +94,8 @@ private:
 	int Generate_TarList(string Path, std::vector<TarListStruct> *TarList, unsigned long long *Target_Size, unsigned *thread_id);
 	static void* createList(void *cookie);
 	static void* extractMulti(void *cookie);
+	static void* extractQueue(void *cookie);
+	int Finish_Restore_Pipeline();
 	int tarList(std::vector<TarListStruct> *TarList, unsigned thread_id);
 	unsigned long long uncompressedSize(string filename);
 	static void Signal_Kill(int signum);
@@ -92,11 +105,13 @@ private:
 	unsigned long long Total_Backup_Size;
 	bool include_root_dir;
 	TAR *t;
-	tartype_t tar_type; // Only used in createTar() but variable must persist while the tar is open
+	tartype_t tar_type; // Used by createTar() and the restore pipeline, must persist while the tar is open
 	int fd;
 	int input_fd;                                                                   // this stores the fd for libtar to write to
 	pid_t pigz_pid;
-	pid_t oaes_pid;
+	uint64_t archive_plain_bytes;                                                   // tar bytes fed to the current pigz, for telemetry
+	twrpAesWriter *aes_writer;                                                      // in-process encryption for backups
+	twrpRestorePipeline *restore_pipeline;                                          // in-process decrypt/inflate for restores
 	unsigned long long file_count;
 
 	string tardir;
@@ -7,6 +7,9 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpRestorePipeline.cpp \
+	../twrpAes.cpp \
+	../twrpTelemetry.cpp \
 	../tarWrite.c \
 	../exclude.cpp \
 	../progresstracking.cpp \
@@ -30,8 +33,6 @@ ifneq ($(RECOVERY_SDCARD_ON_DATA),)
 endif
 ifeq ($(TW_EXCLUDE_ENCRYPTED_BACKUPS), true)
     LOCAL_CFLAGS += -DTW_EXCLUDE_ENCRYPTED_BACKUPS
-else
-	LOCAL_STATIC_LIBRARIES += libopenaes_static
 endif
 
 LOCAL_MODULE:= twrpTar_static
@@ -49,6 +50,9 @@ LOCAL_SRC_FILES:= \
 	twrpTarMain.cpp \
 	../twrp-functions.cpp \
 	../twrpTar.cpp \
+	../twrpRestorePipeline.cpp \
+	../twrpAes.cpp \
+	../twrpTelemetry.cpp \
 	../tarWrite.c \
 	../exclude.cpp \
 	../progresstracking.cpp \
@@ -71,8 +75,6 @@ ifneq ($(RECOVERY_SDCARD_ON_DATA),)
 endif
 ifeq ($(TW_EXCLUDE_ENCRYPTED_BACKUPS), true)
     LOCAL_CFLAGS += -DTW_EXCLUDE_ENCRYPTED_BACKUPS
-else
-	LOCAL_SHARED_LIBRARIES += libopenaes
 endif
 
 LOCAL_MODULE:= twrpTar
@@ -0,0 +1,208 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <time.h>
+#include <string>
+#include <vector>
+#include "twrpTaskGraph.hpp"
+#include "twcommon.h"
+
+twrpTaskGraph::twrpTaskGraph(void) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&finished, NULL);
+	running = 0;
+	stop_on_failure = false;
+	failed = false;
+	run_start_ms = 0;
+	run_end_ms = 0;
+}
+
+twrpTaskGraph::~twrpTaskGraph() {
+	pthread_cond_destroy(&finished);
+	pthread_mutex_destroy(&lock);
+}
+
+uint64_t twrpTaskGraph::Now_Ms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+int twrpTaskGraph::Add_Task(const std::string& name, Task_Function function, void *cookie) {
+	Task task;
+	task.name = name;
+	task.function = function;
+	task.cookie = cookie;
+	task.state = TASK_WAITING;
+	task.ready_ms = 0;
+	task.start_ms = 0;
+	task.end_ms = 0;
+	task.has_thread = false;
+	task.graph = this;
+	tasks.push_back(task);
+	return tasks.size() - 1;
+}
+
+void twrpTaskGraph::Add_Dependency(int task, int after) {
+	if (task < 0 || task >= (int)tasks.size() || after < 0 || after >= (int)tasks.size() || task == after) {
+		LOGERR("Invalid task dependency %i -> %i\n", after, task);
+		return;
+	}
+	tasks[task].after.push_back(after);
+}
+
+void twrpTaskGraph::Stop_On_Failure(void) {
+	stop_on_failure = true;
+}
+
+bool twrpTaskGraph::Succeeded(int task) {
+	return task >= 0 && task < (int)tasks.size() && tasks[task].state == TASK_DONE;
+}
+
+void *twrpTaskGraph::Task_Thread(void *cookie) {
+	Task *task = (Task*)cookie;
+	twrpTaskGraph *graph = task->graph;
+
+	uint64_t start = Now_Ms();
+	bool ret = task->function(task->cookie);
+	uint64_t end = Now_Ms();
+
+	pthread_mutex_lock(&graph->lock);
+	task->start_ms = start;
+	task->end_ms = end;
+	task->state = ret ? TASK_DONE : TASK_FAILED;
+	if (!ret)
+		graph->failed = true;
+	graph->running--;
+	pthread_cond_signal(&graph->finished);
+	pthread_mutex_unlock(&graph->lock);
+	return NULL;
+}
+
+void twrpTaskGraph::Start_Ready_Tasks(void) {
+	bool changed = true;
+
+	// skipping or finishing a task may make others ready, so look again until nothing changes
+	while (changed) {
+		changed = false;
+		for (size_t i = 0; i < tasks.size(); i++) {
+			Task& task = tasks[i];
+			if (task.state != TASK_WAITING)
+				continue;
+
+			bool ready = true, blocked = false;
+			for (size_t d = 0; d < task.after.size(); d++) {
+				Task_State state = tasks[task.after[d]].state;
+				if (state == TASK_FAILED || state == TASK_SKIPPED)
+					blocked = true;
+				else if (state != TASK_DONE)
+					ready = false;
+			}
+			if (failed && stop_on_failure) {
+				LOGINFO("Skipping '%s', an earlier task failed\n", task.name.c_str());
+				task.state = TASK_SKIPPED;
+				continue;
+			}
+			if (blocked) {
+				LOGINFO("Skipping '%s', a task it depends on did not complete\n", task.name.c_str());
+				task.state = TASK_SKIPPED;
+				changed = true;
+				continue;
+			}
+			if (!ready)
+				continue;
+
+			task.state = TASK_RUNNING;
+			task.ready_ms = Now_Ms();
+			running++;
+			if (pthread_create(&task.thread, NULL, Task_Thread, &task) == 0) {
+				task.has_thread = true;
+			} else {
+				// run it here rather than not at all
+				pthread_mutex_unlock(&lock);
+				Task_Thread(&task);
+				pthread_mutex_lock(&lock);
+				changed = true;
+			}
+		}
+	}
+}
+
+bool twrpTaskGraph::Run(void) {
+	bool ret = true;
+
+	run_start_ms = Now_Ms();
+	pthread_mutex_lock(&lock);
+	Start_Ready_Tasks();
+	while (running > 0) {
+		pthread_cond_wait(&finished, &lock);
+		Start_Ready_Tasks();
+	}
+	pthread_mutex_unlock(&lock);
+
+	for (size_t i = 0; i < tasks.size(); i++) {
+		if (tasks[i].has_thread) {
+			pthread_join(tasks[i].thread, NULL);
+			tasks[i].has_thread = false;
+		}
+		if (tasks[i].state == TASK_WAITING) {
+			LOGERR("Task '%s' is part of a dependency cycle\n", tasks[i].name.c_str());
+			tasks[i].state = TASK_SKIPPED;
+		}
+		if (tasks[i].state != TASK_DONE)
+			ret = false;
+	}
+	run_end_ms = Now_Ms();
+	return ret;
+}
+
+void twrpTaskGraph::Log_Timing(const std::string& title) {
+	int last = -1;
+
+	LOGINFO("%s took %llums:\n", title.c_str(), (unsigned long long)(run_end_ms - run_start_ms));
+	for (size_t i = 0; i < tasks.size(); i++) {
+		const Task& task = tasks[i];
+		if (task.state == TASK_SKIPPED) {
+			LOGINFO("  %-16s skipped\n", task.name.c_str());
+			continue;
+		}
+		// wait is from the last dependency finishing to the task starting, i.e. thread startup
+		LOGINFO("  %-16s start %6llums  took %6llums  wait %4llums%s\n", task.name.c_str(),
+			(unsigned long long)(task.start_ms - run_start_ms),
+			(unsigned long long)(task.end_ms - task.start_ms),
+			(unsigned long long)(task.start_ms - task.ready_ms),
+			task.state == TASK_FAILED ? "  (failed)" : "");
+		if (last < 0 || task.end_ms > tasks[last].end_ms)
+			last = i;
+	}
+
+	// walk back from the task that finished last through whichever dependency held it up
+	std::string path;
+	while (last >= 0) {
+		path = tasks[last].name + (path.empty() ? "" : " -> ") + path;
+		int next = -1;
+		for (size_t d = 0; d < tasks[last].after.size(); d++) {
+			int dep = tasks[last].after[d];
+			if (next < 0 || tasks[dep].end_ms > tasks[next].end_ms)
+				next = dep;
+		}
+		last = next;
+	}
+	if (!path.empty())
+		LOGINFO("  critical path: %s\n", path.c_str());
+}
@@ -0,0 +1,81 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPTASKGRAPH_HPP
+#define TWRPTASKGRAPH_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+// Runs a set of tasks, each on a thread of its own as soon as the tasks it depends on have
+// succeeded, and records when each of them started and finished. A task whose dependency
+// failed is skipped, and with Stop_On_Failure() so is every task that has not started yet.
+class twrpTaskGraph {
+public:
+	typedef bool (*Task_Function)(void *cookie);      // returns false on failure
+
+	twrpTaskGraph(void);
+	~twrpTaskGraph();
+
+	int Add_Task(const std::string& name, Task_Function function, void *cookie); // returns the task id
+	void Add_Dependency(int task, int after);        // task only starts once after succeeded
+	void Stop_On_Failure(void);                      // start no more tasks once one has failed
+	bool Run(void);                                  // waits for all tasks, false if any failed or was skipped
+	bool Succeeded(int task);
+	void Log_Timing(const std::string& title);       // start, duration and thread start wait of each task
+	static uint64_t Now_Ms(void);                    // monotonic milliseconds
+
+private:
+	enum Task_State {
+		TASK_WAITING = 0,
+		TASK_RUNNING,
+		TASK_DONE,
+		TASK_FAILED,
+		TASK_SKIPPED
+	};
+
+	struct Task {
+		std::string name;
+		Task_Function function;
+		void *cookie;
+		std::vector<int> after;
+		Task_State state;
+		uint64_t ready_ms;                               // dependencies done
+		uint64_t start_ms;
+		uint64_t end_ms;
+		pthread_t thread;
+		bool has_thread;
+		twrpTaskGraph *graph;
+	};
+
+	static void *Task_Thread(void *cookie);
+	void Start_Ready_Tasks(void);                    // called with lock held
+
+	std::vector<Task> tasks;                          // must not grow while Run is active
+	pthread_mutex_t lock;
+	pthread_cond_t finished;
+	int running;
+	bool stop_on_failure;
+	bool failed;
+	uint64_t run_start_ms;
+	uint64_t run_end_ms;
+};
+
+#endif // TWRPTASKGRAPH_HPP
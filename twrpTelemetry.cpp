@@ -0,0 +1,331 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include "twrpTelemetry.hpp"
+#include "twcommon.h"
+#ifndef BUILD_TWRPTAR_MAIN
+#include "data.hpp"
+#include "variables.h"
+#include "twrpAes.hpp"
+#include "set_metadata.h"
+#endif
+
+static const char *stage_names[TELEMETRY_STAGE_COUNT] = {
+	"scan", "read", "compress", "encrypt", "write", "digest", "fsync"
+};
+
+// 0 means the main slot so threads that never call Set_Thread_Slot land there
+static __thread unsigned thread_slot_plus_one = 0;
+
+std::string twrpTelemetry::operation;
+std::vector<Telemetry_Record> twrpTelemetry::records;
+Telemetry_Block *twrpTelemetry::shared = NULL;
+int twrpTelemetry::current = -1;
+uint64_t twrpTelemetry::current_start = 0;
+
+uint64_t twrpTelemetry::Now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+const char *twrpTelemetry::Stage_Name(Telemetry_Stage stage) {
+	if (stage < 0 || stage >= TELEMETRY_STAGE_COUNT)
+		return "unknown";
+	return stage_names[stage];
+}
+
+void twrpTelemetry::Set_Thread_Slot(unsigned slot) {
+	if (slot >= TELEMETRY_MAIN_SLOT)
+		slot = TELEMETRY_MAIN_SLOT - 1;
+	thread_slot_plus_one = slot + 1;
+}
+
+unsigned twrpTelemetry::Get_Thread_Slot(void) {
+	if (thread_slot_plus_one == 0)
+		return TELEMETRY_MAIN_SLOT;
+	return thread_slot_plus_one - 1;
+}
+
+void twrpTelemetry::Start_Operation(const std::string& op) {
+	operation = op;
+	records.clear();
+	current = -1;
+}
+
+void twrpTelemetry::Begin_Partition(const std::string& partition) {
+	if (shared == NULL) {
+		void *map = mmap(NULL, sizeof(Telemetry_Block), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (map == MAP_FAILED) {
+			LOGINFO("twrpTelemetry: unable to map counters: %s\n", strerror(errno));
+			return;
+		}
+		shared = (Telemetry_Block*) map;
+	}
+	memset(shared, 0, sizeof(Telemetry_Block));
+
+	// Digest checks before a restore and the restore itself add to the same record
+	current = -1;
+	for (size_t i = 0; i < records.size(); i++) {
+		if (records[i].partition == partition) {
+			current = i;
+			break;
+		}
+	}
+	if (current < 0) {
+		Telemetry_Record record;
+		record.partition = partition;
+		record.wall_ns = 0;
+		record.archive_bytes = 0;
+		memset(&record.block, 0, sizeof(record.block));
+		records.push_back(record);
+		current = records.size() - 1;
+	}
+	current_start = Now();
+}
+
+void twrpTelemetry::End_Partition(uint64_t archive_bytes) {
+	if (current < 0 || shared == NULL)
+		return;
+
+	Telemetry_Record& record = records[current];
+	record.wall_ns += Now() - current_start;
+	if (archive_bytes)
+		record.archive_bytes = archive_bytes;
+	for (int slot = 0; slot < TELEMETRY_THREAD_SLOTS; slot++) {
+		for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+			Telemetry_Counter& dst = record.block.counters[slot][stage];
+			const Telemetry_Counter& src = shared->counters[slot][stage];
+			dst.ns += src.ns;
+			dst.bytes += src.bytes;
+			dst.calls += src.calls;
+		}
+	}
+	memset(shared, 0, sizeof(Telemetry_Block));
+	current = -1;
+}
+
+void twrpTelemetry::Add(unsigned slot, Telemetry_Stage stage, uint64_t ns, uint64_t bytes) {
+	// current is set before the archiver forks, so the child sees the same partition
+	if (shared == NULL || current < 0 || slot >= TELEMETRY_THREAD_SLOTS || (unsigned) stage >= TELEMETRY_STAGE_COUNT)
+		return;
+
+	Telemetry_Counter& counter = shared->counters[slot][stage];
+	__sync_fetch_and_add(&counter.ns, ns);
+	__sync_fetch_and_add(&counter.bytes, bytes);
+	__sync_fetch_and_add(&counter.calls, (uint64_t)1);
+}
+
+uint64_t twrpTelemetry::Archive_Bytes(const std::string& folder, const std::string& filename) {
+	DIR *d = opendir(folder.c_str());
+	struct dirent *de;
+	uint64_t total = 0;
+
+	if (d == NULL)
+		return 0;
+	// name.fs.win plus name.fs.win000, name.fs.win001, ... for split archives, but not their
+	// name.fs.win.sha2 or name.fs.win000.sha2 digests
+	while ((de = readdir(d)) != NULL) {
+		if (strncmp(de->d_name, filename.c_str(), filename.size()) != 0)
+			continue;
+		const char *suffix = de->d_name + filename.size();
+		if (*suffix != '\0' && (strlen(suffix) != 3 || !isdigit(suffix[0]) || !isdigit(suffix[1]) || !isdigit(suffix[2])))
+			continue;
+		std::string path = folder + "/" + de->d_name;
+		struct stat st;
+		if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode))
+			total += st.st_size;
+	}
+	closedir(d);
+	return total;
+}
+
+#ifndef BUILD_TWRPTAR_MAIN
+static void Stage_Totals(const Telemetry_Block& block, int stage, Telemetry_Counter *out) {
+	memset(out, 0, sizeof(*out));
+	for (int slot = 0; slot < TELEMETRY_THREAD_SLOTS; slot++) {
+		out->ns += block.counters[slot][stage].ns;
+		out->bytes += block.counters[slot][stage].bytes;
+		out->calls += block.counters[slot][stage].calls;
+	}
+}
+
+static uint64_t Mb_Per_Sec(uint64_t bytes, uint64_t ns) {
+	if (ns == 0)
+		return 0;
+	return (uint64_t)((double)bytes * 1000000000.0 / (double)ns / (1024.0 * 1024.0));
+}
+
+static std::string Json_Stage(const Telemetry_Counter& counter) {
+	char buf[160];
+
+	snprintf(buf, sizeof(buf), "{\"ms\": %llu, \"bytes\": %llu, \"calls\": %llu, \"mb_per_sec\": %llu}",
+		(unsigned long long)(counter.ns / 1000000), (unsigned long long)counter.bytes,
+		(unsigned long long)counter.calls, (unsigned long long)Mb_Per_Sec(counter.bytes, counter.ns));
+	return buf;
+}
+
+static std::string Json_String(const std::string& str) {
+	std::string ret = "\"";
+
+	for (size_t i = 0; i < str.size(); i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			ret += '\\';
+		if ((unsigned char)str[i] >= 0x20)
+			ret += str[i];
+	}
+	return ret + "\"";
+}
+
+bool twrpTelemetry::Write_Report(const std::string& path) {
+	Telemetry_Block totals;
+	uint64_t total_wall = 0, total_archive = 0;
+	std::string json;
+	char buf[256];
+
+	memset(&totals, 0, sizeof(totals));
+	json = "{\n  \"operation\": " + Json_String(operation) + ",\n";
+	json += "  \"version\": " + Json_String(TW_VERSION_STR) + ",\n";
+	json += "  \"aes_engine\": " + Json_String(twrpAes::Engine_Name()) + ",\n";
+	json += "  \"partitions\": [";
+	for (size_t i = 0; i < records.size(); i++) {
+		const Telemetry_Record& record = records[i];
+		snprintf(buf, sizeof(buf), "%s\n    {\n      \"name\": %s,\n      \"wall_ms\": %llu,\n      \"archive_bytes\": %llu,\n",
+			i ? "," : "", Json_String(record.partition).c_str(), (unsigned long long)(record.wall_ns / 1000000), (unsigned long long)record.archive_bytes);
+		json += buf;
+		json += "      \"stages\": {";
+		for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+			Telemetry_Counter counter;
+			Stage_Totals(record.block, stage, &counter);
+			json += std::string(stage ? ", " : "") + "\"" + stage_names[stage] + "\": " + Json_Stage(counter);
+		}
+		json += "},\n      \"threads\": [";
+		bool first_thread = true;
+		for (int slot = 0; slot < TELEMETRY_THREAD_SLOTS; slot++) {
+			bool used = false;
+			for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++)
+				used |= record.block.counters[slot][stage].calls != 0;
+			if (!used)
+				continue;
+			if (slot == TELEMETRY_MAIN_SLOT)
+				snprintf(buf, sizeof(buf), "%s\n        {\"thread\": \"main\", \"stages\": {", first_thread ? "" : ",");
+			else
+				snprintf(buf, sizeof(buf), "%s\n        {\"thread\": %i, \"stages\": {", first_thread ? "" : ",", slot);
+			json += buf;
+			first_thread = false;
+			bool first_stage = true;
+			for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+				const Telemetry_Counter& counter = record.block.counters[slot][stage];
+				if (counter.calls == 0)
+					continue;
+				json += std::string(first_stage ? "" : ", ") + "\"" + stage_names[stage] + "\": " + Json_Stage(counter);
+				first_stage = false;
+			}
+			json += "}}";
+		}
+		json += first_thread ? "]\n    }" : "\n      ]\n    }";
+
+		total_wall += record.wall_ns;
+		total_archive += record.archive_bytes;
+		for (int slot = 0; slot < TELEMETRY_THREAD_SLOTS; slot++) {
+			for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+				totals.counters[slot][stage].ns += record.block.counters[slot][stage].ns;
+				totals.counters[slot][stage].bytes += record.block.counters[slot][stage].bytes;
+				totals.counters[slot][stage].calls += record.block.counters[slot][stage].calls;
+			}
+		}
+	}
+	snprintf(buf, sizeof(buf), "\n  ],\n  \"totals\": {\n    \"wall_ms\": %llu,\n    \"archive_bytes\": %llu,\n    \"stages\": {",
+		(unsigned long long)(total_wall / 1000000), (unsigned long long)total_archive);
+	json += buf;
+	for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+		Telemetry_Counter counter;
+		Stage_Totals(totals, stage, &counter);
+		json += std::string(stage ? ", " : "") + "\"" + stage_names[stage] + "\": " + Json_Stage(counter);
+	}
+	json += "}\n  }\n}\n";
+
+	FILE *f = fopen(path.c_str(), "w");
+	if (f == NULL) {
+		LOGINFO("Unable to write telemetry report '%s': %s\n", path.c_str(), strerror(errno));
+		return false;
+	}
+	fputs(json.c_str(), f);
+	fclose(f);
+	tw_set_default_metadata(path.c_str());
+	DataManager::SetValue(TW_TELEMETRY_REPORT_VAR, path);
+	LOGINFO("Wrote telemetry report '%s'\n", path.c_str());
+	return true;
+}
+
+void twrpTelemetry::Publish(void) {
+	for (int stage = 0; stage < TELEMETRY_STAGE_COUNT; stage++) {
+		Telemetry_Counter total;
+		memset(&total, 0, sizeof(total));
+		for (size_t i = 0; i < records.size(); i++) {
+			Telemetry_Counter counter;
+			Stage_Totals(records[i].block, stage, &counter);
+			total.ns += counter.ns;
+			total.bytes += counter.bytes;
+		}
+		std::string prefix = std::string("tw_telemetry_") + stage_names[stage];
+		DataManager::SetValue(prefix + "_ms", (unsigned long long)(total.ns / 1000000));
+		DataManager::SetValue(prefix + "_bytes", (unsigned long long)total.bytes);
+		DataManager::SetValue(prefix + "_mbps", (unsigned long long)Mb_Per_Sec(total.bytes, total.ns));
+		LOGINFO("Telemetry %-8s %8llu ms %12llu bytes %5llu MB/s\n", stage_names[stage], (unsigned long long)(total.ns / 1000000),
+			(unsigned long long)total.bytes, (unsigned long long)Mb_Per_Sec(total.bytes, total.ns));
+	}
+}
+#endif // ndef BUILD_TWRPTAR_MAIN
+
+twrpStageTimer::twrpStageTimer(Telemetry_Stage timer_stage) {
+	stage = timer_stage;
+	slot = twrpTelemetry::Get_Thread_Slot();
+	start = twrpTelemetry::Now();
+	stopped = false;
+}
+
+twrpStageTimer::twrpStageTimer(Telemetry_Stage timer_stage, unsigned timer_slot) {
+	stage = timer_stage;
+	slot = timer_slot;
+	start = twrpTelemetry::Now();
+	stopped = false;
+}
+
+twrpStageTimer::~twrpStageTimer() {
+	if (!stopped)
+		Stop(0);
+}
+
+void twrpStageTimer::Stop(uint64_t bytes) {
+	if (stopped)
+		return;
+	stopped = true;
+	twrpTelemetry::Add(slot, stage, twrpTelemetry::Now() - start, bytes);
+}
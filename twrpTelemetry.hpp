@@ -0,0 +1,102 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPTELEMETRY_HPP
+#define TWRPTELEMETRY_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+// Stages of a backup or restore. On restore, compress and encrypt hold the inflate and
+// decrypt time.
+enum Telemetry_Stage {
+	TELEMETRY_SCAN = 0,                                // walking the tree to build archive lists
+	TELEMETRY_READ,                                    // reading source data
+	TELEMETRY_COMPRESS,                                // pigz CPU time or in-process inflate
+	TELEMETRY_ENCRYPT,                                 // AES
+	TELEMETRY_WRITE,                                   // pushing archive data out
+	TELEMETRY_DIGEST,                                  // creating or checking digests
+	TELEMETRY_FSYNC,                                   // sync after writing
+	TELEMETRY_STAGE_COUNT
+};
+
+// twrpTar thread ids 0 to 8 get a slot each, everything run by the partition manager
+// itself is counted in the main slot.
+#define TELEMETRY_THREAD_SLOTS 10
+#define TELEMETRY_MAIN_SLOT (TELEMETRY_THREAD_SLOTS - 1)
+
+struct Telemetry_Counter {
+	uint64_t ns;
+	uint64_t bytes;
+	uint64_t calls;
+};
+
+struct Telemetry_Block {
+	Telemetry_Counter counters[TELEMETRY_THREAD_SLOTS][TELEMETRY_STAGE_COUNT];
+};
+
+struct Telemetry_Record {
+	std::string partition;
+	uint64_t wall_ns;
+	uint64_t archive_bytes;                            // size of the backup files for the partition
+	Telemetry_Block block;
+};
+
+// Per-stage timers and byte counters for backups and restores. Counters live in a shared
+// anonymous mapping created before the twrpTar fork, so the archiver process and all of its
+// threads add to the same block the partition manager reads once the fork is done. Adding
+// is a no-op outside of Begin_Partition / End_Partition, e.g. in the standalone twrpTar.
+class twrpTelemetry {
+public:
+	static void Start_Operation(const std::string& operation);  // "backup" or "restore", drops old records
+	static void Begin_Partition(const std::string& partition);   // call before forking the archiver
+	static void End_Partition(uint64_t archive_bytes);
+	static void Add(unsigned slot, Telemetry_Stage stage, uint64_t ns, uint64_t bytes);
+	static void Set_Thread_Slot(unsigned slot);      // slot for the calling thread, defaults to the main slot
+	static unsigned Get_Thread_Slot(void);
+	static uint64_t Now(void);                       // monotonic nanoseconds
+	static const char *Stage_Name(Telemetry_Stage stage);
+	static uint64_t Archive_Bytes(const std::string& folder, const std::string& filename); // sums split archives, not digests
+	static bool Write_Report(const std::string& path);  // JSON report of the finished operation
+	static void Publish(void);                       // totals as tw_telemetry_* variables
+
+private:
+	static std::string operation;
+	static std::vector<Telemetry_Record> records;
+	static Telemetry_Block *shared;
+	static int current;                              // index into records, -1 between partitions
+	static uint64_t current_start;
+};
+
+// Times one stage on the calling thread's slot from construction until Stop or destruction.
+class twrpStageTimer {
+public:
+	twrpStageTimer(Telemetry_Stage stage);
+	twrpStageTimer(Telemetry_Stage stage, unsigned slot);
+	~twrpStageTimer();
+	void Stop(uint64_t bytes);
+
+private:
+	Telemetry_Stage stage;
+	unsigned slot;
+	uint64_t start;
+	bool stopped;
+};
+
+#endif // TWRPTELEMETRY_HPP
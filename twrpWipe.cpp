@@ -0,0 +1,236 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <string>
+#include <vector>
+#include "twrpWipe.hpp"
+#include "twrpTaskGraph.hpp"
+#include "twcommon.h"
+#include "gui/gui.hpp"
+
+#define WIPE_MAX_THREADS 8
+
+twrpWipe::twrpWipe(void) {
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&changed, NULL);
+	exclusions = NULL;
+	scanning = 0;
+	remove_top = false;
+	files = 0;
+	dirs = 0;
+	errors = 0;
+}
+
+twrpWipe::~twrpWipe() {
+	pthread_cond_destroy(&changed);
+	pthread_mutex_destroy(&lock);
+}
+
+void twrpWipe::Set_Exclusions(TWExclude *wipe_exclusions) {
+	exclusions = wipe_exclusions;
+}
+
+bool twrpWipe::Remove_Tree(const std::string& path, bool remove_path) {
+	struct stat st;
+	int err = 0;
+
+	if (stat(path.c_str(), &st) != 0)
+		err = errno;
+	else if (!S_ISDIR(st.st_mode))
+		err = ENOTDIR;
+	if (err) {
+		gui_msg(Msg(msg::kError, "error_opening_strerr=Error opening: '{1}' ({2})")(path)(strerror(err)));
+		return false;
+	}
+
+	Dir *top = new Dir;
+	top->parent = NULL;
+	top->path = path;
+	if (top->path.empty() || top->path[top->path.size() - 1] != '/')
+		top->path += "/";
+	top->name = path;
+	top->fd = -1;
+	top->pending = 1;
+	remove_top = remove_path;
+	files = dirs = errors = 0;
+	queue.push_back(top);
+
+	uint64_t start = twrpTaskGraph::Now_Ms();
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = cpus < 1 ? 1 : (cpus > WIPE_MAX_THREADS ? WIPE_MAX_THREADS : (int)cpus);
+	std::vector<pthread_t> workers;
+	for (int i = 1; i < threads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, Worker_Thread, this) == 0)
+			workers.push_back(thread);
+	}
+	Work();
+	for (size_t i = 0; i < workers.size(); i++)
+		pthread_join(workers[i], NULL);
+
+	LOGINFO("Removed %llu files and %llu folders under '%s' with %i threads in %llums, %llu errors\n",
+		(unsigned long long)files, (unsigned long long)dirs, path.c_str(), (int)workers.size() + 1,
+		(unsigned long long)(twrpTaskGraph::Now_Ms() - start), (unsigned long long)errors);
+	return true;
+}
+
+void *twrpWipe::Worker_Thread(void *cookie) {
+	((twrpWipe*)cookie)->Work();
+	return NULL;
+}
+
+void twrpWipe::Work(void) {
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue.empty() && scanning > 0)
+			pthread_cond_wait(&changed, &lock);
+		if (queue.empty())
+			break;
+		Dir *dir = queue.back();
+		queue.pop_back();
+		scanning++;
+		pthread_mutex_unlock(&lock);
+		Scan(dir);
+		pthread_mutex_lock(&lock);
+		scanning--;
+		if (queue.empty() && scanning == 0)
+			pthread_cond_broadcast(&changed);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void twrpWipe::Scan(Dir *dir) {
+	uint64_t removed = 0, failed = 0;
+
+	if (dir->parent)
+		dir->fd = openat(dir->parent->fd, dir->name.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	else
+		dir->fd = open(dir->path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	int scan_fd = dir->fd < 0 ? -1 : dup(dir->fd);
+	DIR *d = scan_fd < 0 ? NULL : fdopendir(scan_fd);
+	if (d == NULL) {
+		LOGINFO("Unable to open '%s': %s\n", dir->path.c_str(), strerror(errno));
+		if (scan_fd >= 0)
+			close(scan_fd);
+		failed++;
+	} else {
+		struct dirent *de;
+		while ((de = readdir(d)) != NULL) {
+			if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+				continue;
+			if (exclusions && exclusions->check_skip_dirs(dir->path + de->d_name)) {
+				LOGINFO("skipped '%s%s'\n", dir->path.c_str(), de->d_name);
+				continue;
+			}
+
+			bool is_dir = de->d_type == DT_DIR;
+			if (de->d_type == DT_UNKNOWN) {
+				struct stat st;
+				is_dir = fstatat(dir->fd, de->d_name, &st, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(st.st_mode);
+			}
+			if (is_dir) {
+				Dir *child = new Dir;
+				child->parent = dir;
+				child->name = de->d_name;
+				child->path = dir->path + child->name + "/";
+				child->fd = -1;
+				child->pending = 1;
+				pthread_mutex_lock(&lock);
+				dir->pending++;
+				queue.push_back(child);
+				pthread_cond_signal(&changed);
+				pthread_mutex_unlock(&lock);
+			} else if (unlinkat(dir->fd, de->d_name, 0) == 0) {
+				removed++;
+			} else if (errno != ENOENT) {
+				LOGINFO("Unable to unlink '%s%s': %s\n", dir->path.c_str(), de->d_name, strerror(errno));
+				failed++;
+			}
+		}
+		closedir(d);
+	}
+
+	pthread_mutex_lock(&lock);
+	files += removed;
+	errors += failed;
+	pthread_mutex_unlock(&lock);
+	Release(dir);
+}
+
+void twrpWipe::Release(Dir *dir) {
+	while (dir) {
+		pthread_mutex_lock(&lock);
+		bool done = --dir->pending == 0;
+		pthread_mutex_unlock(&lock);
+		if (!done)
+			return;
+
+		// excluded entries or failed unlinks leave the directory in place
+		int ret = 0;
+		if (dir->parent)
+			ret = unlinkat(dir->parent->fd, dir->name.c_str(), AT_REMOVEDIR);
+		else if (remove_top)
+			ret = rmdir(dir->path.c_str());
+		if (ret != 0 && errno != ENOTEMPTY && errno != EEXIST && errno != ENOENT)
+			LOGINFO("Unable to remove '%s': %s\n", dir->path.c_str(), strerror(errno));
+
+		pthread_mutex_lock(&lock);
+		if (ret == 0 && (dir->parent || remove_top))
+			dirs++;
+		pthread_mutex_unlock(&lock);
+		if (dir->fd >= 0)
+			close(dir->fd);
+		Dir *parent = dir->parent;
+		delete dir;
+		dir = parent;
+	}
+}
+
+bool twrpWipe::Discard(const std::string& block_device, uint64_t start, uint64_t length, bool secure) {
+	uint64_t range[2] = { start, length };
+	int ret = -1;
+
+	int fd = open(block_device.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd < 0) {
+		LOGINFO("Unable to open '%s' to discard: %s\n", block_device.c_str(), strerror(errno));
+		return false;
+	}
+	uint64_t begin = twrpTaskGraph::Now_Ms();
+	if (secure) {
+		ret = ioctl(fd, BLKSECDISCARD, &range);
+		if (ret != 0)
+			LOGINFO("BLKSECDISCARD on '%s' failed (%s), using BLKDISCARD\n", block_device.c_str(), strerror(errno));
+	}
+	if (ret != 0)
+		ret = ioctl(fd, BLKDISCARD, &range);
+	if (ret != 0)
+		LOGINFO("BLKDISCARD on '%s' failed: %s\n", block_device.c_str(), strerror(errno));
+	else
+		LOGINFO("Discarded %llu bytes of '%s' in %llums\n", (unsigned long long)length, block_device.c_str(),
+			(unsigned long long)(twrpTaskGraph::Now_Ms() - begin));
+	close(fd);
+	return ret == 0;
+}
@@ -0,0 +1,67 @@
+/*
+        Copyright 2013 to 2017 TeamWin
+        This file is part of TWRP/TeamWin Recovery Project.
+
+        TWRP is free software: you can redistribute it and/or modify
+        it under the terms of the GNU General Public License as published by
+        the Free Software Foundation, either version 3 of the License, or
+        (at your option) any later version.
+
+        TWRP is distributed in the hope that it will be useful,
+        but WITHOUT ANY WARRANTY; without even the implied warranty of
+        MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+        GNU General Public License for more details.
+
+        You should have received a copy of the GNU General Public License
+        along with TWRP.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TWRPWIPE_HPP
+#define TWRPWIPE_HPP
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+#include "exclude.hpp"
+
+// Removes directory trees with a pool of worker threads. Every directory is a task of its
+// own: a worker opens it relative to its parent's fd, unlinks the files in it with unlinkat
+// and queues its subdirectories for the other workers. A directory is removed once the
+// last of its subdirectories is gone. Work isn't split any finer than that since unlinks in
+// one directory serialize on its inode lock anyway.
+class twrpWipe {
+public:
+	twrpWipe(void);
+	~twrpWipe();
+
+	void Set_Exclusions(TWExclude *wipe_exclusions); // entries matching these are left in place
+	bool Remove_Tree(const std::string& path, bool remove_path); // false if path can't be opened, removes path itself if remove_path
+	static bool Discard(const std::string& block_device, uint64_t start, uint64_t length, bool secure); // BLKSECDISCARD or BLKDISCARD on a byte range
+
+private:
+	struct Dir {
+		Dir *parent;
+		std::string path;                                // with a trailing slash
+		std::string name;
+		int fd;                                          // open from the scan until the directory is removed
+		int pending;                                     // its own scan plus each subdirectory not yet removed
+	};
+
+	static void *Worker_Thread(void *cookie);
+	void Work(void);
+	void Scan(Dir *dir);
+	void Release(Dir *dir);                          // one pending item of dir is done
+
+	TWExclude *exclusions;
+	std::vector<Dir*> queue;                          // used as a stack to keep the number of open directories down
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	int scanning;
+	bool remove_top;
+	uint64_t files;
+	uint64_t dirs;
+	uint64_t errors;
+};
+
+#endif // TWRPWIPE_HPP
@@ -90,6 +90,8 @@
 #include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
+#include <limits.h>
+#include <linux/fiemap.h>
 #include <linux/fs.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -102,7 +104,12 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -118,8 +125,13 @@
 
 #include "otautil/error_code.h"
 
-static constexpr int WINDOW_SIZE = 5;
 static constexpr int FIBMAP_RETRY_LIMIT = 3;
+// Extents asked for per FS_IOC_FIEMAP call.
+static constexpr size_t FIEMAP_EXTENT_BATCH = 512;
+// Size and number of the buffers the contents of the package are copied
+// through on encrypted devices.
+static constexpr size_t COPY_CHUNK_SIZE = 1024 * 1024;
+static constexpr size_t COPY_CHUNK_COUNT = 4;
 
 // uncrypt provides three services: SETUP_BCB, CLEAR_BCB and UNCRYPT.
 //
@@ -150,15 +162,23 @@ static int write_at_offset(unsigned char* buffer, size_t size, int wfd, off64_t
     return 0;
 }
 
-static void add_block_to_ranges(std::vector<int>& ranges, int new_block) {
-    if (!ranges.empty() && new_block == ranges.back()) {
-        // If the new block comes immediately after the current range,
-        // all we have to do is extend the current range.
-        ++ranges.back();
+// A run of blocks of the package that is contiguous on the block device.
+struct BlockExtent {
+    int logical;   // first block within the file
+    int physical;  // first block on the block device
+    int count;
+};
+
+static void add_block_to_extents(std::vector<BlockExtent>& extents, int logical, int physical,
+                                 int count) {
+    if (!extents.empty() && extents.back().logical + extents.back().count == logical &&
+        extents.back().physical + extents.back().count == physical) {
+        // If the new blocks come immediately after the current extent,
+        // all we have to do is extend the current extent.
+        extents.back().count += count;
     } else {
-        // We need to start a new range.
-        ranges.push_back(new_block);
-        ranges.push_back(new_block + 1);
+        // We need to start a new extent.
+        extents.push_back({ logical, physical, count });
     }
 }
 
@@ -249,6 +269,228 @@ static int retry_fibmap(const int fd, const char* name, int* block, const int he
     return kUncryptIoctlError;
 }
 
+// Maps the blocks of the package with FS_IOC_FIEMAP, which returns whole
+// extents per call instead of one block per FIBMAP. Returns false if the
+// kernel or filesystem doesn't support it, or if the extents can't be used
+// as they are (holes, inline or unaligned data); the caller then falls back
+// to FIBMAP.
+static bool map_blocks_with_fiemap(int fd, const char* path, blksize_t block_size, int blocks,
+                                   std::vector<BlockExtent>* extents) {
+    std::vector<unsigned char> buffer(sizeof(struct fiemap) +
+                                      FIEMAP_EXTENT_BATCH * sizeof(struct fiemap_extent));
+    struct fiemap* fm = reinterpret_cast<struct fiemap*>(buffer.data());
+    const uint64_t file_end = static_cast<uint64_t>(blocks) * block_size;
+    const uint32_t unusable = FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC |
+            FIEMAP_EXTENT_ENCODED | FIEMAP_EXTENT_DATA_INLINE | FIEMAP_EXTENT_DATA_TAIL |
+            FIEMAP_EXTENT_NOT_ALIGNED;
+    int next_block = 0;
+    bool last = false;
+
+    while (!last && next_block < blocks) {
+        memset(fm, 0, sizeof(*fm));
+        fm->fm_start = static_cast<uint64_t>(next_block) * block_size;
+        fm->fm_length = file_end - fm->fm_start;
+        // Flush delayed allocations first, like the fsync in retry_fibmap.
+        fm->fm_flags = FIEMAP_FLAG_SYNC;
+        fm->fm_extent_count = FIEMAP_EXTENT_BATCH;
+        if (ioctl(fd, FS_IOC_FIEMAP, fm) != 0) {
+            PLOG(WARNING) << "FS_IOC_FIEMAP failed on " << path;
+            return false;
+        }
+        if (fm->fm_mapped_extents == 0) {
+            break;
+        }
+        for (uint32_t i = 0; i < fm->fm_mapped_extents && !last; i++) {
+            const struct fiemap_extent& fe = fm->fm_extents[i];
+            last = (fe.fe_flags & FIEMAP_EXTENT_LAST) != 0;
+            if (fe.fe_flags & unusable) {
+                LOG(WARNING) << "unusable extent at " << fe.fe_logical << " in " << path
+                             << ", flags 0x" << std::hex << fe.fe_flags;
+                return false;
+            }
+            if (fe.fe_logical % block_size != 0 || fe.fe_physical % block_size != 0) {
+                LOG(WARNING) << "unaligned extent at " << fe.fe_logical << " in " << path;
+                return false;
+            }
+            uint64_t logical = fe.fe_logical / block_size;
+            uint64_t physical = fe.fe_physical / block_size;
+            uint64_t count = (fe.fe_length + block_size - 1) / block_size;
+            if (logical != static_cast<uint64_t>(next_block)) {
+                LOG(WARNING) << "hole at block " << next_block << " in " << path;
+                return false;
+            }
+            // Preallocated blocks past the end of the file are not needed.
+            count = std::min(count, static_cast<uint64_t>(blocks - next_block));
+            if (physical + count > INT_MAX) {
+                LOG(WARNING) << "block " << physical << " of " << path << " out of range";
+                return false;
+            }
+            add_block_to_extents(*extents, next_block, physical, count);
+            next_block += count;
+        }
+    }
+    if (next_block != blocks) {
+        LOG(WARNING) << "FS_IOC_FIEMAP only mapped " << next_block << " of " << blocks
+                     << " blocks of " << path;
+        return false;
+    }
+    return true;
+}
+
+static int map_blocks_with_fibmap(int fd, const char* path, int blocks,
+                                  std::vector<BlockExtent>* extents,
+                                  const std::function<void(int)>& progress) {
+    for (int head_block = 0; head_block < blocks; ++head_block) {
+        if (head_block % 1024 == 0) {
+            progress(head_block);
+        }
+        int block = head_block;
+        if (ioctl(fd, FIBMAP, &block) != 0) {
+            PLOG(ERROR) << "failed to find block " << head_block;
+            return kUncryptIoctlError;
+        }
+
+        if (block == 0) {
+            LOG(ERROR) << "failed to find block " << head_block << ", retrying";
+            int error = retry_fibmap(fd, path, &block, head_block);
+            if (error != kUncryptNoError) {
+                return error;
+            }
+        }
+        add_block_to_extents(*extents, head_block, block, 1);
+    }
+    return kUncryptNoError;
+}
+
+// Writes a chunk of the package, starting at block first_block, to where its
+// blocks are on the block device. extent is where the search starts, chunks
+// come in file order so it only ever moves forward.
+static int write_chunk(const unsigned char* data, int first_block, int block_count,
+                       blksize_t block_size, const std::vector<BlockExtent>& extents,
+                       size_t* extent, int wfd) {
+    int block = first_block;
+    while (block < first_block + block_count) {
+        while (*extent < extents.size() &&
+               extents[*extent].logical + extents[*extent].count <= block) {
+            ++*extent;
+        }
+        if (*extent == extents.size()) {
+            LOG(ERROR) << "block " << block << " is not in the block map";
+            return kUncryptWriteError;
+        }
+        const BlockExtent& e = extents[*extent];
+        int count = std::min(e.logical + e.count, first_block + block_count) - block;
+        if (write_at_offset(const_cast<unsigned char*>(data) +
+                                    static_cast<size_t>(block - first_block) * block_size,
+                            static_cast<size_t>(count) * block_size, wfd,
+                            static_cast<off64_t>(block_size) * (e.physical + block - e.logical)) != 0) {
+            return kUncryptWriteError;
+        }
+        block += count;
+    }
+    return kUncryptNoError;
+}
+
+// Copies the package, read through the filesystem so it gets decrypted, to
+// its blocks on the underlying device. The main thread reads large chunks
+// while a second thread writes out the ones read before, so reads and
+// writes overlap.
+static int copy_to_block_device(int fd, const char* path, int wfd, const struct stat& sb,
+                                const std::vector<BlockExtent>& extents,
+                                const std::function<void(off64_t)>& progress) {
+    struct Chunk {
+        std::vector<unsigned char> data;
+        int first_block;
+        int block_count;
+    };
+    const blksize_t block_size = sb.st_blksize;
+    const size_t chunk_size = std::max(COPY_CHUNK_SIZE / block_size, static_cast<size_t>(1)) *
+            block_size;
+    std::vector<Chunk> chunks(COPY_CHUNK_COUNT);
+    std::deque<Chunk*> free_chunks;
+    std::deque<Chunk*> full_chunks;
+    for (auto& chunk : chunks) {
+        chunk.data.resize(chunk_size);
+        free_chunks.push_back(&chunk);
+    }
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool reading_done = false;
+    int write_error = kUncryptNoError;
+
+    std::thread writer([&]() {
+        size_t extent = 0;
+        while (true) {
+            Chunk* chunk;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cv.wait(lock, [&]() { return !full_chunks.empty() || reading_done; });
+                if (full_chunks.empty()) {
+                    return;
+                }
+                chunk = full_chunks.front();
+                full_chunks.pop_front();
+            }
+            int error = write_chunk(chunk->data.data(), chunk->first_block, chunk->block_count,
+                                    block_size, extents, &extent, wfd);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                write_error = error;
+                free_chunks.push_back(chunk);
+            }
+            cv.notify_all();
+            if (error != kUncryptNoError) {
+                return;
+            }
+        }
+    });
+
+    int read_error = kUncryptNoError;
+    off64_t pos = 0;
+    while (pos < sb.st_size) {
+        progress(pos);
+        Chunk* chunk;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cv.wait(lock, [&]() { return !free_chunks.empty() || write_error != kUncryptNoError; });
+            if (write_error != kUncryptNoError) {
+                break;
+            }
+            chunk = free_chunks.front();
+            free_chunks.pop_front();
+        }
+        size_t to_read = static_cast<size_t>(
+                std::min(static_cast<off64_t>(chunk_size), sb.st_size - pos));
+        if (!android::base::ReadFully(fd, chunk->data.data(), to_read)) {
+            PLOG(ERROR) << "failed to read " << path;
+            read_error = kUncryptReadError;
+            break;
+        }
+        // The last block is written out whole, without stale data at its end.
+        size_t padded = (to_read + block_size - 1) / block_size * block_size;
+        memset(chunk->data.data() + to_read, 0, padded - to_read);
+        chunk->first_block = pos / block_size;
+        chunk->block_count = padded / block_size;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            full_chunks.push_back(chunk);
+        }
+        cv.notify_all();
+        pos += to_read;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        reading_done = true;
+    }
+    cv.notify_all();
+    writer.join();
+    if (read_error != kUncryptNoError) {
+        return read_error;
+    }
+    return write_error;
+}
+
 static int produce_block_map(const char* path, const char* map_file, const char* blk_dev,
                              bool encrypted, bool f2fs_fs, int socket) {
     std::string err;
@@ -281,8 +523,6 @@ static int produce_block_map(const char* path, const char* map_file, const char*
     int blocks = ((sb.st_size-1) / sb.st_blksize) + 1;
     LOG(INFO) << "  file size: " << sb.st_size << " bytes, " << blocks << " blocks";
 
-    std::vector<int> ranges;
-
     std::string s = android::base::StringPrintf("%s\n%" PRId64 " %" PRId64 "\n",
                        blk_dev, static_cast<int64_t>(sb.st_size),
                        static_cast<int64_t>(sb.st_blksize));
@@ -291,13 +531,6 @@ static int produce_block_map(const char* path, const char* map_file, const char*
         return kUncryptWriteError;
     }
 
-    std::vector<std::vector<unsigned char>> buffers;
-    if (encrypted) {
-        buffers.resize(WINDOW_SIZE, std::vector<unsigned char>(sb.st_blksize));
-    }
-    int head_block = 0;
-    int head = 0, tail = 0;
-
     android::base::unique_fd fd(open(path, O_RDONLY));
     if (fd == -1) {
         PLOG(ERROR) << "failed to open " << path << " for reading";
@@ -324,86 +557,51 @@ static int produce_block_map(const char* path, const char* map_file, const char*
         return kUncryptIoctlError;
     }
 
-    off64_t pos = 0;
+    // Without encryption the mapping is all there is to do, so it makes up
+    // the whole progress; otherwise the copy takes the second half.
     int last_progress = 0;
-    while (pos < sb.st_size) {
-        // Update the status file, progress must be between [0, 99].
-        int progress = static_cast<int>(100 * (double(pos) / double(sb.st_size)));
+    auto report_progress = [&](int progress) {
+        // Progress must be between [0, 99].
         if (progress > last_progress) {
             last_progress = progress;
             write_status_to_socket(progress, socket);
         }
-
-        if ((tail+1) % WINDOW_SIZE == head) {
-            // write out head buffer
-            int block = head_block;
-            if (ioctl(fd, FIBMAP, &block) != 0) {
-                PLOG(ERROR) << "failed to find block " << head_block;
-                return kUncryptIoctlError;
-            }
-
-            if (block == 0) {
-                LOG(ERROR) << "failed to find block " << head_block << ", retrying";
-                int error = retry_fibmap(fd, path, &block, head_block);
-                if (error != kUncryptNoError) {
-                    return error;
-                }
-            }
-
-            add_block_to_ranges(ranges, block);
-            if (encrypted) {
-                if (write_at_offset(buffers[head].data(), sb.st_blksize, wfd,
-                                    static_cast<off64_t>(sb.st_blksize) * block) != 0) {
-                    return kUncryptWriteError;
-                }
-            }
-            head = (head + 1) % WINDOW_SIZE;
-            ++head_block;
-        }
-
-        // read next block to tail
-        if (encrypted) {
-            size_t to_read = static_cast<size_t>(
-                    std::min(static_cast<off64_t>(sb.st_blksize), sb.st_size - pos));
-            if (!android::base::ReadFully(fd, buffers[tail].data(), to_read)) {
-                PLOG(ERROR) << "failed to read " << path;
-                return kUncryptReadError;
-            }
-            pos += to_read;
-        } else {
-            // If we're not encrypting; we don't need to actually read
-            // anything, just skip pos forward as if we'd read a
-            // block.
-            pos += sb.st_blksize;
+    };
+    int map_progress_end = encrypted ? 50 : 99;
+
+    std::vector<BlockExtent> extents;
+    if (!map_blocks_with_fiemap(fd, path, sb.st_blksize, blocks, &extents)) {
+        LOG(INFO) << "mapping " << path << " with FIBMAP";
+        extents.clear();
+        int error = map_blocks_with_fibmap(fd, path, blocks, &extents, [&](int block) {
+            report_progress(static_cast<int>(static_cast<int64_t>(map_progress_end) * block / blocks));
+        });
+        if (error != kUncryptNoError) {
+            return error;
         }
-        tail = (tail+1) % WINDOW_SIZE;
     }
+    LOG(INFO) << "  " << extents.size() << " extents";
+    report_progress(map_progress_end);
 
-    while (head != tail) {
-        // write out head buffer
-        int block = head_block;
-        if (ioctl(fd, FIBMAP, &block) != 0) {
-            PLOG(ERROR) << "failed to find block " << head_block;
-            return kUncryptIoctlError;
-        }
-
-        if (block == 0) {
-            LOG(ERROR) << "failed to find block " << head_block << ", retrying";
-            int error = retry_fibmap(fd, path, &block, head_block);
-            if (error != kUncryptNoError) {
-                return error;
-            }
+    if (encrypted) {
+        int error = copy_to_block_device(fd, path, wfd, sb, extents, [&](off64_t pos) {
+            report_progress(50 + static_cast<int>(49 * (double(pos) / double(sb.st_size))));
+        });
+        if (error != kUncryptNoError) {
+            return error;
         }
+    }
 
-        add_block_to_ranges(ranges, block);
-        if (encrypted) {
-            if (write_at_offset(buffers[head].data(), sb.st_blksize, wfd,
-                                static_cast<off64_t>(sb.st_blksize) * block) != 0) {
-                return kUncryptWriteError;
-            }
+    // The block map lists ranges of physical blocks in file order, so
+    // extents that follow each other on the device are merged.
+    std::vector<int> ranges;
+    for (const auto& extent : extents) {
+        if (!ranges.empty() && ranges.back() == extent.physical) {
+            ranges.back() += extent.count;
+        } else {
+            ranges.push_back(extent.physical);
+            ranges.push_back(extent.physical + extent.count);
         }
-        head = (head + 1) % WINDOW_SIZE;
-        ++head_block;
     }
 
     if (!android::base::WriteStringToFd(
@@ -35,8 +35,11 @@
 #include <unistd.h>
 #include <utime.h>
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <android-base/file.h>
@@ -971,14 +974,16 @@ static struct perm_parsed_args ParsePermArgs(State * state,
   return parsed;
 }
 
-static int ApplyParsedPerms(State* state, const char* filename, const struct stat* statptr,
-                            struct perm_parsed_args parsed) {
+// Failures are appended to *errors rather than printed, so that set_metadata_recursive can apply
+// permissions from several threads and still report them in walk order.
+static int ApplyParsedPerms(std::string* errors, const char* filename, const struct stat* statptr,
+                            const struct perm_parsed_args& parsed) {
   int bad = 0;
 
   if (parsed.has_selabel) {
     if (lsetfilecon(filename, parsed.selabel) != 0) {
-      uiPrintf(state, "ApplyParsedPerms: lsetfilecon of %s to %s failed: %s\n", filename,
-               parsed.selabel, strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: lsetfilecon of %s to %s failed: %s\n",
+                                   filename, parsed.selabel, strerror(errno));
       bad++;
     }
   }
@@ -990,40 +995,40 @@ static int ApplyParsedPerms(State* state, const char* filename, const struct sta
 
   if (parsed.has_uid) {
     if (chown(filename, parsed.uid, -1) < 0) {
-      uiPrintf(state, "ApplyParsedPerms: chown of %s to %d failed: %s\n", filename, parsed.uid,
-               strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: chown of %s to %d failed: %s\n",
+                                   filename, parsed.uid, strerror(errno));
       bad++;
     }
   }
 
   if (parsed.has_gid) {
     if (chown(filename, -1, parsed.gid) < 0) {
-      uiPrintf(state, "ApplyParsedPerms: chgrp of %s to %d failed: %s\n", filename, parsed.gid,
-               strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: chgrp of %s to %d failed: %s\n",
+                                   filename, parsed.gid, strerror(errno));
       bad++;
     }
   }
 
   if (parsed.has_mode) {
     if (chmod(filename, parsed.mode) < 0) {
-      uiPrintf(state, "ApplyParsedPerms: chmod of %s to %d failed: %s\n", filename, parsed.mode,
-               strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: chmod of %s to %d failed: %s\n",
+                                   filename, parsed.mode, strerror(errno));
       bad++;
     }
   }
 
   if (parsed.has_dmode && S_ISDIR(statptr->st_mode)) {
     if (chmod(filename, parsed.dmode) < 0) {
-      uiPrintf(state, "ApplyParsedPerms: chmod of %s to %d failed: %s\n", filename, parsed.dmode,
-               strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: chmod of %s to %d failed: %s\n",
+                                   filename, parsed.dmode, strerror(errno));
       bad++;
     }
   }
 
   if (parsed.has_fmode && S_ISREG(statptr->st_mode)) {
     if (chmod(filename, parsed.fmode) < 0) {
-      uiPrintf(state, "ApplyParsedPerms: chmod of %s to %d failed: %s\n", filename, parsed.fmode,
-               strerror(errno));
+      android::base::StringAppendF(errors, "ApplyParsedPerms: chmod of %s to %d failed: %s\n",
+                                   filename, parsed.fmode, strerror(errno));
       bad++;
     }
   }
@@ -1032,8 +1037,10 @@ static int ApplyParsedPerms(State* state, const char* filename, const struct sta
     if (parsed.capabilities == 0) {
       if ((removexattr(filename, XATTR_NAME_CAPS) == -1) && (errno != ENODATA)) {
         // Report failure unless it's ENODATA (attribute not set)
-        uiPrintf(state, "ApplyParsedPerms: removexattr of %s to %" PRIx64 " failed: %s\n", filename,
-                 parsed.capabilities, strerror(errno));
+        android::base::StringAppendF(errors,
+                                     "ApplyParsedPerms: removexattr of %s to %" PRIx64
+                                     " failed: %s\n",
+                                     filename, parsed.capabilities, strerror(errno));
         bad++;
       }
     } else {
@@ -1045,8 +1052,9 @@ static int ApplyParsedPerms(State* state, const char* filename, const struct sta
       cap_data.data[1].permitted = (uint32_t)(parsed.capabilities >> 32);
       cap_data.data[1].inheritable = 0;
       if (setxattr(filename, XATTR_NAME_CAPS, &cap_data, sizeof(cap_data), 0) < 0) {
-        uiPrintf(state, "ApplyParsedPerms: setcap of %s to %" PRIx64 " failed: %s\n", filename,
-                 parsed.capabilities, strerror(errno));
+        android::base::StringAppendF(errors,
+                                     "ApplyParsedPerms: setcap of %s to %" PRIx64 " failed: %s\n",
+                                     filename, parsed.capabilities, strerror(errno));
         bad++;
       }
     }
@@ -1057,12 +1065,54 @@ static int ApplyParsedPerms(State* state, const char* filename, const struct sta
 
 // nftw doesn't allow us to pass along context, so we need to use
 // global variables.  *sigh*
-static struct perm_parsed_args recursive_parsed_args;
-static State* recursive_state;
+struct metadata_entry {
+  std::string filename;
+  struct stat st;
+};
+static std::vector<metadata_entry>* recursive_entries;
+
+// Upper bound on the threads used to apply set_metadata_recursive; the work is one syscall per
+// attribute, so more threads than this only add contention on the filesystem's inode locks.
+static constexpr size_t MAX_METADATA_THREADS = 8;
 
 static int do_SetMetadataRecursive(const char* filename, const struct stat* statptr, int fileflags,
                                    struct FTW* pfwt) {
-  return ApplyParsedPerms(recursive_state, filename, statptr, recursive_parsed_args);
+  recursive_entries->push_back({ filename, *statptr });
+  return 0;
+}
+
+// Applies the parsed perms to every entry, in parallel batches. Returns the number of failures;
+// their messages are sent to the UI in the order nftw visited the entries.
+static int ApplyParsedPermsBatch(State* state, const std::vector<metadata_entry>& entries,
+                                 const struct perm_parsed_args& parsed) {
+  std::vector<std::string> errors(entries.size());
+  std::atomic<size_t> next_entry(0);
+  std::atomic<int> bad(0);
+  auto worker = [&]() {
+    size_t i;
+    while ((i = next_entry++) < entries.size()) {
+      bad += ApplyParsedPerms(&errors[i], entries[i].filename.c_str(), &entries[i].st, parsed);
+    }
+  };
+
+  size_t thread_count = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                         MAX_METADATA_THREADS);
+  thread_count = std::min(thread_count, entries.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& t : threads) {
+    t.join();
+  }
+
+  for (const auto& error : errors) {
+    if (!error.empty()) {
+      uiPrint(state, error);
+    }
+  }
+  return bad;
 }
 
 static Value* SetMetadataFn(const char* name, State* state, const std::vector<std::unique_ptr<Expr>>& argv) {
@@ -1087,13 +1137,18 @@ static Value* SetMetadataFn(const char* name, State* state, const std::vector<st
   bool recursive = (strcmp(name, "set_metadata_recursive") == 0);
 
   if (recursive) {
-    recursive_parsed_args = parsed;
-    recursive_state = state;
+    // Collect the tree first, then apply the metadata to all of it in one batch.
+    std::vector<metadata_entry> entries;
+    recursive_entries = &entries;
     bad += nftw(args[0].c_str(), do_SetMetadataRecursive, 30, FTW_CHDIR | FTW_DEPTH | FTW_PHYS);
-    memset(&recursive_parsed_args, 0, sizeof(recursive_parsed_args));
-    recursive_state = NULL;
+    recursive_entries = nullptr;
+    bad += ApplyParsedPermsBatch(state, entries, parsed);
   } else {
-    bad += ApplyParsedPerms(state, args[0].c_str(), &sb, parsed);
+    std::string errors;
+    bad += ApplyParsedPerms(&errors, args[0].c_str(), &sb, parsed);
+    if (!errors.empty()) {
+      uiPrint(state, errors);
+    }
   }
 
   if (bad > 0) {
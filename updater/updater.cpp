@@ -145,6 +145,7 @@ int main(int argc, char** argv) {
     CloseArchive(za);
     return 6;
   }
+  CompileExpr(&root);
 
   sehandle = selinux_android_file_context_handle();
   selinux_android_set_sehandle(sehandle);
@@ -38,6 +38,7 @@
 #define TW_BACKUP_AVG_IMG_RATE      "tw_backup_avg_img_rate"
 #define TW_BACKUP_AVG_FILE_RATE     "tw_backup_avg_file_rate"
 #define TW_BACKUP_AVG_FILE_COMP_RATE    "tw_backup_avg_file_comp_rate"
+#define TW_TELEMETRY_REPORT_VAR         "tw_telemetry_report"
 #define TW_BACKUP_SYSTEM_SIZE       "tw_backup_system_size"
 #define TW_BACKUP_DATA_SIZE         "tw_backup_data_size"
 #define TW_BACKUP_BOOT_SIZE         "tw_backup_boot_size"